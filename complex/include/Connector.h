@@ -0,0 +1,29 @@
+#ifndef __CONNECTOR_H__
+#define __CONNECTOR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netdb.h>
+
+#define CONNECTOR_FAMILIES          2                           /**< IPv4 and IPv6 */
+
+/**
+ * connect attempts of one address family, latency of the successful ones in ns
+ */
+typedef struct {
+    uint32_t                numAttempts;
+    uint32_t                numConnected;                       /**< won the race */
+    uint32_t                numFailed;                          /**< refused, unreachable, ... */
+    uint32_t                numCancelled;                       /**< lost the race or timed out */
+    uint64_t                sum;
+    uint64_t                min;
+    uint64_t                max;
+} ConnectorStats;
+
+int                 Connector_connect       (struct addrinfo *addrinfo, uint32_t delay, uint32_t timeout);
+
+void                Connector_getStats      (int family, ConnectorStats *stats);
+void                Connector_logStats      (void);
+void                Connector_printStats    (int family);
+
+#endif
@@ -4,16 +4,27 @@
 #define CONFIG_PROGRAM_NAME                 "echo_client"
 #define CONFIG_PROGRAM_DESC                 "KT2 Echo Client"
 #define CONFIG_PROGRAM_VERSION              "1.0"
-#define CONFIG_PROGRAM_USAGE                "(-h | [-m <mode>] [-l <log level>] (<hostname> | <IP address>) [<service> | <port number>])"
+#define CONFIG_PROGRAM_USAGE                "(-h | [-m <mode>] [-l <log level>] [-e <delay>] [-c <connections>] [-t <threads>] [-q <in flight>] [-r <rate> [-a <arrival>]] [-d <seconds> | -n <messages>] [-s <sizes>] [-x <upper:lower>] (<hostname> | <IP address>) [<service> | <port number>])"
+#define CONFIG_PROGRAM_OPTIONS              ":hm:l:e:c:t:q:r:a:d:n:s:x:"
 #define CONFIG_PROGRAM_HELP1                "192.168.0.1"
-#define CONFIG_PROGRAM_HELP2                "-m ipv4 192.168.0.1 echo"
-#define CONFIG_PROGRAM_HELP3                "-m ipv6 -l DEBUG fe80::21b:21ff:fe5c:2201 6500"
+#define CONFIG_PROGRAM_HELP2                "-c 32 -r 20000 -a poisson -d 60 192.168.0.1"
+#define CONFIG_PROGRAM_HELP3                "-c 64 -t 4 -d 30 -s 64:8,1024-4096:2 -x 3:1 192.168.0.1"
 
 #define CONFIG_SERVICE                      "2345"
+#define CONFIG_RECV_TIMEOUT                 1           /**< seconds */
+#define CONFIG_RECV_BUFFER_SIZE             16384
+#define CONFIG_CONNECT_DELAY                250         /**< ms between two connect attempts (Happy Eyeballs) */
+#define CONFIG_CONNECT_TIMEOUT              10000       /**< ms for all connect attempts */
 
+/* load generator, used if any of -c, -t, -q, -r, -a, -d, -n, -s or -x is given */
+#define CONFIG_LOAD_DURATION                10          /**< seconds */
+#define CONFIG_LOAD_SIZE                    128         /**< payload bytes */
+#define CONFIG_LOAD_OPEN_DEPTH              64          /**< requests in flight per connection with -r */
+
+#include <stdint.h>
 #include <stdbool.h>
 #include <netdb.h>
 
-bool EchoClient_connect(struct addrinfo *addrinfo);
+bool EchoClient_connect(struct addrinfo *addrinfo, uint32_t delay);
 
 #endif
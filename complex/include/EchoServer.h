@@ -2,22 +2,40 @@
 #define __ECHO_SERVER_H__
 
 #define CONFIG_PROGRAM_NAME                 "echo_server"
+#ifdef WITH_IO_URING
+#define CONFIG_PROGRAM_DESC                 "KT2 Echo Server (io_uring)"
+#else
 #define CONFIG_PROGRAM_DESC                 "KT2 Echo Server"
+#endif
 #define CONFIG_PROGRAM_VERSION              "1.0"
-#define CONFIG_PROGRAM_USAGE                "(-h | [-m <mode>] [-l <log level>] [<service>])"
+#define CONFIG_PROGRAM_USAGE                "(-h | [-m <mode>] [-l <log level>] [-s <shards>] [-a <log overflow>] [-t <trace file>] [<service>])"
+#define CONFIG_PROGRAM_OPTIONS              ":hm:l:s:a:t:"
 #define CONFIG_PROGRAM_HELP1                "2345"
-#define CONFIG_PROGRAM_HELP2                "-m ipv4"
-#define CONFIG_PROGRAM_HELP3                "-m ipv6 -l DEBUG"
+#define CONFIG_PROGRAM_HELP2                "-m ipv4 -s 4"
+#define CONFIG_PROGRAM_HELP3                "-m ipv6 -l DEBUG -a block -t echo_server.trace"
 
 #define CONFIG_SERVICE                      "2345"
-#define CONFIG_LISTEN_QUEUE                 6
+#define CONFIG_SHARDS                       1           /**< 0 = one per online core */
+#define CONFIG_LISTEN_QUEUE                 SOMAXCONN
+#define CONFIG_RECV_BUFFER_SIZE             16384
+#define CONFIG_SEND_BUFFER                  17          /**< responses per connection: 2^17 bytes */
+
+#define CONFIG_WORKER_THREADS               0           /**< 0 = one per online core */
+#define CONFIG_WORKER_QUEUE_MAX             4096        /**< event loop blocks beyond */
+#define CONFIG_OFFLOAD_MIN                  16384       /**< transforms of this size run on the pool, answered out of order */
+
+#define CONFIG_RESOLVER_THREADS             2           /**< reverse lookups of client addresses */
+#define CONFIG_RESOLVER_CACHE               1024        /**< cached client addresses */
+#define CONFIG_RESOLVER_QUEUE               256         /**< pending lookups, more are skipped */
+#define CONFIG_RESOLVER_TTL                 300         /**< seconds a name is cached */
 
-#define CONFIG_SELECT_WAIT_SECS             0
-#define CONFIG_SELECT_WAIT_USECS            5000
+#define CONFIG_URING_ENTRIES                4096        /**< io_uring engine: submission queue */
+#define CONFIG_URING_BUFFERS                1024        /**< io_uring engine: receive buffers per shard (2^n) */
 
+#include <stdint.h>
 #include <stdbool.h>
 #include <netdb.h>
 
-bool EchoServer_create(struct addrinfo *addrinfo);
+bool EchoServer_create(struct addrinfo *addrinfo, uint32_t numShards);
 
 #endif
@@ -0,0 +1,40 @@
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <sys/epoll.h>
+
+#define EVENT_LOOP_MAX_EVENTS           256
+
+typedef struct _EventHandler EventHandler;
+
+typedef void (*EventCallback)(EventHandler *handler, uint32_t events);
+
+/**
+ * embedded as first member of every object registered with an event loop,
+ * the callback receives the epoll event mask
+ */
+struct _EventHandler {
+    int                     fd;                                 /**< monitored file descriptor */
+    EventCallback           callback;                           /**< called when fd is ready   */
+};
+
+typedef struct {
+    int                     epollfd;                            /**< epoll instance            */
+    EventHandler            stop;                               /**< eventfd to wake up loop   */
+    bool                    running;                            /**< loop state                */
+} EventLoop;
+
+EventLoop          *EventLoop_new           (void);
+void                EventLoop_delete        (EventLoop *this);
+
+bool                EventLoop_add           (EventLoop *this, EventHandler *handler, uint32_t events);
+bool                EventLoop_modify        (EventLoop *this, EventHandler *handler, uint32_t events);
+bool                EventLoop_remove        (EventLoop *this, EventHandler *handler);
+
+void                EventLoop_run           (EventLoop *this);
+void                EventLoop_stop          (EventLoop *this);
+
+#endif
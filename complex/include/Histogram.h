@@ -0,0 +1,36 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HISTOGRAM_SUB_BITS          8                           /**< 2^8 sub-buckets: values within 1/128 */
+#define HISTOGRAM_MAX_BITS          40                          /**< values up to 2^40 (ns: 18 minutes) */
+#define HISTOGRAM_SUB_COUNT         (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NUM_COUNTS        (HISTOGRAM_SUB_COUNT + (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS) * (HISTOGRAM_SUB_COUNT / 2))
+
+/**
+ * HDR-style histogram: values below 2^SUB_BITS are counted exactly,
+ * above every power of two is split into SUB_COUNT / 2 linear buckets,
+ * so the relative error stays the same over the whole range
+ */
+typedef struct {
+    uint64_t                count;                              /**< recorded values */
+    uint64_t                min;
+    uint64_t                max;
+    uint64_t                sum;                                /**< for the mean */
+    uint64_t                counts[HISTOGRAM_NUM_COUNTS];
+} Histogram;
+
+Histogram          *Histogram_new           (void);
+void                Histogram_delete        (Histogram *this);
+void                Histogram_reset         (Histogram *this);
+
+void                Histogram_record        (Histogram *this, uint64_t value);
+void                Histogram_add           (Histogram *this, const Histogram *other);
+
+uint64_t            Histogram_percentile    (const Histogram *this, double percentile);
+double              Histogram_mean          (const Histogram *this);
+void                Histogram_print         (const Histogram *this, const char *name);
+
+#endif
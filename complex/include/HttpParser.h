@@ -0,0 +1,56 @@
+#ifndef __HTTP_PARSER_H__
+#define __HTTP_PARSER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HTTP_LINE_MAX               8192                        /**< status line, header or chunk size line */
+
+typedef enum {
+    HTTP_PARSER_STATUS,                                         /**< status line               */
+    HTTP_PARSER_HEADER,                                         /**< header lines              */
+    HTTP_PARSER_BODY,                                           /**< Content-Length bytes      */
+    HTTP_PARSER_CHUNK_SIZE,                                     /**< chunk size line           */
+    HTTP_PARSER_CHUNK_DATA,                                     /**< chunk bytes               */
+    HTTP_PARSER_CHUNK_END,                                      /**< CRLF behind a chunk       */
+    HTTP_PARSER_TRAILER,                                        /**< trailer lines             */
+    HTTP_PARSER_UNTIL_CLOSE,                                    /**< body ends with the connection */
+    HTTP_PARSER_DONE,
+    HTTP_PARSER_FAILED
+} HttpParserState;
+
+typedef enum {
+    HTTP_PARSER_MORE,                                           /**< all consumed, feed more   */
+    HTTP_PARSER_HEAD,                                           /**< status and headers parsed */
+    HTTP_PARSER_DATA,                                           /**< a piece of the body       */
+    HTTP_PARSER_COMPLETE,                                       /**< the rest is the next response */
+    HTTP_PARSER_ERROR
+} HttpParserEvent;
+
+/**
+ * resumable parser for HTTP/1.x responses, chunks may end anywhere,
+ * the body is handed out in pieces of the input and never buffered
+ */
+typedef struct {
+    HttpParserState         state;
+    int                     status;                             /**< status code               */
+    int                     minor;                              /**< HTTP/1.minor              */
+    bool                    noBody;                             /**< response to HEAD          */
+    bool                    chunked;                            /**< Transfer-Encoding: chunked */
+    bool                    close;                              /**< connection closes behind it */
+    bool                    hasLength;
+    uint64_t                contentLength;
+    uint64_t                remaining;                          /**< bytes of the body or chunk */
+    uint64_t                bodyLen;                            /**< body bytes so far         */
+    uint32_t                lineLen;
+    char                    line[HTTP_LINE_MAX];                /**< partially received line   */
+} HttpParser;
+
+void                HttpParser_init         (HttpParser *this, bool noBody);
+
+HttpParserEvent     HttpParser_feed         (HttpParser *this, const char **data, uint32_t *len,
+                                             const char **body, uint32_t *bodyLen);
+HttpParserEvent     HttpParser_finish       (HttpParser *this);
+void                HttpParser_skip         (HttpParser *this, uint64_t len);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __IO_URING_H__
+#define __IO_URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <linux/io_uring.h>
+
+/**
+ * minimal io_uring binding on top of the raw system calls (no liburing),
+ * a ring must only be used by the thread which created it
+ */
+typedef struct {
+    int                     ringfd;                             /**< io_uring instance         */
+    void                   *sqRing;                             /**< mapped submission ring    */
+    void                   *cqRing;                             /**< mapped completion ring    */
+    size_t                  sqRingSize;
+    size_t                  cqRingSize;
+    struct io_uring_sqe    *sqes;                               /**< submission entries        */
+    size_t                  sqesSize;
+    uint32_t               *sqHead;
+    uint32_t               *sqTail;
+    uint32_t               *sqArray;
+    uint32_t                sqMask;
+    uint32_t                sqEntries;
+    uint32_t                sqLocalTail;                        /**< prepared, not yet visible */
+    uint32_t                toSubmit;                           /**< prepared since last enter */
+    uint32_t               *cqHead;
+    uint32_t               *cqTail;
+    uint32_t                cqMask;
+    struct io_uring_cqe    *cqes;
+    uint32_t                enterFlags;                         /**< flags for io_uring_enter  */
+} IoUring;
+
+/**
+ * provided buffer ring: the kernel picks a buffer when data arrives,
+ * the application gives it back after use
+ */
+typedef struct {
+    struct io_uring_buf_ring *ring;                             /**< shared with the kernel    */
+    size_t                  ringSize;
+    uint32_t                entries;                            /**< number of buffers (2^n)   */
+    uint32_t                bufferSize;                         /**< size of a single buffer   */
+    uint16_t                bgid;                               /**< buffer group id           */
+    uint16_t                localTail;
+    char                   *buffers;                            /**< entries * bufferSize      */
+} IoUringBuffers;
+
+IoUring            *IoUring_new             (uint32_t entries);
+void                IoUring_delete          (IoUring *this);
+
+bool                IoUring_reserve         (IoUring *this, uint32_t num);
+struct io_uring_sqe *IoUring_getSqe         (IoUring *this);
+int                 IoUring_submitAndWait   (IoUring *this, uint32_t waitNr);
+struct io_uring_cqe *IoUring_peekCqe        (IoUring *this);
+void                IoUring_seenCqe         (IoUring *this);
+
+IoUringBuffers     *IoUringBuffers_new      (IoUring *ring, uint16_t bgid, uint32_t entries, uint32_t bufferSize);
+void                IoUringBuffers_delete   (IoUringBuffers *this, IoUring *ring);
+char               *IoUringBuffers_get      (IoUringBuffers *this, uint16_t bid);
+void                IoUringBuffers_put      (IoUringBuffers *this, uint16_t bid);
+
+#endif
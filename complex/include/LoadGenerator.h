@@ -0,0 +1,43 @@
+#ifndef __LOAD_GENERATOR_H__
+#define __LOAD_GENERATOR_H__
+
+#include "LoadRunner.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netdb.h>
+
+#define LOAD_SIZES_MAX              8                           /**< entries of a payload size distribution */
+#define LOAD_PAYLOAD_MAX            UINT16_MAX
+
+/**
+ * payload sizes between min and max (uniform), picked with weight
+ */
+typedef struct {
+    uint32_t                min;
+    uint32_t                max;
+    uint32_t                weight;
+} LoadSize;
+
+typedef struct {
+    uint32_t                numConnections;
+    uint32_t                connectDelay;                       /**< ms between two connect attempts (Happy Eyeballs) */
+    uint32_t                numThreads;                         /**< 0 = one per online core */
+    uint32_t                depth;                              /**< requests in flight per connection */
+    uint32_t                rate;                               /**< requests per second (open loop), 0 = closed loop */
+    LoadArrival             arrival;
+    uint32_t                duration;                           /**< seconds, 0 = until numMessages */
+    uint64_t                numMessages;                        /**< 0 = until duration */
+    LoadSize                sizes[LOAD_SIZES_MAX];
+    uint32_t                numSizes;
+    uint32_t                upperWeight;                        /**< request mix */
+    uint32_t                lowerWeight;
+} LoadConfig;
+
+void                LoadConfig_init         (LoadConfig *this);
+bool                LoadConfig_parseSizes   (LoadConfig *this, const char *str);
+bool                LoadConfig_parseMix     (LoadConfig *this, const char *str);
+
+bool                LoadGenerator_run       (struct addrinfo *addrinfo, const LoadConfig *config);
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef __LOAD_RUNNER_H__
+#define __LOAD_RUNNER_H__
+
+#include "EventLoop.h"
+#include "RingBuffer.h"
+#include "Histogram.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netdb.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+
+#define LOAD_OUTPUT_MIN             12                          /**< output ring is at least 2^12 bytes */
+#define LOAD_BACKLOG                (1 << 18)                   /**< due requests waiting for a connection, per thread */
+
+typedef struct _LoadRunner LoadRunner;
+typedef struct _LoadThread LoadThread;
+typedef struct _LoadConnection LoadConnection;
+
+/**
+ * open loop: time between two requests of a thread
+ */
+typedef enum {
+    LOAD_ARRIVAL_FIXED = 0,                                     /**< constant interval */
+    LOAD_ARRIVAL_POISSON                                        /**< exponentially distributed intervals */
+} LoadArrival;
+
+/**
+ * the protocol of a load run, all calls happen on the connection's thread
+ */
+typedef struct {
+    size_t                  connectionSize;                     /**< embeds LoadConnection as first member */
+    bool                  (*init)   (LoadThread *thread);       /**< allocate thread->data, freed by the runner */
+    bool                  (*open)   (LoadConnection *connection); /**< connect, before the clock starts */
+    bool                  (*send)   (LoadConnection *connection, uint64_t intended); /**< encode a request */
+    void                  (*fail)   (LoadConnection *connection); /**< send or flush failed: close or reconnect */
+    void                  (*close)  (LoadConnection *connection); /**< free what open allocated */
+    void                  (*expire) (LoadConnection *connection, uint64_t now); /**< run over: LoadRunner_unanswered() per request in flight */
+    void                  (*report) (LoadRunner *runner, double elapsed);
+} LoadProtocol;
+
+/**
+ * what the runner knows of a connection, the protocol's connection starts with it
+ */
+struct _LoadConnection {
+    EventHandler            handler;                            /**< connected socket */
+    LoadThread             *thread;                             /**< owning thread */
+    RingBuffer             *output;                             /**< encoded requests which aren't sent yet */
+    uint32_t                numPending;                         /**< requests in flight */
+    uint32_t                events;                             /**< registered events */
+    struct sockaddr_storage peer;                               /**< the address which won the first connect */
+    socklen_t               peerLen;
+    bool                    connecting;                         /**< reconnect in progress, waiting for EPOLLOUT */
+    bool                    closed;
+};
+
+/**
+ * event loop with its own connections, histogram and counters,
+ * nothing is shared with other threads while the load runs
+ *
+ * open loop: the requests are due at fixed points in time (next), the
+ * timer is armed absolute and every due request is taken at once, so a
+ * late timer or a stalled loop doesn't shift the schedule. Due requests
+ * wait in the backlog for a connection with room, with their intended time.
+ */
+struct _LoadThread {
+    uint32_t                idx;
+    pthread_t               tid;
+    LoadRunner             *runner;
+    EventLoop              *loop;
+    char                   *connections;                        /**< numConnections of protocol->connectionSize */
+    uint32_t                numConnections;
+    uint32_t                numActive;                          /**< connections not closed yet */
+    void                   *data;                               /**< protocol's, e.g. a buffer */
+    Histogram              *histogram;                          /**< latency in ns */
+    Histogram              *service;                            /**< ns from the actual send */
+    uint64_t                random;                             /**< xorshift64* state */
+    uint64_t                numSent;
+    uint64_t                numReceived;                        /**< read by the progress report (atomic) */
+    uint64_t                numBytes;                           /**< received */
+    uint64_t                numRejected;                        /**< answered, but not successfully */
+    uint64_t                numConnectErrors;
+    uint64_t                numReadErrors;                      /**< reset, closed with requests in flight, invalid response */
+    uint64_t                numWriteErrors;
+    uint64_t                numReconnects;
+    uint64_t                numUnanswered;                      /**< in flight or in the backlog when the run was over */
+    uint64_t                finished;                           /**< ns, when the last connection was done */
+    bool                    exhausted;                          /**< no more requests to send */
+
+    EventHandler            timer;                              /**< timerfd, open loop only */
+    double                  next;                               /**< ns, intended time of the next request */
+    double                  interval;                           /**< ns, mean time between requests */
+    uint64_t               *backlog;                            /**< ring of intended times */
+    uint32_t                head;
+    uint32_t                tail;
+    uint32_t                nextConnection;                     /**< round-robin */
+    uint64_t                maxLag;                             /**< ns the timer fired late at most */
+    uint64_t                numOverflows;                       /**< requests dropped, backlog full */
+};
+
+/**
+ * the schedule is set by the caller before LoadRunner_run()
+ */
+struct _LoadRunner {
+    const LoadProtocol     *protocol;
+    void                   *context;                            /**< protocol's, e.g. its configuration */
+    struct addrinfo        *addrinfo;
+    uint32_t                numConnections;
+    uint32_t                numThreads;                         /**< 0 = one per online core */
+    uint32_t                depth;                              /**< requests in flight per connection */
+    uint32_t                rate;                               /**< requests per second (open loop), 0 = closed loop */
+    LoadArrival             arrival;
+    uint32_t                duration;                           /**< seconds, 0 = until numMessages */
+    uint64_t                numMessages;                        /**< 0 = until duration */
+    uint32_t                connectDelay;                       /**< ms between two connect attempts (Happy Eyeballs) */
+    uint32_t                connectTimeout;                     /**< ms for all connect attempts */
+
+    LoadThread             *threads;
+    uint64_t                numStarted;                         /**< requests claimed by all threads (atomic) */
+    uint32_t                numRunning;                         /**< threads with open connections (atomic) */
+    pthread_t               main;                               /**< woken up by the last thread */
+    bool                    running;                            /**< cleared when the duration is over (atomic) */
+};
+
+/**
+ * the counters of all threads, for the report
+ */
+typedef struct {
+    Histogram              *histogram;
+    Histogram              *service;
+    uint64_t                numSent;
+    uint64_t                numReceived;
+    uint64_t                numBytes;
+    uint64_t                numRejected;
+    uint64_t                numConnectErrors;
+    uint64_t                numReadErrors;
+    uint64_t                numWriteErrors;
+    uint64_t                numReconnects;
+    uint64_t                numUnanswered;
+    uint64_t                numOverflows;
+    uint64_t                maxLag;
+} LoadTotals;
+
+void                LoadRunner_init         (LoadRunner *this, const LoadProtocol *protocol, void *context,
+                                             struct addrinfo *addrinfo);
+bool                LoadRunner_run          (LoadRunner *this);
+
+LoadConnection     *LoadRunner_connection   (LoadThread *thread, uint32_t idx);
+bool                LoadRunner_connect      (LoadConnection *connection, uint32_t outputSize);
+bool                LoadRunner_reconnect    (LoadConnection *connection);
+bool                LoadRunner_connected    (LoadConnection *connection);
+bool                LoadRunner_fill         (LoadConnection *connection);
+bool                LoadRunner_flush        (LoadConnection *connection);
+void                LoadRunner_close        (LoadConnection *connection);
+void                LoadRunner_settle       (LoadConnection *connection);
+void                LoadRunner_unanswered   (LoadConnection *connection, uint64_t intended, uint64_t sent, uint64_t now);
+
+bool                LoadRunner_sum          (LoadRunner *this, LoadTotals *totals);
+void                LoadRunner_printLatency (LoadRunner *this, const LoadTotals *totals, const char *unit);
+void                LoadRunner_freeTotals   (LoadTotals *totals);
+
+uint64_t            LoadRunner_random       (LoadThread *thread);
+uint64_t            LoadRunner_now          (void);
+
+#endif
@@ -7,6 +7,8 @@
 #include <stdbool.h>
 #include <stdarg.h>
 
+#include "LogTrace.h"
+
 /*** DEFINES ****************************************************************/
 
 #define LOG_PRINTF                      fprintf
@@ -15,6 +17,11 @@
 
 #define STRERROR_R_BUFFER_MAX           64
 
+#define LOG_LINE_MAX                    1024        /**< longer lines are truncated */
+#define LOG_BUFFER_SIZE                 16          /**< async: 2^16 bytes per thread */
+#define LOG_FLUSH_INTERVAL              10          /**< async: flusher wakes up at least every 10 ms */
+#define LOG_IOV_MAX                     64          /**< async: thread buffers per writev() */
+
 #ifdef ENABLE_LOG_DEBUG
 #define LOG_LEVEL_ADDITION              ,__FILE__, __LINE__, __FUNCTION__
 #define LOG_PARAMETER_DECLARATION       LogLevel level, \
@@ -32,6 +39,11 @@
 #define LOG_FORMAT_PARAMETER            3
 #endif
 
+/* sites above this level are compiled out, e.g. "make LOG_COMPILE_LEVEL=LOG_INFO_PRIVATE" */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL               LOG_DEBUG_PRIVATE
+#endif
+
 #define LOG_NONE                        LOG_NONE_PRIVATE  LOG_LEVEL_ADDITION
 #define LOG_FATAL                       LOG_FATAL_PRIVATE LOG_LEVEL_ADDITION
 #define LOG_ERROR                       LOG_ERROR_PRIVATE LOG_LEVEL_ADDITION
@@ -45,10 +57,12 @@
 #define LOG_FLAG_PID                    0x08
 #define LOG_FLAG_TIME                   0x10
 #define LOG_FLAG_DATE                   0x20
+#define LOG_FLAG_USEC                   0x40        /**< microseconds after the time */
 
 /*** DECLARATION ************************************************************/
 
 typedef enum   LogLevel LogLevel;
+typedef enum   LogOverflow LogOverflow;
 
 enum LogLevel {
     LOG_NONE_PRIVATE = 0,
@@ -59,10 +73,22 @@ enum LogLevel {
     LOG_DEBUG_PRIVATE
 };
 
+/**
+ * async mode: what a thread does if its buffer is full
+ */
+enum LogOverflow {
+    LOG_OVERFLOW_DROP = 0,                      /**< drop the line, the count is logged later */
+    LOG_OVERFLOW_BLOCK                          /**< wait for the flusher */
+};
+
 /*** DEFINITION *************************************************************/
 
 
 void        Log_init                    (FILE *stream, LogLevel level, uint8_t flags);
+bool        Log_startAsync              (LogOverflow overflow);
+void        Log_stop                    (void);
+bool        Log_openTrace               (const char *filename);
+void        Log_closeTrace              (void);
 void        Log_print                   (LOG_PARAMETER_DECLARATION, const char *format, ...)                __attribute__ ((format (printf, LOG_FORMAT_STRING, LOG_FORMAT_PARAMETER)));
 void        Log_println                 (LOG_PARAMETER_DECLARATION, const char *format, ...)                __attribute__ ((format (printf, LOG_FORMAT_STRING, LOG_FORMAT_PARAMETER)));
 void        Log_errno                   (LOG_PARAMETER_DECLARATION, int errnum, const char *format, ...)    __attribute__ ((format (printf, LOG_FORMAT_STRING + 1, LOG_FORMAT_PARAMETER + 1)));
@@ -71,8 +97,71 @@ void        Log_append                  (LOG_PARAMETER_DECLARATION, const char *
 void        Log_appendln                (LOG_PARAMETER_DECLARATION, const char *format, ...)                __attribute__ ((format (printf, LOG_FORMAT_STRING, LOG_FORMAT_PARAMETER)));
 void        Log_charstream              (LOG_PARAMETER_DECLARATION, const char *stream, const uint32_t len);
 
+void        Log_trace                   (LogTraceSite *site, ...);
+
 const char *Log_getFamily               (int family);
 
+extern LogLevel log_level;
+extern bool     log_trace;
+
+/*** SITES ******************************************************************/
+
+/**
+ * a disabled site costs one relaxed load and a compare, the arguments
+ * aren't evaluated, and above LOG_COMPILE_LEVEL it's dead code
+ *
+ * LOG_DEBUG etc. expand to the level and the site's position,
+ * so the level is split off in a second step
+ */
+#define LOG_ENABLED(level)              ((level) <= LOG_COMPILE_LEVEL && \
+                                         (level) <= __atomic_load_n(&log_level, __ATOMIC_RELAXED))
+
+#define LOG_SITE(function, ...)         LOG_SITE_PRIVATE(function, __VA_ARGS__)
+#define LOG_SITE_PRIVATE(function, level, ...) \
+                                        (LOG_ENABLED(level) ? (function)(level, __VA_ARGS__) : (void) 0)
+
+#define Log_print(...)                  LOG_SITE(Log_print,      __VA_ARGS__)
+#define Log_println(...)                LOG_SITE(Log_println,    __VA_ARGS__)
+#define Log_errno(...)                  LOG_SITE(Log_errno,      __VA_ARGS__)
+#define Log_gai(...)                    LOG_SITE(Log_gai,        __VA_ARGS__)
+#define Log_append(...)                 LOG_SITE(Log_append,     __VA_ARGS__)
+#define Log_appendln(...)               LOG_SITE(Log_appendln,   __VA_ARGS__)
+#define Log_charstream(...)             LOG_SITE(Log_charstream, __VA_ARGS__)
+
+/**
+ * binary record to the trace file (Log_openTrace) instead of a line:
+ * the site is registered at compile time, the call only copies the
+ * arguments, log_decode formats them later
+ */
+#define Log_trace(...)                  LOG_TRACE_SITE(__VA_ARGS__)
+
+#ifdef ENABLE_LOG_DEBUG
+#define LOG_TRACE_SITE(level, filename, line, function, ...) \
+                                        LOG_TRACE_PRIVATE(level, __VA_ARGS__)
+#else
+#define LOG_TRACE_SITE(level, ...)      LOG_TRACE_PRIVATE(level, __VA_ARGS__)
+#endif
+
+#define LOG_TRACE_PRIVATE(level, format, ...) \
+    do { \
+        static LogTraceSite logTraceSite __attribute__ ((used, section ("log_trace"), aligned (8))) = \
+            { format, __FILE__, __FUNCTION__, __LINE__, level, 0, { 0 }, { 0 } }; \
+        if (0) { \
+            Log_traceFormat(format, ## __VA_ARGS__); \
+        } \
+        if (LOG_ENABLED(level) && __atomic_load_n(&log_trace, __ATOMIC_RELAXED)) { \
+            (Log_trace)(&logTraceSite, ## __VA_ARGS__); \
+        } \
+    } while (0)
+
+/**
+ * never called, lets the compiler check the arguments against the format
+ */
+static inline void __attribute__ ((format (printf, 1, 2)))
+Log_traceFormat(const char *format, ...)
+{
+}
+
 
 #endif
 
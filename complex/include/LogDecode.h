@@ -0,0 +1,16 @@
+#ifndef __LOG_DECODE_H__
+#define __LOG_DECODE_H__
+
+#define CONFIG_PROGRAM_NAME                 "log_decode"
+#define CONFIG_PROGRAM_DESC                 "KT2 Trace Decoder"
+#define CONFIG_PROGRAM_VERSION              "1.0"
+#define CONFIG_PROGRAM_USAGE                "(-h | [<trace file>])"
+#define CONFIG_PROGRAM_HELP1                "echo_server.trace"
+#define CONFIG_PROGRAM_HELP2                "< echo_server.trace"
+
+#include <stdio.h>
+#include <stdbool.h>
+
+bool LogDecode_file(FILE *in, FILE *out);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __LOG_TRACE_H__
+#define __LOG_TRACE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * binary trace file, written by Log_trace and formatted offline by log_decode
+ *
+ *     header:      magic, version, number of sites           (3 x uint32)
+ *     site:        level (uint8), line (uint32), filename,
+ *                  function, format (each uint16 length + bytes)
+ *     record:      site, tid, time in ns, length of the args (uint32, uint32, uint64, uint32)
+ *                  followed by the raw argument values
+ *
+ * all numbers in host byte order, the decoder runs on the same kind of machine
+ */
+#define LOG_TRACE_MAGIC                 0x4B543254  /**< "KT2T" */
+#define LOG_TRACE_VERSION               1
+#define LOG_TRACE_RECORD_LEN            20
+#define LOG_TRACE_ARGS_MAX              16          /**< sites with more arguments aren't traced */
+#define LOG_TRACE_SITES_MAX             65536       /**< a dictionary with more sites is corrupt */
+#define LOG_TRACE_STRING_MAX            256         /**< %s arguments are cut off */
+#define LOG_TRACE_ARGS_LEN_MAX          (LOG_TRACE_ARGS_MAX * (2 + LOG_TRACE_STRING_MAX))
+#define LOG_TRACE_BUFFER_SIZE           65536       /**< per thread, written with one write() when full */
+
+typedef enum {
+    LOG_TRACE_NONE = 0,                             /**< "%%" */
+    LOG_TRACE_INT,                                  /**< 4 bytes: int, char, short, '*' width or precision */
+    LOG_TRACE_LONG,                                 /**< 8 bytes: long, long long, size_t, intmax_t, ptrdiff_t */
+    LOG_TRACE_DOUBLE,                               /**< 8 bytes */
+    LOG_TRACE_POINTER,                              /**< 8 bytes */
+    LOG_TRACE_STRING,                               /**< uint16 length + bytes, without '\0', "%.Ns" at most N */
+    LOG_TRACE_STRING_BOUNDED,                       /**< "%.*s": at most the preceding int argument bytes */
+    LOG_TRACE_UNKNOWN                               /**< e.g. long double or "%n", the site isn't traced */
+} LogTraceType;
+
+/**
+ * one conversion of a format string, e.g. "%-*.*s"
+ */
+typedef struct {
+    const char             *start;                  /**< at '%' */
+    const char             *end;                    /**< behind the conversion character */
+    LogTraceType            type;
+    bool                    widthStar;              /**< width is an int argument */
+    bool                    precisionStar;          /**< precision is an int argument */
+    int32_t                 precision;              /**< literal precision, -1 if there is none */
+} LogTraceConversion;
+
+/**
+ * one per Log_trace call site, the linker collects them in the section
+ * "log_trace", the index in the section is the site id. The sites are
+ * aligned to 8 explicitly, gcc would align big static objects to 32 bytes
+ * and leave gaps in the section.
+ */
+typedef struct {
+    const char             *format;
+    const char             *filename;
+    const char             *function;
+    uint32_t                line;
+    uint8_t                 level;
+    uint8_t                 numArgs;                /**< UINT8_MAX: too many or unknown conversions */
+    uint8_t                 types[LOG_TRACE_ARGS_MAX];
+    uint16_t                bounds[LOG_TRACE_ARGS_MAX]; /**< bytes of a string argument at most */
+} __attribute__ ((aligned (8))) LogTraceSite;
+
+bool                LogTrace_scan           (const char **format, LogTraceConversion *conversion);
+uint8_t             LogTrace_parse          (const char *format, uint8_t *types, uint16_t *bounds);
+
+#endif
@@ -6,7 +6,8 @@
 
 #include "RingBuffer.h"
 
-#define MESSAGE_HEADER_LEN      4
+#define MESSAGE_HEADER_LEN      8                       /**< type, flags, len and nr */
+#define MESSAGE_RECV_BUFFER     17                      /**< receive ring buffer is 2^17 bytes */
 
 typedef enum {
     REQUEST_TO_UPPER = 1,
@@ -17,30 +18,36 @@ typedef enum {
     RESPONSE_FINISH
 } MessageType;
 
-typedef struct {
-    uint8_t         data[UINT16_MAX];       /**< Data */
-    uint16_t        len;                    /**< Length of the whole raw message */
-} MessageRaw;
-
-
 typedef struct {
     uint8_t         type;                   /**< Type */
     uint8_t         flags;                  /**< For future use */
     uint16_t        len;                    /**< Payload length, exclude header (max. 65536 bytes) */
 } MessageHeader;
 
-typedef struct {
+/**
+ * allocated from the MessagePool with room for header.len bytes,
+ * freed when the last reference is dropped
+ */
+typedef struct _Message {
     MessageHeader   header;
     uint32_t        nr;                     /**< Request/Response number */
-    char            data[UINT16_MAX];       /**< Data */
+    uint32_t        refs;                   /**< References (atomic) */
+    uint8_t         sizeClass;              /**< MessagePool size class */
+    struct _Message *next;                  /**< Free list or queue of the owner */
+    void           *owner;                  /**< Context while it's processed elsewhere */
+    char            data[];                 /**< Data */
 } Message;
 
-bool            Message_send(int sockfd, MessageType type, uint32_t nr, const char *data, uint16_t len);
-bool            Message_receive(int sockfd, RingBuffer *buffer, Message *msg);
-MessageRaw     *Message_encode(MessageRaw *raw, Message *msg);
-Message        *Message_decode(Message *msg, RingBuffer *buffer);
+Message        *Message_new(uint16_t len);
+Message        *Message_ref(Message *msg);
+void            Message_unref(Message *msg);
 
-//MessageRaw     *Message_encode(MessageRaw *raw, Message *msg);
-//Message        *Message_decode(Message *msg, MessageRaw *raw);
+bool            Message_send(int sockfd, MessageType type, uint32_t nr, const char *data, uint16_t len);
+bool            Message_sendBatch(int sockfd, Message **msgs, uint32_t num);
+char           *Message_encodeHeader(char *header, MessageType type, uint8_t flags, uint16_t len, uint32_t nr);
+Message        *Message_receive(int sockfd, RingBuffer *buffer);
+RingBuffer     *Message_encode(RingBuffer *buffer, Message *msg);
+Message        *Message_decode(RingBuffer *buffer);
+bool            Message_reply(Message *msg);
 
 #endif
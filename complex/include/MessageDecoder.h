@@ -0,0 +1,32 @@
+#ifndef __MESSAGE_DECODER_H__
+#define __MESSAGE_DECODER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Message.h"
+
+typedef enum {
+    MESSAGE_DECODER_HEADER,                                     /**< collecting the header     */
+    MESSAGE_DECODER_BODY,                                       /**< collecting the payload    */
+    MESSAGE_DECODER_FAILED                                      /**< out of memory             */
+} MessageDecoderState;
+
+/**
+ * resumable decoder for a byte stream, chunks may end anywhere
+ * inside a header or a payload
+ */
+typedef struct {
+    MessageDecoderState     state;
+    uint32_t                have;                               /**< bytes of the current part */
+    char                    header[MESSAGE_HEADER_LEN];         /**< partially received header */
+    Message                *msg;                                /**< message being decoded     */
+} MessageDecoder;
+
+MessageDecoder     *MessageDecoder_new      (void);
+void                MessageDecoder_delete   (MessageDecoder *this);
+void                MessageDecoder_reset    (MessageDecoder *this);
+
+Message            *MessageDecoder_feed     (MessageDecoder *this, const char **data, uint32_t *len);
+
+#endif
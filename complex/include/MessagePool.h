@@ -0,0 +1,35 @@
+#ifndef __MESSAGE_POOL_H__
+#define __MESSAGE_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "Message.h"
+
+#define MESSAGE_POOL_CLASSES        6                           /**< payloads up to 64, 256, 1K, 4K, 16K, 64K bytes */
+#define MESSAGE_POOL_SLAB_SIZE      65536                       /**< at most, as many messages of one class as fit (at least one) */
+#define MESSAGE_POOL_CACHE_MAX      64                          /**< per thread and class, the rest goes to the depot */
+#define MESSAGE_POOL_BATCH          32                          /**< messages moved between cache and depot at once */
+
+/**
+ * free messages of one size class, shared by all threads
+ */
+typedef struct {
+    pthread_mutex_t         mutex;                              /**< mutual exclusive      */
+    Message                *free;                               /**< free list             */
+    uint32_t                count;                              /**< length of free list   */
+} MessagePoolDepot;
+
+/**
+ * free messages of one size class, owned by one thread
+ */
+typedef struct {
+    Message                *free;                               /**< free list             */
+    uint32_t                count;                              /**< length of free list   */
+} MessagePoolCache;
+
+Message            *MessagePool_get         (uint16_t len);
+void                MessagePool_put         (Message *msg);
+
+#endif
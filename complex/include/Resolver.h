@@ -0,0 +1,57 @@
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netdb.h>
+
+#define RESOLVER_WAYS               4                           /**< entries per cache set */
+
+typedef enum {
+    RESOLVER_EMPTY = 0,
+    RESOLVER_PENDING,                                           /**< queued or being resolved */
+    RESOLVER_RESOLVED,
+    RESOLVER_FAILED                                             /**< no name, cached as well */
+} ResolverState;
+
+/**
+ * IPv4 or IPv6 address without port, IPv4 in the first 4 bytes
+ */
+typedef struct {
+    uint8_t                 addr[16];
+    uint32_t                scopeId;                            /**< interface of an IPv6 link-local address */
+    sa_family_t             family;
+} ResolverKey;
+
+typedef struct {
+    ResolverKey             key;
+    ResolverState           state;
+    time_t                  expires;                            /**< resolved or failed until */
+    char                    name[NI_MAXHOST];
+} ResolverEntry;
+
+typedef struct {
+    ResolverEntry          *entries;                            /**< numSets * RESOLVER_WAYS */
+    uint32_t                numSets;                            /**< 2^n */
+    uint32_t                ttl;                                /**< seconds a result is cached */
+    ResolverKey            *queue;                              /**< ring of pending lookups */
+    uint32_t                max;                                /**< ring length (2^n) */
+    uint32_t                head;                               /**< next lookup to take */
+    uint32_t                tail;                               /**< next free slot */
+    uint32_t                numThreads;                         /**< detached, blocking getnameinfo() */
+    uint32_t                numRunning;                         /**< threads not finished, the last one frees the resolver */
+    pthread_mutex_t         mutex;                              /**< protects cache and queue */
+    pthread_cond_t          notEmpty;                           /**< wakes up idle threads */
+    bool                    running;
+} Resolver;
+
+Resolver           *Resolver_new            (uint32_t numThreads, uint32_t maxEntries, uint32_t maxQueued, uint32_t ttl);
+void                Resolver_delete         (Resolver *this);
+
+bool                Resolver_lookup         (Resolver *this, const struct sockaddr *addr, char *name, size_t len);
+
+#endif
@@ -5,21 +5,39 @@
 #include <stdbool.h>
 #include <pthread.h>
 
+#define RINGBUFFER_CACHE_LINE       64
+
+#define RINGBUFFER_FLAG_SPSC        0x01                        /**< lock-free, one producer and one consumer */
+#define RINGBUFFER_FLAG_MIRRORED    0x02                        /**< buffer mapped twice, regions are contiguous */
+
+/**
+ * consumer and producer fields live on separate cache lines,
+ * each side caches the other side's pointer (SPSC mode)
+ */
 typedef struct {
-    pthread_mutex_t         mutex;                              /**< mutual exclusive      */
+    uint32_t                readPointer                         /**< read pointer          */
+                            __attribute__ ((aligned (RINGBUFFER_CACHE_LINE)));
+    uint32_t                writeCache;                         /**< consumer's copy of the write pointer */
+
+    uint32_t                writePointer                        /**< write pointer         */
+                            __attribute__ ((aligned (RINGBUFFER_CACHE_LINE)));
+    uint32_t                readCache;                          /**< producer's copy of the read pointer */
+
+    pthread_mutex_t         mutex                               /**< mutual exclusive      */
+                            __attribute__ ((aligned (RINGBUFFER_CACHE_LINE)));
     uint32_t                max;                                /**< maximum buffer length */
     char                   *ringBuffer;                         /**< ring buffer           */
-    uint32_t                readPointer;                        /**< read pointer          */
-    uint32_t                writePointer;                       /**< write pointer         */
-    uint32_t                size;                               /**< current buffer size   */
+    uint8_t                 flags;                              /**< RINGBUFFER_FLAG_*     */
 } RingBuffer;
 
 RingBuffer         *RingBuffer_new          (int num_bytes);
+RingBuffer         *RingBuffer_newWithFlags (int num_bytes, uint8_t flags);
 void                RingBuffer_delete       (RingBuffer *this);
 
-inline uint32_t     RingBuffer_getSize      (RingBuffer *this);
-inline bool         RingBuffer_canRead      (RingBuffer *this);
-inline bool         RingBuffer_canWrite     (RingBuffer *this);
+static inline uint32_t  RingBuffer_getSize  (RingBuffer *this);
+static inline uint32_t  RingBuffer_getFree  (RingBuffer *this);
+static inline bool      RingBuffer_canRead  (RingBuffer *this);
+static inline bool      RingBuffer_canWrite (RingBuffer *this);
 
 bool                RingBuffer_read         (RingBuffer *this, char *buffer, uint16_t *size);
 bool                RingBuffer_get          (RingBuffer *this, char *character);
@@ -27,27 +45,47 @@ bool                RingBuffer_get          (RingBuffer *this, char *character);
 bool                RingBuffer_write        (RingBuffer *this, char *buffer, uint16_t size);
 bool                RingBuffer_put          (RingBuffer *this, char character);
 
+char               *RingBuffer_readableSpan (RingBuffer *this, uint32_t *len);
+char               *RingBuffer_readableSpanAt(RingBuffer *this, uint32_t offset, uint32_t *len);
+bool                RingBuffer_consume      (RingBuffer *this, uint32_t len);
+
+char               *RingBuffer_writableSpan (RingBuffer *this, uint32_t *len);
+bool                RingBuffer_commitWrite  (RingBuffer *this, uint32_t len);
+
 /**
- *
+ * current buffer size, only a snapshot if the other side is running concurrently
  */
-inline uint32_t
+static inline uint32_t
 RingBuffer_getSize(RingBuffer *this)
 {
-    return this->size;
+    return (__atomic_load_n(&(this->writePointer), __ATOMIC_ACQUIRE) -
+            __atomic_load_n(&(this->readPointer),  __ATOMIC_ACQUIRE)) & (this->max - 1);
 }
 
 
 /**
- *
+ * free space (one entry always stays empty), only a snapshot if the other side is running concurrently
+ */
+static inline uint32_t
+RingBuffer_getFree(RingBuffer *this)
+{
+    return this->max - 1 - RingBuffer_getSize(this);
+}
+
+
+/**
+ * called by the consumer
  */
-inline bool
+static inline bool
 RingBuffer_canRead(RingBuffer *this)
 {
-    return (this->writePointer != this->readPointer);
+    return (__atomic_load_n(&(this->writePointer), __ATOMIC_ACQUIRE) != this->readPointer);
 }
 
 
 /**
+ * called by the producer
+ *
  * ring buffer full (write pointer is next to read pointer)?
  *      _______________________________
  *     |   |   |   |   |   |   |   |   |
@@ -64,10 +102,10 @@ RingBuffer_canRead(RingBuffer *this)
  *       ^                           ^
  *       R                           W
  */
-inline bool
+static inline bool
 RingBuffer_canWrite(RingBuffer *this)
 {
-    return (((this->writePointer + 1) & (this->max - 1)) != this->readPointer);
+    return (((this->writePointer + 1) & (this->max - 1)) != __atomic_load_n(&(this->readPointer), __ATOMIC_ACQUIRE));
 }
 
 #endif
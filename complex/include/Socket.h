@@ -0,0 +1,10 @@
+#ifndef __SOCKET_H__
+#define __SOCKET_H__
+
+#include <stdbool.h>
+#include <netdb.h>
+
+int                 Socket_listen           (struct addrinfo *addrinfo, int backlog, bool reuseport);
+bool                Socket_raiseFileLimit   (void);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __THREAD_POOL_H__
+#define __THREAD_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*ThreadPoolTask)(void *arg);
+
+typedef struct {
+    ThreadPoolTask          task;                               /**< function to execute   */
+    void                   *arg;                                /**< argument of task      */
+} ThreadPoolJob;
+
+/**
+ * per-worker deque: the owner takes from the head,
+ * idle workers steal from the tail
+ */
+typedef struct {
+    pthread_mutex_t         mutex;                              /**< mutual exclusive      */
+    ThreadPoolJob          *jobs;                               /**< ring of jobs          */
+    uint32_t                max;                                /**< ring length (2^n)     */
+    uint32_t                head;                               /**< next job to take      */
+    uint32_t                tail;                               /**< next free slot        */
+} ThreadPoolQueue;
+
+typedef struct _ThreadPool ThreadPool;
+
+typedef struct {
+    ThreadPool             *pool;                               /**< back reference        */
+    uint32_t                idx;                                /**< own queue             */
+    pthread_t               tid;                                /**< worker thread         */
+} ThreadPoolWorker;
+
+struct _ThreadPool {
+    ThreadPoolWorker       *workers;                            /**< pre-spawned threads   */
+    ThreadPoolQueue        *queues;                             /**< one queue per worker  */
+    uint32_t                numWorkers;                         /**< number of threads     */
+    uint32_t                maxJobs;                            /**< queued jobs limit     */
+    uint32_t                numJobs;                            /**< queued jobs (atomic)  */
+    uint32_t                next;                               /**< round-robin (atomic)  */
+    pthread_mutex_t         mutex;                              /**< protects conditions   */
+    pthread_cond_t          notEmpty;                           /**< wakes up idle workers */
+    pthread_cond_t          notFull;                            /**< wakes up submitters   */
+    bool                    running;                            /**< pool state            */
+};
+
+ThreadPool         *ThreadPool_new          (uint32_t numWorkers, uint32_t maxJobs);
+void                ThreadPool_delete       (ThreadPool *this);
+
+bool                ThreadPool_submit       (ThreadPool *this, ThreadPoolTask task, void *arg);
+bool                ThreadPool_trySubmit    (ThreadPool *this, ThreadPoolTask task, void *arg);
+
+#endif
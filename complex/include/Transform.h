@@ -0,0 +1,19 @@
+#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * in-place case conversion of UTF-8 KT2 payloads,
+ * the implementation (AVX2, SSE2 or scalar) is selected on first use
+ */
+typedef bool (*TransformFunction)(char *data, uint32_t len);
+
+bool                Transform_toUpper       (char *data, uint32_t len);
+bool                Transform_toLower       (char *data, uint32_t len);
+
+const char         *Transform_getName       (void);
+bool                Transform_getFunctions  (const char *name, TransformFunction *toUpper, TransformFunction *toLower);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef __TRANSFORM_TEST_H__
+#define __TRANSFORM_TEST_H__
+
+#define CONFIG_PROGRAM_NAME                 "transform_test"
+#define CONFIG_PROGRAM_DESC                 "KT2 Transform Test"
+#define CONFIG_PROGRAM_VERSION              "1.0"
+#define CONFIG_PROGRAM_USAGE                "(-h | [-n <iterations>] [-b <MiB>] [-s <message size>])"
+#define CONFIG_PROGRAM_HELP1                ""
+#define CONFIG_PROGRAM_HELP2                "-n 1000000 -b 256 -s 1024"
+
+#define CONFIG_TEST_ITERATIONS              100000              /**< random payloads of the differential test */
+#define CONFIG_TEST_LEN_MAX                 512                 /**< bytes, several vectors and a tail */
+#define CONFIG_BENCH_SIZE                   64                  /**< MiB converted per implementation and payload */
+#define CONFIG_BENCH_MESSAGE                65535               /**< bytes per call, a full KT2 payload */
+
+#endif
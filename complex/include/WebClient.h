@@ -4,16 +4,95 @@
 #define CONFIG_PROGRAM_NAME                 "web_client"
 #define CONFIG_PROGRAM_DESC                 "KT2 Web Client"
 #define CONFIG_PROGRAM_VERSION              "1.0"
-#define CONFIG_PROGRAM_USAGE                "(-h | [-m <mode>] [-l <log level>] (<hostname> | <IP address>))"
+#define CONFIG_PROGRAM_USAGE                "(-h | [-m <mode>] [-l <log level>] [-e <delay>] [-b <buffer size>] [-p <pipeline depth>] [-o <output file>] [-c <connections>] [-t <threads>] [-d <seconds>] [-r <rate>] (<hostname> | <IP address>) [<service> | <port number>] [<path> ...])"
+#define CONFIG_PROGRAM_OPTIONS              ":hm:l:e:b:p:o:c:t:d:r:"
 #define CONFIG_PROGRAM_HELP1                "www.google.com"
-#define CONFIG_PROGRAM_HELP2                "-m ipv4 www.google.com"
-#define CONFIG_PROGRAM_HELP3                "-m ipv6 -l DEBUG ipv6.google.com"
+#define CONFIG_PROGRAM_HELP2                "-m ipv4 -o google.html www.google.com 80 / /robots.txt"
+#define CONFIG_PROGRAM_HELP3                "-m ipv6 -c 256 -t 4 -d 30 ::1 8080 /index.html /style.css"
 
 #define CONFIG_SERVICE                      "80"
+#define CONFIG_PATH                         "/"
+#define CONFIG_CONNECT_DELAY                250         /**< ms between two connect attempts (Happy Eyeballs) */
+#define CONFIG_CONNECT_TIMEOUT              10000       /**< ms for all connect attempts */
+#define CONFIG_READ_BUFFER_SIZE             16384       /**< bytes per connection */
+#define CONFIG_READ_BUFFER_MIN              64
+#define CONFIG_PIPELINE_DEPTH               8           /**< requests sent ahead of their responses */
+#define CONFIG_REQUEST_MAX                  8192        /**< bytes of a request */
+#define CONFIG_PATH_MAX                     4096
 
+/* download to a file (-o): bodies are spliced, the read buffer is only for headers and chunks */
+#define CONFIG_DOWNLOAD_BUFFER_SIZE         (1 << 20)   /**< read buffer unless -b is given */
+#define CONFIG_PIPE_SIZE                    (1 << 20)   /**< bytes in the pipe of one splice() */
+
+/* benchmark, used if any of -c, -t, -d or -r is given */
+#define CONFIG_LOAD_DURATION                10          /**< seconds */
+#define CONFIG_LOAD_OPEN_DEPTH              64          /**< requests in flight per connection with -r */
+
+#include "HttpParser.h"
+
+#include <stdint.h>
 #include <stdbool.h>
 #include <netdb.h>
 
-bool WebClient_get(struct addrinfo *addrinfo);
+typedef enum {
+    WEB_CLIENT_HEAD,                                            /**< status and headers        */
+    WEB_CLIENT_DATA,                                            /**< a piece of the body       */
+    WEB_CLIENT_END                                              /**< the response is complete  */
+} WebClientEvent;
+
+/**
+ * called for every response, in the order of the paths,
+ * data is only valid during the call
+ *
+ * @param   idx                     of the path
+ * @param   parser                  status, headers and body length so far
+ */
+typedef void (*WebClientHandler)(void *arg, uint32_t idx, WebClientEvent event, const HttpParser *parser,
+                                 const char *data, uint32_t len);
+
+typedef struct {
+    uint32_t                connectDelay;                       /**< ms between two connect attempts (Happy Eyeballs) */
+    uint32_t                bufferSize;                         /**< read buffer per connection */
+    uint32_t                depth;                              /**< requests in flight per connection */
+    const char             *output;                             /**< file for the bodies, NULL = stdout */
+    uint32_t                numConnections;                     /**< benchmark */
+    uint32_t                numThreads;                         /**< 0 = one per online core */
+    uint32_t                duration;                           /**< seconds */
+    uint32_t                rate;                               /**< requests per second (open loop), 0 = closed loop */
+} WebConfig;
+
+/**
+ * HTTP/1.1 client of one host, the connection is kept open between fetches
+ */
+typedef struct {
+    struct addrinfo        *addrinfo;
+    const WebConfig        *config;
+    char                    host[NI_MAXHOST + NI_MAXSERV + 3];  /**< Host header */
+    int                     sockfd;                             /**< -1 if not connected */
+    char                   *buffer;
+    HttpParser              parser;
+    int                     output;                             /**< bodies go here, -1 = to the handler */
+    int                     pipe[2];                            /**< socket -> pipe -> output */
+    bool                    splice;                             /**< false once the output refused it */
+    uint32_t                numConnections;
+    uint64_t                numResponses;
+    uint64_t                numSpliced;                         /**< body bytes which stayed in the kernel */
+    uint64_t                numWritten;                         /**< body bytes copied through the buffer */
+} WebClient;
+
+void                WebConfig_init          (WebConfig *this);
+
+WebClient          *WebClient_new           (struct addrinfo *addrinfo, const char *hostname, const char *port,
+                                             const WebConfig *config);
+void                WebClient_delete        (WebClient *this);
+bool                WebClient_setOutput     (WebClient *this, int fd);
+bool                WebClient_fetch         (WebClient *this, const char **paths, uint32_t numPaths,
+                                             WebClientHandler handler, void *arg);
+
+int                 WebClient_host          (char *host, size_t len, const char *hostname, const char *port);
+int                 WebClient_request       (char *request, size_t len, const char *host, const char *path);
+
+bool                WebClient_get           (struct addrinfo *addrinfo, const char *hostname, const char *port,
+                                             const char **paths, uint32_t numPaths, const WebConfig *config);
 
 #endif
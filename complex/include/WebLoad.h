@@ -0,0 +1,13 @@
+#ifndef __WEB_LOAD_H__
+#define __WEB_LOAD_H__
+
+#include "WebClient.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netdb.h>
+
+bool                WebLoad_run             (struct addrinfo *addrinfo, const char *hostname, const char *port,
+                                             const char **paths, uint32_t numPaths, const WebConfig *config);
+
+#endif
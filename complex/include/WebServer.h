@@ -0,0 +1,32 @@
+#ifndef __WEB_SERVER_H__
+#define __WEB_SERVER_H__
+
+#define CONFIG_PROGRAM_NAME                 "web_server"
+#define CONFIG_PROGRAM_DESC                 "KT2 Web Server"
+#define CONFIG_PROGRAM_VERSION              "1.0"
+#define CONFIG_PROGRAM_USAGE                "(-h | [-m <mode>] [-l <log level>] [-s <shards>] [-r <document root>] [<service>])"
+#define CONFIG_PROGRAM_OPTIONS              ":hm:l:s:r:"
+#define CONFIG_PROGRAM_HELP1                "8080"
+#define CONFIG_PROGRAM_HELP2                "-m ipv4 -s 4 -r /var/www"
+#define CONFIG_PROGRAM_HELP3                "-m ipv6 -l DEBUG -r public 80"
+
+#define CONFIG_SERVICE                      "8080"
+#define CONFIG_SHARDS                       1           /**< 0 = one per online core */
+#define CONFIG_LISTEN_QUEUE                 SOMAXCONN
+#define CONFIG_DOCUMENT_ROOT                "."
+#define CONFIG_INDEX                        "index.html"
+#define CONFIG_REQUEST_MAX                  4096        /**< request line and headers, per connection */
+#define CONFIG_HEAD_MAX                     1024        /**< status line and headers of a response */
+#define CONFIG_SENDFILE_MAX                 (1 << 20)   /**< bytes of one sendfile(), other connections get a turn */
+#define CONFIG_KEEPALIVE_TIMEOUT            15          /**< s an idle connection is kept between requests */
+#define CONFIG_REQUEST_TIMEOUT              10          /**< s from the first byte of a request to its last header */
+#define CONFIG_SEND_TIMEOUT                 30          /**< s a response may make no progress */
+#define CONFIG_LINGER_TIMEOUT               2           /**< s unread input is discarded after the last response */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <netdb.h>
+
+bool WebServer_create(struct addrinfo *addrinfo, uint32_t numShards, const char *root);
+
+#endif
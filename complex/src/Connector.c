@@ -0,0 +1,349 @@
+#include "Connector.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/**
+ * a started attempt
+ */
+typedef struct {
+    struct addrinfo    *addrinfo;
+    uint64_t            start;                  /**< ns (CLOCK_MONOTONIC) */
+} ConnectorAttempt;
+
+static uint32_t         Connector_interleave    (struct addrinfo *addrinfo, struct addrinfo **candidates, uint32_t max);
+static int              Connector_start         (struct addrinfo *addrinfo);
+static void             Connector_record        (int family, uint64_t latency, bool connected, bool cancelled);
+static ConnectorStats  *Connector_stats         (int family);
+static const char      *Connector_address       (struct addrinfo *addrinfo, char *address, size_t len);
+static uint64_t         Connector_now           (void);
+
+/* IPv4 and IPv6, of all connects of the process */
+static ConnectorStats   connectorStats[CONNECTOR_FAMILIES] = { { .min = UINT64_MAX }, { .min = UINT64_MAX } };
+static pthread_mutex_t  connectorMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Happy Eyeballs (RFC 8305): the addresses are raced, families alternating
+ * in the order of getaddrinfo(), a new attempt is started every delay ms
+ * or as soon as the previous one failed, the first connection wins and
+ * the others are closed
+ *
+ * @param   delay                   ms between two attempts (connection attempt delay)
+ * @param   timeout                 ms for all of them
+ * @return                          blocking connected socket or -1
+ */
+int
+Connector_connect(struct addrinfo *addrinfo, uint32_t delay, uint32_t timeout)
+{
+    struct addrinfo   **candidates;
+    struct addrinfo    *entry;
+    struct pollfd      *fds;
+    ConnectorAttempt   *attempts;
+    uint32_t            numCandidates = 0;
+    uint32_t            numStarted    = 0;
+    uint32_t            numPending    = 0;
+    uint32_t            idx;
+    uint64_t            now           = Connector_now();
+    uint64_t            deadline      = now + timeout * 1000000ULL;
+    uint64_t            nextStart     = now;
+    uint64_t            wakeup;
+    char                address[NI_MAXHOST];
+    int                 sockfd        = -1;
+    int                 error;
+    socklen_t           errorLen;
+    int                 status;
+
+    for (entry = addrinfo; entry != NULL; entry = entry->ai_next) {
+        numCandidates++;
+    }
+
+    candidates = (struct addrinfo **)   malloc(numCandidates * sizeof(struct addrinfo *));
+    fds        = (struct pollfd *)      malloc(numCandidates * sizeof(struct pollfd));
+    attempts   = (ConnectorAttempt *)   malloc(numCandidates * sizeof(ConnectorAttempt));
+
+    if (numCandidates == 0 || candidates == NULL || fds == NULL || attempts == NULL) {
+        Log_println(LOG_ERROR, "Can't connect to server: no address");
+        free(attempts);
+        free(fds);
+        free(candidates);
+        return -1;
+    }
+
+    numCandidates = Connector_interleave(addrinfo, candidates, numCandidates);
+
+    while (sockfd == -1) {
+        now = Connector_now();
+
+        /* the next attempt is due, or nothing is left to wait for */
+        if (numStarted < numCandidates && (now >= nextStart || numPending == 0)) {
+            addrinfo = candidates[numStarted++];
+            Log_println(LOG_DEBUG, "Connect to %s (%s)", Connector_address(addrinfo, address, sizeof(address)),
+                        Log_getFamily(addrinfo->ai_family));
+
+            fds[numPending].fd              = Connector_start(addrinfo);
+            fds[numPending].events          = POLLOUT;
+            fds[numPending].revents         = 0;
+            attempts[numPending].addrinfo   = addrinfo;
+            attempts[numPending].start      = now;
+
+            if (fds[numPending].fd == -1) {
+                Connector_record(addrinfo->ai_family, 0, false, false);
+                nextStart = now;
+            } else {
+                numPending++;
+                nextStart = now + delay * 1000000ULL;
+            }
+            continue;
+        }
+
+        if (numPending == 0 || now >= deadline) {
+            break;
+        }
+
+        wakeup = deadline;
+        if (numStarted < numCandidates && nextStart < wakeup) {
+            wakeup = nextStart;
+        }
+
+        status = poll(fds, numPending, (int) ((wakeup - now + 999999) / 1000000));
+        if (status == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't poll connect attempts");
+            break;
+        }
+
+        now = Connector_now();
+
+        for (idx = 0; idx < numPending && sockfd == -1; ) {
+            if (fds[idx].revents == 0) {
+                idx++;
+                continue;
+            }
+
+            error    = 0;
+            errorLen = sizeof(error);
+            if (getsockopt(fds[idx].fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1) {
+                error = errno;
+            }
+
+            addrinfo = attempts[idx].addrinfo;
+
+            if (error == 0) {
+                sockfd = fds[idx].fd;
+                Connector_record(addrinfo->ai_family, now - attempts[idx].start, true, false);
+                Log_println(LOG_DEBUG, "Connected to %s (%s) in %.1f ms",
+                            Connector_address(addrinfo, address, sizeof(address)),
+                            Log_getFamily(addrinfo->ai_family), (now - attempts[idx].start) / 1e6);
+            } else {
+                Log_errno(LOG_INFO, error, "Can't connect to %s (%s)",
+                          Connector_address(addrinfo, address, sizeof(address)), Log_getFamily(addrinfo->ai_family));
+                Connector_record(addrinfo->ai_family, 0, false, false);
+                close(fds[idx].fd);
+                nextStart = now;
+            }
+
+            /* remove it, the last one takes its place */
+            numPending--;
+            fds[idx]      = fds[numPending];
+            attempts[idx] = attempts[numPending];
+        }
+    }
+
+    /* cancel the attempts which lost the race */
+    for (idx = 0; idx < numPending; idx++) {
+        Connector_record(attempts[idx].addrinfo->ai_family, 0, false, true);
+        close(fds[idx].fd);
+    }
+
+    if (sockfd == -1) {
+        Log_println(LOG_ERROR, "Can't connect to server: %u address(es) tried", numStarted);
+    } else if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't set blocking mode");
+        close(sockfd);
+        sockfd = -1;
+    }
+
+    free(attempts);
+    free(fds);
+    free(candidates);
+
+    return sockfd;
+}
+
+/**
+ * a copy of the counters
+ *
+ * @param   family                  AF_INET or AF_INET6
+ */
+void
+Connector_getStats(int family, ConnectorStats *stats)
+{
+    pthread_mutex_lock(&connectorMutex);
+    *stats = *Connector_stats(family);
+    pthread_mutex_unlock(&connectorMutex);
+}
+
+void
+Connector_logStats(void)
+{
+    static const int    families[CONNECTOR_FAMILIES] = { AF_INET6, AF_INET };
+    ConnectorStats      stats;
+    uint32_t            idx;
+
+    for (idx = 0; idx < CONNECTOR_FAMILIES; idx++) {
+        Connector_getStats(families[idx], &stats);
+
+        if (stats.numAttempts == 0) {
+            continue;
+        }
+
+        Log_println(LOG_INFO, "%s: %u attempt(s), %u connected, %u failed, %u cancelled, connect min %.2f ms, mean %.2f ms, max %.2f ms",
+                    Log_getFamily(families[idx]), stats.numAttempts, stats.numConnected, stats.numFailed, stats.numCancelled,
+                    stats.numConnected > 0 ? stats.min / 1e6 : 0.0,
+                    stats.numConnected > 0 ? stats.sum / 1e6 / stats.numConnected : 0.0,
+                    stats.max / 1e6);
+    }
+}
+
+/**
+ * Happy Eyeballs outcome of one family, a report line on stdout
+ */
+void
+Connector_printStats(int family)
+{
+    ConnectorStats      stats;
+
+    Connector_getStats(family, &stats);
+
+    if (stats.numAttempts == 0) {
+        return;
+    }
+
+    printf("  Connect     %s %u connected, %u failed, %u cancelled, mean %.2f ms, max %.2f ms\n",
+           Log_getFamily(family), stats.numConnected, stats.numFailed, stats.numCancelled,
+           stats.numConnected > 0 ? stats.sum / 1e6 / stats.numConnected : 0.0, stats.max / 1e6);
+}
+
+/**
+ * RFC 8305 section 4: the family of the first address goes first,
+ * then the families alternate, the order within a family is kept
+ *
+ * @return                          number of candidates
+ */
+static uint32_t
+Connector_interleave(struct addrinfo *addrinfo, struct addrinfo **candidates, uint32_t max)
+{
+    struct addrinfo    *first  = addrinfo;
+    struct addrinfo    *second = addrinfo;
+    int                 family = addrinfo->ai_family;
+    uint32_t            num    = 0;
+
+    while (num < max && (first != NULL || second != NULL)) {
+        while (first != NULL && first->ai_family != family) {
+            first = first->ai_next;
+        }
+        while (second != NULL && second->ai_family == family) {
+            second = second->ai_next;
+        }
+
+        if (first != NULL) {
+            candidates[num++] = first;
+            first = first->ai_next;
+        }
+        if (second != NULL && num < max) {
+            candidates[num++] = second;
+            second = second->ai_next;
+        }
+    }
+
+    return num;
+}
+
+/**
+ * non-blocking connect, -1 if it failed right away
+ */
+static int
+Connector_start(struct addrinfo *addrinfo)
+{
+    int                 sockfd;
+
+    if ((sockfd = socket(addrinfo->ai_family, addrinfo->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addrinfo->ai_protocol)) == -1) {
+        Log_errno(LOG_INFO, errno, "Can't create %s socket", Log_getFamily(addrinfo->ai_family));
+        return -1;
+    }
+
+    if (connect(sockfd, addrinfo->ai_addr, addrinfo->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        Log_errno(LOG_INFO, errno, "Can't connect (%s)", Log_getFamily(addrinfo->ai_family));
+        close(sockfd);
+        return -1;
+    }
+
+    return sockfd;
+}
+
+static void
+Connector_record(int family, uint64_t latency, bool connected, bool cancelled)
+{
+    ConnectorStats     *stats;
+
+    pthread_mutex_lock(&connectorMutex);
+
+    stats = Connector_stats(family);
+    stats->numAttempts++;
+
+    if (connected) {
+        stats->numConnected++;
+        stats->sum += latency;
+        if (latency < stats->min) {
+            stats->min = latency;
+        }
+        if (latency > stats->max) {
+            stats->max = latency;
+        }
+    } else if (cancelled) {
+        stats->numCancelled++;
+    } else {
+        stats->numFailed++;
+    }
+
+    pthread_mutex_unlock(&connectorMutex);
+}
+
+static ConnectorStats *
+Connector_stats(int family)
+{
+    return &(connectorStats[family == AF_INET6 ? 1 : 0]);
+}
+
+static const char *
+Connector_address(struct addrinfo *addrinfo, char *address, size_t len)
+{
+    if (getnameinfo(addrinfo->ai_addr, addrinfo->ai_addrlen, address, len, NULL, 0, NI_NUMERICHOST)) {
+        strncpy(address, "?", len);
+    }
+
+    return address;
+}
+
+static uint64_t
+Connector_now(void)
+{
+    struct timespec     now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -1,4 +1,5 @@
 #include "EchoClient.h"
+#include "Connector.h"
 #include "Message.h"
 #include "Log.h"
 
@@ -7,53 +8,124 @@
 #include <string.h>
 #include <errno.h>
 
-#define CLIENT_FAILURE_EXIT         close(sockfd); \
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define CLIENT_FAILURE_EXIT         EchoClient_cleanup(sockfd, recvBuffer, requests); \
                                     return false;
 
+#define CLIENT_NUM_MESSAGES         3
+
+static Message *EchoClient_request(MessageType type, uint32_t nr, const char *text);
+static void     EchoClient_cleanup(int sockfd, RingBuffer *recvBuffer, Message **requests);
+
+/**
+ * all requests are sent at once (pipelined), the server answers them in
+ * completion order, responses are matched to their request by nr
+ *
+ * @param   delay                   ms between two connect attempts (Happy Eyeballs)
+ */
 bool
-EchoClient_connect(struct addrinfo *addrinfo)
+EchoClient_connect(struct addrinfo *addrinfo, uint32_t delay)
 {
     int                 sockfd;
+    RingBuffer         *recvBuffer = NULL;
+    Message            *requests[CLIENT_NUM_MESSAGES] = { NULL };
+    Message            *msg;
+    Message            *request;
+    struct timeval      tv;
+    uint32_t            numPending;
     const char         *text = "Das ist der Daumen, " \
                                "der schüttelt die Pflaumen, " \
                                "der liest sie auf, " \
                                "der trägt sie heim, " \
                                "und der kleine isst sie ganz allein.";
 
-    //char                buffer[64];
-    //int                 len;
-
-    /* create socket */
-    if((sockfd = socket(addrinfo->ai_family, addrinfo->ai_socktype, 0)) == -1) {
-        Log_errno(LOG_ERROR, errno, "Can't create socket");
+    /* connect to server, all addresses are raced */
+    if ((sockfd = Connector_connect(addrinfo, delay, CONFIG_CONNECT_TIMEOUT)) == -1) {
+        return false;
     }
 
-    /* connect to server */
-    if (connect(sockfd, addrinfo->ai_addr, addrinfo->ai_addrlen) == -1) {
-        Log_errno(LOG_ERROR, errno, ("Can't connect to server"));
-        CLIENT_FAILURE_EXIT
+    /* a lost response must not block forever */
+    tv.tv_sec  = CONFIG_RECV_TIMEOUT;
+    tv.tv_usec = 0;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't set receive timeout");
     }
 
-    /* send request to upper */
-    if (!Message_send(sockfd, REQUEST_TO_UPPER, 1, text, strlen(text))) {
+    /* request to upper, request to lower and finish, nr = index + 1 */
+    requests[0] = EchoClient_request(REQUEST_TO_UPPER, 1, text);
+    requests[1] = EchoClient_request(REQUEST_TO_LOWER, 2, text);
+    requests[2] = EchoClient_request(REQUEST_FINISH,   3, NULL);
+
+    if (requests[0] == NULL || requests[1] == NULL || requests[2] == NULL) {
         CLIENT_FAILURE_EXIT
     }
 
-    /* send request to lower */
-    if (!Message_send(sockfd, REQUEST_TO_LOWER, 2, text, strlen(text))) {
+    if (!Message_sendBatch(sockfd, requests, CLIENT_NUM_MESSAGES)) {
         CLIENT_FAILURE_EXIT
     }
 
-    /* send request finish */
-    if (!Message_send(sockfd, REQUEST_FINISH, 3, NULL, 0)) {
+    /* receive */
+    if ((recvBuffer = RingBuffer_newWithFlags(MESSAGE_RECV_BUFFER, RINGBUFFER_FLAG_MIRRORED)) == NULL) {
         CLIENT_FAILURE_EXIT
     }
 
-    /* receive */
+    for (numPending = CLIENT_NUM_MESSAGES; numPending > 0; numPending--) {
+        if ((msg = Message_receive(sockfd, recvBuffer)) == NULL) {
+            CLIENT_FAILURE_EXIT
+        }
 
+        if (msg->nr < 1 || msg->nr > CLIENT_NUM_MESSAGES || (request = requests[msg->nr - 1]) == NULL ||
+            msg->header.type != request->header.type + 1) {
+            Log_println(LOG_ERROR, "Unexpected response type=%u nr=%u", msg->header.type, msg->nr);
+            Message_unref(msg);
+            CLIENT_FAILURE_EXIT
+        }
 
+        Log_println(LOG_INFO, "Received message type=%u nr=%u \"%.*s\"",
+                    msg->header.type, msg->nr, (int) msg->header.len, msg->data);
 
+        requests[msg->nr - 1] = NULL;
+        Message_unref(request);
+        Message_unref(msg);
+    }
 
+    EchoClient_cleanup(sockfd, recvBuffer, requests);
 
     return true;
 }
+
+static Message *
+EchoClient_request(MessageType type, uint32_t nr, const char *text)
+{
+    uint16_t            len = (text != NULL) ? (uint16_t) strlen(text) : 0;
+    Message            *msg;
+
+    if ((msg = Message_new(len)) == NULL) {
+        return NULL;
+    }
+
+    msg->header.type = type;
+    msg->nr          = nr;
+    if (len > 0) {
+        memcpy(msg->data, text, len);
+    }
+
+    Log_println(LOG_INFO, "Send message type=%u nr=%u \"%.*s\"", type, nr, (int) len, msg->data);
+
+    return msg;
+}
+
+static void
+EchoClient_cleanup(int sockfd, RingBuffer *recvBuffer, Message **requests)
+{
+    uint32_t            idx;
+
+    for (idx = 0; idx < CLIENT_NUM_MESSAGES; idx++) {
+        Message_unref(requests[idx]);
+    }
+
+    RingBuffer_delete(recvBuffer);
+    close(sockfd);
+}
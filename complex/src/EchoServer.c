@@ -1,55 +1,249 @@
+#define _GNU_SOURCE
+
 #include "EchoServer.h"
+#include "MessageDecoder.h"
+#include "RingBuffer.h"
+#include "EventLoop.h"
+#include "ThreadPool.h"
+#include "Socket.h"
+#include "Resolver.h"
 #include "Log.h"
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 
 #include <signal.h>
-
 #include <pthread.h>
 
-#define ECHO_SERVER_SOCKET              0x01
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+
+#define LISTENER_MAX                    2
+
+/* room for the responses to one received chunk: a message started in an earlier chunk plus the chunk itself */
+#define OUTPUT_RESERVE                  (CONFIG_RECV_BUFFER_SIZE + MESSAGE_HEADER_LEN + UINT16_MAX)
+
+/* one-shot: a connection is served by at most one worker at a time,
+ * it waits for input or, while responses are pending, for output only
+ * (or just for offloaded requests) */
+#define CONNECTION_EVENTS               (EPOLLET | EPOLLONESHOT)
+#define CONNECTION_READ                 (CONNECTION_EVENTS | EPOLLIN | EPOLLRDHUP)
+#define CONNECTION_WRITE                (CONNECTION_EVENTS | EPOLLOUT)
+
+/* work a worker leaves to the shard's loop thread */
+#define CONNECTION_PENDING_CLOSE        0x01        /**< close the socket, drop the registration */
+#define CONNECTION_PENDING_SERVE        0x02        /**< offloaded responses are ready */
+
+typedef struct _Shard Shard;
+
+typedef struct _Listener {
+    EventHandler        handler;                /**< listening socket */
+    Shard              *shard;                  /**< owning shard */
+    int                 family;                 /**< AF_INET or AF_INET6 */
+} Listener;
+
+typedef struct _Connection {
+    EventHandler        handler;                /**< connected socket */
+    Shard              *shard;                  /**< shard which accepted it */
+    struct _Connection *prev;                   /**< list of open connections */
+    struct _Connection *next;
+    MessageDecoder     *decoder;                /**< requests, resumed with every chunk */
+    RingBuffer         *output;                 /**< encoded responses which aren't sent yet, allocated with the first request */
+    bool                finished;               /**< REQUEST_FINISH received, close when sent */
+    bool                closed;                 /**< no more I/O, the loop thread closes the socket */
+    bool                registered;             /**< socket open and in epoll, loop thread only */
+    uint32_t            events;                 /**< ready events handed to the worker (atomic) */
+    uint32_t            scheduled;              /**< serve requests (atomic), one worker serves them all */
+    uint32_t            refs;                   /**< registration, serving worker, offloaded requests, pending (atomic) */
+    uint32_t            pending;                /**< CONNECTION_PENDING_*, protected by the shard's mutex */
+    struct _Connection *pendingNext;            /**< list of connections with pending work */
+    struct _Connection *buriedNext;             /**< list of closed ones, released after the current batch */
+    uint32_t            numOffloaded;           /**< requests transformed on the pool */
+    uint32_t            offloadedLen;           /**< length of their responses */
+    pthread_mutex_t     mutex;                  /**< protects the completed list */
+    Message            *completed;              /**< offloaded responses in completion order */
+    Message            *completedTail;
+    Message            *finish;                 /**< RESPONSE_FINISH, held back until the offloaded ones are sent */
+    struct sockaddr_storage addr;               /**< client address, key of its host name */
+    char                address[NI_MAXHOST];    /**< numeric client address */
+    char                port[NI_MAXSERV];       /**< numeric client port */
+} Connection;
+
+/**
+ * event loop with its own listening sockets, the kernel
+ * spreads new connections over all shards (SO_REUSEPORT)
+ */
+struct _Shard {
+    uint32_t            idx;
+    pthread_t           tid;
+    EventLoop          *loop;
+    Listener            listener[LISTENER_MAX];
+    int                 numListeners;
+    Connection         *connections;
+    uint32_t            numConnections;
+    pthread_mutex_t     mutex;                  /**< protects the connection and the pending list */
+    EventHandler        wakeup;                 /**< eventfd, workers hand work to the loop thread */
+    Connection         *pending;
+    Connection         *buried;                 /**< loop thread only */
+};
+
+static bool EchoServer_createShard(Shard *shard, struct addrinfo *addrinfo, bool reuseport);
+static void EchoServer_deleteShard(Shard *shard);
+static void *EchoServer_shardThread(void *arg);
+static void EchoServer_acceptCallback(EventHandler *handler, uint32_t events);
+static void EchoServer_connectionCallback(EventHandler *handler, uint32_t events);
+static void EchoServer_wakeupCallback(EventHandler *handler, uint32_t events);
+static void EchoServer_wake(Connection *connection, uint32_t pending);
+static void EchoServer_drain(Shard *shard, bool serve);
+static void EchoServer_schedule(Connection *connection);
+static void EchoServer_serve(void *arg);
+static void EchoServer_work(Connection *connection);
+static bool EchoServer_receive(Connection *connection);
+static bool EchoServer_process(Connection *connection, const char *data, uint32_t len);
+static void EchoServer_transform(void *arg);
+static bool EchoServer_collect(Connection *connection);
+static bool EchoServer_flush(Connection *connection);
+static uint32_t EchoServer_outputFree(Connection *connection);
+static void EchoServer_close(Connection *connection);
+static void EchoServer_unregister(Connection *connection);
+static void EchoServer_release(Connection *connection);
+static const char *EchoServer_host(Connection *connection, char *host, size_t len);
+
+static ThreadPool      *pool;
+static Resolver        *resolver;
+
+/**
+ * @param   numShards               number of event loops, 0 = one per online core
+ */
+bool
+EchoServer_create(struct addrinfo *addrinfo, uint32_t numShards)
+{
+    Shard                  *shards;
+    sigset_t                mask;
+    struct signalfd_siginfo siginfo;
+    int                     signalfd_;
+    uint32_t                numStarted;
+    uint32_t                idx;
+    int                     status;
+
+    if (numShards == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numShards  = (cores > 0) ? (uint32_t) cores : 1;
+    }
+
+    /* SIGINT and SIGTERM are only received through the signalfd */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+        Log_println(LOG_FATAL, "Can't block signals");
+        return false;
+    }
+
+    if ((signalfd_ = signalfd(-1, &mask, SFD_CLOEXEC)) == -1) {
+        Log_errno(LOG_FATAL, errno, "Can't create signalfd");
+        return false;
+    }
+
+    Socket_raiseFileLimit();
 
-#define THREAD_MAX                      2
+    if ((shards = (Shard *) calloc(numShards, sizeof(Shard))) == NULL) {
+        Log_errno(LOG_FATAL, errno, "Can't allocate shards");
+        close(signalfd_);
+        return false;
+    }
 
-#define RETURN_ON_ERROR(stat, str)      if (stat < 0) { \
-                                            Log_errno(LOG_ERROR, errno, str); \
-                                            if (listenfd >= 0) close(listenfd); \
-                                            return false; \
-                                        }
+    /* workers and shards inherit the blocked signals */
+    if ((pool = ThreadPool_new(CONFIG_WORKER_THREADS, CONFIG_WORKER_QUEUE_MAX)) == NULL) {
+        free(shards);
+        close(signalfd_);
+        return false;
+    }
 
+    /* client host names for the log, without one the numeric address is logged */
+    resolver = Resolver_new(CONFIG_RESOLVER_THREADS, CONFIG_RESOLVER_CACHE, CONFIG_RESOLVER_QUEUE, CONFIG_RESOLVER_TTL);
+
+    for (numStarted = 0; numStarted < numShards; numStarted++) {
+        shards[numStarted].idx = numStarted;
+
+        if (!EchoServer_createShard(&(shards[numStarted]), addrinfo, numShards > 1)) {
+            EchoServer_deleteShard(&(shards[numStarted]));
+            break;
+        }
 
-typedef struct _WorkerInfo {
-    struct sockaddr    *client_addr;
-    socklen_t           client_addrlen;
-    int                 connectfd;
-} WorkerInfo;
+        if ((status = pthread_create(&(shards[numStarted].tid), NULL, EchoServer_shardThread, &(shards[numStarted])))) {
+            Log_println(LOG_ERROR, "Can't create shard thread: error = %d", status);
+            EchoServer_deleteShard(&(shards[numStarted]));
+            break;
+        }
+    }
 
-static bool EchoServer_installSignal(int signum, void (*sighandler) (int, siginfo_t *, void *));
-static void EchoServer_sigint(int signal, siginfo_t *siginfo, void *context);
-static uint8_t EchoServer_select(int socket);
-static void *EchoServer_protocolThread(void *arg);
-static void *EchoServer_workerThread(void *arg);
+    Log_println(LOG_INFO, "%u of %u shard(s) running", numStarted, numShards);
 
-bool                running;
-pthread_mutex_t     mutex_running = PTHREAD_MUTEX_INITIALIZER;
+    /* run until SIGINT or SIGTERM */
+    if (numStarted > 0) {
+        while (read(signalfd_, &siginfo, sizeof(siginfo)) != sizeof(siginfo)) {
+            if (errno != EINTR) {
+                Log_errno(LOG_ERROR, errno, "Can't read signalfd");
+                break;
+            }
+        }
+        Log_println(LOG_DEBUG, "Received signal %s", strsignal(siginfo.ssi_signo));
+    }
 
-bool
-EchoServer_create(struct addrinfo *addrinfo)
+    for (idx = 0; idx < numStarted; idx++) {
+        EventLoop_stop(shards[idx].loop);
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        if ((status = pthread_join(shards[idx].tid, NULL))) {
+            Log_println(LOG_ERROR, "Can't join shard thread: error = %d", status);
+        }
+    }
+
+    /* finish queued work first, workers still re-arm their connections */
+    ThreadPool_delete(pool);
+
+    for (idx = 0; idx < numStarted; idx++) {
+        EchoServer_deleteShard(&(shards[idx]));
+    }
+
+    Resolver_delete(resolver);
+    free(shards);
+    close(signalfd_);
+
+    return numStarted > 0;
+}
+
+static bool
+EchoServer_createShard(Shard *shard, struct addrinfo *addrinfo, bool reuseport)
 {
-    pthread_t           tid[THREAD_MAX];
-    int                 idx;
-    int                 numThreads;
-    int                 status;
+    Listener           *listener;
+
+    pthread_mutex_init(&(shard->mutex), NULL);
+    shard->wakeup.fd = -1;
 
-    EchoServer_installSignal(SIGINT, EchoServer_sigint);
+    if ((shard->loop = EventLoop_new()) == NULL) {
+        return false;
+    }
 
-    running     = true;
-    numThreads  = 0;
+    shard->wakeup.callback = EchoServer_wakeupCallback;
+
+    if ((shard->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't create eventfd");
+        return false;
+    }
+
+    if (!EventLoop_add(shard->loop, &(shard->wakeup), EPOLLIN)) {
+        return false;
+    }
 
-    for (idx = 0; running && addrinfo != NULL; addrinfo = addrinfo->ai_next, idx++) {
+    for (; addrinfo != NULL; addrinfo = addrinfo->ai_next) {
 
         /* allow only IPv4 and IPv6 */
         if (addrinfo->ai_family != AF_INET && addrinfo->ai_family != AF_INET6) {
@@ -57,232 +251,657 @@ EchoServer_create(struct addrinfo *addrinfo)
             continue;
         }
 
-        if (idx >= THREAD_MAX) {
-            Log_println(LOG_ERROR, "Maximum number of threads (= %d) exceeds", THREAD_MAX);
+        if (shard->numListeners >= LISTENER_MAX) {
+            Log_println(LOG_ERROR, "Maximum number of listeners (= %d) exceeds", LISTENER_MAX);
             break;
         }
 
-        /* create new thread */
-        if ((status = pthread_create(&tid[idx], NULL, EchoServer_protocolThread, addrinfo))) {
-            Log_println(LOG_ERROR, "Can't create thread: error = %d", status);
-            break;
+        listener = &(shard->listener[shard->numListeners]);
+
+        if ((listener->handler.fd = Socket_listen(addrinfo, CONFIG_LISTEN_QUEUE, reuseport)) == -1) {
+            continue;
         }
 
-        numThreads++;
+        listener->handler.callback = EchoServer_acceptCallback;
+        listener->shard            = shard;
+        listener->family           = addrinfo->ai_family;
+
+        if (!EventLoop_add(shard->loop, &(listener->handler), EPOLLIN | EPOLLET)) {
+            close(listener->handler.fd);
+            continue;
+        }
+
+        shard->numListeners++;
+    }
+
+    return shard->numListeners > 0;
+}
+
+static void
+EchoServer_deleteShard(Shard *shard)
+{
+    int                 idx;
+
+    if (shard->numConnections > 0) {
+        Log_println(LOG_INFO, "Shard %u: close %u connection(s)", shard->idx, shard->numConnections);
+    }
+
+    /* the pool is gone, what workers left behind is closed but not served */
+    EchoServer_drain(shard, false);
+
+    while (shard->connections != NULL) {
+        shard->connections->closed = true;
+        EchoServer_unregister(shard->connections);
+    }
+
+    /* the loop doesn't run anymore */
+    EchoServer_drain(shard, false);
+
+    for (idx = 0; idx < shard->numListeners; idx++) {
+        close(shard->listener[idx].handler.fd);
+    }
+
+    if (shard->wakeup.fd != -1) {
+        close(shard->wakeup.fd);
     }
 
-    /* wait until all threads terminate */
+    EventLoop_delete(shard->loop);
+    pthread_mutex_destroy(&(shard->mutex));
+}
+
+static void *
+EchoServer_shardThread(void *arg)
+{
+    Shard              *shard = (Shard *) arg;
+
+    Log_println(LOG_DEBUG, "Shard %u: event loop started", shard->idx);
+
+    EventLoop_run(shard->loop);
 
-    for (idx = 0; idx < numThreads; idx++) {
-        if ((status = pthread_join(tid[idx], NULL))) {
-            Log_println(LOG_ERROR, "Can't join thread: error = %d", status);
+    return NULL;
+}
+
+/**
+ * edge-triggered: accept until the backlog is empty
+ */
+static void
+EchoServer_acceptCallback(EventHandler *handler, uint32_t events)
+{
+    Shard                  *shard = ((Listener *) handler)->shard;
+    Connection             *connection;
+    struct sockaddr_storage client_addr;
+    socklen_t               client_addrlen;
+    char                    host[NI_MAXHOST];
+    int                     connectfd;
+    int                     status;
+
+    for (;;) {
+        client_addrlen = sizeof(client_addr);
+        connectfd      = accept4(handler->fd, (struct sockaddr *) &client_addr, &client_addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (connectfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log_errno(LOG_ERROR, errno, "Can't accept connection");
+            }
+            return;
+        }
+
+        if ((connection = (Connection *) malloc(sizeof(Connection))) == NULL) {
+            Log_errno(LOG_ERROR, errno, "Can't allocate connection");
+            close(connectfd);
+            continue;
+        }
+
+        /* only ever touched by the one worker serving the connection */
+        connection->decoder          = MessageDecoder_new();
+        connection->output           = NULL;
+
+        if (connection->decoder == NULL) {
+            free(connection);
+            close(connectfd);
+            continue;
+        }
+
+        connection->handler.fd       = connectfd;
+        connection->handler.callback = EchoServer_connectionCallback;
+        connection->shard            = shard;
+        connection->finished         = false;
+        connection->closed           = false;
+        connection->registered       = true;
+        connection->events           = 0;
+        connection->scheduled        = 0;
+        connection->refs             = 1;
+        connection->pending          = 0;
+        connection->numOffloaded     = 0;
+        connection->offloadedLen     = 0;
+        connection->completed        = NULL;
+        connection->completedTail    = NULL;
+        connection->finish           = NULL;
+        pthread_mutex_init(&(connection->mutex), NULL);
+
+        /* numeric only, the host name is looked up by the resolver */
+        memcpy(&(connection->addr), &client_addr, sizeof(client_addr));
+        status = getnameinfo((struct sockaddr *) &client_addr, client_addrlen,
+                             connection->address, sizeof(connection->address),
+                             connection->port,    sizeof(connection->port),
+                             NI_NUMERICHOST | NI_NUMERICSERV);
+        if (status) {
+            Log_gai(LOG_ERROR, status, "can't resolve client address");
+            strcpy(connection->address, "?");
+            strcpy(connection->port,    "?");
+        }
+
+        pthread_mutex_lock(&(shard->mutex));
+        connection->prev = NULL;
+        connection->next = shard->connections;
+        if (shard->connections != NULL) {
+            shard->connections->prev = connection;
+        }
+        shard->connections = connection;
+        shard->numConnections++;
+        pthread_mutex_unlock(&(shard->mutex));
+
+        Log_println(LOG_DEBUG, "Shard %u: connection from client %s, port %s", shard->idx, EchoServer_host(connection, host, sizeof(host)), connection->port);
+
+        /* a worker may pick it up right away */
+        if (!EventLoop_add(shard->loop, &(connection->handler), CONNECTION_READ)) {
+            EchoServer_close(connection);
         }
     }
-    return true;
 }
 
-static bool
-EchoServer_installSignal(int signum, void (*sighandler) (int, siginfo_t *, void *))
+/**
+ * hand the connection over to the pool, blocks while the pool is full
+ */
+static void
+EchoServer_connectionCallback(EventHandler *handler, uint32_t events)
 {
-    struct sigaction signal;
+    Connection         *connection = (Connection *) handler;
 
-    bzero(&signal, sizeof(signal));
+    __atomic_or_fetch(&(connection->events), events, __ATOMIC_RELEASE);
 
-    /* set signal handler */
-    signal.sa_sigaction = sighandler;
+    EchoServer_schedule(connection);
+}
 
-    /* signal handler takes 3 arguments, not one */
-    signal.sa_flags = SA_SIGINFO;
+/**
+ * loop thread: work handed over by the workers
+ */
+static void
+EchoServer_wakeupCallback(EventHandler *handler, uint32_t events)
+{
+    Shard              *shard = (Shard *) ((char *) handler - offsetof(Shard, wakeup));
+    uint64_t            value;
 
-    Log_println(LOG_DEBUG, "Install SIGINT signal-handler");
-    if (sigaction(signum, &signal, NULL) == -1) {
-        Log_errno(LOG_FATAL, errno, "Couldn't set signal action");
-        return false;
+    if (read(handler->fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        Log_errno(LOG_ERROR, errno, "Can't read eventfd");
     }
 
-    return true;
+    EchoServer_drain(shard, true);
 }
 
+/**
+ * any thread: queue work for the shard's loop thread, the queue holds a reference
+ */
 static void
-EchoServer_sigint(int signal, siginfo_t *siginfo, void *context)
+EchoServer_wake(Connection *connection, uint32_t pending)
 {
-    Log_println(LOG_DEBUG, "SIGINT");
+    Shard              *shard = connection->shard;
+    uint64_t            value = 1;
+    bool                first = false;
+
+    pthread_mutex_lock(&(shard->mutex));
+    if (connection->pending == 0) {
+        __atomic_add_fetch(&(connection->refs), 1, __ATOMIC_RELAXED);
+        first               = (shard->pending == NULL);
+        connection->pendingNext = shard->pending;
+        shard->pending      = connection;
+    }
+    connection->pending |= pending;
+    pthread_mutex_unlock(&(shard->mutex));
 
-    pthread_mutex_lock(&mutex_running);
-    running = false;
-    pthread_mutex_unlock(&mutex_running);
+    if (first && write(shard->wakeup.fd, &value, sizeof(value)) != sizeof(value)) {
+        Log_errno(LOG_ERROR, errno, "Can't write eventfd");
+    }
 }
 
-static void *
-EchoServer_protocolThread(void *arg)
+/**
+ * loop thread (or shutdown): close and serve what the workers queued
+ *
+ * @param   serve                   false: the pool is gone, offloaded responses are dropped
+ */
+static void
+EchoServer_drain(Shard *shard, bool serve)
 {
-    struct addrinfo    *server_addrinfo = (struct addrinfo *) arg;
-    int                 listenfd;
-    int                 connectfd;
-    int                 status;
-    uint8_t             readyMask;
-    bool                local_running;
-    pthread_t           tid;
-    pthread_attr_t      attr;
-    WorkerInfo         *workerInfo;
-    //int                 num_bytes;
-    //char                buffer[64];
-    //int                 len;
-
-    /* create socket */
-    Log_println(LOG_INFO, "Create %s socket", Log_getFamily(server_addrinfo->ai_family));
-    listenfd = socket(server_addrinfo->ai_family, server_addrinfo->ai_socktype, 0);
-    RETURN_ON_ERROR(listenfd, "Can't create socket");
-
-    /* turn off IPv4 to IPv6 mapping */
-    if (server_addrinfo->ai_family == AF_INET6) {
-        int v6only = 1;
-        Log_println(LOG_INFO, "Turn off IPv4 to IPv6 mapping");
-        if (setsockopt(listenfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
-            Log_errno(LOG_ERROR, errno, "Can't set socket option IPV6_V6ONLY = 1");
-            return NULL;
+    Connection         *connection;
+    Connection         *next;
+    uint32_t            pending;
+
+    /* closed in an earlier batch, no event still to dispatch refers to them */
+    connection    = shard->buried;
+    shard->buried = NULL;
+
+    for (; connection != NULL; connection = next) {
+        next = connection->buriedNext;
+        EchoServer_release(connection);
+    }
+
+    pthread_mutex_lock(&(shard->mutex));
+    connection     = shard->pending;
+    shard->pending = NULL;
+    pthread_mutex_unlock(&(shard->mutex));
+
+    for (; connection != NULL; connection = next) {
+        pthread_mutex_lock(&(shard->mutex));
+        next                = connection->pendingNext;
+        pending             = connection->pending;
+        connection->pending = 0;
+        pthread_mutex_unlock(&(shard->mutex));
+
+        if (pending & CONNECTION_PENDING_CLOSE) {
+            EchoServer_unregister(connection);
+        }
+
+        /* a worker collects the responses, or drops them if closed */
+        if (serve && (pending & CONNECTION_PENDING_SERVE)) {
+            EchoServer_schedule(connection);
         }
+
+        /* the queue's reference */
+        EchoServer_release(connection);
+    }
+}
+
+/**
+ * loop thread: request a round of EchoServer_work, the first request starts
+ * a worker which also serves all requests arriving while it runs,
+ * blocks while the pool is full
+ */
+static void
+EchoServer_schedule(Connection *connection)
+{
+    if (__atomic_fetch_add(&(connection->scheduled), 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
     }
 
-    /* bind address to socket */
-    Log_println(LOG_INFO, "Bind address to socket");
-    status = bind(listenfd, server_addrinfo->ai_addr, server_addrinfo->ai_addrlen);
-    RETURN_ON_ERROR(status, "Can't bind address to socket");
+    /* the serving worker's reference */
+    __atomic_add_fetch(&(connection->refs), 1, __ATOMIC_RELAXED);
 
-    /* set to passive socket */
-    Log_println(LOG_INFO, "Set to passive socket");
-    status = listen(listenfd, CONFIG_LISTEN_QUEUE);
-    RETURN_ON_ERROR(status, "Can't set to passive socket");
+    if (!ThreadPool_submit(pool, EchoServer_serve, connection)) {
+        EchoServer_close(connection);
+        EchoServer_release(connection);
+    }
+}
+
+/**
+ * worker thread: the only one serving the connection until all requests are handled
+ */
+static void
+EchoServer_serve(void *arg)
+{
+    Connection         *connection = (Connection *) arg;
+    uint32_t            scheduled;
 
     do {
-        readyMask = EchoServer_select(listenfd);
+        scheduled = __atomic_load_n(&(connection->scheduled), __ATOMIC_ACQUIRE);
+        EchoServer_work(connection);
+    } while (__atomic_sub_fetch(&(connection->scheduled), scheduled, __ATOMIC_ACQ_REL) > 0);
+
+    EchoServer_release(connection);
+}
 
-        if (readyMask & ECHO_SERVER_SOCKET) {
-            /* Initialize and set thread detached attribute */
-            pthread_attr_init(&attr);
-            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+/**
+ * the connection is disabled in epoll until it's re-armed here
+ */
+static void
+EchoServer_work(Connection *connection)
+{
+    uint32_t            events;
 
-            workerInfo                  = (WorkerInfo *) malloc(sizeof(WorkerInfo));
-            workerInfo->client_addr     = malloc(server_addrinfo->ai_addrlen);
-            workerInfo->client_addrlen  = server_addrinfo->ai_addrlen;
+    /* offloaded requests still complete after a close */
+    if (connection->closed) {
+        EchoServer_collect(connection);
+        return;
+    }
 
-            connectfd = accept(listenfd, workerInfo->client_addr, &(workerInfo->client_addrlen));
+    events = __atomic_exchange_n(&(connection->events), 0, __ATOMIC_ACQUIRE);
 
-            workerInfo->connectfd = connectfd;
+    if (events & EPOLLERR) {
+        EchoServer_close(connection);
+        return;
+    }
 
-            pthread_create(&tid, &attr, EchoServer_workerThread, workerInfo);
+    /* queue the offloaded responses and send what's left over, then continue reading */
+    if (!EchoServer_collect(connection) || !EchoServer_flush(connection) || !EchoServer_receive(connection)) {
+        EchoServer_close(connection);
+        return;
+    }
+
+    if (connection->output != NULL && RingBuffer_canRead(connection->output)) {
+        events = CONNECTION_WRITE;
+    } else if (connection->finished && connection->numOffloaded == 0) {
+        /* every response to REQUEST_FINISH is sent */
+        EchoServer_close(connection);
+        return;
+    } else if (connection->finished || EchoServer_outputFree(connection) < OUTPUT_RESERVE + connection->offloadedLen) {
+        /* woken up by the offloaded requests */
+        events = CONNECTION_EVENTS;
+    } else {
+        events = CONNECTION_READ;
+    }
 
-            pthread_attr_destroy(&attr);
+    if (!EventLoop_modify(connection->shard->loop, &(connection->handler), events)) {
+        EchoServer_close(connection);
+    }
+}
+
+/**
+ * read until the socket would block or the peer can't keep up
+ *
+ * @return                          false if the connection has to be closed
+ */
+static bool
+EchoServer_receive(Connection *connection)
+{
+    char                buffer[CONFIG_RECV_BUFFER_SIZE];
+    char                host[NI_MAXHOST];
+    ssize_t             num_bytes;
+
+    while (!connection->finished && EchoServer_outputFree(connection) >= OUTPUT_RESERVE + connection->offloadedLen) {
+        num_bytes = recv(connection->handler.fd, buffer, sizeof(buffer), 0);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't receive from client %s", EchoServer_host(connection, host, sizeof(host)));
+            return false;
         }
 
-        pthread_mutex_lock(&mutex_running);
-        local_running = running;
-        pthread_mutex_unlock(&mutex_running);
-    } while (local_running);
+        /* orderly shutdown */
+        if (num_bytes == 0) {
+            return false;
+        }
 
-    return NULL;
+        /* an idle connection doesn't hold it */
+        if (connection->output == NULL &&
+            (connection->output = RingBuffer_newWithFlags(CONFIG_SEND_BUFFER, RINGBUFFER_FLAG_SPSC)) == NULL) {
+            return false;
+        }
+
+        if (!EchoServer_process(connection, buffer, num_bytes) || !EchoServer_flush(connection)) {
+            return false;
+        }
+    }
+
+    /* stop reading, resumed after the next EPOLLOUT */
+    return true;
 }
 
-static uint8_t
-EchoServer_select(int socket)
+/**
+ * decode every complete request of the chunk, small requests are answered
+ * right away, big transforms run on the pool and are answered when done
+ */
+static bool
+EchoServer_process(Connection *connection, const char *data, uint32_t len)
 {
-    uint8_t             selected    = 0;    /* bit-field of selected sockets */
-    fd_set              readfds;            /* list of monitored file descriptors */
-    int                 numfds;             /* number of ready file descriptors */
-    int                 maxfd       = 0;    /* maximum socket used in select() */
-    struct timeval      tv = {              /* time structure used in select() */
-        .tv_sec  = CONFIG_SELECT_WAIT_SECS,
-        .tv_usec = CONFIG_SELECT_WAIT_USECS
-    };
-
-    FD_ZERO(&readfds);
-
-    /* add packet socket to monitored list */
-    FD_SET(socket, &readfds);
-    if (socket > maxfd) maxfd = socket;
-
-    /* you could add more socket file descriptors... */
-
-    /* wait until one or multiple "file descriptor(s)" are ready (returns immediately after ready)
-       or wait until time is up. Return value is number of ready
-       "file descriptors", 0 (time is up) or -1 (error) */
-    numfds = select(maxfd + 1, &readfds, NULL, NULL, &tv);
-    switch (numfds) {
-        /* error */
-        case -1:
-            Log_errno(LOG_ERROR, errno, "can't monitor socket");
-            break;
+    Message            *msg;
+    bool                replied;
 
-        /* time up */
-        case 0:
-            break;
+    while (!connection->finished && (msg = MessageDecoder_feed(connection->decoder, &data, &len)) != NULL) {
+        Log_trace(LOG_DEBUG, "Request %u: type = %u, len = %u, client port %s", msg->nr, msg->header.type, msg->header.len, connection->port);
 
-        /* fd ready */
-        default:
-            if (FD_ISSET(socket, &readfds)) selected |= ECHO_SERVER_SOCKET;
-            /* you could check if more socket file descriptors are ready ... */
-            break;
+        if (msg->header.len >= CONFIG_OFFLOAD_MIN &&
+            (msg->header.type == REQUEST_TO_UPPER || msg->header.type == REQUEST_TO_LOWER)) {
+
+            msg->owner = connection;
+            __atomic_add_fetch(&(connection->refs), 1, __ATOMIC_RELAXED);
+
+            if (ThreadPool_trySubmit(pool, EchoServer_transform, msg)) {
+                connection->numOffloaded++;
+                connection->offloadedLen += MESSAGE_HEADER_LEN + msg->header.len;
+                continue;
+            }
+
+            /* pool is full, answer it here */
+            __atomic_sub_fetch(&(connection->refs), 1, __ATOMIC_RELAXED);
+        }
+
+        if (!Message_reply(msg)) {
+            Message_unref(msg);
+            return false;
+        }
+
+        /* the last response, unless offloaded ones are still running */
+        if (msg->header.type == RESPONSE_FINISH) {
+            connection->finished = true;
+            if (connection->numOffloaded > 0) {
+                connection->finish = msg;
+                break;
+            }
+        }
+
+        replied = Message_encode(connection->output, msg) != NULL;
+        Message_unref(msg);
+
+        if (!replied) {
+            return false;
+        }
     }
 
-    return selected;
+    return connection->decoder->state != MESSAGE_DECODER_FAILED;
 }
 
-static void *
-EchoServer_workerThread(void *arg)
+/**
+ * pool job: transform an offloaded request, the loop thread schedules the connection
+ */
+static void
+EchoServer_transform(void *arg)
 {
-    WorkerInfo         *workerInfo = (WorkerInfo *) arg;
+    Message            *msg        = (Message *) arg;
+    Connection         *connection = (Connection *) msg->owner;
 
-    char                host_str[NI_MAXHOST];
-    char                ip_address_str[NI_MAXHOST];
-    char                service_str[NI_MAXSERV];
-    char                port_str[NI_MAXSERV];
-    int                 status;
+    Message_reply(msg);
 
-    status = getnameinfo(workerInfo->client_addr, workerInfo->client_addrlen, host_str, sizeof(host_str), service_str, sizeof(service_str), 0);
-    if (status) {
-        Log_gai(LOG_ERROR, status, "can't resolve client address");
-        return NULL;
+    pthread_mutex_lock(&(connection->mutex));
+    msg->next = NULL;
+    if (connection->completedTail != NULL) {
+        connection->completedTail->next = msg;
+    } else {
+        connection->completed = msg;
     }
+    connection->completedTail = msg;
+    pthread_mutex_unlock(&(connection->mutex));
+
+    EchoServer_wake(connection, CONNECTION_PENDING_SERVE);
+    EchoServer_release(connection);
+}
+
+/**
+ * queue the responses of completed offloaded requests (dropped if closed),
+ * RESPONSE_FINISH follows the last of them
+ */
+static bool
+EchoServer_collect(Connection *connection)
+{
+    Message            *msg;
+    Message            *next;
+    bool                result = true;
+
+    pthread_mutex_lock(&(connection->mutex));
+    msg                       = connection->completed;
+    connection->completed     = NULL;
+    connection->completedTail = NULL;
+    pthread_mutex_unlock(&(connection->mutex));
+
+    for (; msg != NULL; msg = next) {
+        next = msg->next;
+
+        connection->numOffloaded--;
+        connection->offloadedLen -= MESSAGE_HEADER_LEN + msg->header.len;
 
-    status = getnameinfo(workerInfo->client_addr, workerInfo->client_addrlen, ip_address_str, sizeof(ip_address_str), port_str, sizeof(port_str), NI_NUMERICHOST | NI_NUMERICSERV);
-    if (status) {
-        Log_gai(LOG_ERROR, status, "can't resolve client address");
-        return NULL;
+        if (result && !connection->closed && Message_encode(connection->output, msg) == NULL) {
+            result = false;
+        }
+        Message_unref(msg);
     }
 
-    Log_println(LOG_DEBUG, "Connection from client %s (%s), service %s (%s)", host_str, ip_address_str, service_str, port_str);
+    /* the last response */
+    if (connection->finish != NULL && connection->numOffloaded == 0) {
+        if (result && !connection->closed && Message_encode(connection->output, connection->finish) == NULL) {
+            result = false;
+        }
+        Message_unref(connection->finish);
+        connection->finish = NULL;
+    }
 
-    Log_println(LOG_DEBUG, "Connection from client %s (%s), service %s (%s)", host_str, ip_address_str, service_str, port_str);
+    return result;
+}
 
-    close(workerInfo->connectfd);
+/**
+ * send as much as possible, keep the rest until the socket is writable again
+ */
+static bool
+EchoServer_flush(Connection *connection)
+{
+    const char         *span;
+    uint32_t            len;
+    char                host[NI_MAXHOST];
+    ssize_t             num_bytes;
 
-    /* receives a raw message and copies it to a structured message */
-    CharsReceived = recv(CommunicationSocket, Buffer, sizeof(Buffer), 0);
-    while (CharsReceived > 0) {
-        Buffer[CharsReceived] = 0;
-        fprintf(stdout,"%s", Buffer);
-        CharsReceived = recv(CommunicationSocket, Buffer, sizeof(Buffer), 0);
+    if (connection->output == NULL) {
+        return true;
     }
 
+    for (;;) {
+        len = 1;
+        if ((span = RingBuffer_readableSpan(connection->output, &len)) == NULL) {
+            return true;
+        }
 
-    /*
-    n = recv(ConnectedSocket, Buffer, sizeof(Buffer), 0);
-    while (n > 0) {
-        Buffer[n] = 0;
-        fprintf(stdout,"%d> %s", Visits, Buffer);
-        n = recv(ListeningSocket, Buffer, sizeof(Buffer), 0);
+        num_bytes = send(connection->handler.fd, span, len, MSG_NOSIGNAL);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't send to client %s", EchoServer_host(connection, host, sizeof(host)));
+            return false;
+        }
+
+        RingBuffer_consume(connection->output, (uint32_t) num_bytes);
     }
+}
 
-    sprintf(Buffer, "%d. Verbindung von Node %s, Port %d\n", Visits, inet_ntop(AF_INET6, &(ClientAddr.sin6_addr), AddressBuffer, INET6_ADDRSTRLEN), ClientAddr.sin6_port);
+/**
+ * free bytes of the output, all of them before the first request allocates it
+ */
+static uint32_t
+EchoServer_outputFree(Connection *connection)
+{
+    if (connection->output == NULL) {
+        return (1u << CONFIG_SEND_BUFFER) - 1;
+    }
 
-    Status = send(ConnectedSocket, Buffer, strlen(Buffer), 0);
-    ExitOnError(Status, "send fehlgeschlagen: ", strerror(errno));
+    return RingBuffer_getFree(connection->output);
+}
 
-    Status = close(ConnectedSocket);
-    ExitOnError(Status, "close fehlgeschlagen: ", strerror(errno));
+/**
+ * called by the serving worker (or by the loop thread when no worker is),
+ * the socket is closed on the loop thread, its events may still be dispatched
+ */
+static void
+EchoServer_close(Connection *connection)
+{
+    char                host[NI_MAXHOST];
 
-*/
+    if (connection->closed) {
+        return;
+    }
 
-    return NULL;
+    Log_println(LOG_DEBUG, "Close connection from client %s, port %s", EchoServer_host(connection, host, sizeof(host)), connection->port);
+
+    connection->closed = true;
+    EchoServer_wake(connection, CONNECTION_PENDING_CLOSE);
+}
+
+/**
+ * loop thread (or shutdown): the registration's reference is released
+ * after the current batch of events, which may still refer to it
+ */
+static void
+EchoServer_unregister(Connection *connection)
+{
+    Shard              *shard = connection->shard;
+    uint64_t            value = 1;
+
+    if (!connection->registered) {
+        return;
+    }
+    connection->registered = false;
+
+    /* close() removes the fd from the epoll instance */
+    close(connection->handler.fd);
+
+    pthread_mutex_lock(&(shard->mutex));
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        shard->connections = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->prev = connection->prev;
+    }
+    shard->numConnections--;
+    pthread_mutex_unlock(&(shard->mutex));
+
+    /* the registration's reference, the next wakeup releases it */
+    connection->buriedNext = shard->buried;
+    shard->buried          = connection;
+
+    if (write(shard->wakeup.fd, &value, sizeof(value)) != sizeof(value)) {
+        Log_errno(LOG_ERROR, errno, "Can't write eventfd");
+    }
 }
 
+static void
+EchoServer_release(Connection *connection)
+{
+    Message            *msg;
+
+    if (__atomic_sub_fetch(&(connection->refs), 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    while ((msg = connection->completed) != NULL) {
+        connection->completed = msg->next;
+        Message_unref(msg);
+    }
+    Message_unref(connection->finish);
+
+    pthread_mutex_destroy(&(connection->mutex));
+    MessageDecoder_delete(connection->decoder);
+    RingBuffer_delete(connection->output);
+    free(connection);
+}
+
+/**
+ * the client's host name once it's resolved, the numeric address until then
+ */
+static const char *
+EchoServer_host(Connection *connection, char *host, size_t len)
+{
+    if (Resolver_lookup(resolver, (struct sockaddr *) &(connection->addr), host, len)) {
+        return host;
+    }
+
+    return connection->address;
+}
@@ -0,0 +1,829 @@
+#define _GNU_SOURCE
+
+#include "EchoServer.h"
+#include "MessageDecoder.h"
+#include "RingBuffer.h"
+#include "IoUring.h"
+#include "Socket.h"
+#include "Resolver.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#define LISTENER_MAX                    2
+
+/* operation in the low bits of user_data, all objects are 8-byte aligned */
+#define OP_ACCEPT                       0
+#define OP_RECV                         1
+#define OP_SEND                         2
+#define OP_STOP                         3
+#define OP_MASK                         7
+
+#define USER_DATA(ptr, op)              ((uint64_t) (uintptr_t) (ptr) | (op))
+#define USER_PTR(data)                  ((void *) (uintptr_t) ((data) & ~(uint64_t) OP_MASK))
+#define USER_OP(data)                   ((uint32_t) ((data) & OP_MASK))
+
+#define BUFFER_NONE                     -1
+
+/* room for the responses to one received buffer: a message started in an earlier buffer plus the buffer itself */
+#define OUTPUT_RESERVE                  (CONFIG_RECV_BUFFER_SIZE + MESSAGE_HEADER_LEN + UINT16_MAX)
+
+typedef struct _Shard Shard;
+
+typedef struct _Listener {
+    Shard              *shard;                  /**< owning shard */
+    int                 fd;                     /**< listening socket */
+} Listener;
+
+/**
+ * received buffers are queued by buffer id until there is room for their
+ * responses, they go back to the kernel as soon as they are decoded
+ */
+typedef struct _Connection {
+    Shard              *shard;                  /**< shard which accepted it */
+    int                 fd;                     /**< connected socket */
+    struct _Connection *prev;                   /**< list of open connections */
+    struct _Connection *next;
+    struct _Connection *nextStarved;            /**< waits for free buffers */
+    uint32_t            refs;                   /**< operations in flight */
+    bool                receiving;              /**< multishot recv armed */
+    bool                starved;
+    bool                closing;
+    uint32_t            numSending;             /**< linked sends of the output in flight */
+    bool                finished;               /**< REQUEST_FINISH received, close when sent */
+    int32_t             head;                   /**< first queued buffer */
+    int32_t             tail;                   /**< last queued buffer */
+    MessageDecoder     *decoder;                /**< requests, resumed with every buffer */
+    RingBuffer         *output;                 /**< encoded responses which aren't sent yet, allocated with the first request */
+    struct sockaddr_storage addr;               /**< client address, key of its host name */
+    char                address[NI_MAXHOST];    /**< numeric client address */
+    char                port[NI_MAXSERV];       /**< numeric client port */
+} Connection;
+
+struct _Shard {
+    uint32_t            idx;
+    pthread_t           tid;
+    Listener            listener[LISTENER_MAX];
+    int                 numListeners;
+    int                 stopfd;                 /**< eventfd, written by the main thread */
+    uint64_t            stopValue;
+    bool                running;
+    IoUring            *ring;
+    IoUringBuffers     *buffers;                /**< provided receive buffers */
+    int32_t            *nextBuffer;             /**< queue links, indexed by buffer id */
+    uint32_t           *bufferLen;              /**< received length, indexed by buffer id */
+    Connection         *connections;
+    uint32_t            numConnections;
+    Connection         *starved;                /**< connections without armed recv */
+    bool                buffersFreed;           /**< given back since the last round */
+    uint32_t            numInFlight;            /**< submitted operations without their final completion */
+};
+
+static bool EchoServer_createShard(Shard *shard, struct addrinfo *addrinfo, bool reuseport);
+static void EchoServer_deleteShard(Shard *shard);
+static void *EchoServer_shardThread(void *arg);
+static void EchoServer_reap(Shard *shard);
+static bool EchoServer_drain(Shard *shard);
+static bool EchoServer_prepareAccept(Shard *shard, Listener *listener);
+static bool EchoServer_prepareStop(Shard *shard);
+static bool EchoServer_prepareRecv(Connection *connection);
+static bool EchoServer_prepareSend(Connection *connection);
+static void EchoServer_accepted(Listener *listener, struct io_uring_cqe *cqe);
+static void EchoServer_received(Connection *connection, struct io_uring_cqe *cqe);
+static void EchoServer_sent(Connection *connection, struct io_uring_cqe *cqe);
+static bool EchoServer_process(Connection *connection);
+static void EchoServer_putBuffer(Shard *shard, uint16_t bid);
+static void EchoServer_rearmStarved(Shard *shard);
+static void EchoServer_close(Connection *connection);
+static void EchoServer_release(Connection *connection);
+static const char *EchoServer_host(Connection *connection, char *host, size_t len);
+
+static Resolver        *resolver;
+
+bool
+EchoServer_create(struct addrinfo *addrinfo, uint32_t numShards)
+{
+    Shard                  *shards;
+    sigset_t                mask;
+    struct signalfd_siginfo siginfo;
+    int                     signalfd_;
+    uint32_t                numStarted;
+    uint32_t                idx;
+    uint64_t                value = 1;
+    int                     status;
+
+    if (numShards == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numShards  = (cores > 0) ? (uint32_t) cores : 1;
+    }
+
+    /* SIGINT and SIGTERM are only received through the signalfd */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+        Log_println(LOG_FATAL, "Can't block signals");
+        return false;
+    }
+
+    if ((signalfd_ = signalfd(-1, &mask, SFD_CLOEXEC)) == -1) {
+        Log_errno(LOG_FATAL, errno, "Can't create signalfd");
+        return false;
+    }
+
+    Socket_raiseFileLimit();
+
+    if ((shards = (Shard *) calloc(numShards, sizeof(Shard))) == NULL) {
+        Log_errno(LOG_FATAL, errno, "Can't allocate shards");
+        close(signalfd_);
+        return false;
+    }
+
+    /* client host names for the log, without one the numeric address is logged */
+    resolver = Resolver_new(CONFIG_RESOLVER_THREADS, CONFIG_RESOLVER_CACHE, CONFIG_RESOLVER_QUEUE, CONFIG_RESOLVER_TTL);
+
+    for (numStarted = 0; numStarted < numShards; numStarted++) {
+        shards[numStarted].idx = numStarted;
+
+        if (!EchoServer_createShard(&(shards[numStarted]), addrinfo, numShards > 1)) {
+            EchoServer_deleteShard(&(shards[numStarted]));
+            break;
+        }
+
+        if ((status = pthread_create(&(shards[numStarted].tid), NULL, EchoServer_shardThread, &(shards[numStarted])))) {
+            Log_println(LOG_ERROR, "Can't create shard thread: error = %d", status);
+            EchoServer_deleteShard(&(shards[numStarted]));
+            break;
+        }
+    }
+
+    Log_println(LOG_INFO, "%u of %u io_uring shard(s) running", numStarted, numShards);
+
+    /* run until SIGINT or SIGTERM */
+    if (numStarted > 0) {
+        while (read(signalfd_, &siginfo, sizeof(siginfo)) != sizeof(siginfo)) {
+            if (errno != EINTR) {
+                Log_errno(LOG_ERROR, errno, "Can't read signalfd");
+                break;
+            }
+        }
+        Log_println(LOG_DEBUG, "Received signal %s", strsignal(siginfo.ssi_signo));
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        if (write(shards[idx].stopfd, &value, sizeof(value)) != sizeof(value)) {
+            Log_errno(LOG_ERROR, errno, "Can't stop shard %u", idx);
+        }
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        if ((status = pthread_join(shards[idx].tid, NULL))) {
+            Log_println(LOG_ERROR, "Can't join shard thread: error = %d", status);
+        }
+        EchoServer_deleteShard(&(shards[idx]));
+    }
+
+    Resolver_delete(resolver);
+    free(shards);
+    close(signalfd_);
+
+    return numStarted > 0;
+}
+
+/**
+ * listening sockets are created up front, the ring belongs to the shard thread
+ */
+static bool
+EchoServer_createShard(Shard *shard, struct addrinfo *addrinfo, bool reuseport)
+{
+    Listener           *listener;
+
+    if ((shard->stopfd = eventfd(0, EFD_CLOEXEC)) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't create eventfd");
+        return false;
+    }
+
+    for (; addrinfo != NULL; addrinfo = addrinfo->ai_next) {
+
+        /* allow only IPv4 and IPv6 */
+        if (addrinfo->ai_family != AF_INET && addrinfo->ai_family != AF_INET6) {
+            Log_println(LOG_WARN, "Ignore family %d", addrinfo->ai_family);
+            continue;
+        }
+
+        if (shard->numListeners >= LISTENER_MAX) {
+            Log_println(LOG_ERROR, "Maximum number of listeners (= %d) exceeds", LISTENER_MAX);
+            break;
+        }
+
+        listener = &(shard->listener[shard->numListeners]);
+
+        if ((listener->fd = Socket_listen(addrinfo, CONFIG_LISTEN_QUEUE, reuseport)) == -1) {
+            continue;
+        }
+
+        listener->shard = shard;
+        shard->numListeners++;
+    }
+
+    return shard->numListeners > 0;
+}
+
+static void
+EchoServer_deleteShard(Shard *shard)
+{
+    Connection         *connection;
+    int                 idx;
+
+    if (shard->numConnections > 0) {
+        Log_println(LOG_INFO, "Shard %u: close %u connection(s)", shard->idx, shard->numConnections);
+    }
+
+    /* the ring is gone, nothing is in flight anymore */
+    while ((connection = shard->connections) != NULL) {
+        shard->connections = connection->next;
+        close(connection->fd);
+        MessageDecoder_delete(connection->decoder);
+        RingBuffer_delete(connection->output);
+        free(connection);
+    }
+
+    for (idx = 0; idx < shard->numListeners; idx++) {
+        close(shard->listener[idx].fd);
+    }
+
+    if (shard->stopfd > 0) {
+        close(shard->stopfd);
+    }
+}
+
+static void *
+EchoServer_shardThread(void *arg)
+{
+    Shard                  *shard = (Shard *) arg;
+    int                     idx;
+
+    /* created here: the ring is bound to its submitting thread */
+    shard->ring = IoUring_new(CONFIG_URING_ENTRIES);
+    if (shard->ring != NULL) {
+        shard->buffers    = IoUringBuffers_new(shard->ring, 0, CONFIG_URING_BUFFERS, CONFIG_RECV_BUFFER_SIZE);
+        shard->nextBuffer = (int32_t *)  malloc(CONFIG_URING_BUFFERS * sizeof(int32_t));
+        shard->bufferLen  = (uint32_t *) malloc(CONFIG_URING_BUFFERS * sizeof(uint32_t));
+    }
+
+    if (shard->ring == NULL || shard->buffers == NULL || shard->nextBuffer == NULL || shard->bufferLen == NULL) {
+        Log_println(LOG_FATAL, "Shard %u: can't start io_uring engine", shard->idx);
+        kill(getpid(), SIGTERM);
+        goto EchoServer_shardThreadExit;
+    }
+
+    shard->running = EchoServer_prepareStop(shard);
+
+    for (idx = 0; idx < shard->numListeners; idx++) {
+        EchoServer_prepareAccept(shard, &(shard->listener[idx]));
+    }
+
+    Log_println(LOG_DEBUG, "Shard %u: io_uring engine started", shard->idx);
+
+    /* a single system call per round submits everything and reaps completions */
+    while (shard->running) {
+        if (IoUring_submitAndWait(shard->ring, 1) < 0 && errno != EAGAIN && errno != EBUSY) {
+            break;
+        }
+
+        EchoServer_reap(shard);
+
+        if (shard->starved != NULL) {
+            EchoServer_rearmStarved(shard);
+        }
+    }
+
+EchoServer_shardThreadExit:
+    /* the kernel writes into the receive buffers as long as a recv is in flight */
+    if (EchoServer_drain(shard)) {
+        IoUringBuffers_delete(shard->buffers, shard->ring);
+    } else {
+        Log_println(LOG_WARN, "Shard %u: %u operation(s) still in flight, receive buffers are kept", shard->idx, shard->numInFlight);
+    }
+    IoUring_delete(shard->ring);
+    free(shard->bufferLen);
+    free(shard->nextBuffer);
+
+    return NULL;
+}
+
+static void
+EchoServer_reap(Shard *shard)
+{
+    struct io_uring_cqe    *cqe;
+
+    while ((cqe = IoUring_peekCqe(shard->ring)) != NULL) {
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            shard->numInFlight--;
+        }
+
+        switch (USER_OP(cqe->user_data)) {
+            case OP_ACCEPT: EchoServer_accepted((Listener *)   USER_PTR(cqe->user_data), cqe); break;
+            case OP_RECV:   EchoServer_received((Connection *) USER_PTR(cqe->user_data), cqe); break;
+            case OP_SEND:   EchoServer_sent((Connection *)     USER_PTR(cqe->user_data), cqe); break;
+            case OP_STOP:   shard->running = false;                                            break;
+        }
+        IoUring_seenCqe(shard->ring);
+    }
+}
+
+/**
+ * shut the listeners and connections down and reap until nothing is in flight anymore
+ *
+ * @return                          false if operations are left, e.g. io_uring_enter failed
+ */
+static bool
+EchoServer_drain(Shard *shard)
+{
+    Connection             *connection;
+    uint64_t                value = 1;
+    int                     idx;
+
+    if (shard->ring == NULL) {
+        return true;
+    }
+
+    shard->running = false;
+
+    /* ends the multishot accepts and the stop read, if it's still armed */
+    for (idx = 0; idx < shard->numListeners; idx++) {
+        shutdown(shard->listener[idx].fd, SHUT_RDWR);
+    }
+    if (write(shard->stopfd, &value, sizeof(value)) != sizeof(value)) {
+        Log_errno(LOG_ERROR, errno, "Can't stop shard %u", shard->idx);
+    }
+
+    for (connection = shard->connections; connection != NULL; connection = connection->next) {
+        EchoServer_close(connection);
+    }
+
+    while (true) {
+        /* releases the closed ones */
+        if (shard->starved != NULL) {
+            EchoServer_rearmStarved(shard);
+        }
+
+        if (shard->numInFlight == 0) {
+            return true;
+        }
+
+        if (IoUring_submitAndWait(shard->ring, 1) < 0 && errno != EAGAIN && errno != EBUSY) {
+            return false;
+        }
+
+        EchoServer_reap(shard);
+    }
+}
+
+static bool
+EchoServer_prepareAccept(Shard *shard, Listener *listener)
+{
+    struct io_uring_sqe    *sqe;
+
+    if ((sqe = IoUring_getSqe(shard->ring)) == NULL) {
+        return false;
+    }
+
+    /* one submission for all incoming connections */
+    sqe->opcode         = IORING_OP_ACCEPT;
+    sqe->fd             = listener->fd;
+    sqe->ioprio         = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags   = SOCK_CLOEXEC;
+    sqe->user_data      = USER_DATA(listener, OP_ACCEPT);
+
+    shard->numInFlight++;
+
+    return true;
+}
+
+static bool
+EchoServer_prepareStop(Shard *shard)
+{
+    struct io_uring_sqe    *sqe;
+
+    if ((sqe = IoUring_getSqe(shard->ring)) == NULL) {
+        return false;
+    }
+
+    sqe->opcode         = IORING_OP_READ;
+    sqe->fd             = shard->stopfd;
+    sqe->addr           = (uint64_t) (uintptr_t) &(shard->stopValue);
+    sqe->len            = sizeof(shard->stopValue);
+    sqe->user_data      = USER_DATA(shard, OP_STOP);
+
+    shard->numInFlight++;
+
+    return true;
+}
+
+static bool
+EchoServer_prepareRecv(Connection *connection)
+{
+    struct io_uring_sqe    *sqe;
+
+    if ((sqe = IoUring_getSqe(connection->shard->ring)) == NULL) {
+        return false;
+    }
+
+    /* the kernel picks a buffer from the group for every chunk */
+    sqe->opcode         = IORING_OP_RECV;
+    sqe->fd             = connection->fd;
+    sqe->ioprio         = IORING_RECV_MULTISHOT;
+    sqe->flags          = IOSQE_BUFFER_SELECT;
+    sqe->buf_group      = connection->shard->buffers->bgid;
+    sqe->user_data      = USER_DATA(connection, OP_RECV);
+
+    connection->receiving = true;
+    connection->refs++;
+    connection->shard->numInFlight++;
+
+    return true;
+}
+
+/**
+ * send the output, a wrapped one as a chain of two linked sends: the link keeps
+ * them in order, MSG_WAITALL breaks it if the first one falls short
+ */
+static bool
+EchoServer_prepareSend(Connection *connection)
+{
+    Shard                  *shard = connection->shard;
+    struct io_uring_sqe    *sqe = NULL;
+    struct io_uring_sqe    *prev;
+    char                   *span[2];
+    uint32_t                len[2];
+    uint32_t                offset = 0;
+    uint32_t                num;
+    uint32_t                idx;
+
+    for (num = 0; num < 2; num++) {
+        len[num] = 1;
+        if ((span[num] = RingBuffer_readableSpanAt(connection->output, offset, &(len[num]))) == NULL) {
+            break;
+        }
+        offset += len[num];
+    }
+
+    if (num == 0) {
+        return true;
+    }
+
+    if (!IoUring_reserve(shard->ring, num)) {
+        return false;
+    }
+
+    for (idx = 0; idx < num; idx++) {
+        prev = sqe;
+        if ((sqe = IoUring_getSqe(shard->ring)) == NULL) {
+            /* the queued send mustn't link to whatever is prepared next */
+            if (prev != NULL) {
+                prev->flags &= ~IOSQE_IO_LINK;
+            }
+            return false;
+        }
+
+        sqe->opcode     = IORING_OP_SEND;
+        sqe->fd         = connection->fd;
+        sqe->addr       = (uint64_t) (uintptr_t) span[idx];
+        sqe->len        = len[idx];
+        sqe->msg_flags  = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->flags      = (idx + 1 < num) ? IOSQE_IO_LINK : 0;
+        sqe->user_data  = USER_DATA(connection, OP_SEND);
+
+        connection->numSending++;
+        connection->refs++;
+        shard->numInFlight++;
+    }
+
+    return true;
+}
+
+static void
+EchoServer_accepted(Listener *listener, struct io_uring_cqe *cqe)
+{
+    Shard                  *shard = listener->shard;
+    Connection             *connection;
+    socklen_t               client_addrlen = sizeof(struct sockaddr_storage);
+    char                    host[NI_MAXHOST];
+    int                     status;
+
+    /* multishot accept ended, e.g. out of file descriptors */
+    if (!(cqe->flags & IORING_CQE_F_MORE) && shard->running) {
+        EchoServer_prepareAccept(shard, listener);
+    }
+
+    if (cqe->res < 0) {
+        if (shard->running) {
+            Log_errno(LOG_ERROR, -cqe->res, "Can't accept connection");
+        }
+        return;
+    }
+
+    /* draining */
+    if (!shard->running) {
+        close(cqe->res);
+        return;
+    }
+
+    if ((connection = (Connection *) calloc(1, sizeof(Connection))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate connection");
+        close(cqe->res);
+        return;
+    }
+
+    connection->shard   = shard;
+    connection->fd      = cqe->res;
+    connection->head    = BUFFER_NONE;
+    connection->tail    = BUFFER_NONE;
+    connection->decoder = MessageDecoder_new();
+
+    if (connection->decoder == NULL) {
+        free(connection);
+        close(cqe->res);
+        return;
+    }
+
+    /* numeric only, the host name is looked up by the resolver */
+    if (getpeername(connection->fd, (struct sockaddr *) &(connection->addr), &client_addrlen) == -1 ||
+        (status = getnameinfo((struct sockaddr *) &(connection->addr), client_addrlen,
+                               connection->address, sizeof(connection->address),
+                               connection->port,    sizeof(connection->port),
+                               NI_NUMERICHOST | NI_NUMERICSERV)) != 0) {
+        strcpy(connection->address, "?");
+        strcpy(connection->port,    "?");
+    }
+
+    connection->next = shard->connections;
+    if (shard->connections != NULL) {
+        shard->connections->prev = connection;
+    }
+    shard->connections = connection;
+    shard->numConnections++;
+
+    Log_println(LOG_DEBUG, "Shard %u: connection from client %s, port %s", shard->idx, EchoServer_host(connection, host, sizeof(host)), connection->port);
+
+    if (!EchoServer_prepareRecv(connection)) {
+        EchoServer_close(connection);
+        EchoServer_release(connection);
+    }
+}
+
+static void
+EchoServer_received(Connection *connection, struct io_uring_cqe *cqe)
+{
+    Shard                  *shard = connection->shard;
+    char                    host[NI_MAXHOST];
+    uint16_t                bid;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+        if (cqe->res <= 0 || connection->closing || connection->finished) {
+            EchoServer_putBuffer(shard, bid);
+        } else {
+            /* append to the receive queue */
+            shard->bufferLen[bid]  = (uint32_t) cqe->res;
+            shard->nextBuffer[bid] = BUFFER_NONE;
+            if (connection->tail != BUFFER_NONE) {
+                shard->nextBuffer[connection->tail] = bid;
+            } else {
+                connection->head = bid;
+            }
+            connection->tail = bid;
+
+            if (!EchoServer_process(connection)) {
+                EchoServer_close(connection);
+            }
+        }
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        connection->receiving = false;
+        connection->refs--;
+
+        if (cqe->res == -ENOBUFS && !connection->closing) {
+            /* all buffers in use, re-armed as soon as one is given back */
+            connection->starved     = true;
+            connection->nextStarved = shard->starved;
+            shard->starved          = connection;
+        } else if (cqe->res > 0 && !connection->closing) {
+            if (!EchoServer_prepareRecv(connection)) {
+                EchoServer_close(connection);
+            }
+        }
+    }
+
+    /* orderly shutdown or error */
+    if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS)) {
+        if (cqe->res < 0 && cqe->res != -ECONNRESET && cqe->res != -ECANCELED) {
+            Log_errno(LOG_ERROR, -cqe->res, "Can't receive from client %s", EchoServer_host(connection, host, sizeof(host)));
+        }
+        EchoServer_close(connection);
+    }
+
+    EchoServer_release(connection);
+}
+
+static void
+EchoServer_sent(Connection *connection, struct io_uring_cqe *cqe)
+{
+    char                    host[NI_MAXHOST];
+
+    connection->numSending--;
+    connection->refs--;
+
+    if (cqe->res == -ECANCELED) {
+        /* the first send of the chain fell short, its rest and this span are sent again */
+    } else if (cqe->res < 0) {
+        if (cqe->res != -EPIPE && cqe->res != -ECONNRESET) {
+            Log_errno(LOG_ERROR, -cqe->res, "Can't send to client %s", EchoServer_host(connection, host, sizeof(host)));
+        }
+        EchoServer_close(connection);
+    } else {
+        /* a short send continues with the rest */
+        RingBuffer_consume(connection->output, (uint32_t) cqe->res);
+    }
+
+    if (!connection->closing && !EchoServer_process(connection)) {
+        EchoServer_close(connection);
+    }
+
+    EchoServer_release(connection);
+}
+
+/**
+ * decode queued buffers while their responses fit into the output, give the
+ * buffers back and send the output. Closes after the response to REQUEST_FINISH.
+ *
+ * @return                          false if the connection has to be closed
+ */
+static bool
+EchoServer_process(Connection *connection)
+{
+    Shard                  *shard = connection->shard;
+    Message                *msg;
+    const char             *data;
+    uint32_t                len;
+    int32_t                 bid;
+    bool                    replied;
+
+    /* an idle connection doesn't hold it */
+    if (connection->output == NULL && connection->head != BUFFER_NONE &&
+        (connection->output = RingBuffer_newWithFlags(CONFIG_SEND_BUFFER, RINGBUFFER_FLAG_SPSC)) == NULL) {
+        return false;
+    }
+
+    while ((bid = connection->head) != BUFFER_NONE &&
+           (connection->finished || RingBuffer_getFree(connection->output) >= OUTPUT_RESERVE)) {
+
+        data = IoUringBuffers_get(shard->buffers, (uint16_t) bid);
+        len  = shard->bufferLen[bid];
+
+        while (!connection->finished && (msg = MessageDecoder_feed(connection->decoder, &data, &len)) != NULL) {
+            Log_trace(LOG_DEBUG, "Request %u: type = %u, len = %u, client port %s", msg->nr, msg->header.type, msg->header.len, connection->port);
+            replied              = Message_reply(msg) && Message_encode(connection->output, msg) != NULL;
+            connection->finished = (msg->header.type == RESPONSE_FINISH);
+            Message_unref(msg);
+
+            if (!replied) {
+                return false;
+            }
+        }
+
+        if (connection->decoder->state == MESSAGE_DECODER_FAILED) {
+            return false;
+        }
+
+        connection->head = shard->nextBuffer[bid];
+        if (connection->head == BUFFER_NONE) {
+            connection->tail = BUFFER_NONE;
+        }
+        EchoServer_putBuffer(shard, (uint16_t) bid);
+    }
+
+    if (connection->numSending > 0) {
+        return true;
+    }
+
+    if (connection->finished && !RingBuffer_canRead(connection->output)) {
+        return false;
+    }
+
+    return EchoServer_prepareSend(connection);
+}
+
+static void
+EchoServer_putBuffer(Shard *shard, uint16_t bid)
+{
+    IoUringBuffers_put(shard->buffers, bid);
+    shard->buffersFreed = true;
+}
+
+/**
+ * called between rounds: re-arm recv for connections which ran out of buffers
+ * once buffers have been given back, and release the closed ones. An armed recv
+ * doesn't hold a buffer until data arrives, so all of them are re-armed.
+ */
+static void
+EchoServer_rearmStarved(Shard *shard)
+{
+    Connection        **link = &(shard->starved);
+    Connection         *connection;
+
+    while ((connection = *link) != NULL) {
+        if (!connection->closing && !shard->buffersFreed) {
+            link = &(connection->nextStarved);
+            continue;
+        }
+
+        *link               = connection->nextStarved;
+        connection->starved = false;
+
+        if (!connection->closing) {
+            if (!EchoServer_prepareRecv(connection)) {
+                EchoServer_close(connection);
+            }
+        }
+
+        EchoServer_release(connection);
+    }
+
+    shard->buffersFreed = false;
+}
+
+/**
+ * shutdown() completes the operations in flight, the connection is freed afterwards
+ */
+static void
+EchoServer_close(Connection *connection)
+{
+    if (!connection->closing) {
+        connection->closing = true;
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+}
+
+static void
+EchoServer_release(Connection *connection)
+{
+    Shard                  *shard = connection->shard;
+    char                    host[NI_MAXHOST];
+    int32_t                 bid;
+
+    if (!connection->closing || connection->refs > 0 || connection->starved) {
+        return;
+    }
+
+    Log_println(LOG_DEBUG, "Close connection from client %s, port %s", EchoServer_host(connection, host, sizeof(host)), connection->port);
+
+    /* buffers which were never submitted */
+    while ((bid = connection->head) != BUFFER_NONE) {
+        connection->head = shard->nextBuffer[bid];
+        IoUringBuffers_put(shard->buffers, (uint16_t) bid);
+    }
+
+    close(connection->fd);
+    MessageDecoder_delete(connection->decoder);
+    RingBuffer_delete(connection->output);
+
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        shard->connections = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->prev = connection->prev;
+    }
+    shard->numConnections--;
+
+    free(connection);
+}
+
+/**
+ * the client's host name once it's resolved, the numeric address until then
+ */
+static const char *
+EchoServer_host(Connection *connection, char *host, size_t len)
+{
+    if (Resolver_lookup(resolver, (struct sockaddr *) &(connection->addr), host, len)) {
+        return host;
+    }
+
+    return connection->address;
+}
@@ -0,0 +1,160 @@
+#include "EventLoop.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include <sys/eventfd.h>
+
+static void EventLoop_stopCallback(EventHandler *handler, uint32_t events);
+
+/**
+ * create an epoll instance together with an eventfd which is used
+ * to interrupt epoll_wait() from another thread or a signal handler
+ */
+EventLoop *
+EventLoop_new(void)
+{
+    EventLoop *this = (EventLoop *) malloc(sizeof(EventLoop));
+
+    if (this == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate event loop");
+        return NULL;
+    }
+
+    this->running       = false;
+    this->stop.callback = EventLoop_stopCallback;
+
+    if ((this->epollfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't create epoll instance");
+        free(this);
+        return NULL;
+    }
+
+    if ((this->stop.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't create eventfd");
+        close(this->epollfd);
+        free(this);
+        return NULL;
+    }
+
+    /* level-triggered: stays ready until the loop is deleted */
+    if (!EventLoop_add(this, &(this->stop), EPOLLIN)) {
+        close(this->stop.fd);
+        close(this->epollfd);
+        free(this);
+        return NULL;
+    }
+
+    return this;
+}
+
+void
+EventLoop_delete(EventLoop *this)
+{
+    if (this != NULL) {
+        close(this->stop.fd);
+        close(this->epollfd);
+        free(this);
+    }
+}
+
+bool
+EventLoop_add(EventLoop *this, EventHandler *handler, uint32_t events)
+{
+    struct epoll_event  event = {
+        .events   = events,
+        .data.ptr = handler
+    };
+
+    if (epoll_ctl(this->epollfd, EPOLL_CTL_ADD, handler->fd, &event) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't add fd %d to epoll instance", handler->fd);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+EventLoop_modify(EventLoop *this, EventHandler *handler, uint32_t events)
+{
+    struct epoll_event  event = {
+        .events   = events,
+        .data.ptr = handler
+    };
+
+    if (epoll_ctl(this->epollfd, EPOLL_CTL_MOD, handler->fd, &event) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't modify fd %d in epoll instance", handler->fd);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+EventLoop_remove(EventLoop *this, EventHandler *handler)
+{
+    if (epoll_ctl(this->epollfd, EPOLL_CTL_DEL, handler->fd, NULL) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't remove fd %d from epoll instance", handler->fd);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * dispatch events until EventLoop_stop() is called,
+ * blocks without timeout while there is nothing to do
+ */
+void
+EventLoop_run(EventLoop *this)
+{
+    struct epoll_event  events[EVENT_LOOP_MAX_EVENTS];
+    EventHandler       *handler;
+    int                 numEvents;
+    int                 idx;
+
+    this->running = true;
+
+    while (this->running) {
+        numEvents = epoll_wait(this->epollfd, events, EVENT_LOOP_MAX_EVENTS, -1);
+
+        if (numEvents == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't wait for events");
+            break;
+        }
+
+        for (idx = 0; idx < numEvents; idx++) {
+            handler = (EventHandler *) events[idx].data.ptr;
+            handler->callback(handler, events[idx].events);
+        }
+    }
+
+    this->running = false;
+}
+
+/**
+ * thread-safe and async-signal-safe
+ */
+void
+EventLoop_stop(EventLoop *this)
+{
+    uint64_t value = 1;
+
+    if (write(this->stop.fd, &value, sizeof(value)) != sizeof(value)) {
+        /* counter overflow, the loop is woken up anyway */
+    }
+}
+
+static void
+EventLoop_stopCallback(EventHandler *handler, uint32_t events)
+{
+    EventLoop *this = (EventLoop *) ((char *) handler - offsetof(EventLoop, stop));
+
+    this->running = false;
+}
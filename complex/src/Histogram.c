@@ -0,0 +1,184 @@
+#include "Histogram.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static uint32_t Histogram_index     (uint64_t value);
+static uint64_t Histogram_highest   (uint32_t idx);
+
+Histogram *
+Histogram_new(void)
+{
+    Histogram          *this;
+
+    if ((this = (Histogram *) malloc(sizeof(Histogram))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate histogram");
+        return NULL;
+    }
+
+    Histogram_reset(this);
+
+    return this;
+}
+
+void
+Histogram_delete(Histogram *this)
+{
+    free(this);
+}
+
+void
+Histogram_reset(Histogram *this)
+{
+    memset(this, 0, sizeof(Histogram));
+    this->min = UINT64_MAX;
+}
+
+/**
+ * values beyond the range are counted in the last bucket,
+ * min and max stay exact
+ */
+void
+Histogram_record(Histogram *this, uint64_t value)
+{
+    this->counts[Histogram_index(value)]++;
+    this->count++;
+    this->sum += value;
+
+    if (value < this->min) {
+        this->min = value;
+    }
+    if (value > this->max) {
+        this->max = value;
+    }
+}
+
+/**
+ * merge, e.g. the histograms of all threads
+ */
+void
+Histogram_add(Histogram *this, const Histogram *other)
+{
+    uint32_t            idx;
+
+    for (idx = 0; idx < HISTOGRAM_NUM_COUNTS; idx++) {
+        this->counts[idx] += other->counts[idx];
+    }
+
+    this->count += other->count;
+    this->sum   += other->sum;
+
+    if (other->min < this->min) {
+        this->min = other->min;
+    }
+    if (other->max > this->max) {
+        this->max = other->max;
+    }
+}
+
+/**
+ * highest value of the bucket the percentile falls into, never above max
+ *
+ * @param   percentile              0.0 - 100.0
+ */
+uint64_t
+Histogram_percentile(const Histogram *this, double percentile)
+{
+    uint64_t            rank;
+    uint64_t            seen = 0;
+    uint64_t            value;
+    uint32_t            idx;
+
+    if (this->count == 0) {
+        return 0;
+    }
+
+    if (percentile >= 100.0) {
+        return this->max;
+    }
+
+    rank = (uint64_t) (percentile / 100.0 * this->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (idx = 0; idx < HISTOGRAM_NUM_COUNTS; idx++) {
+        seen += this->counts[idx];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    value = Histogram_highest(idx);
+
+    return value < this->max ? value : this->max;
+}
+
+double
+Histogram_mean(const Histogram *this)
+{
+    return this->count > 0 ? (double) this->sum / this->count : 0.0;
+}
+
+/**
+ * two report lines on stdout, ns values in us
+ */
+void
+Histogram_print(const Histogram *this, const char *name)
+{
+    if (this->count == 0) {
+        return;
+    }
+
+    printf("  %-10s  min %.1f us, mean %.1f us\n", name, this->min / 1e3, Histogram_mean(this) / 1e3);
+    printf("              p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           Histogram_percentile(this, 50.0)  / 1e3,
+           Histogram_percentile(this, 90.0)  / 1e3,
+           Histogram_percentile(this, 99.0)  / 1e3,
+           Histogram_percentile(this, 99.9)  / 1e3,
+           this->max / 1e3);
+}
+
+/**
+ *  value               shift   index
+ *  [0, SUB)            0       value
+ *  [SUB, 2 * SUB)      1       SUB + (value >> 1) - SUB / 2
+ *  [2 * SUB, 4 * SUB)  2       SUB + SUB / 2 + (value >> 2) - SUB / 2
+ */
+static uint32_t
+Histogram_index(uint64_t value)
+{
+    uint32_t            shift;
+
+    if (value < HISTOGRAM_SUB_COUNT) {
+        return (uint32_t) value;
+    }
+
+    if (value >= (1ULL << HISTOGRAM_MAX_BITS)) {
+        return HISTOGRAM_NUM_COUNTS - 1;
+    }
+
+    shift = 63 - __builtin_clzll(value) - (HISTOGRAM_SUB_BITS - 1);
+
+    return HISTOGRAM_SUB_COUNT + (shift - 1) * (HISTOGRAM_SUB_COUNT / 2) +
+           (uint32_t) (value >> shift) - HISTOGRAM_SUB_COUNT / 2;
+}
+
+static uint64_t
+Histogram_highest(uint32_t idx)
+{
+    uint32_t            shift;
+    uint64_t            sub;
+
+    if (idx < HISTOGRAM_SUB_COUNT) {
+        return idx;
+    }
+
+    shift = (idx - HISTOGRAM_SUB_COUNT) / (HISTOGRAM_SUB_COUNT / 2) + 1;
+    sub   = (idx - HISTOGRAM_SUB_COUNT) % (HISTOGRAM_SUB_COUNT / 2) + HISTOGRAM_SUB_COUNT / 2;
+
+    return ((sub + 1) << shift) - 1;
+}
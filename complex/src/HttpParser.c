@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include "HttpParser.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+static bool             HttpParser_line         (HttpParser *this, const char **data, uint32_t *len);
+static bool             HttpParser_status       (HttpParser *this);
+static bool             HttpParser_header       (HttpParser *this);
+static HttpParserEvent  HttpParser_head         (HttpParser *this);
+static bool             HttpParser_chunkSize    (HttpParser *this);
+static HttpParserEvent  HttpParser_fail         (HttpParser *this, const char *msg);
+
+/**
+ * prepare for the next response on the same connection
+ *
+ * @param   noBody                  the request was HEAD, a Content-Length has no body behind it
+ */
+void
+HttpParser_init(HttpParser *this, bool noBody)
+{
+    this->state         = HTTP_PARSER_STATUS;
+    this->status        = 0;
+    this->minor         = 0;
+    this->noBody        = noBody;
+    this->chunked       = false;
+    this->close         = false;
+    this->hasLength     = false;
+    this->contentLength = 0;
+    this->remaining     = 0;
+    this->bodyLen       = 0;
+    this->lineLen       = 0;
+}
+
+/**
+ * consume bytes until something happens or the chunk is used up,
+ * call it again with the remaining chunk until it returns HTTP_PARSER_MORE
+ *
+ * @param   data                    input is the chunk, output is the unconsumed rest
+ * @param   len                     input is the chunk length, output is the rest
+ * @param   body                    output is a piece of the body with HTTP_PARSER_DATA,
+ *                                  pointing into the chunk
+ * @param   bodyLen                 output is the length of that piece
+ * @return                          HTTP_PARSER_COMPLETE once per response, the parser stays
+ *                                  in HTTP_PARSER_DONE until HttpParser_init()
+ */
+HttpParserEvent
+HttpParser_feed(HttpParser *this, const char **data, uint32_t *len, const char **body, uint32_t *bodyLen)
+{
+    uint64_t            wanted;
+
+    while (*len > 0) {
+
+        switch (this->state) {
+            case HTTP_PARSER_STATUS:
+                if (!HttpParser_line(this, data, len)) {
+                    break;
+                }
+                if (!HttpParser_status(this)) {
+                    return HttpParser_fail(this, "Invalid status line");
+                }
+                this->state = HTTP_PARSER_HEADER;
+                break;
+
+            case HTTP_PARSER_HEADER:
+                if (!HttpParser_line(this, data, len)) {
+                    break;
+                }
+                if (this->lineLen > 0) {
+                    if (!HttpParser_header(this)) {
+                        return HttpParser_fail(this, "Invalid header");
+                    }
+                    this->lineLen = 0;
+                    break;
+                }
+                if (this->status < 200 && this->status != 101) {
+                    /* interim response, the real one follows */
+                    HttpParser_init(this, this->noBody);
+                    break;
+                }
+                return HttpParser_head(this);
+
+            case HTTP_PARSER_BODY:
+            case HTTP_PARSER_CHUNK_DATA:
+            case HTTP_PARSER_UNTIL_CLOSE:
+                wanted = *len;
+                if (this->state != HTTP_PARSER_UNTIL_CLOSE && wanted > this->remaining) {
+                    wanted = this->remaining;
+                }
+
+                *body          = *data;
+                *bodyLen       = (uint32_t) wanted;
+                *data         += wanted;
+                *len          -= (uint32_t) wanted;
+                this->bodyLen += wanted;
+
+                if (this->state != HTTP_PARSER_UNTIL_CLOSE) {
+                    this->remaining -= wanted;
+                    if (this->remaining == 0) {
+                        this->state = (this->state == HTTP_PARSER_BODY) ? HTTP_PARSER_DONE : HTTP_PARSER_CHUNK_END;
+                    }
+                }
+                return HTTP_PARSER_DATA;
+
+            case HTTP_PARSER_CHUNK_SIZE:
+                if (!HttpParser_line(this, data, len)) {
+                    break;
+                }
+                if (!HttpParser_chunkSize(this)) {
+                    return HttpParser_fail(this, "Invalid chunk size");
+                }
+                this->state   = (this->remaining > 0) ? HTTP_PARSER_CHUNK_DATA : HTTP_PARSER_TRAILER;
+                this->lineLen = 0;
+                break;
+
+            case HTTP_PARSER_CHUNK_END:
+                if (!HttpParser_line(this, data, len)) {
+                    break;
+                }
+                if (this->lineLen > 0) {
+                    return HttpParser_fail(this, "Chunk not terminated");
+                }
+                this->state = HTTP_PARSER_CHUNK_SIZE;
+                break;
+
+            case HTTP_PARSER_TRAILER:
+                if (!HttpParser_line(this, data, len)) {
+                    break;
+                }
+                if (this->lineLen > 0) {
+                    this->lineLen = 0;                  /* trailers are ignored */
+                    break;
+                }
+                this->state = HTTP_PARSER_DONE;
+                break;
+
+            case HTTP_PARSER_DONE:
+            case HTTP_PARSER_FAILED:
+                break;
+        }
+
+        if (this->state == HTTP_PARSER_DONE) {
+            return HTTP_PARSER_COMPLETE;
+        }
+        if (this->state == HTTP_PARSER_FAILED) {
+            return HTTP_PARSER_ERROR;
+        }
+    }
+
+    /* the last body byte completes the response without more input */
+    if (this->state == HTTP_PARSER_DONE) {
+        return HTTP_PARSER_COMPLETE;
+    }
+
+    return HTTP_PARSER_MORE;
+}
+
+/**
+ * the connection was closed by the server
+ *
+ * @return                          HTTP_PARSER_COMPLETE if the body ends with the connection,
+ *                                  HTTP_PARSER_ERROR if the response was cut off
+ */
+HttpParserEvent
+HttpParser_finish(HttpParser *this)
+{
+    if (this->state == HTTP_PARSER_UNTIL_CLOSE || this->state == HTTP_PARSER_DONE) {
+        this->state = HTTP_PARSER_DONE;
+        return HTTP_PARSER_COMPLETE;
+    }
+
+    this->state = HTTP_PARSER_FAILED;
+    return HTTP_PARSER_ERROR;
+}
+
+/**
+ * body bytes were moved past the parser (splice), only in HTTP_PARSER_BODY
+ * or HTTP_PARSER_UNTIL_CLOSE and never more than remaining
+ */
+void
+HttpParser_skip(HttpParser *this, uint64_t len)
+{
+    this->bodyLen += len;
+
+    if (this->state == HTTP_PARSER_BODY) {
+        this->remaining -= len;
+        if (this->remaining == 0) {
+            this->state = HTTP_PARSER_DONE;
+        }
+    }
+}
+
+/**
+ * collect a line, CRLF or a bare LF ends it and isn't part of it
+ *
+ * @return                          true if the line is complete
+ */
+static bool
+HttpParser_line(HttpParser *this, const char **data, uint32_t *len)
+{
+    const char         *lf = memchr(*data, '\n', *len);
+    uint32_t            wanted = (lf != NULL) ? (uint32_t) (lf - *data) : *len;
+
+    if (this->lineLen + wanted >= HTTP_LINE_MAX) {
+        HttpParser_fail(this, "Line too long");
+        return false;
+    }
+
+    memcpy(&(this->line[this->lineLen]), *data, wanted);
+    this->lineLen += wanted;
+    *data         += wanted;
+    *len          -= wanted;
+
+    if (lf == NULL) {
+        return false;
+    }
+
+    /* skip the LF */
+    (*data)++;
+    (*len)--;
+
+    if (this->lineLen > 0 && this->line[this->lineLen - 1] == '\r') {
+        this->lineLen--;
+    }
+    this->line[this->lineLen] = '\0';
+
+    return true;
+}
+
+/**
+ * "HTTP/1.1 200 OK"
+ */
+static bool
+HttpParser_status(HttpParser *this)
+{
+    int                 major;
+
+    if (sscanf(this->line, "HTTP/%d.%d %3d", &major, &(this->minor), &(this->status)) != 3 ||
+        major != 1 || this->status < 100 || this->status > 999) {
+        Log_println(LOG_DEBUG, "Status line: %s", this->line);
+        return false;
+    }
+
+    /* HTTP/1.0 closes unless it says keep-alive */
+    this->close   = (this->minor == 0);
+    this->lineLen = 0;
+
+    return true;
+}
+
+/**
+ * the headers that decide where the response ends
+ */
+static bool
+HttpParser_header(HttpParser *this)
+{
+    char               *value = strchr(this->line, ':');
+    char               *end;
+    unsigned long long  number;
+
+    if (value == NULL || value == this->line) {
+        Log_println(LOG_DEBUG, "Header: %s", this->line);
+        return false;
+    }
+
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+
+    if (strcasecmp(this->line, "Content-Length") == 0) {
+        errno  = 0;
+        number = strtoull(value, &end, 10);
+        if (errno != 0 || end == value || !isdigit((unsigned char) *value) ||
+            (this->hasLength && this->contentLength != number)) {
+            return false;
+        }
+        this->hasLength     = true;
+        this->contentLength = number;
+
+    } else if (strcasecmp(this->line, "Transfer-Encoding") == 0) {
+        /* chunked must be the last coding */
+        end = value + strlen(value);
+        while (end > value && (end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+        this->chunked = (end - value >= 7 && strncasecmp(end - 7, "chunked", 7) == 0);
+        if (!this->chunked) {
+            this->close = true;
+        }
+
+    } else if (strcasecmp(this->line, "Connection") == 0) {
+        if (strcasestr(value, "close") != NULL) {
+            this->close = true;
+        } else if (strcasestr(value, "keep-alive") != NULL) {
+            this->close = false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * the empty line: decide how the body is framed (RFC 7230, 3.3.3)
+ */
+static HttpParserEvent
+HttpParser_head(HttpParser *this)
+{
+    this->lineLen = 0;
+
+    if (this->noBody || this->status == 204 || this->status == 304 || this->status < 200) {
+        this->state = HTTP_PARSER_DONE;
+    } else if (this->chunked) {
+        this->state = HTTP_PARSER_CHUNK_SIZE;
+    } else if (this->hasLength) {
+        this->remaining = this->contentLength;
+        this->state     = (this->remaining > 0) ? HTTP_PARSER_BODY : HTTP_PARSER_DONE;
+    } else {
+        this->close = true;
+        this->state = HTTP_PARSER_UNTIL_CLOSE;
+    }
+
+    return HTTP_PARSER_HEAD;
+}
+
+/**
+ * "1a3f;ext=value"
+ */
+static bool
+HttpParser_chunkSize(HttpParser *this)
+{
+    const char         *ptr  = this->line;
+    uint64_t            size = 0;
+    int                 digits = 0;
+
+    while (isxdigit((unsigned char) *ptr)) {
+        if (++digits > 15) {
+            return false;
+        }
+        size = (size << 4) | (uint64_t) (isdigit((unsigned char) *ptr) ? *ptr - '0' : (tolower((unsigned char) *ptr) - 'a' + 10));
+        ptr++;
+    }
+
+    while (*ptr == ' ' || *ptr == '\t') {
+        ptr++;
+    }
+
+    if (digits == 0 || (*ptr != '\0' && *ptr != ';')) {
+        return false;
+    }
+
+    this->remaining = size;
+
+    return true;
+}
+
+static HttpParserEvent
+HttpParser_fail(HttpParser *this, const char *msg)
+{
+    Log_println(LOG_ERROR, "Can't parse response: %s", msg);
+    this->state = HTTP_PARSER_FAILED;
+
+    return HTTP_PARSER_ERROR;
+}
@@ -0,0 +1,333 @@
+#include "IoUring.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int IoUring_setup(uint32_t entries, struct io_uring_params *params);
+static int IoUring_enter(int ringfd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags);
+static int IoUring_register(int ringfd, uint32_t opcode, void *arg, uint32_t numArgs);
+
+/* tried in order, newer kernels run completions on the submitting thread */
+static const uint32_t setupFlags[] = {
+    IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+    IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN,
+    0
+};
+
+static int
+IoUring_setup(uint32_t entries, struct io_uring_params *params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+IoUring_enter(int ringfd, uint32_t toSubmit, uint32_t minComplete, uint32_t flags)
+{
+    return (int) syscall(__NR_io_uring_enter, ringfd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int
+IoUring_register(int ringfd, uint32_t opcode, void *arg, uint32_t numArgs)
+{
+    return (int) syscall(__NR_io_uring_register, ringfd, opcode, arg, numArgs);
+}
+
+IoUring *
+IoUring_new(uint32_t entries)
+{
+    IoUring                *this;
+    struct io_uring_params  params;
+    int                     idx;
+
+    if ((this = (IoUring *) calloc(1, sizeof(IoUring))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate io_uring");
+        return NULL;
+    }
+
+    for (idx = 0; idx < sizeof(setupFlags) / sizeof(setupFlags[0]); idx++) {
+        memset(&params, 0, sizeof(params));
+        params.flags = setupFlags[idx];
+
+        if ((this->ringfd = IoUring_setup(entries, &params)) >= 0 || errno != EINVAL) {
+            break;
+        }
+    }
+
+    if (this->ringfd < 0) {
+        Log_errno(LOG_ERROR, errno, "Can't setup io_uring");
+        free(this);
+        return NULL;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        Log_println(LOG_ERROR, "Kernel too old for io_uring engine (no IORING_FEAT_SINGLE_MMAP)");
+        close(this->ringfd);
+        free(this);
+        return NULL;
+    }
+
+    this->enterFlags = IORING_ENTER_GETEVENTS;
+
+    /* submission and completion ring share one mapping */
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    this->cqRingSize = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (this->cqRingSize > this->sqRingSize) {
+        this->sqRingSize = this->cqRingSize;
+    }
+    this->cqRingSize = this->sqRingSize;
+
+    this->sqRing = mmap(NULL, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringfd, IORING_OFF_SQ_RING);
+    if (this->sqRing == MAP_FAILED) {
+        Log_errno(LOG_ERROR, errno, "Can't map io_uring");
+        close(this->ringfd);
+        free(this);
+        return NULL;
+    }
+    this->cqRing = this->sqRing;
+
+    this->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    this->sqes     = (struct io_uring_sqe *) mmap(NULL, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ringfd, IORING_OFF_SQES);
+    if (this->sqes == MAP_FAILED) {
+        Log_errno(LOG_ERROR, errno, "Can't map io_uring submission entries");
+        munmap(this->sqRing, this->sqRingSize);
+        close(this->ringfd);
+        free(this);
+        return NULL;
+    }
+
+    this->sqHead        = (uint32_t *) ((char *) this->sqRing + params.sq_off.head);
+    this->sqTail        = (uint32_t *) ((char *) this->sqRing + params.sq_off.tail);
+    this->sqArray       = (uint32_t *) ((char *) this->sqRing + params.sq_off.array);
+    this->sqMask        = *(uint32_t *) ((char *) this->sqRing + params.sq_off.ring_mask);
+    this->sqEntries     = params.sq_entries;
+    this->sqLocalTail   = *(this->sqTail);
+
+    this->cqHead        = (uint32_t *) ((char *) this->cqRing + params.cq_off.head);
+    this->cqTail        = (uint32_t *) ((char *) this->cqRing + params.cq_off.tail);
+    this->cqMask        = *(uint32_t *) ((char *) this->cqRing + params.cq_off.ring_mask);
+    this->cqes          = (struct io_uring_cqe *) ((char *) this->cqRing + params.cq_off.cqes);
+
+    Log_println(LOG_DEBUG, "io_uring with %u/%u entries, flags = 0x%x", params.sq_entries, params.cq_entries, params.flags);
+
+    return this;
+}
+
+void
+IoUring_delete(IoUring *this)
+{
+    if (this != NULL) {
+        munmap(this->sqes, this->sqesSize);
+        munmap(this->sqRing, this->sqRingSize);
+        close(this->ringfd);
+        free(this);
+    }
+}
+
+/**
+ * room for num submission entries, submits pending entries if the ring is full.
+ * A chain (IOSQE_IO_LINK) is reserved as a whole before its first entry is
+ * taken, a submission in the middle of it would cut it off.
+ */
+bool
+IoUring_reserve(IoUring *this, uint32_t num)
+{
+    if (num > this->sqEntries) {
+        Log_println(LOG_ERROR, "Can't reserve %u of %u io_uring entries", num, this->sqEntries);
+        return false;
+    }
+
+    while (this->sqLocalTail - __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE) > this->sqEntries - num) {
+        if (IoUring_submitAndWait(this, 0) < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * next free submission entry (cleared), submits pending entries if the ring is full
+ * unless that splits a chain which wasn't reserved with IoUring_reserve()
+ */
+struct io_uring_sqe *
+IoUring_getSqe(IoUring *this)
+{
+    struct io_uring_sqe    *sqe;
+    uint32_t                idx;
+
+    if (this->sqLocalTail - __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE) >= this->sqEntries &&
+        this->toSubmit > 0 && (this->sqes[(this->sqLocalTail - 1) & this->sqMask].flags & IOSQE_IO_LINK)) {
+        Log_println(LOG_ERROR, "Can't submit io_uring entries in the middle of a chain");
+        return NULL;
+    }
+
+    if (!IoUring_reserve(this, 1)) {
+        return NULL;
+    }
+
+    idx                 = this->sqLocalTail & this->sqMask;
+    sqe                 = &(this->sqes[idx]);
+    this->sqArray[idx]  = idx;
+    this->sqLocalTail++;
+    this->toSubmit++;
+
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+/**
+ * one system call: submit all prepared entries and wait for completions
+ */
+int
+IoUring_submitAndWait(IoUring *this, uint32_t waitNr)
+{
+    int                     status;
+
+    __atomic_store_n(this->sqTail, this->sqLocalTail, __ATOMIC_RELEASE);
+
+    do {
+        status = IoUring_enter(this->ringfd, this->toSubmit, waitNr, this->enterFlags);
+    } while (status < 0 && errno == EINTR);
+
+    if (status < 0) {
+        if (errno != EAGAIN && errno != EBUSY) {
+            Log_errno(LOG_ERROR, errno, "Can't enter io_uring");
+        }
+        return -1;
+    }
+
+    this->toSubmit -= (uint32_t) status;
+
+    return status;
+}
+
+/**
+ * @return                          next completion or NULL, mark it with IoUring_seenCqe()
+ */
+struct io_uring_cqe *
+IoUring_peekCqe(IoUring *this)
+{
+    uint32_t                head = *(this->cqHead);
+
+    if (head == __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    return &(this->cqes[head & this->cqMask]);
+}
+
+void
+IoUring_seenCqe(IoUring *this)
+{
+    __atomic_store_n(this->cqHead, *(this->cqHead) + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * register a provided buffer ring and hand all buffers to the kernel
+ *
+ * @param   entries                 number of buffers, power of two
+ */
+IoUringBuffers *
+IoUringBuffers_new(IoUring *ring, uint16_t bgid, uint32_t entries, uint32_t bufferSize)
+{
+    IoUringBuffers         *this;
+    struct io_uring_buf_reg reg;
+    uint32_t                bid;
+
+    if ((this = (IoUringBuffers *) calloc(1, sizeof(IoUringBuffers))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate provided buffers");
+        return NULL;
+    }
+
+    this->entries    = entries;
+    this->bufferSize = bufferSize;
+    this->bgid       = bgid;
+    this->ringSize   = entries * sizeof(struct io_uring_buf);
+
+    /* page aligned, shared with the kernel */
+    this->ring = (struct io_uring_buf_ring *) mmap(NULL, this->ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (this->ring == MAP_FAILED) {
+        Log_errno(LOG_ERROR, errno, "Can't map provided buffer ring");
+        free(this);
+        return NULL;
+    }
+
+    if ((this->buffers = (char *) malloc((size_t) entries * bufferSize)) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate provided buffers");
+        munmap(this->ring, this->ringSize);
+        free(this);
+        return NULL;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t) (uintptr_t) this->ring;
+    reg.ring_entries = entries;
+    reg.bgid         = bgid;
+
+    if (IoUring_register(ring->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        Log_errno(LOG_ERROR, errno, "Can't register provided buffer ring");
+        free(this->buffers);
+        munmap(this->ring, this->ringSize);
+        free(this);
+        return NULL;
+    }
+
+    for (bid = 0; bid < entries; bid++) {
+        IoUringBuffers_put(this, (uint16_t) bid);
+    }
+
+    return this;
+}
+
+/**
+ * only once nothing which selects a buffer is in flight anymore, the kernel
+ * writes into the buffers until then
+ *
+ * @param   ring                    NULL if the ring has already been deleted
+ */
+void
+IoUringBuffers_delete(IoUringBuffers *this, IoUring *ring)
+{
+    struct io_uring_buf_reg reg;
+
+    if (this != NULL) {
+        if (ring != NULL) {
+            memset(&reg, 0, sizeof(reg));
+            reg.bgid = this->bgid;
+            IoUring_register(ring->ringfd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        }
+
+        munmap(this->ring, this->ringSize);
+        free(this->buffers);
+        free(this);
+    }
+}
+
+char *
+IoUringBuffers_get(IoUringBuffers *this, uint16_t bid)
+{
+    return &(this->buffers[(size_t) bid * this->bufferSize]);
+}
+
+/**
+ * give a buffer back to the kernel
+ */
+void
+IoUringBuffers_put(IoUringBuffers *this, uint16_t bid)
+{
+    struct io_uring_buf    *buf = &(this->ring->bufs[this->localTail & (this->entries - 1)]);
+
+    buf->addr = (uint64_t) (uintptr_t) IoUringBuffers_get(this, bid);
+    buf->len  = this->bufferSize;
+    buf->bid  = bid;
+
+    this->localTail++;
+    __atomic_store_n(&(this->ring->tail), this->localTail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+
+#include "LoadGenerator.h"
+#include "EchoClient.h"
+#include "MessageDecoder.h"
+#include "RingBuffer.h"
+#include "EventLoop.h"
+#include "Histogram.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+
+/**
+ * a request in flight, its nr is seq * depth + slot
+ */
+typedef struct {
+    uint64_t            intended;               /**< ns (CLOCK_MONOTONIC), latency is measured from here */
+    uint64_t            sent;                   /**< ns, when it was actually encoded */
+    uint16_t            len;                    /**< payload length */
+    uint8_t             type;                   /**< request type, 0 = free */
+} LoadSlot;
+
+typedef struct {
+    LoadConnection      connection;             /**< connected socket, output and requests in flight */
+    MessageDecoder     *decoder;                /**< responses, resumed with every chunk */
+    LoadSlot           *slots;                  /**< config->depth */
+    uint32_t            seq;                    /**< requests sent */
+} LoadGeneratorConnection;
+
+/**
+ * the echo protocol of a load run, the thread's data are LOAD_PAYLOAD_MAX random letters
+ */
+typedef struct {
+    const LoadConfig   *config;
+    uint32_t            sizeWeight;             /**< sum of the size weights */
+} LoadGenerator;
+
+static bool     LoadGenerator_init          (LoadThread *thread);
+static bool     LoadGenerator_open          (LoadConnection *connection);
+static void     LoadGenerator_callback      (EventHandler *handler, uint32_t events);
+static bool     LoadGenerator_receive       (LoadGeneratorConnection *connection);
+static bool     LoadGenerator_complete      (LoadGeneratorConnection *connection, Message *msg, uint64_t now);
+static bool     LoadGenerator_send          (LoadConnection *connection, uint64_t intended);
+static void     LoadGenerator_fail          (LoadConnection *connection);
+static void     LoadGenerator_close         (LoadConnection *connection);
+static void     LoadGenerator_expire        (LoadConnection *connection, uint64_t now);
+static void     LoadGenerator_report        (LoadRunner *runner, double elapsed);
+
+static const LoadProtocol protocol = {
+    .connectionSize = sizeof(LoadGeneratorConnection),
+    .init           = LoadGenerator_init,
+    .open           = LoadGenerator_open,
+    .send           = LoadGenerator_send,
+    .fail           = LoadGenerator_fail,
+    .close          = LoadGenerator_close,
+    .expire         = LoadGenerator_expire,
+    .report         = LoadGenerator_report
+};
+
+/**
+ * one fixed size, as many upper as lower requests,
+ * one connection with one request in flight for CONFIG_LOAD_DURATION
+ */
+void
+LoadConfig_init(LoadConfig *this)
+{
+    memset(this, 0, sizeof(LoadConfig));
+
+    this->numConnections  = 1;
+    this->connectDelay    = CONFIG_CONNECT_DELAY;
+    this->numThreads      = 1;
+    this->depth           = 1;
+    this->duration        = CONFIG_LOAD_DURATION;
+    this->sizes[0].min    = CONFIG_LOAD_SIZE;
+    this->sizes[0].max    = CONFIG_LOAD_SIZE;
+    this->sizes[0].weight = 1;
+    this->numSizes        = 1;
+    this->upperWeight     = 1;
+    this->lowerWeight     = 1;
+}
+
+/**
+ * comma separated sizes, each "<size>" or "<min>-<max>" with an optional ":<weight>",
+ * e.g. "64:8,1024-4096:2" sends 64 bytes 80% and 1 - 4 KiB 20% of the time
+ */
+bool
+LoadConfig_parseSizes(LoadConfig *this, const char *str)
+{
+    LoadSize            size;
+    unsigned long       value;
+    char               *end;
+
+    this->numSizes = 0;
+
+    do {
+        if (this->numSizes >= LOAD_SIZES_MAX) {
+            return false;
+        }
+
+        errno    = 0;
+        value    = strtoul(str, &end, 10);
+        size.min = (uint32_t) value;
+        if (errno != 0 || end == str || value > LOAD_PAYLOAD_MAX) {
+            return false;
+        }
+
+        size.max = size.min;
+        if (*end == '-') {
+            str      = end + 1;
+            value    = strtoul(str, &end, 10);
+            size.max = (uint32_t) value;
+            if (errno != 0 || end == str || value > LOAD_PAYLOAD_MAX || size.max < size.min) {
+                return false;
+            }
+        }
+
+        size.weight = 1;
+        if (*end == ':') {
+            str         = end + 1;
+            value       = strtoul(str, &end, 10);
+            size.weight = (uint32_t) value;
+            if (errno != 0 || end == str || value == 0 || value > UINT16_MAX) {
+                return false;
+            }
+        }
+
+        this->sizes[this->numSizes++] = size;
+        str = end + 1;
+    } while (*end == ',');
+
+    return *end == '\0';
+}
+
+/**
+ * "<upper>:<lower>", the weights of REQUEST_TO_UPPER and REQUEST_TO_LOWER,
+ * e.g. "3:1" or "1:0"
+ */
+bool
+LoadConfig_parseMix(LoadConfig *this, const char *str)
+{
+    unsigned int        upper;
+    unsigned int        lower;
+    int                 consumed = 0;
+
+    if (sscanf(str, "%u:%u%n", &upper, &lower, &consumed) != 2 || str[consumed] != '\0' ||
+        upper + lower == 0 || upper > UINT16_MAX || lower > UINT16_MAX) {
+        return false;
+    }
+
+    this->upperWeight = upper;
+    this->lowerWeight = lower;
+
+    return true;
+}
+
+/**
+ * open all connections, run the threads until the duration is over, the number
+ * of messages is answered or SIGINT / SIGTERM, then print the latency percentiles
+ */
+bool
+LoadGenerator_run(struct addrinfo *addrinfo, const LoadConfig *config)
+{
+    LoadGenerator       this;
+    LoadRunner          runner;
+    uint32_t            idx;
+
+    this.config     = config;
+    this.sizeWeight = 0;
+
+    for (idx = 0; idx < config->numSizes; idx++) {
+        this.sizeWeight += config->sizes[idx].weight;
+    }
+
+    LoadRunner_init(&runner, &protocol, &this, addrinfo);
+
+    runner.numConnections = config->numConnections;
+    runner.numThreads     = config->numThreads;
+    runner.depth          = config->depth;
+    runner.rate           = config->rate;
+    runner.arrival        = config->arrival;
+    runner.duration       = config->duration;
+    runner.numMessages    = config->numMessages;
+    runner.connectDelay   = config->connectDelay;
+    runner.connectTimeout = CONFIG_CONNECT_TIMEOUT;
+
+    return LoadRunner_run(&runner);
+}
+
+/**
+ * letters, both transforms change all of them
+ */
+static bool
+LoadGenerator_init(LoadThread *thread)
+{
+    char               *payload;
+    uint32_t            idx;
+
+    if ((payload = (char *) malloc(LOAD_PAYLOAD_MAX)) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate payload");
+        return false;
+    }
+
+    for (idx = 0; idx < LOAD_PAYLOAD_MAX; idx++) {
+        payload[idx] = (char) ((LoadRunner_random(thread) & 1 ? 'a' : 'A') + LoadRunner_random(thread) % 26);
+    }
+
+    thread->data = payload;
+
+    return true;
+}
+
+static bool
+LoadGenerator_open(LoadConnection *base)
+{
+    LoadGeneratorConnection *connection = (LoadGeneratorConnection *) base;
+    const LoadConfig   *config = ((LoadGenerator *) base->thread->runner->context)->config;
+    uint32_t            total  = 0;
+    uint32_t            idx;
+
+    /* room for all requests in flight */
+    for (idx = 0; idx < config->numSizes; idx++) {
+        if (config->sizes[idx].max > total) {
+            total = config->sizes[idx].max;
+        }
+    }
+    total = (total + MESSAGE_HEADER_LEN) * config->depth;
+
+    connection->decoder = MessageDecoder_new();
+    connection->slots   = (LoadSlot *) calloc(config->depth, sizeof(LoadSlot));
+
+    if (connection->decoder == NULL || connection->slots == NULL) {
+        Log_println(LOG_ERROR, "Can't allocate connection");
+        return false;
+    }
+
+    if (!LoadRunner_connect(base, total)) {
+        return false;
+    }
+    base->handler.callback = LoadGenerator_callback;
+
+    return true;
+}
+
+/**
+ * level-triggered: responses are read until EAGAIN, EPOLLOUT is
+ * registered only while requests are waiting in the output ring
+ */
+static void
+LoadGenerator_callback(EventHandler *handler, uint32_t events)
+{
+    LoadGeneratorConnection *connection = (LoadGeneratorConnection *) handler;
+    LoadConnection     *base = &(connection->connection);
+    bool                ok   = true;
+
+    /* closed by an earlier event of the same batch */
+    if (base->closed) {
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        ok = LoadGenerator_receive(connection) && LoadRunner_fill(base);
+    } else if (events & EPOLLOUT) {
+        ok = LoadRunner_flush(base);
+    }
+
+    if (!ok) {
+        LoadRunner_close(base);
+    }
+
+    LoadRunner_settle(base);
+}
+
+static bool
+LoadGenerator_receive(LoadGeneratorConnection *connection)
+{
+    LoadThread         *thread = connection->connection.thread;
+    char                buffer[CONFIG_RECV_BUFFER_SIZE];
+    const char         *data;
+    uint32_t            len;
+    ssize_t             num_bytes;
+    Message            *msg;
+    uint64_t            now;
+    bool                ok;
+
+    for (;;) {
+        num_bytes = recv(connection->connection.handler.fd, buffer, sizeof(buffer), 0);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't receive");
+            thread->numReadErrors++;
+            return false;
+        }
+
+        if (num_bytes == 0) {
+            Log_println(LOG_ERROR, "Connection closed by peer");
+            thread->numReadErrors++;
+            return false;
+        }
+
+        /* one time stamp for all responses of the chunk */
+        now  = LoadRunner_now();
+        data = buffer;
+        len  = (uint32_t) num_bytes;
+
+        while ((msg = MessageDecoder_feed(connection->decoder, &data, &len)) != NULL) {
+            ok = LoadGenerator_complete(connection, msg, now);
+            Message_unref(msg);
+
+            if (!ok) {
+                thread->numReadErrors++;
+                return false;
+            }
+        }
+
+        if (connection->decoder->state == MESSAGE_DECODER_FAILED) {
+            thread->numReadErrors++;
+            return false;
+        }
+    }
+}
+
+/**
+ * match the response to its request by nr and record the latency
+ */
+static bool
+LoadGenerator_complete(LoadGeneratorConnection *connection, Message *msg, uint64_t now)
+{
+    LoadThread         *thread = connection->connection.thread;
+    LoadSlot           *slot   = &(connection->slots[msg->nr % thread->runner->depth]);
+
+    if (slot->type == 0 || msg->header.type != slot->type + 1 || msg->header.len != slot->len) {
+        Log_println(LOG_ERROR, "Unexpected response type=%u nr=%u len=%u", msg->header.type, msg->nr, msg->header.len);
+        return false;
+    }
+
+    Histogram_record(thread->histogram, now - slot->intended);
+    Histogram_record(thread->service,   now - slot->sent);
+    __atomic_store_n(&(thread->numReceived), thread->numReceived + 1, __ATOMIC_RELAXED);
+    thread->numBytes += msg->header.len;
+
+    slot->type = 0;
+    connection->connection.numPending--;
+
+    return true;
+}
+
+/**
+ * encode a request of random type and size into the output ring,
+ * the latency is measured from intended
+ */
+static bool
+LoadGenerator_send(LoadConnection *base, uint64_t intended)
+{
+    LoadGeneratorConnection *connection = (LoadGeneratorConnection *) base;
+    LoadThread         *thread    = base->thread;
+    LoadGenerator      *generator = (LoadGenerator *) thread->runner->context;
+    const LoadConfig   *config    = generator->config;
+    const LoadSize     *size      = config->sizes;
+    LoadSlot           *slot;
+    char                header[MESSAGE_HEADER_LEN];
+    uint32_t            weight;
+    uint32_t            idx;
+
+    for (idx = 0; connection->slots[idx].type != 0; idx++) {
+    }
+    slot = &(connection->slots[idx]);
+
+    weight = LoadRunner_random(thread) % generator->sizeWeight;
+    while (weight >= size->weight) {
+        weight -= size->weight;
+        size++;
+    }
+
+    slot->intended = intended;
+    slot->sent     = (config->rate > 0) ? LoadRunner_now() : intended;
+    slot->len  = (uint16_t) (size->min + LoadRunner_random(thread) % (size->max - size->min + 1));
+    slot->type = (LoadRunner_random(thread) % (config->upperWeight + config->lowerWeight) < config->upperWeight) ?
+                 REQUEST_TO_UPPER : REQUEST_TO_LOWER;
+
+    Message_encodeHeader(header, slot->type, 0, slot->len, connection->seq * config->depth + idx);
+
+    if (!RingBuffer_write(base->output, header, MESSAGE_HEADER_LEN) ||
+        (slot->len > 0 && !RingBuffer_write(base->output, (char *) thread->data, slot->len))) {
+        Log_println(LOG_ERROR, "Output buffer full");
+        thread->numWriteErrors++;
+        return false;
+    }
+
+    connection->seq++;
+    base->numPending++;
+    thread->numSent++;
+
+    return true;
+}
+
+/**
+ * the requests in flight are lost with the connection
+ */
+static void
+LoadGenerator_fail(LoadConnection *connection)
+{
+    LoadRunner_close(connection);
+}
+
+static void
+LoadGenerator_close(LoadConnection *base)
+{
+    LoadGeneratorConnection *connection = (LoadGeneratorConnection *) base;
+
+    free(connection->slots);
+    MessageDecoder_delete(connection->decoder);
+
+    connection->slots   = NULL;
+    connection->decoder = NULL;
+}
+
+static void
+LoadGenerator_expire(LoadConnection *base, uint64_t now)
+{
+    LoadGeneratorConnection *connection = (LoadGeneratorConnection *) base;
+    uint32_t            idx;
+
+    for (idx = 0; idx < base->thread->runner->depth; idx++) {
+        if (connection->slots[idx].type != 0) {
+            LoadRunner_unanswered(base, connection->slots[idx].intended, connection->slots[idx].sent, now);
+        }
+    }
+}
+
+static void
+LoadGenerator_report(LoadRunner *runner, double elapsed)
+{
+    LoadTotals          totals;
+
+    if (!LoadRunner_sum(runner, &totals)) {
+        return;
+    }
+
+    if (elapsed <= 0.0) {
+        elapsed = 1e-9;
+    }
+
+    printf("%u connection(s), %u thread(s), %u in flight, %.2f s\n",
+           runner->numConnections, runner->numThreads, runner->depth, elapsed);
+    printf("  Requests    %" PRIu64 " sent, %" PRIu64 " answered, %" PRIu64 " unanswered, %" PRIu64 " error(s)\n",
+           totals.numSent, totals.numReceived, totals.numUnanswered,
+           totals.numConnectErrors + totals.numReadErrors + totals.numWriteErrors);
+    printf("  Throughput  %.1f msgs/s, %.2f MiB/s\n",
+           totals.numReceived / elapsed, totals.numBytes / elapsed / (1024.0 * 1024.0));
+    LoadRunner_printLatency(runner, &totals, "msgs/s");
+
+    LoadRunner_freeTotals(&totals);
+}
@@ -0,0 +1,880 @@
+#define _GNU_SOURCE
+
+#include "LoadRunner.h"
+#include "Connector.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <stddef.h>
+
+#include <signal.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/timerfd.h>
+
+static bool     LoadRunner_createThread     (LoadThread *thread);
+static void     LoadRunner_deleteThread     (LoadThread *thread);
+static void    *LoadRunner_thread           (void *arg);
+static void     LoadRunner_timerCallback    (EventHandler *handler, uint32_t events);
+static void     LoadRunner_schedule         (LoadThread *thread);
+static void     LoadRunner_dispatch         (LoadThread *thread);
+static void     LoadRunner_finish           (LoadThread *thread);
+static void     LoadRunner_expire           (LoadThread *thread, uint64_t now);
+static bool     LoadRunner_claim            (LoadThread *thread);
+static double   LoadRunner_gap              (LoadThread *thread);
+
+/**
+ * one connection with one request in flight, closed loop
+ */
+void
+LoadRunner_init(LoadRunner *this, const LoadProtocol *protocol, void *context, struct addrinfo *addrinfo)
+{
+    memset(this, 0, sizeof(LoadRunner));
+
+    this->protocol       = protocol;
+    this->context        = context;
+    this->addrinfo       = addrinfo;
+    this->numConnections = 1;
+    this->numThreads     = 1;
+    this->depth          = 1;
+}
+
+/**
+ * open all connections, run the threads until the duration is over, the number
+ * of messages is answered or SIGINT / SIGTERM, then let the protocol report
+ *
+ * @return                          false if it failed or the schedule couldn't be kept
+ */
+bool
+LoadRunner_run(LoadRunner *this)
+{
+    sigset_t            mask;
+    struct timespec     timeout = { 1, 0 };
+    uint64_t            start;
+    uint64_t            stop;
+    uint64_t            now;
+    uint64_t            numOverflows = 0;
+    uint64_t            numReceived;
+    uint64_t            lastReceived = 0;
+    uint32_t            numStarted;
+    uint32_t            idx;
+    int                 signal_;
+    int                 status;
+
+    this->running = true;
+
+    if (this->numThreads == 0) {
+        long cores       = sysconf(_SC_NPROCESSORS_ONLN);
+        this->numThreads = (cores > 0) ? (uint32_t) cores : 1;
+    }
+    if (this->numThreads > this->numConnections) {
+        this->numThreads = this->numConnections;
+    }
+
+    /* SIGINT and SIGTERM end the run early, SIGUSR1 when all threads are done,
+     * they're only received here */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    this->main = pthread_self();
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+        Log_println(LOG_FATAL, "Can't block signals");
+        return false;
+    }
+
+    if ((this->threads = (LoadThread *) calloc(this->numThreads, sizeof(LoadThread))) == NULL) {
+        Log_errno(LOG_FATAL, errno, "Can't allocate load threads");
+        return false;
+    }
+
+    for (idx = 0; idx < this->numThreads; idx++) {
+        this->threads[idx].timer.fd = -1;
+    }
+
+    /* connections are spread evenly, all of them are open before the clock starts */
+    for (idx = 0; idx < this->numThreads; idx++) {
+        this->threads[idx].idx            = idx;
+        this->threads[idx].runner         = this;
+        this->threads[idx].numConnections = this->numConnections / this->numThreads +
+                                            (idx < this->numConnections % this->numThreads ? 1 : 0);
+
+        if (!LoadRunner_createThread(&(this->threads[idx]))) {
+            break;
+        }
+    }
+
+    if (idx < this->numThreads) {
+        for (idx = 0; idx < this->numThreads; idx++) {
+            LoadRunner_deleteThread(&(this->threads[idx]));
+        }
+        free(this->threads);
+        return false;
+    }
+
+    Log_println(LOG_INFO, "%u connection(s) on %u thread(s), %u request(s) in flight per connection",
+                this->numConnections, this->numThreads, this->depth);
+    if (this->rate > 0) {
+        Log_println(LOG_INFO, "Open loop: %u request(s) per second, %s arrival",
+                    this->rate, this->arrival == LOAD_ARRIVAL_POISSON ? "poisson" : "fixed");
+    }
+
+    start = LoadRunner_now();
+
+    for (numStarted = 0; numStarted < this->numThreads; numStarted++) {
+        __atomic_add_fetch(&(this->numRunning), 1, __ATOMIC_RELAXED);
+
+        if ((status = pthread_create(&(this->threads[numStarted].tid), NULL, LoadRunner_thread, &(this->threads[numStarted])))) {
+            Log_println(LOG_ERROR, "Can't create load thread: error = %d", status);
+            __atomic_sub_fetch(&(this->numRunning), 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+
+    /* progress once a second */
+    while (__atomic_load_n(&(this->numRunning), __ATOMIC_ACQUIRE) > 0) {
+        if ((signal_ = sigtimedwait(&mask, NULL, &timeout)) == SIGUSR1) {
+            continue;
+        } else if (signal_ > 0) {
+            Log_println(LOG_INFO, "Received signal %s", strsignal(signal_));
+            break;
+        }
+
+        now = LoadRunner_now();
+        if (this->duration > 0 && now - start >= this->duration * 1000000000ULL) {
+            break;
+        }
+
+        for (numReceived = 0, idx = 0; idx < numStarted; idx++) {
+            numReceived += __atomic_load_n(&(this->threads[idx].numReceived), __ATOMIC_RELAXED);
+        }
+        Log_println(LOG_INFO, "%" PRIu64 " response(s), %" PRIu64 " in the last second",
+                    numReceived, numReceived - lastReceived);
+        lastReceived = numReceived;
+    }
+
+    /* requests still in flight aren't waited for, they count as unanswered */
+    __atomic_store_n(&(this->running), false, __ATOMIC_RELEASE);
+    now  = LoadRunner_now();
+    stop = now;
+
+    /* all done before: the time of the last response */
+    if (__atomic_load_n(&(this->numRunning), __ATOMIC_ACQUIRE) == 0) {
+        for (now = start, idx = 0; idx < numStarted; idx++) {
+            if (this->threads[idx].finished > now) {
+                now = this->threads[idx].finished;
+            }
+        }
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        EventLoop_stop(this->threads[idx].loop);
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        if ((status = pthread_join(this->threads[idx].tid, NULL))) {
+            Log_println(LOG_ERROR, "Can't join load thread: error = %d", status);
+        }
+    }
+
+    /* a stall at the end must show up in the percentiles, not vanish with the requests */
+    for (idx = 0; idx < numStarted; idx++) {
+        LoadRunner_expire(&(this->threads[idx]), stop);
+        numOverflows += this->threads[idx].numOverflows;
+    }
+
+    this->protocol->report(this, (now - start) / 1e9);
+
+    /* their latency is unknown, the percentiles are too low */
+    if (numOverflows > 0) {
+        Log_println(LOG_ERROR, "%" PRIu64 " request(s) dropped, the backlog was full: the latency isn't valid", numOverflows);
+    }
+
+    for (idx = 0; idx < this->numThreads; idx++) {
+        LoadRunner_deleteThread(&(this->threads[idx]));
+    }
+    free(this->threads);
+
+    return numOverflows == 0;
+}
+
+static bool
+LoadRunner_createThread(LoadThread *thread)
+{
+    LoadRunner         *runner = thread->runner;
+    uint32_t            idx;
+
+    thread->random      = (uint64_t) time(NULL) ^ ((thread->idx + 1) * 0x9E3779B97F4A7C15ULL);
+    thread->loop        = EventLoop_new();
+    thread->histogram   = Histogram_new();
+    thread->service     = Histogram_new();
+    thread->connections = (char *) calloc(thread->numConnections, runner->protocol->connectionSize);
+
+    if (thread->loop == NULL || thread->histogram == NULL || thread->service == NULL || thread->connections == NULL) {
+        Log_println(LOG_ERROR, "Can't allocate load thread %u", thread->idx);
+        return false;
+    }
+
+    /* open loop: the thread's share of the rate, by its connections */
+    if (runner->rate > 0) {
+        thread->interval       = 1e9 * runner->numConnections / ((double) runner->rate * thread->numConnections);
+        thread->timer.callback = LoadRunner_timerCallback;
+        thread->backlog        = (uint64_t *) malloc(LOAD_BACKLOG * sizeof(uint64_t));
+
+        if (thread->backlog == NULL) {
+            Log_errno(LOG_ERROR, errno, "Can't allocate backlog");
+            return false;
+        }
+
+        if ((thread->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+            Log_errno(LOG_ERROR, errno, "Can't create timerfd");
+            return false;
+        }
+    }
+
+    if (!runner->protocol->init(thread)) {
+        return false;
+    }
+
+    for (idx = 0; idx < thread->numConnections; idx++) {
+        LoadRunner_connection(thread, idx)->thread     = thread;
+        LoadRunner_connection(thread, idx)->handler.fd = -1;
+    }
+
+    for (idx = 0; idx < thread->numConnections; idx++) {
+        thread->numActive++;
+
+        if (!runner->protocol->open(LoadRunner_connection(thread, idx))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void
+LoadRunner_deleteThread(LoadThread *thread)
+{
+    uint32_t            idx;
+
+    for (idx = 0; thread->connections != NULL && idx < thread->numConnections; idx++) {
+        LoadRunner_close(LoadRunner_connection(thread, idx));
+    }
+
+    if (thread->timer.fd != -1) {
+        close(thread->timer.fd);
+    }
+
+    free(thread->connections);
+    free(thread->data);
+    free(thread->backlog);
+    Histogram_delete(thread->service);
+    Histogram_delete(thread->histogram);
+    EventLoop_delete(thread->loop);
+}
+
+LoadConnection *
+LoadRunner_connection(LoadThread *thread, uint32_t idx)
+{
+    return (LoadConnection *) (thread->connections + (size_t) idx * thread->runner->protocol->connectionSize);
+}
+
+/**
+ * blocking connect (raced over all addresses), non-blocking afterwards
+ *
+ * @param   outputSize              bytes of all requests in flight, the output ring is allocated once
+ */
+bool
+LoadRunner_connect(LoadConnection *connection, uint32_t outputSize)
+{
+    LoadRunner         *runner = connection->thread->runner;
+    uint32_t            bits   = LOAD_OUTPUT_MIN;
+    int                 one    = 1;
+    int                 sockfd;
+
+    if (connection->output == NULL) {
+        while ((1U << bits) <= outputSize) {
+            bits++;
+        }
+
+        if ((connection->output = RingBuffer_newWithFlags(bits, RINGBUFFER_FLAG_SPSC)) == NULL) {
+            Log_println(LOG_ERROR, "Can't allocate connection");
+            return false;
+        }
+    }
+
+    if ((sockfd = Connector_connect(runner->addrinfo, runner->connectDelay, runner->connectTimeout)) == -1) {
+        connection->thread->numConnectErrors++;
+        return false;
+    }
+    connection->handler.fd = sockfd;
+
+    /* reconnects go to the same address */
+    connection->peerLen = sizeof(connection->peer);
+    if (getpeername(sockfd, (struct sockaddr *) &(connection->peer), &(connection->peerLen)) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't get peer address");
+        connection->peerLen = 0;
+    }
+
+    /* small requests must not wait for the previous ones to be acknowledged */
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't set TCP_NODELAY");
+    }
+
+    if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't set non-blocking mode");
+        connection->thread->numConnectErrors++;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * non-blocking connect to the address of the first connect, it mustn't stall
+ * the other connections of the thread: the loop reports EPOLLOUT once it's
+ * done and the protocol calls LoadRunner_connected() before anything else
+ */
+bool
+LoadRunner_reconnect(LoadConnection *connection)
+{
+    LoadThread         *thread  = connection->thread;
+    unsigned int        timeout = thread->runner->connectTimeout;
+    int                 sockfd;
+
+    if (connection->handler.fd != -1) {
+        close(connection->handler.fd);
+        connection->handler.fd = -1;
+    }
+
+    if (connection->peerLen == 0) {
+        thread->numConnectErrors++;
+        return false;
+    }
+
+    if ((sockfd = socket(connection->peer.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't create socket");
+        thread->numConnectErrors++;
+        return false;
+    }
+    connection->handler.fd = sockfd;
+
+    /* bounded like the first connect, the SYN isn't retried for minutes */
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout)) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't set TCP_USER_TIMEOUT");
+    }
+
+    if (connect(sockfd, (struct sockaddr *) &(connection->peer), connection->peerLen) == -1 && errno != EINPROGRESS) {
+        Log_errno(LOG_WARN, errno, "Can't reconnect");
+        thread->numConnectErrors++;
+        return false;
+    }
+
+    connection->connecting = true;
+    connection->events     = EPOLLOUT;
+
+    if (!EventLoop_add(thread->loop, &(connection->handler), connection->events)) {
+        thread->numConnectErrors++;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * after an event of a reconnecting connection: false if the connect failed,
+ * connecting stays set while it's in progress (an event of the old socket)
+ */
+bool
+LoadRunner_connected(LoadConnection *connection)
+{
+    LoadThread         *thread   = connection->thread;
+    struct sockaddr_storage peer;
+    socklen_t           peerLen  = sizeof(peer);
+    unsigned int        timeout  = 0;
+    int                 one      = 1;
+    int                 error    = 0;
+    socklen_t           errorLen = sizeof(error);
+
+    if (getsockopt(connection->handler.fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1) {
+        error = errno;
+    }
+
+    if (error == 0 && getpeername(connection->handler.fd, (struct sockaddr *) &peer, &peerLen) == -1) {
+        if (errno == ENOTCONN) {
+            return true;
+        }
+        error = errno;
+    }
+
+    connection->connecting = false;
+
+    if (error != 0) {
+        Log_errno(LOG_WARN, error, "Can't reconnect");
+        thread->numConnectErrors++;
+        return false;
+    }
+
+    if (setsockopt(connection->handler.fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout)) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't reset TCP_USER_TIMEOUT");
+    }
+
+    /* small requests must not wait for the previous ones to be acknowledged */
+    if (setsockopt(connection->handler.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't set TCP_NODELAY");
+    }
+
+    connection->events = EPOLLIN | EPOLLRDHUP;
+    if (!EventLoop_modify(thread->loop, &(connection->handler), connection->events)) {
+        thread->numConnectErrors++;
+        return false;
+    }
+
+    return true;
+}
+
+static void *
+LoadRunner_thread(void *arg)
+{
+    LoadThread         *thread = (LoadThread *) arg;
+    LoadRunner         *runner = thread->runner;
+    LoadConnection     *connection;
+    uint32_t            idx;
+
+    for (idx = 0; idx < thread->numConnections; idx++) {
+        connection         = LoadRunner_connection(thread, idx);
+        connection->events = EPOLLIN | EPOLLRDHUP;
+
+        if (!EventLoop_add(thread->loop, &(connection->handler), connection->events)) {
+            thread->numConnectErrors++;
+            LoadRunner_close(connection);
+        } else if (!LoadRunner_fill(connection)) {
+            LoadRunner_close(connection);
+        }
+    }
+
+    /* the first request is due right away */
+    if (thread->timer.fd != -1) {
+        thread->next = (double) LoadRunner_now();
+
+        if (!EventLoop_add(thread->loop, &(thread->timer), EPOLLIN)) {
+            thread->exhausted = true;
+            LoadRunner_finish(thread);
+        } else {
+            LoadRunner_schedule(thread);
+        }
+    }
+
+    if (thread->numActive > 0) {
+        EventLoop_run(thread->loop);
+    }
+
+    thread->finished = LoadRunner_now();
+    if (__atomic_sub_fetch(&(runner->numRunning), 1, __ATOMIC_RELEASE) == 0) {
+        pthread_kill(runner->main, SIGUSR1);
+    }
+
+    return NULL;
+}
+
+/**
+ * up to depth in flight: closed loop a new request for every response,
+ * open loop the due requests of the backlog
+ */
+bool
+LoadRunner_fill(LoadConnection *connection)
+{
+    LoadThread         *thread = connection->thread;
+    LoadRunner         *runner = thread->runner;
+    uint64_t            intended;
+
+    while (connection->numPending < runner->depth) {
+        if (runner->rate > 0) {
+            if (thread->head == thread->tail) {
+                break;
+            }
+            intended     = thread->backlog[thread->head];
+            thread->head = (thread->head + 1) & (LOAD_BACKLOG - 1);
+        } else if (LoadRunner_claim(thread)) {
+            intended     = LoadRunner_now();
+        } else {
+            break;
+        }
+
+        if (!runner->protocol->send(connection, intended)) {
+            return false;
+        }
+    }
+
+    return LoadRunner_flush(connection);
+}
+
+/**
+ * the thread is exhausted once the duration is over or all messages are claimed
+ */
+static bool
+LoadRunner_claim(LoadThread *thread)
+{
+    LoadRunner         *runner = thread->runner;
+
+    if (!thread->exhausted &&
+        (!__atomic_load_n(&(runner->running), __ATOMIC_ACQUIRE) ||
+         (runner->numMessages > 0 &&
+          __atomic_fetch_add(&(runner->numStarted), 1, __ATOMIC_RELAXED) >= runner->numMessages))) {
+        thread->exhausted = true;
+    }
+
+    return !thread->exhausted;
+}
+
+/**
+ * take all requests which are due by now, however late the timer fired
+ */
+static void
+LoadRunner_timerCallback(EventHandler *handler, uint32_t events)
+{
+    LoadThread         *thread = (LoadThread *) ((char *) handler - offsetof(LoadThread, timer));
+    uint64_t            expirations;
+    uint64_t            now    = LoadRunner_now();
+
+    if (read(handler->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        Log_errno(LOG_ERROR, errno, "Can't read timerfd");
+    }
+
+    if (thread->next <= now && now - (uint64_t) thread->next > thread->maxLag) {
+        thread->maxLag = now - (uint64_t) thread->next;
+    }
+
+    while (thread->next <= now && LoadRunner_claim(thread)) {
+        if (((thread->tail + 1) & (LOAD_BACKLOG - 1)) == thread->head) {
+            thread->numOverflows++;
+        } else {
+            thread->backlog[thread->tail] = (uint64_t) thread->next;
+            thread->tail                  = (thread->tail + 1) & (LOAD_BACKLOG - 1);
+        }
+        thread->next += LoadRunner_gap(thread);
+    }
+
+    LoadRunner_dispatch(thread);
+
+    if (thread->exhausted) {
+        LoadRunner_finish(thread);
+    } else {
+        LoadRunner_schedule(thread);
+    }
+
+    if (thread->numActive == 0) {
+        thread->loop->running = false;
+    }
+}
+
+/**
+ * arm the timer absolute, it never drifts
+ */
+static void
+LoadRunner_schedule(LoadThread *thread)
+{
+    struct itimerspec   timer;
+    uint64_t            next = (uint64_t) thread->next;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec  = next / 1000000000ULL;
+    timer.it_value.tv_nsec = next % 1000000000ULL;
+
+    if (timerfd_settime(thread->timer.fd, TFD_TIMER_ABSTIME, &timer, NULL) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't arm timerfd");
+    }
+}
+
+/**
+ * one due request per connection with room in turn, the rest stays in the backlog
+ */
+static void
+LoadRunner_dispatch(LoadThread *thread)
+{
+    LoadRunner         *runner = thread->runner;
+    LoadConnection     *connection;
+    uint32_t            numFull;
+    uint64_t            intended;
+
+    for (numFull = 0; thread->head != thread->tail && numFull < thread->numConnections; ) {
+        connection             = LoadRunner_connection(thread, thread->nextConnection);
+        thread->nextConnection = (thread->nextConnection + 1) % thread->numConnections;
+
+        if (connection->closed || connection->connecting || connection->numPending >= runner->depth) {
+            numFull++;
+            continue;
+        }
+        numFull = 0;
+
+        intended     = thread->backlog[thread->head];
+        thread->head = (thread->head + 1) & (LOAD_BACKLOG - 1);
+
+        if (!runner->protocol->send(connection, intended) || !LoadRunner_flush(connection)) {
+            runner->protocol->fail(connection);
+        }
+    }
+}
+
+/**
+ * close the connections without requests in flight, the others when their last response is in
+ */
+static void
+LoadRunner_finish(LoadThread *thread)
+{
+    LoadConnection     *connection;
+    uint32_t            idx;
+
+    for (idx = 0; idx < thread->numConnections; idx++) {
+        connection = LoadRunner_connection(thread, idx);
+
+        if (!connection->closed && connection->numPending == 0) {
+            LoadRunner_close(connection);
+        }
+    }
+}
+
+/**
+ * send as much as possible, wait for EPOLLOUT while something is left
+ */
+bool
+LoadRunner_flush(LoadConnection *connection)
+{
+    const char         *span;
+    uint32_t            len;
+    uint32_t            events;
+    ssize_t             num_bytes;
+
+    for (;;) {
+        len = 1;
+        if ((span = RingBuffer_readableSpan(connection->output, &len)) == NULL) {
+            break;
+        }
+
+        num_bytes = send(connection->handler.fd, span, len, MSG_NOSIGNAL);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            Log_errno(LOG_WARN, errno, "Can't send");
+            connection->thread->numWriteErrors++;
+            return false;
+        }
+
+        RingBuffer_consume(connection->output, (uint32_t) num_bytes);
+    }
+
+    events = EPOLLIN | EPOLLRDHUP | (RingBuffer_canRead(connection->output) ? EPOLLOUT : 0);
+    if (events != connection->events) {
+        connection->events = events;
+        if (!EventLoop_modify(connection->thread->loop, &(connection->handler), events)) {
+            connection->thread->numWriteErrors++;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+LoadRunner_close(LoadConnection *connection)
+{
+    if (connection->closed) {
+        return;
+    }
+    connection->closed = true;
+    connection->thread->numActive--;
+
+    if (connection->handler.fd != -1) {
+        close(connection->handler.fd);
+        connection->handler.fd = -1;
+    }
+
+    RingBuffer_delete(connection->output);
+    connection->output = NULL;
+
+    connection->thread->runner->protocol->close(connection);
+}
+
+/**
+ * after a callback: out of requests and nothing in flight anymore,
+ * the loop ends with the last connection
+ */
+void
+LoadRunner_settle(LoadConnection *connection)
+{
+    LoadThread         *thread = connection->thread;
+
+    if (!connection->closed && connection->numPending == 0 && thread->exhausted) {
+        LoadRunner_close(connection);
+    }
+
+    if (thread->numActive == 0) {
+        thread->loop->running = false;
+    }
+}
+
+/**
+ * latency and service time of a request in flight which was never answered
+ */
+void
+LoadRunner_unanswered(LoadConnection *connection, uint64_t intended, uint64_t sent, uint64_t now)
+{
+    LoadThread         *thread = connection->thread;
+
+    Histogram_record(thread->histogram, now > intended ? now - intended : 0);
+    Histogram_record(thread->service,   now > sent     ? now - sent     : 0);
+    thread->numUnanswered++;
+}
+
+/**
+ * after the thread ended: the requests in flight and the due ones of
+ * the backlog are recorded with the latency they had by now
+ */
+static void
+LoadRunner_expire(LoadThread *thread, uint64_t now)
+{
+    LoadConnection     *connection;
+    uint32_t            idx;
+
+    for (idx = 0; idx < thread->numConnections; idx++) {
+        connection = LoadRunner_connection(thread, idx);
+
+        if (!connection->closed && connection->numPending > 0) {
+            thread->runner->protocol->expire(connection, now);
+        }
+    }
+
+    for (; thread->head != thread->tail; thread->head = (thread->head + 1) & (LOAD_BACKLOG - 1)) {
+        Histogram_record(thread->histogram, now > thread->backlog[thread->head] ? now - thread->backlog[thread->head] : 0);
+        thread->numUnanswered++;
+    }
+}
+
+/**
+ * merge the histograms and counters of all threads
+ */
+bool
+LoadRunner_sum(LoadRunner *this, LoadTotals *totals)
+{
+    LoadThread         *thread;
+    uint32_t            idx;
+
+    memset(totals, 0, sizeof(LoadTotals));
+
+    if ((totals->histogram = Histogram_new()) == NULL || (totals->service = Histogram_new()) == NULL) {
+        LoadRunner_freeTotals(totals);
+        return false;
+    }
+
+    for (idx = 0; idx < this->numThreads; idx++) {
+        thread = &(this->threads[idx]);
+
+        Histogram_add(totals->histogram, thread->histogram);
+        Histogram_add(totals->service,   thread->service);
+        totals->numSent          += thread->numSent;
+        totals->numReceived      += thread->numReceived;
+        totals->numBytes         += thread->numBytes;
+        totals->numRejected      += thread->numRejected;
+        totals->numConnectErrors += thread->numConnectErrors;
+        totals->numReadErrors    += thread->numReadErrors;
+        totals->numWriteErrors   += thread->numWriteErrors;
+        totals->numReconnects    += thread->numReconnects;
+        totals->numUnanswered    += thread->numUnanswered;
+        totals->numOverflows     += thread->numOverflows;
+        if (thread->maxLag > totals->maxLag) {
+            totals->maxLag = thread->maxLag;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * connect statistics and percentiles, open loop: latency from the
+ * intended send time, service time from the actual one
+ *
+ * @param   unit                    of the rate, e.g. "req/s"
+ */
+void
+LoadRunner_printLatency(LoadRunner *this, const LoadTotals *totals, const char *unit)
+{
+    Connector_printStats(AF_INET6);
+    Connector_printStats(AF_INET);
+
+    if (this->rate > 0) {
+        printf("  Schedule    %u %s %s, timer %.1f us late at most, %" PRIu64 " dropped (backlog full)\n",
+               this->rate, unit, this->arrival == LOAD_ARRIVAL_POISSON ? "poisson" : "fixed",
+               totals->maxLag / 1e3, totals->numOverflows);
+        if (totals->numOverflows > 0) {
+            printf("  INVALID     %" PRIu64 " request(s) dropped, the percentiles are too low\n", totals->numOverflows);
+        }
+        Histogram_print(totals->histogram, "Latency");
+        Histogram_print(totals->service,   "Service");
+    } else {
+        Histogram_print(totals->histogram, "Latency");
+    }
+}
+
+void
+LoadRunner_freeTotals(LoadTotals *totals)
+{
+    Histogram_delete(totals->service);
+    Histogram_delete(totals->histogram);
+}
+
+/**
+ * xorshift64*, one state per thread
+ */
+uint64_t
+LoadRunner_random(LoadThread *thread)
+{
+    thread->random ^= thread->random >> 12;
+    thread->random ^= thread->random << 25;
+    thread->random ^= thread->random >> 27;
+
+    return thread->random * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * ns to the next request, exponentially distributed for poisson arrivals
+ */
+static double
+LoadRunner_gap(LoadThread *thread)
+{
+    double              uniform;
+
+    if (thread->runner->arrival != LOAD_ARRIVAL_POISSON) {
+        return thread->interval;
+    }
+
+    /* (0, 1], never log(0) */
+    uniform = ((LoadRunner_random(thread) >> 11) + 1) * (1.0 / 9007199254740992.0);
+
+    return -log(uniform) * thread->interval;
+}
+
+uint64_t
+LoadRunner_now(void)
+{
+    struct timespec     now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
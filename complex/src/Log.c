@@ -1,232 +1,415 @@
 #include "Log.h"
+#include "RingBuffer.h"
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <fcntl.h>
 
+#include <sys/uio.h>
+#include <sys/syscall.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
-static bool Log_header(LOG_PARAMETER_DECLARATION);
+/**
+ * one formatted line, written to the sink at once
+ */
+typedef struct {
+    char                buffer[LOG_LINE_MAX];
+    uint32_t            len;
+} LogLine;
 
-/* NOT thread-safe! */
+/**
+ * per thread: the header parts which don't change with every line
+ */
+typedef struct {
+    time_t              second;                 /**< of the formatted stamp */
+    uint8_t             flags;                  /**< the stamp was formatted with */
+    char                stamp[32];
+    uint32_t            stampLen;
+    char                id[48];                 /**< "[pid:tid]" */
+    uint32_t            idLen;
+} LogCache;
+
+/**
+ * trace records of one thread, written with one write() when full
+ */
+typedef struct {
+    char                data[LOG_TRACE_BUFFER_SIZE];
+    uint32_t            len;
+    uint32_t            tid;
+} LogTraceBuffer;
+
+/**
+ * async mode: lines of one thread, the thread produces, the flusher consumes
+ */
+typedef struct _LogBuffer {
+    RingBuffer         *ring;                   /**< SPSC and mirrored: one span per writev entry */
+    struct _LogBuffer  *next;                   /**< list of all thread buffers */
+    bool                orphaned;               /**< thread exited (atomic), freed when drained */
+} LogBuffer;
+
+static bool     Log_header      (LogLine *logLine, LOG_PARAMETER_DECLARATION);
+static void     Log_formatStamp (LogCache *cache, time_t second);
+static void     Log_appendRaw   (LogLine *line, const char *str, uint32_t len);
+static void     Log_appendUsec  (LogLine *line, long usec);
+static void     Log_vformat     (LogLine *line, const char *format, va_list args);
+static void     Log_format      (LogLine *line, const char *format, ...)    __attribute__ ((format (printf, 2, 3)));
+static void     Log_write       (LogLine *line);
+static bool     Log_push        (LogBuffer *buffer, LogLine *line);
+static LogBuffer *Log_threadBuffer(void);
+static void     Log_threadExit  (void *arg);
+static void    *Log_flusherThread(void *arg);
+static void     Log_flushBuffers(void);
+static void     Log_writeBuffers(struct iovec *iov, LogBuffer **pending, uint32_t *lengths, int num);
+static void     Log_writeAll    (struct iovec *iov, int num);
+static LogTraceBuffer *Log_traceBuffer(void);
+static void     Log_traceExit   (void *arg);
+static void     Log_traceAppend (LogTraceBuffer *buffer, const void *data, uint32_t len);
+static void     Log_traceString (LogTraceBuffer *buffer, const char *str);
+static void     Log_traceFlush  (LogTraceBuffer *buffer);
+
+/* the mutex serializes the sink in sync mode, in async mode it
+ * protects the buffer list and the flusher's conditions */
 
 typedef struct {
     FILE               *stream;
-    LogLevel            level;
     uint8_t             flags;
     pthread_mutex_t     mutex;
+    bool                async;                  /**< lines go to the thread buffers (atomic) */
+    LogOverflow         overflow;
+    LogBuffer          *buffers;
+    uint32_t            dropped;                /**< lines dropped since the last flush (atomic) */
+    pthread_t           flusher;
+    pthread_cond_t      wakeup;                 /**< a buffer is half full or a thread waits */
+    pthread_cond_t      drained;                /**< the flusher finished a round */
 } Log;
 
 Log logger = {
-    .stream = 0,
-    .level  = 0,
-    .flags  = 0,
-    .mutex  = PTHREAD_MUTEX_INITIALIZER
+    .stream  = 0,
+    .flags   = 0,
+    .mutex   = PTHREAD_MUTEX_INITIALIZER,
+    .wakeup  = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER
+};
+
+/* read by every log site (relaxed), nothing is logged before Log_init */
+LogLevel log_level = LOG_NONE_PRIVATE;
+
+static const char *levelStr[] = {
+    [LOG_FATAL_PRIVATE] = "[FATAL] ",
+    [LOG_ERROR_PRIVATE] = "[ERROR] ",
+    [LOG_WARN_PRIVATE]  = "[WARN ] ",
+    [LOG_INFO_PRIVATE]  = "[INFO ] ",
+    [LOG_DEBUG_PRIVATE] = "[DEBUG] "
 };
 
+static __thread LogCache            threadCache;
+static __thread LogBuffer          *threadBuffer;
+static __thread bool                threadUnbuffered;   /**< allocating (it logs itself) or failed */
+
+static pthread_key_t                exitKey;
+static bool                         exitKeyCreated;
+
+/* Log_trace sites of all linked objects, absent if there are none */
+extern LogTraceSite                 __start_log_trace[] __attribute__ ((weak));
+extern LogTraceSite                 __stop_log_trace[]  __attribute__ ((weak));
+
+/* read by every trace site (relaxed) */
+bool log_trace = false;
+
+static int                          traceFd = -1;
+static __thread LogTraceBuffer     *traceBuffer;
+static pthread_key_t                traceKey;
+static bool                         traceKeyCreated;
+
 /*** MESSAGES ****************************************************************/
 
 void
 Log_init(FILE *stream, LogLevel level, uint8_t flags)
 {
     logger.stream = stream;
-    logger.level  = level;
+    __atomic_store_n(&log_level, level, __ATOMIC_RELAXED);
     logger.flags  = flags;
 }
 
+/**
+ * from now on threads format into their own buffers without locking,
+ * a background thread writes them to the stream with writev()
+ *
+ * @param   overflow                LOG_OVERFLOW_DROP or LOG_OVERFLOW_BLOCK if a thread's buffer is full
+ */
+bool
+Log_startAsync(LogOverflow overflow)
+{
+    int                 status;
+
+    if (logger.async) {
+        return true;
+    }
+
+    if (!exitKeyCreated) {
+        if (pthread_key_create(&exitKey, Log_threadExit)) {
+            return false;
+        }
+        exitKeyCreated = true;
+    }
+
+    fflush(logger.stream);
+    logger.overflow = overflow;
+    __atomic_store_n(&(logger.async), true, __ATOMIC_RELEASE);
+
+    if ((status = pthread_create(&(logger.flusher), NULL, Log_flusherThread, NULL))) {
+        __atomic_store_n(&(logger.async), false, __ATOMIC_RELEASE);
+        Log_println(LOG_ERROR, "Can't create log flusher thread: error = %d", status);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * drain all buffers and continue synchronously,
+ * call it after the other threads stopped logging
+ */
+void
+Log_stop(void)
+{
+    int                 status;
+
+    if (!logger.async) {
+        return;
+    }
+
+    pthread_mutex_lock(&(logger.mutex));
+    __atomic_store_n(&(logger.async), false, __ATOMIC_RELEASE);
+    pthread_cond_signal(&(logger.wakeup));
+    pthread_cond_broadcast(&(logger.drained));
+    pthread_mutex_unlock(&(logger.mutex));
+
+    if ((status = pthread_join(logger.flusher, NULL))) {
+        Log_println(LOG_ERROR, "Can't join log flusher thread: error = %d", status);
+    }
+}
+
 static bool
-Log_header(LOG_PARAMETER_DECLARATION)
+Log_header(LogLine *logLine, LOG_PARAMETER_DECLARATION)
 {
+    LogCache           *cache = &threadCache;
+    struct timespec     now;
 
-    if (logger.stream <= 0 || level > logger.level) {
+    if (logger.stream <= 0 || level > log_level) {
         return false;
     }
 
     if ((logger.flags & LOG_FLAG_TIME) || (logger.flags & LOG_FLAG_DATE)) {
-        time_t      unixtime;
-        struct tm   now;
-        unixtime = time(NULL);
-        localtime_r(&unixtime, &now);
-
-        /* time */
-        if (!(logger.flags & LOG_FLAG_DATE)) {
-            fprintf(logger.stream, "[%02d:%02d:%02d]",                now.tm_hour,
-                                                                      now.tm_min,
-                                                                      now.tm_sec);
-
-        /* date */
-        } else if (!(logger.flags & LOG_FLAG_TIME)) {
-            fprintf(logger.stream, "[%02d.%02d.%02d]",                now.tm_mday,
-                                                                      now.tm_mon + 1,
-                                                                      now.tm_year + 1900);
-
-        /* both */
-        } else {
-            fprintf(logger.stream, "[%02d.%02d.%02d %02d:%02d:%02d]", now.tm_mday,
-                                                                      now.tm_mon + 1,
-                                                                      now.tm_year + 1900,
-                                                                      now.tm_hour,
-                                                                      now.tm_min,
-                                                                      now.tm_sec);
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        /* localtime_r and the formatting only once a second */
+        if (now.tv_sec != cache->second || logger.flags != cache->flags) {
+            Log_formatStamp(cache, now.tv_sec);
+        }
+        Log_appendRaw(logLine, cache->stamp, cache->stampLen);
+
+        if (logger.flags & LOG_FLAG_USEC) {
+            Log_appendUsec(logLine, now.tv_nsec / 1000);
         }
+        Log_appendRaw(logLine, "]", 1);
     }
 
     /* PID / TID */
     if (logger.flags & LOG_FLAG_PID) {
-        fprintf(logger.stream, "[%d:%ld]", getpid(), (long int) pthread_self());
+        if (cache->idLen == 0) {
+            cache->idLen = snprintf(cache->id, sizeof(cache->id), "[%d:%ld]", getpid(), (long int) pthread_self());
+        }
+        Log_appendRaw(logLine, cache->id, cache->idLen);
     }
 
 #ifdef ENABLE_LOG_DEBUG
     if ((logger.flags & LOG_FLAG_FILENAME) && (logger.flags & LOG_FLAG_LINE)) {
-        char filetrunk[20 + 1];
-        char buffer[25 + 1];
-
-        strncpy(filetrunk, filename, 21);
-        filetrunk[20]= '\0';
-        snprintf(buffer, 25, "%s:%d", filetrunk, line);
+        uint32_t start = logLine->len;
 
-        fprintf(logger.stream, "[%-25s]", buffer);
+        /* at most 20 characters of the filename and 24 in total, padded to 25 */
+        Log_format(logLine, "[%.20s:%d", filename, line);
+        if (logLine->len > start + 1 + 24) {
+            logLine->len = start + 1 + 24;
+        }
+        Log_format(logLine, "%*s]", (int) (start + 1 + 25 - logLine->len), "");
 
     } else {
         /* filename */
         if (logger.flags & LOG_FLAG_FILENAME) {
-            fprintf(logger.stream, "[%-20s]", filename);
+            Log_format(logLine, "[%-20s]", filename);
         }
 
         /* line */
         if (logger.flags & LOG_FLAG_LINE) {
-            fprintf(logger.stream, "[%4d]", line);
+            Log_format(logLine, "[%4d]", line);
         }
     }
 
     /* function */
     if (logger.flags & LOG_FLAG_FUNCTION) {
-        fprintf(logger.stream, "[%-40s]", function);
+        Log_format(logLine, "[%-40s]", function);
     }
 #endif
 
-    if      (level == LOG_FATAL_PRIVATE) fprintf(logger.stream, "[FATAL] ");
-    else if (level == LOG_ERROR_PRIVATE) fprintf(logger.stream, "[ERROR] ");
-    else if (level == LOG_WARN_PRIVATE)  fprintf(logger.stream, "[WARN ] ");
-    else if (level == LOG_INFO_PRIVATE)  fprintf(logger.stream, "[INFO ] ");
-    else if (level == LOG_DEBUG_PRIVATE) fprintf(logger.stream, "[DEBUG] ");
+    if (level > LOG_NONE_PRIVATE && level <= LOG_DEBUG_PRIVATE) {
+        Log_appendRaw(logLine, levelStr[level], 8);
+    }
 
     return true;
 }
 
+/**
+ * "[time", "[date" or "[date time" of the second, the caller closes the bracket
+ */
+static void
+Log_formatStamp(LogCache *cache, time_t second)
+{
+    struct tm           now;
+
+    localtime_r(&second, &now);
+
+    /* time */
+    if (!(logger.flags & LOG_FLAG_DATE)) {
+        cache->stampLen = snprintf(cache->stamp, sizeof(cache->stamp), "[%02d:%02d:%02d",                now.tm_hour,
+                                                                                                         now.tm_min,
+                                                                                                         now.tm_sec);
+
+    /* date */
+    } else if (!(logger.flags & LOG_FLAG_TIME)) {
+        cache->stampLen = snprintf(cache->stamp, sizeof(cache->stamp), "[%02d.%02d.%02d",                now.tm_mday,
+                                                                                                         now.tm_mon + 1,
+                                                                                                         now.tm_year + 1900);
+
+    /* both */
+    } else {
+        cache->stampLen = snprintf(cache->stamp, sizeof(cache->stamp), "[%02d.%02d.%02d %02d:%02d:%02d", now.tm_mday,
+                                                                                                         now.tm_mon + 1,
+                                                                                                         now.tm_year + 1900,
+                                                                                                         now.tm_hour,
+                                                                                                         now.tm_min,
+                                                                                                         now.tm_sec);
+    }
+
+    cache->second = second;
+    cache->flags  = logger.flags;
+}
 
 void
-Log_print(LOG_PARAMETER_DECLARATION, const char *format, ...)
+(Log_print)(LOG_PARAMETER_DECLARATION, const char *format, ...)
 {
+    LogLine             logLine = { .len = 0 };
     va_list             args;
 
-    pthread_mutex_lock(&logger.mutex);
+    if (!Log_header(&logLine, LOG_PARAMETER_IMPLEMENTATION)) {
+        return;
+    }
 
-    Log_header(LOG_PARAMETER_IMPLEMENTATION);
     va_start(args, format);
-    vfprintf(logger.stream, format, args);
-    fflush(logger.stream);
+    Log_vformat(&logLine, format, args);
     va_end(args);
 
-    pthread_mutex_unlock(&logger.mutex);
+    Log_write(&logLine);
 }
 
 void
-Log_println(LOG_PARAMETER_DECLARATION, const char *format, ...)
+(Log_println)(LOG_PARAMETER_DECLARATION, const char *format, ...)
 {
+    LogLine             logLine = { .len = 0 };
     va_list             args;
 
-    pthread_mutex_lock(&logger.mutex);
+    if (!Log_header(&logLine, LOG_PARAMETER_IMPLEMENTATION)) {
+        return;
+    }
 
-    Log_header(LOG_PARAMETER_IMPLEMENTATION);
     va_start(args, format);
-    vfprintf(logger.stream, format, args);
-    fprintf(logger.stream, "\n");
-    fflush(logger.stream);
+    Log_vformat(&logLine, format, args);
     va_end(args);
+    Log_format(&logLine, "\n");
 
-    pthread_mutex_unlock(&logger.mutex);
+    Log_write(&logLine);
 }
 
 void
-Log_append(LOG_PARAMETER_DECLARATION, const char *format, ...)
+(Log_append)(LOG_PARAMETER_DECLARATION, const char *format, ...)
 {
+    LogLine             logLine = { .len = 0 };
     va_list             args;
 
-    pthread_mutex_lock(&logger.mutex);
-
     va_start(args, format);
-    vfprintf(logger.stream, format, args);
-    fflush(logger.stream);
+    Log_vformat(&logLine, format, args);
     va_end(args);
 
-    pthread_mutex_unlock(&logger.mutex);
+    Log_write(&logLine);
 }
 
 void
-Log_appendln(LOG_PARAMETER_DECLARATION, const char *format, ...)
+(Log_appendln)(LOG_PARAMETER_DECLARATION, const char *format, ...)
 {
+    LogLine             logLine = { .len = 0 };
     va_list             args;
 
-    pthread_mutex_lock(&logger.mutex);
-
     va_start(args, format);
-    vfprintf(logger.stream, format, args);
-    fprintf(logger.stream, "\n");
-    fflush(logger.stream);
+    Log_vformat(&logLine, format, args);
     va_end(args);
+    Log_format(&logLine, "\n");
 
-    pthread_mutex_unlock(&logger.mutex);
+    Log_write(&logLine);
 }
 
 void
-Log_errno(LOG_PARAMETER_DECLARATION, int errnum, const char *format, ...)
+(Log_errno)(LOG_PARAMETER_DECLARATION, int errnum, const char *format, ...)
 {
+    LogLine             logLine = { .len = 0 };
     va_list             args;
     char                error_str[STRERROR_R_BUFFER_MAX];
 
-    pthread_mutex_lock(&logger.mutex);
+    if (!Log_header(&logLine, LOG_PARAMETER_IMPLEMENTATION)) {
+        return;
+    }
 
-    Log_header(LOG_PARAMETER_IMPLEMENTATION);
     va_start(args, format);
-    vfprintf(logger.stream, format, args);
-    fflush(logger.stream);
+    Log_vformat(&logLine, format, args);
     va_end(args);
 
     if (!strerror_r(errnum, error_str, sizeof(error_str))) {
-        fprintf(logger.stream, ": %s\n", error_str);
+        Log_format(&logLine, ": %s\n", error_str);
     } else {
-        fprintf(logger.stream, ": <lookup error number failed>\n");
+        Log_format(&logLine, ": <lookup error number failed>\n");
     }
 
-    pthread_mutex_unlock(&logger.mutex);
+    Log_write(&logLine);
 }
 
 void
-Log_gai(LOG_PARAMETER_DECLARATION, int gai, const char *format, ...)
+(Log_gai)(LOG_PARAMETER_DECLARATION, int gai, const char *format, ...)
 {
+    LogLine             logLine = { .len = 0 };
     va_list             args;
 
-    pthread_mutex_lock(&logger.mutex);
+    if (!Log_header(&logLine, LOG_PARAMETER_IMPLEMENTATION)) {
+        return;
+    }
 
-    Log_header(LOG_PARAMETER_IMPLEMENTATION);
     va_start(args, format);
-    vfprintf(logger.stream, format, args);
-    fflush(logger.stream);
+    Log_vformat(&logLine, format, args);
     va_end(args);
 
-    fprintf(logger.stream, ": %s\n", gai_strerror(gai));
+    Log_format(&logLine, ": %s\n", gai_strerror(gai));
 
-    pthread_mutex_unlock(&logger.mutex);
+    Log_write(&logLine);
 }
 
 void
-Log_charstream(LOG_PARAMETER_DECLARATION, const char *stream, const uint32_t len)
+(Log_charstream)(LOG_PARAMETER_DECLARATION, const char *stream, const uint32_t len)
 {
     /*      ________________________
      *     |   |   |   |   |   |    |
@@ -234,19 +417,18 @@ Log_charstream(LOG_PARAMETER_DECLARATION, const char *stream, const uint32_t len
      *     |___|___|___|___|___|____|
      *       0   1   2   3   4   5
      */
+    LogLine                 logLine = { .len = 0 };
     uint32_t                idx;
 
-    pthread_mutex_lock(&logger.mutex);
-
-    fprintf(logger.stream, " (len=%02" PRIu32 ") ", len);
+    Log_format(&logLine, " (len=%02" PRIu32 ") ", len);
 
     for (idx = 0; idx < len; idx++) {
-        fprintf(logger.stream,  "%02" PRIx8 " ", (uint8_t) stream[idx]);
+        Log_format(&logLine,  "%02" PRIx8 " ", (uint8_t) stream[idx]);
     }
 
-    fprintf(logger.stream, "\n");
+    Log_format(&logLine, "\n");
 
-    pthread_mutex_unlock(&logger.mutex);
+    Log_write(&logLine);
 }
 
 const char *
@@ -259,4 +441,549 @@ Log_getFamily(int family)
     }
 }
 
+/*** LINES *******************************************************************/
+
+/**
+ * append to the line, the rest is cut off if it's full
+ * (a truncated line keeps its newline)
+ */
+static void
+Log_vformat(LogLine *line, const char *format, va_list args)
+{
+    int                 num;
+
+    if (line->len < sizeof(line->buffer) - 1) {
+        if ((num = vsnprintf(&(line->buffer[line->len]), sizeof(line->buffer) - line->len, format, args)) < 0) {
+            return;
+        }
+        line->len = (line->len + num < sizeof(line->buffer) - 1) ? line->len + num : sizeof(line->buffer) - 1;
+    }
+
+    if (line->len == sizeof(line->buffer) - 1 && format[0] != '\0' && format[strlen(format) - 1] == '\n') {
+        line->buffer[line->len - 1] = '\n';
+    }
+}
+
+static void
+Log_format(LogLine *line, const char *format, ...)
+{
+    va_list             args;
+
+    va_start(args, format);
+    Log_vformat(line, format, args);
+    va_end(args);
+}
+
+/**
+ * append without formatting, cut off if the line is full
+ */
+static void
+Log_appendRaw(LogLine *line, const char *str, uint32_t len)
+{
+    if (len > sizeof(line->buffer) - 1 - line->len) {
+        len = sizeof(line->buffer) - 1 - line->len;
+    }
+
+    memcpy(&(line->buffer[line->len]), str, len);
+    line->len += len;
+}
+
+/**
+ * ".uuuuuu" without a printf
+ */
+static void
+Log_appendUsec(LogLine *line, long usec)
+{
+    char                digits[7];
+    int                 idx;
+
+    digits[0] = '.';
+    for (idx = 6; idx > 0; idx--) {
+        digits[idx] = '0' + (usec % 10);
+        usec       /= 10;
+    }
+
+    Log_appendRaw(line, digits, sizeof(digits));
+}
+
+/**
+ * async: into the thread's buffer, sync (or if that's impossible): straight to the stream
+ */
+static void
+Log_write(LogLine *line)
+{
+    LogBuffer          *buffer;
+
+    if (line->len == 0 || logger.stream <= 0) {
+        return;
+    }
+
+    if (__atomic_load_n(&(logger.async), __ATOMIC_ACQUIRE) && (buffer = Log_threadBuffer()) != NULL && Log_push(buffer, line)) {
+        return;
+    }
+
+    pthread_mutex_lock(&(logger.mutex));
+    fwrite(line->buffer, 1, line->len, logger.stream);
+    fflush(logger.stream);
+    pthread_mutex_unlock(&(logger.mutex));
+}
+
+/**
+ * @return                          false if the line has to be written synchronously
+ */
+static bool
+Log_push(LogBuffer *buffer, LogLine *line)
+{
+    while (!RingBuffer_write(buffer->ring, line->buffer, (uint16_t) line->len)) {
+        if (logger.overflow == LOG_OVERFLOW_DROP) {
+            __atomic_add_fetch(&(logger.dropped), 1, __ATOMIC_RELAXED);
+            return true;
+        }
+
+        pthread_mutex_lock(&(logger.mutex));
+        if (!logger.async) {
+            pthread_mutex_unlock(&(logger.mutex));
+            return false;
+        }
+        pthread_cond_signal(&(logger.wakeup));
+        pthread_cond_wait(&(logger.drained), &(logger.mutex));
+        pthread_mutex_unlock(&(logger.mutex));
+    }
+
+    /* don't wait for the interval if it fills up, a signal without waiter is cheap */
+    if (RingBuffer_getFree(buffer->ring) < buffer->ring->max / 2) {
+        pthread_cond_signal(&(logger.wakeup));
+    }
+
+    return true;
+}
+
+/**
+ * the calling thread's buffer, registered with the flusher on first use
+ */
+static LogBuffer *
+Log_threadBuffer(void)
+{
+    LogBuffer          *buffer;
+
+    if (threadBuffer != NULL || threadUnbuffered) {
+        return threadBuffer;
+    }
+
+    /* a failing allocation logs synchronously */
+    threadUnbuffered = true;
+
+    if ((buffer = (LogBuffer *) calloc(1, sizeof(LogBuffer))) == NULL) {
+        return NULL;
+    }
+
+    if ((buffer->ring = RingBuffer_newWithFlags(LOG_BUFFER_SIZE, RINGBUFFER_FLAG_SPSC | RINGBUFFER_FLAG_MIRRORED)) == NULL) {
+        free(buffer);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&(logger.mutex));
+    buffer->next    = logger.buffers;
+    logger.buffers  = buffer;
+    pthread_mutex_unlock(&(logger.mutex));
+
+    pthread_setspecific(exitKey, buffer);
+
+    threadUnbuffered = false;
+    threadBuffer     = buffer;
+
+    return buffer;
+}
+
+/**
+ * the flusher writes what's left and frees the buffer
+ */
+static void
+Log_threadExit(void *arg)
+{
+    LogBuffer          *buffer = (LogBuffer *) arg;
+
+    __atomic_store_n(&(buffer->orphaned), true, __ATOMIC_RELEASE);
+}
+
+static void *
+Log_flusherThread(void *arg)
+{
+    struct timespec     timeout;
+    bool                running = true;
+
+    pthread_mutex_lock(&(logger.mutex));
+
+    while (running) {
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_nsec += LOG_FLUSH_INTERVAL * 1000000L;
+        if (timeout.tv_nsec >= 1000000000L) {
+            timeout.tv_sec++;
+            timeout.tv_nsec -= 1000000000L;
+        }
+
+        if (logger.async) {
+            pthread_cond_timedwait(&(logger.wakeup), &(logger.mutex), &timeout);
+        }
+
+        /* one last round after Log_stop */
+        running = logger.async;
+
+        Log_flushBuffers();
+        pthread_cond_broadcast(&(logger.drained));
+    }
+
+    pthread_mutex_unlock(&(logger.mutex));
+
+    return NULL;
+}
+
+/**
+ * called with the mutex held: write the buffers, up to LOG_IOV_MAX at once,
+ * then free the ones of exited threads
+ */
+static void
+Log_flushBuffers(void)
+{
+    struct iovec        iov[LOG_IOV_MAX];
+    LogBuffer          *pending[LOG_IOV_MAX];
+    uint32_t            lengths[LOG_IOV_MAX];
+    LogBuffer          *buffer;
+    LogBuffer         **link;
+    char                dropped[64];
+    uint32_t            numDropped;
+    uint32_t            len;
+    int                 num = 0;
+
+    if ((numDropped = __atomic_exchange_n(&(logger.dropped), 0, __ATOMIC_RELAXED)) > 0) {
+        iov[0].iov_base = dropped;
+        iov[0].iov_len  = snprintf(dropped, sizeof(dropped), "[WARN ] %u log line(s) dropped\n", numDropped);
+        Log_writeAll(iov, 1);
+    }
+
+    for (buffer = logger.buffers; buffer != NULL; buffer = buffer->next) {
+        len = buffer->ring->max;
+        if ((iov[num].iov_base = RingBuffer_readableSpan(buffer->ring, &len)) == NULL) {
+            continue;
+        }
+        iov[num].iov_len = len;
+        lengths[num]     = len;
+        pending[num++]   = buffer;
+
+        if (num == LOG_IOV_MAX) {
+            Log_writeBuffers(iov, pending, lengths, num);
+            num = 0;
+        }
+    }
+
+    if (num > 0) {
+        Log_writeBuffers(iov, pending, lengths, num);
+    }
+
+    for (link = &(logger.buffers); (buffer = *link) != NULL; ) {
+        if (__atomic_load_n(&(buffer->orphaned), __ATOMIC_ACQUIRE) && !RingBuffer_canRead(buffer->ring)) {
+            *link = buffer->next;
+            RingBuffer_delete(buffer->ring);
+            free(buffer);
+        } else {
+            link = &(buffer->next);
+        }
+    }
+}
+
+static void
+Log_writeBuffers(struct iovec *iov, LogBuffer **pending, uint32_t *lengths, int num)
+{
+    int                 idx;
+
+    Log_writeAll(iov, num);
+
+    for (idx = 0; idx < num; idx++) {
+        RingBuffer_consume(pending[idx]->ring, lengths[idx]);
+    }
+}
+
+/**
+ * blocking writev() until everything is written, lines are lost on errors
+ */
+static void
+Log_writeAll(struct iovec *iov, int num)
+{
+    ssize_t             num_bytes;
+    int                 fd = fileno(logger.stream);
+
+    while (num > 0) {
+        if ((num_bytes = writev(fd, iov, num)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        while (num > 0 && (size_t) num_bytes >= iov->iov_len) {
+            num_bytes -= iov->iov_len;
+            iov++;
+            num--;
+        }
 
+        if (num > 0) {
+            iov->iov_base  = (char *) iov->iov_base + num_bytes;
+            iov->iov_len  -= num_bytes;
+        }
+    }
+}
+
+/*** TRACE *******************************************************************/
+
+/**
+ * create the trace file and write the dictionary of all sites,
+ * from now on enabled Log_trace sites append records to it
+ */
+bool
+Log_openTrace(const char *filename)
+{
+    LogTraceBuffer     *buffer;
+    LogTraceSite       *site;
+    uint32_t            header[3];
+
+    if (log_trace) {
+        return true;
+    }
+
+    if (!traceKeyCreated) {
+        if (pthread_key_create(&traceKey, Log_traceExit)) {
+            return false;
+        }
+        traceKeyCreated = true;
+    }
+
+    if ((buffer = (LogTraceBuffer *) malloc(sizeof(LogTraceBuffer))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate trace buffer");
+        return false;
+    }
+
+    if ((traceFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't open trace file %s", filename);
+        free(buffer);
+        return false;
+    }
+
+    header[0]   = LOG_TRACE_MAGIC;
+    header[1]   = LOG_TRACE_VERSION;
+    header[2]   = __stop_log_trace - __start_log_trace;
+    buffer->len = 0;
+    Log_traceAppend(buffer, header, sizeof(header));
+
+    for (site = __start_log_trace; site < __stop_log_trace; site++) {
+        site->numArgs = LogTrace_parse(site->format, site->types, site->bounds);
+        if (site->numArgs == UINT8_MAX) {
+            Log_println(LOG_WARN, "Can't trace %s:%u, unsupported format \"%s\"", site->filename, site->line, site->format);
+        }
+
+        Log_traceAppend(buffer, &(site->level), sizeof(site->level));
+        Log_traceAppend(buffer, &(site->line),  sizeof(site->line));
+        Log_traceString(buffer, site->filename);
+        Log_traceString(buffer, site->function);
+        Log_traceString(buffer, site->format);
+    }
+
+    Log_traceFlush(buffer);
+    free(buffer);
+
+    Log_println(LOG_INFO, "Trace %u site(s) to %s", header[2], filename);
+
+    __atomic_store_n(&log_trace, true, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/**
+ * write the calling thread's records and close the file, the records
+ * of other threads are written when they exit, so close it after
+ * the other threads are joined
+ */
+void
+Log_closeTrace(void)
+{
+    if (!log_trace) {
+        return;
+    }
+
+    __atomic_store_n(&log_trace, false, __ATOMIC_RELEASE);
+
+    if (traceBuffer != NULL) {
+        Log_traceFlush(traceBuffer);
+    }
+
+    close(traceFd);
+    traceFd = -1;
+}
+
+/**
+ * called through the Log_trace macro only, the arguments are
+ * copied in the order and size found in the format
+ */
+void
+(Log_trace)(LogTraceSite *site, ...)
+{
+    LogTraceBuffer     *buffer;
+    char               *record;
+    va_list             args;
+    struct timespec     now;
+    uint32_t            id;
+    uint64_t            time;
+    uint32_t            len;
+    uint32_t            start;
+    uint8_t             idx;
+    int32_t             intValue;
+    int32_t             bound = 0;
+    int64_t             longValue;
+    double              doubleValue;
+    uint64_t            pointerValue;
+    const char         *str;
+    uint16_t            strLen;
+
+    if (site->numArgs == UINT8_MAX || (buffer = Log_traceBuffer()) == NULL) {
+        return;
+    }
+
+    if (buffer->len + LOG_TRACE_RECORD_LEN + LOG_TRACE_ARGS_LEN_MAX > sizeof(buffer->data)) {
+        Log_traceFlush(buffer);
+    }
+
+    record       = &(buffer->data[buffer->len]);
+    start        = buffer->len;
+    buffer->len += LOG_TRACE_RECORD_LEN;
+
+    va_start(args, site);
+    for (idx = 0; idx < site->numArgs; idx++) {
+        switch (site->types[idx]) {
+            case LOG_TRACE_INT:
+                intValue = va_arg(args, int);
+                bound    = intValue;
+                Log_traceAppend(buffer, &intValue, sizeof(intValue));
+                break;
+
+            case LOG_TRACE_LONG:
+                longValue = va_arg(args, long long);
+                Log_traceAppend(buffer, &longValue, sizeof(longValue));
+                break;
+
+            case LOG_TRACE_DOUBLE:
+                doubleValue = va_arg(args, double);
+                Log_traceAppend(buffer, &doubleValue, sizeof(doubleValue));
+                break;
+
+            case LOG_TRACE_POINTER:
+                pointerValue = (uintptr_t) va_arg(args, void *);
+                Log_traceAppend(buffer, &pointerValue, sizeof(pointerValue));
+                break;
+
+            case LOG_TRACE_STRING:
+            case LOG_TRACE_STRING_BOUNDED:
+                if ((str = va_arg(args, const char *)) == NULL) {
+                    str = "(null)";
+                }
+                /* "%.*s": the precision precedes it, "%.Ns": it's in the site,
+                 * the bytes behind it may not be terminated */
+                if (site->types[idx] == LOG_TRACE_STRING_BOUNDED && bound >= 0 && bound < LOG_TRACE_STRING_MAX) {
+                    strLen = strnlen(str, bound);
+                } else if (site->types[idx] == LOG_TRACE_STRING) {
+                    strLen = strnlen(str, site->bounds[idx]);
+                } else {
+                    strLen = strnlen(str, LOG_TRACE_STRING_MAX);
+                }
+                Log_traceAppend(buffer, &strLen, sizeof(strLen));
+                Log_traceAppend(buffer, str, strLen);
+                break;
+        }
+    }
+    va_end(args);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    id   = site - __start_log_trace;
+    time = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    len  = buffer->len - start - LOG_TRACE_RECORD_LEN;
+
+    memcpy(&(record[0]),  &id,           sizeof(id));
+    memcpy(&(record[4]),  &(buffer->tid), sizeof(buffer->tid));
+    memcpy(&(record[8]),  &time,         sizeof(time));
+    memcpy(&(record[16]), &len,          sizeof(len));
+}
+
+/**
+ * the calling thread's buffer, written by the thread exit
+ */
+static LogTraceBuffer *
+Log_traceBuffer(void)
+{
+    if (traceBuffer == NULL) {
+        if ((traceBuffer = (LogTraceBuffer *) malloc(sizeof(LogTraceBuffer))) == NULL) {
+            return NULL;
+        }
+        traceBuffer->len = 0;
+        traceBuffer->tid = (uint32_t) syscall(SYS_gettid);
+
+        pthread_setspecific(traceKey, traceBuffer);
+    }
+
+    return traceBuffer;
+}
+
+static void
+Log_traceExit(void *arg)
+{
+    LogTraceBuffer     *buffer = (LogTraceBuffer *) arg;
+
+    Log_traceFlush(buffer);
+    free(buffer);
+}
+
+/**
+ * written out first if it doesn't fit, a record reserves
+ * room for all of its arguments up front
+ */
+static void
+Log_traceAppend(LogTraceBuffer *buffer, const void *data, uint32_t len)
+{
+    if (buffer->len + len > sizeof(buffer->data)) {
+        Log_traceFlush(buffer);
+    }
+
+    memcpy(&(buffer->data[buffer->len]), data, len);
+    buffer->len += len;
+}
+
+/**
+ * dictionary: uint16 length and the bytes
+ */
+static void
+Log_traceString(LogTraceBuffer *buffer, const char *str)
+{
+    uint16_t            len = strnlen(str, UINT16_MAX);
+
+    Log_traceAppend(buffer, &len, sizeof(len));
+    Log_traceAppend(buffer, str,  len);
+}
+
+/**
+ * one write() per buffer (O_APPEND), records of different threads don't mix
+ */
+static void
+Log_traceFlush(LogTraceBuffer *buffer)
+{
+    ssize_t             num_bytes;
+    uint32_t            offset = 0;
+
+    while (offset < buffer->len && traceFd != -1) {
+        if ((num_bytes = write(traceFd, &(buffer->data[offset]), buffer->len - offset)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        offset += num_bytes;
+    }
+
+    buffer->len = 0;
+}
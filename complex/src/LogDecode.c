@@ -0,0 +1,322 @@
+#include "LogDecode.h"
+#include "LogTrace.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define SPEC_MAX                        32
+
+/**
+ * a site of the dictionary
+ */
+typedef struct {
+    uint8_t             level;
+    uint32_t            line;
+    char               *filename;
+    char               *function;
+    char               *format;
+    uint8_t             numArgs;
+    uint8_t             types[LOG_TRACE_ARGS_MAX];
+    uint16_t            bounds[LOG_TRACE_ARGS_MAX];
+} Site;
+
+static bool     LogDecode_read      (FILE *in, void *data, size_t len);
+static char    *LogDecode_string    (FILE *in);
+static bool     LogDecode_record    (FILE *out, Site *site, uint32_t tid, uint64_t time, const char *args, uint32_t len);
+static bool     LogDecode_message   (FILE *out, Site *site, const char *args, uint32_t len);
+static void     LogDecode_usage     (const char *program);
+
+static const char *levelStr[] = { "", "[FATAL] ", "[ERROR] ", "[WARN ] ", "[INFO ] ", "[DEBUG] " };
+
+int
+main(int argc, char *argv[])
+{
+    FILE               *in = stdin;
+    bool                result;
+
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+        LogDecode_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 2 && (in = fopen(argv[1], "rb")) == NULL) {
+        fprintf(stderr, "Can't open %s: %s\n", argv[1], strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    result = LogDecode_file(in, stdout);
+
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void
+LogDecode_usage(const char *program)
+{
+    fprintf(stderr, CONFIG_PROGRAM_DESC " " CONFIG_PROGRAM_VERSION "\n");
+    fprintf(stderr, "Usage:\n%s %s\n", program, CONFIG_PROGRAM_USAGE);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples:\n");
+    fprintf(stderr, "%s %s\n", program, CONFIG_PROGRAM_HELP1);
+    fprintf(stderr, "%s %s\n", program, CONFIG_PROGRAM_HELP2);
+    fprintf(stderr, "\n");
+}
+
+/**
+ * read the dictionary, then print every record as a log line
+ */
+bool
+LogDecode_file(FILE *in, FILE *out)
+{
+    uint32_t            header[3];
+    uint32_t            record[LOG_TRACE_RECORD_LEN / sizeof(uint32_t)];
+    Site               *sites;
+    uint32_t            idx;
+    uint32_t            id;
+    uint32_t            tid;
+    uint64_t            time;
+    uint32_t            len;
+    char                args[LOG_TRACE_ARGS_LEN_MAX];
+    bool                result = false;
+
+    if (!LogDecode_read(in, header, sizeof(header)) || header[0] != LOG_TRACE_MAGIC || header[1] != LOG_TRACE_VERSION) {
+        fprintf(stderr, "Not a trace file (version %u)\n", LOG_TRACE_VERSION);
+        return false;
+    }
+
+    /* header[2] + 1 mustn't wrap */
+    if (header[2] > LOG_TRACE_SITES_MAX) {
+        fprintf(stderr, "Corrupt dictionary: %u sites\n", header[2]);
+        return false;
+    }
+
+    if ((sites = (Site *) calloc(header[2] + 1, sizeof(Site))) == NULL) {
+        fprintf(stderr, "Can't allocate %u sites\n", header[2]);
+        return false;
+    }
+
+    for (idx = 0; idx < header[2]; idx++) {
+        if (!LogDecode_read(in, &(sites[idx].level), sizeof(sites[idx].level)) ||
+            !LogDecode_read(in, &(sites[idx].line),  sizeof(sites[idx].line))  ||
+            (sites[idx].filename = LogDecode_string(in)) == NULL ||
+            (sites[idx].function = LogDecode_string(in)) == NULL ||
+            (sites[idx].format   = LogDecode_string(in)) == NULL) {
+            fprintf(stderr, "Truncated dictionary\n");
+            goto LogDecode_fileExit;
+        }
+        sites[idx].numArgs = LogTrace_parse(sites[idx].format, sites[idx].types, sites[idx].bounds);
+    }
+
+    for (;;) {
+        /* the end of the file, unless within a record */
+        if ((len = fread(record, 1, sizeof(record), in)) != sizeof(record)) {
+            result = (len == 0 && feof(in));
+            if (!result) {
+                fprintf(stderr, "Truncated record\n");
+            }
+            break;
+        }
+
+        memcpy(&id,   &(record[0]), sizeof(id));
+        memcpy(&tid,  &(record[1]), sizeof(tid));
+        memcpy(&time, &(record[2]), sizeof(time));
+        memcpy(&len,  &(record[4]), sizeof(len));
+
+        if (id >= header[2] || len > sizeof(args) || !LogDecode_read(in, args, len)) {
+            fprintf(stderr, "Corrupt record\n");
+            break;
+        }
+
+        if (!LogDecode_record(out, &(sites[id]), tid, time, args, len)) {
+            fprintf(stderr, "Record doesn't match %s:%u\n", sites[id].filename, sites[id].line);
+        }
+    }
+
+LogDecode_fileExit:
+    for (idx = 0; idx < header[2]; idx++) {
+        free(sites[idx].filename);
+        free(sites[idx].function);
+        free(sites[idx].format);
+    }
+    free(sites);
+
+    return result;
+}
+
+static bool
+LogDecode_read(FILE *in, void *data, size_t len)
+{
+    return len == 0 || fread(data, len, 1, in) == 1;
+}
+
+/**
+ * uint16 length and the bytes, returned with '\0'
+ */
+static char *
+LogDecode_string(FILE *in)
+{
+    uint16_t            len;
+    char               *str;
+
+    if (!LogDecode_read(in, &len, sizeof(len)) || (str = (char *) malloc(len + 1)) == NULL) {
+        return NULL;
+    }
+
+    if (!LogDecode_read(in, str, len)) {
+        free(str);
+        return NULL;
+    }
+    str[len] = '\0';
+
+    return str;
+}
+
+/**
+ * same header as a text log line, with microseconds and the kernel's thread id
+ */
+static bool
+LogDecode_record(FILE *out, Site *site, uint32_t tid, uint64_t time, const char *args, uint32_t len)
+{
+    time_t              second = time / 1000000000ULL;
+    struct tm           now;
+    char                position[25 + 1];
+
+    localtime_r(&second, &now);
+    snprintf(position, sizeof(position) - 1, "%.20s:%u", site->filename, site->line);
+
+    fprintf(out, "[%02d:%02d:%02d.%06u][%u][%-25s]%s", now.tm_hour,
+                                                       now.tm_min,
+                                                       now.tm_sec,
+                                                       (unsigned int) ((time % 1000000000ULL) / 1000),
+                                                       tid,
+                                                       position,
+                                                       site->level < sizeof(levelStr) / sizeof(levelStr[0]) ? levelStr[site->level] : "");
+
+    if (!LogDecode_message(out, site, args, len)) {
+        fprintf(out, "<%s>\n", site->format);
+        return false;
+    }
+
+    fprintf(out, "\n");
+    return true;
+}
+
+/* a conversion with its '*' arguments */
+#define PRINT_CONVERSION(value)         (numStars == 0 ? fprintf(out, spec, value) : \
+                                         numStars == 1 ? fprintf(out, spec, stars[0], value) : \
+                                                         fprintf(out, spec, stars[0], stars[1], value))
+
+/**
+ * walk the format like printf, the values come from the record
+ */
+static bool
+LogDecode_message(FILE *out, Site *site, const char *args, uint32_t len)
+{
+    LogTraceConversion  conversion;
+    const char         *format = site->format;
+    const char         *literal;
+    const char         *end = args + len;
+    char                spec[SPEC_MAX];
+    char                str[LOG_TRACE_STRING_MAX + 1];
+    int32_t             stars[2];
+    int                 numStars;
+    int32_t             intValue;
+    int64_t             longValue;
+    double              doubleValue;
+    uint64_t            pointerValue;
+    uint16_t            strLen;
+
+    if (site->numArgs == UINT8_MAX) {
+        return false;
+    }
+
+    for (literal = format; LogTrace_scan(&format, &conversion); literal = format) {
+        fwrite(literal, 1, conversion.start - literal, out);
+
+        if (conversion.type == LOG_TRACE_NONE) {
+            fputc('%', out);
+            continue;
+        }
+
+        if (conversion.end - conversion.start >= SPEC_MAX) {
+            return false;
+        }
+        memcpy(spec, conversion.start, conversion.end - conversion.start);
+        spec[conversion.end - conversion.start] = '\0';
+
+        for (numStars = 0; numStars < conversion.widthStar + conversion.precisionStar; numStars++) {
+            if (args + sizeof(int32_t) > end) {
+                return false;
+            }
+            memcpy(&(stars[numStars]), args, sizeof(int32_t));
+            args += sizeof(int32_t);
+        }
+
+        switch (conversion.type) {
+            case LOG_TRACE_INT:
+                if (args + sizeof(intValue) > end) {
+                    return false;
+                }
+                memcpy(&intValue, args, sizeof(intValue));
+                args += sizeof(intValue);
+                PRINT_CONVERSION(intValue);
+                break;
+
+            case LOG_TRACE_LONG:
+                if (args + sizeof(longValue) > end) {
+                    return false;
+                }
+                memcpy(&longValue, args, sizeof(longValue));
+                args += sizeof(longValue);
+                PRINT_CONVERSION((long long) longValue);
+                break;
+
+            case LOG_TRACE_DOUBLE:
+                if (args + sizeof(doubleValue) > end) {
+                    return false;
+                }
+                memcpy(&doubleValue, args, sizeof(doubleValue));
+                args += sizeof(doubleValue);
+                PRINT_CONVERSION(doubleValue);
+                break;
+
+            case LOG_TRACE_POINTER:
+                if (args + sizeof(pointerValue) > end) {
+                    return false;
+                }
+                memcpy(&pointerValue, args, sizeof(pointerValue));
+                args += sizeof(pointerValue);
+                PRINT_CONVERSION((void *) (uintptr_t) pointerValue);
+                break;
+
+            case LOG_TRACE_STRING:
+            case LOG_TRACE_STRING_BOUNDED:
+                if (args + sizeof(strLen) > end) {
+                    return false;
+                }
+                memcpy(&strLen, args, sizeof(strLen));
+                args += sizeof(strLen);
+                if (strLen > LOG_TRACE_STRING_MAX || args + strLen > end) {
+                    return false;
+                }
+                memcpy(str, args, strLen);
+                str[strLen] = '\0';
+                args += strLen;
+                PRINT_CONVERSION(str);
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    fputs(literal, out);
+
+    return args == end;
+}
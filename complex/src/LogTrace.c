@@ -0,0 +1,142 @@
+#include "LogTrace.h"
+
+#include <string.h>
+#include <ctype.h>
+
+/**
+ * find the next conversion of a printf format string
+ *
+ * @param   format                  input is where to start, output is behind the conversion
+ * @return                          false if there is none left
+ */
+bool
+LogTrace_scan(const char **format, LogTraceConversion *conversion)
+{
+    const char         *ptr    = strchr(*format, '%');
+    bool                isLong = false;
+    bool                isLongDouble = false;
+
+    if (ptr == NULL) {
+        *format += strlen(*format);
+        return false;
+    }
+
+    conversion->start         = ptr++;
+    conversion->widthStar     = false;
+    conversion->precisionStar = false;
+    conversion->precision     = -1;
+
+    /* flags */
+    while (*ptr != '\0' && strchr("-+ #0'", *ptr) != NULL) {
+        ptr++;
+    }
+
+    /* width */
+    if (*ptr == '*') {
+        conversion->widthStar = true;
+        ptr++;
+    } else {
+        while (isdigit((unsigned char) *ptr)) {
+            ptr++;
+        }
+    }
+
+    /* precision */
+    if (*ptr == '.') {
+        ptr++;
+        if (*ptr == '*') {
+            conversion->precisionStar = true;
+            ptr++;
+        } else {
+            /* "%.s" is a precision of 0, big ones are as good as none */
+            for (conversion->precision = 0; isdigit((unsigned char) *ptr); ptr++) {
+                if (conversion->precision < UINT16_MAX) {
+                    conversion->precision = conversion->precision * 10 + (*ptr - '0');
+                }
+            }
+        }
+    }
+
+    /* length: everything wider than int is 8 bytes on LP64 */
+    while (*ptr != '\0' && strchr("hlLqjzt", *ptr) != NULL) {
+        if (*ptr == 'L') {
+            isLongDouble = true;
+        } else if (*ptr != 'h') {
+            isLong = true;
+        }
+        ptr++;
+    }
+
+    switch (*ptr) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+            conversion->type = isLong ? LOG_TRACE_LONG : LOG_TRACE_INT;
+            break;
+        case 'c':
+            conversion->type = LOG_TRACE_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            conversion->type = isLongDouble ? LOG_TRACE_UNKNOWN : LOG_TRACE_DOUBLE;
+            break;
+        case 's':
+            conversion->type = isLong ? LOG_TRACE_UNKNOWN : LOG_TRACE_STRING;
+            break;
+        case 'p':
+            conversion->type = LOG_TRACE_POINTER;
+            break;
+        case '%':
+            conversion->type = LOG_TRACE_NONE;
+            break;
+        default:
+            conversion->type = LOG_TRACE_UNKNOWN;
+            break;
+    }
+
+    if (*ptr != '\0') {
+        ptr++;
+    }
+    conversion->end = ptr;
+    *format         = ptr;
+
+    return true;
+}
+
+/**
+ * argument types of a format string, '*' widths and precisions included
+ *
+ * @param   types                   room for LOG_TRACE_ARGS_MAX types
+ * @param   bounds                  room for LOG_TRACE_ARGS_MAX, the bytes a string
+ *                                  argument is read at most, LOG_TRACE_STRING_MAX
+ *                                  or a smaller literal precision ("%.4s")
+ * @return                          number of arguments, UINT8_MAX if it can't be traced
+ */
+uint8_t
+LogTrace_parse(const char *format, uint8_t *types, uint16_t *bounds)
+{
+    LogTraceConversion  conversion;
+    uint8_t             num = 0;
+
+    while (LogTrace_scan(&format, &conversion)) {
+        if (conversion.type == LOG_TRACE_NONE) {
+            continue;
+        }
+
+        if (conversion.type == LOG_TRACE_UNKNOWN ||
+            num + conversion.widthStar + conversion.precisionStar + 1 > LOG_TRACE_ARGS_MAX) {
+            return UINT8_MAX;
+        }
+
+        if (conversion.widthStar) {
+            bounds[num]  = 0;
+            types[num++] = LOG_TRACE_INT;
+        }
+        if (conversion.precisionStar) {
+            bounds[num]  = 0;
+            types[num++] = LOG_TRACE_INT;
+        }
+        bounds[num]  = (conversion.precision >= 0 && conversion.precision < LOG_TRACE_STRING_MAX) ?
+                       (uint16_t) conversion.precision : LOG_TRACE_STRING_MAX;
+        types[num++] = (conversion.type == LOG_TRACE_STRING && conversion.precisionStar) ? LOG_TRACE_STRING_BOUNDED : conversion.type;
+    }
+
+    return num;
+}
@@ -2,10 +2,16 @@
 
 #ifdef WITH_ECHO_CLIENT
 #include "EchoClient.h"
+#include "LoadGenerator.h"
+#include "Connector.h"
 #elif WITH_ECHO_SERVER
 #include "EchoServer.h"
 #elif WITH_WEB_CLIENT
 #include "WebClient.h"
+#include "WebLoad.h"
+#include "Connector.h"
+#elif WITH_WEB_SERVER
+#include "WebServer.h"
 #endif
 
 #include <stdio.h>
@@ -33,9 +39,22 @@ typedef struct {
     int             family;
 } mode_str_t;
 
+typedef struct {
+    const char     *str;
+    LogOverflow     overflow;
+} overflow_str_t;
+
+#ifdef WITH_ECHO_CLIENT
+typedef struct {
+    const char     *str;
+    LoadArrival     arrival;
+} arrival_str_t;
+#endif
+
 static void usage(int argc, char *argv[]);
 static void usage_help(int argc, char *argv[]);
 static void usage_opt(int argc, char *argv[], const char *msg);
+static bool parse_uint32(const char *str, uint32_t *value);
 
 const level_str_t level_str[] = {
         { "NONE" ,      LOG_NONE_PRIVATE    },
@@ -51,6 +70,20 @@ const mode_str_t mode_str[] = {
         { "IPv6" ,      AF_INET6    }
 };
 
+#ifdef WITH_ECHO_SERVER
+const overflow_str_t overflow_str[] = {
+        { "drop",       LOG_OVERFLOW_DROP   },
+        { "block",      LOG_OVERFLOW_BLOCK  }
+};
+#endif
+
+#ifdef WITH_ECHO_CLIENT
+const arrival_str_t arrival_str[] = {
+        { "fixed",      LOAD_ARRIVAL_FIXED      },
+        { "poisson",    LOAD_ARRIVAL_POISSON    }
+};
+#endif
+
 int     g_argc;
 char  **g_argv;
 int     opt;        /**< argument for getopt() as a single integer */
@@ -95,6 +128,23 @@ usage_opt(int argc, char *argv[], const char *msg)
    exit(EXIT_FAILURE);
 }
 
+static bool
+parse_uint32(const char *str, uint32_t *value)
+{
+    char               *end;
+    unsigned long       number;
+
+    errno  = 0;
+    number = strtoul(str, &end, 10);
+
+    if (errno != 0 || end == str || *end != '\0' || number > UINT32_MAX) {
+        return false;
+    }
+
+    *value = (uint32_t) number;
+    return true;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -102,9 +152,40 @@ main(int argc, char *argv[])
     bool                hflag = false;
     bool                mflag = false;
     bool                lflag = false;
+    LogLevel            level = LOG_DEBUG_PRIVATE;
     int                 family;
     const char         *hostname = NULL;
     const char         *service  = CONFIG_SERVICE;
+#ifdef WITH_ECHO_SERVER
+    uint32_t            shards   = CONFIG_SHARDS;
+    bool                aflag    = false;
+    LogOverflow         overflow = LOG_OVERFLOW_DROP;
+    const char         *trace    = NULL;
+#endif
+#ifdef WITH_WEB_SERVER
+    uint32_t            shards   = CONFIG_SHARDS;
+    const char         *root     = CONFIG_DOCUMENT_ROOT;
+#endif
+#if defined(WITH_ECHO_CLIENT) || defined(WITH_WEB_CLIENT)
+    uint32_t            delay    = CONFIG_CONNECT_DELAY;
+#endif
+#ifdef WITH_ECHO_CLIENT
+    bool                bflag    = false;
+    bool                dflag    = false;
+    bool                qflag    = false;
+    bool                aflag    = false;
+    uint32_t            messages = 0;
+    LoadConfig          load;
+#endif
+#ifdef WITH_WEB_CLIENT
+    bool                bflag    = false;
+    bool                pflag    = false;
+    bool                sflag    = false;
+    WebConfig           web;
+    const char         *defaultPath = CONFIG_PATH;
+    const char        **paths    = &defaultPath;
+    uint32_t            numPaths = 1;
+#endif
 
     struct addrinfo     hints;
     struct addrinfo    *addrinfo = NULL;
@@ -113,14 +194,19 @@ main(int argc, char *argv[])
     char                service_str[NI_MAXSERV];
     char                port_str[NI_MAXSERV];
     int                 status;
+    bool                success  = true;
 
     g_argc = argc;
     g_argv = argv;
 
-    //log_level = LOG_DEBUG;
+#ifdef WITH_ECHO_CLIENT
+    LoadConfig_init(&load);
+#elif WITH_WEB_CLIENT
+    WebConfig_init(&web);
+#endif
 
     /* The getopt() function parses the command-line arguments */
-    while ((opt = getopt(argc, argv, ":hm:l:")) != -1) {
+    while ((opt = getopt(argc, argv, CONFIG_PROGRAM_OPTIONS)) != -1) {
         switch (opt) {
             /* option: help */
             case 'h':
@@ -147,7 +233,7 @@ main(int argc, char *argv[])
                 for (idx = 0; idx < (sizeof(level_str) / sizeof(level_str_t)); idx++) {
                     if (strcasecmp(optarg, level_str[idx].str) == 0) {
                         lflag     = true;
-                        //log_level = level_str[idx].level;
+                        level     = level_str[idx].level;
                         break;
                     }
                 }
@@ -158,6 +244,184 @@ main(int argc, char *argv[])
 
                 break;
 
+#if defined(WITH_ECHO_SERVER) || defined(WITH_WEB_SERVER)
+            /* option: number of shards */
+            case 's':
+                if (!parse_uint32(optarg, &shards)) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                break;
+#endif
+
+#ifdef WITH_WEB_SERVER
+            /* option: document root */
+            case 'r':
+                root = optarg;
+                break;
+#endif
+
+#ifdef WITH_ECHO_SERVER
+            /* option: asynchronous logging, drop or block if a thread's buffer is full */
+            case 'a':
+                for (idx = 0; idx < (sizeof(overflow_str) / sizeof(overflow_str_t)); idx++) {
+                    if (strcasecmp(optarg, overflow_str[idx].str) == 0) {
+                        aflag    = true;
+                        overflow = overflow_str[idx].overflow;
+                        break;
+                    }
+                }
+
+                if (!aflag) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                break;
+
+            /* option: binary trace file, see log_decode */
+            case 't':
+                trace = optarg;
+                break;
+#endif
+
+#if defined(WITH_ECHO_CLIENT) || defined(WITH_WEB_CLIENT)
+            /* option: ms between two connect attempts, IPv6 and IPv4 are raced */
+            case 'e':
+                if (!parse_uint32(optarg, &delay)) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                break;
+#endif
+
+#ifdef WITH_ECHO_CLIENT
+            /* options of the load generator (benchmark mode) */
+            case 'c':
+                if (!parse_uint32(optarg, &(load.numConnections)) || load.numConnections == 0) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            case 't':
+                if (!parse_uint32(optarg, &(load.numThreads))) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            case 'q':
+                if (!parse_uint32(optarg, &(load.depth)) || load.depth == 0 || load.depth > UINT16_MAX) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                qflag = true;
+                break;
+
+            /* open loop: requests per second, fixed or poisson arrival */
+            case 'r':
+                if (!parse_uint32(optarg, &(load.rate)) || load.rate == 0) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            case 'a':
+                for (idx = 0; idx < (sizeof(arrival_str) / sizeof(arrival_str_t)); idx++) {
+                    if (strcasecmp(optarg, arrival_str[idx].str) == 0) {
+                        aflag        = true;
+                        load.arrival = arrival_str[idx].arrival;
+                        break;
+                    }
+                }
+
+                if (!aflag) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            case 'd':
+                if (!parse_uint32(optarg, &(load.duration)) || load.duration == 0) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                dflag = true;
+                break;
+
+            case 'n':
+                if (!parse_uint32(optarg, &messages) || messages == 0) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                load.numMessages = messages;
+                bflag = true;
+                break;
+
+            case 's':
+                if (!LoadConfig_parseSizes(&load, optarg)) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            case 'x':
+                if (!LoadConfig_parseMix(&load, optarg)) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+#endif
+
+#ifdef WITH_WEB_CLIENT
+            /* option: read buffer per connection */
+            case 'b':
+                if (!parse_uint32(optarg, &(web.bufferSize)) || web.bufferSize < CONFIG_READ_BUFFER_MIN) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                sflag = true;
+                break;
+
+            /* option: bodies into a file instead of stdout */
+            case 'o':
+                web.output = optarg;
+                break;
+
+            /* option: requests sent ahead of their responses */
+            case 'p':
+                if (!parse_uint32(optarg, &(web.depth)) || web.depth == 0 || web.depth > UINT16_MAX) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                pflag = true;
+                break;
+
+            /* options of the benchmark */
+            case 'c':
+                if (!parse_uint32(optarg, &(web.numConnections)) || web.numConnections == 0) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            case 't':
+                if (!parse_uint32(optarg, &(web.numThreads))) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            case 'd':
+                if (!parse_uint32(optarg, &(web.duration)) || web.duration == 0) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+
+            /* open loop: requests per second */
+            case 'r':
+                if (!parse_uint32(optarg, &(web.rate)) || web.rate == 0) {
+                    usage_opt(argc, argv, OPT_ARGUMENT_INVALID);
+                }
+                bflag = true;
+                break;
+#endif
+
             /**
              * missing option argument:
              * If the first character of optstring is a colon (':')
@@ -187,7 +451,38 @@ main(int argc, char *argv[])
         family = AF_UNSPEC;
     }
 
+#ifdef WITH_ECHO_CLIENT
+    /* a number of messages without a duration runs until all are answered */
+    if (load.numMessages > 0 && !dflag) {
+        load.duration = 0;
+    }
+
+    /* open loop: a slow response must not hold back the schedule */
+    if (load.rate > 0 && !qflag) {
+        load.depth = CONFIG_LOAD_OPEN_DEPTH;
+    }
+
+    load.connectDelay = delay;
+#elif WITH_WEB_CLIENT
+    web.connectDelay  = delay;
+
+    /* benchmark: one request in flight per connection unless -p, more for the open loop */
+    if (bflag && !pflag) {
+        web.depth = (web.rate > 0) ? CONFIG_LOAD_OPEN_DEPTH : 1;
+    }
+
+    /* download: headers and chunked bodies are read in large pieces */
+    if (web.output != NULL && !sflag) {
+        web.bufferSize = CONFIG_DOWNLOAD_BUFFER_SIZE;
+    }
+#endif
+
     /* additional arguments */
+#if defined(WITH_ECHO_SERVER) || defined(WITH_WEB_SERVER)
+    if ((argc - optind) >= 1) {
+        service  = argv[optind];
+    }
+#else
     if ((argc - optind) >= 1) {
         hostname = argv[optind];
     }
@@ -195,8 +490,17 @@ main(int argc, char *argv[])
     if ((argc - optind) >= 2) {
         service  = argv[optind + 1];
     }
+#endif
 
-    Log_init(stderr, LOG_DEBUG_PRIVATE, LOG_FLAG_TIME | LOG_FLAG_PID | LOG_FLAG_FILENAME | LOG_FLAG_LINE);
+#ifdef WITH_WEB_CLIENT
+    /* the rest are paths, fetched over one connection */
+    if ((argc - optind) >= 3) {
+        paths    = (const char **) &(argv[optind + 2]);
+        numPaths = argc - optind - 2;
+    }
+#endif
+
+    Log_init(stderr, level, LOG_FLAG_TIME | LOG_FLAG_PID | LOG_FLAG_FILENAME | LOG_FLAG_LINE);
 
 #if defined(WITH_ECHO_CLIENT) ||defined(WITH_WEB_CLIENT)
     if (hostname == NULL) {
@@ -214,7 +518,7 @@ main(int argc, char *argv[])
 
     hints.ai_family   = family;
     hints.ai_socktype = SOCK_STREAM;
-#ifdef WITH_ECHO_SERVER
+#if defined(WITH_ECHO_SERVER) || defined(WITH_WEB_SERVER)
     hints.ai_flags = AI_PASSIVE;
 #endif
 
@@ -240,16 +544,39 @@ main(int argc, char *argv[])
 
 #ifdef WITH_ECHO_CLIENT
     Log_println(LOG_DEBUG, "Connect to server %s (%s), service %s (%s)", host_str, ip_address_str, service_str, port_str);
-    EchoClient_connect(addrinfo);
+    if (bflag) {
+        success = LoadGenerator_run(addrinfo, &load);
+    } else {
+        EchoClient_connect(addrinfo, delay);
+        Connector_logStats();
+    }
 #elif WITH_ECHO_SERVER
     Log_println(LOG_DEBUG, "Listen on %s (%s), service %s (%s)", host_str, ip_address_str, service_str, port_str);
-    EchoServer_create(addrinfo);
+    if (aflag) {
+        Log_startAsync(overflow);
+    }
+    if (trace != NULL) {
+        Log_openTrace(trace);
+    }
+    EchoServer_create(addrinfo, shards);
+    Log_closeTrace();
 #elif WITH_WEB_CLIENT
     Log_println(LOG_DEBUG, "Connect from web server %s (%s), service %s (%s)", host_str, ip_address_str, service_str, port_str);
-    WebClient_get(addrinfo);
+    if (bflag) {
+        success = WebLoad_run(addrinfo, hostname, port_str, paths, numPaths, &web);
+    } else {
+        success = WebClient_get(addrinfo, hostname, port_str, paths, numPaths, &web);
+        Connector_logStats();
+    }
+#elif WITH_WEB_SERVER
+    Log_println(LOG_DEBUG, "Listen on %s (%s), service %s (%s)", host_str, ip_address_str, service_str, port_str);
+    success = WebServer_create(addrinfo, shards, root);
 #endif
 
     freeaddrinfo(addrinfo);
 
-    return 0;
+    /* write what's still buffered */
+    Log_stop();
+
+    return success ? 0 : EXIT_FAILURE;
 }
@@ -1,4 +1,6 @@
 #include "Message.h"
+#include "MessagePool.h"
+#include "Transform.h"
 #include "Log.h"
 
 #include <string.h>
@@ -6,158 +8,320 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
-#define SEND_BUFFER_SIZE    16
-#define SEND_MAX_SIZE       16
-#define RECV_MAX_SIZE       16
+#define MESSAGE_BATCH_MAX           512                     /**< messages per sendmsg(), two iovecs each */
 
-#define MESSAGE_FAILURE_EXIT        RingBuffer_delete(sendBuffer); \
-                                    return false;
+static bool     Message_sendAll(int sockfd, struct iovec *iov, int iovcnt);
 
+/**
+ * pooled message with room for len bytes of payload, one reference
+ */
+Message *
+Message_new(uint16_t len)
+{
+    Message            *msg;
 
+    if ((msg = MessagePool_get(len)) == NULL) {
+        return NULL;
+    }
 
-bool
-Message_send(int sockfd, MessageType type, uint32_t nr, const char *data, uint16_t len)
+    msg->header.type  = 0;
+    msg->header.flags = 0;
+    msg->header.len   = len;
+    msg->nr           = 0;
+    msg->refs         = 1;
+
+    return msg;
+}
+
+Message *
+Message_ref(Message *msg)
 {
-    Message             msg;
-    MessageRaw          raw;
-    RingBuffer         *sendBuffer;
-    int                 num_bytes;
-
-    /* length exceeds maximum */
-    if (len > sizeof(msg.data)) {
-        Log_println(LOG_ERROR, "Length too long. Abort!");
-        return false;
+    __atomic_add_fetch(&(msg->refs), 1, __ATOMIC_RELAXED);
+
+    return msg;
+}
+
+/**
+ * the last reference gives the message back to the pool of the calling thread
+ */
+void
+Message_unref(Message *msg)
+{
+    if (msg != NULL && __atomic_sub_fetch(&(msg->refs), 1, __ATOMIC_ACQ_REL) == 0) {
+        MessagePool_put(msg);
     }
+}
 
-    msg.header.type  = type;
-    msg.header.flags = 0;
-    msg.header.len   = len;
-    msg.nr           = nr;
+/**
+ * send header and payload with one sendmsg(), the payload isn't copied
+ */
+bool
+Message_send(int sockfd, MessageType type, uint32_t nr, const char *data, uint16_t len)
+{
+    char                header[MESSAGE_HEADER_LEN];
+    struct iovec        iov[2];
 
     if (data == NULL) {
         Log_println(LOG_INFO, "Send message without data");
+        len = 0;
     } else {
-        strncpy(msg.data, data, sizeof(msg.data));
-        Log_println(LOG_INFO, "Send message with data \"%s\"", data);
+        Log_println(LOG_INFO, "Send message with data \"%.*s\"", (int) len, data);
     }
 
-    sendBuffer = RingBuffer_new(SEND_BUFFER_SIZE);
-    Message_encode(&sendBuffer, &msg);
+    iov[0].iov_base = Message_encodeHeader(header, type, 0, len, nr);
+    iov[0].iov_len  = MESSAGE_HEADER_LEN;
+    iov[1].iov_base = (void *) data;
+    iov[1].iov_len  = len;
 
-    while (RingBuffer_canRead(sendBuffer)) {
-        raw.len = SEND_MAX_SIZE;
-        RingBuffer_read(sendBuffer, raw.data, &raw.len);
+    return Message_sendAll(sockfd, iov, len > 0 ? 2 : 1);
+}
 
-        num_bytes = send(sockfd, raw.data, raw.len, 0);
+/**
+ * send num messages with as few sendmsg() calls as possible
+ * (up to MESSAGE_BATCH_MAX messages each)
+ */
+bool
+Message_sendBatch(int sockfd, Message **msgs, uint32_t num)
+{
+    char                headers[MESSAGE_BATCH_MAX][MESSAGE_HEADER_LEN];
+    struct iovec        iov[2 * MESSAGE_BATCH_MAX];
+    uint32_t            i;
+    int                 iovcnt;
+
+    while (num > 0) {
+        iovcnt = 0;
+
+        for (i = 0; i < num && i < MESSAGE_BATCH_MAX; i++) {
+            iov[iovcnt].iov_base = Message_encodeHeader(headers[i], msgs[i]->header.type,
+                                                        msgs[i]->header.flags, msgs[i]->header.len, msgs[i]->nr);
+            iov[iovcnt].iov_len  = MESSAGE_HEADER_LEN;
+            iovcnt++;
+
+            if (msgs[i]->header.len > 0) {
+                iov[iovcnt].iov_base = msgs[i]->data;
+                iov[iovcnt].iov_len  = msgs[i]->header.len;
+                iovcnt++;
+            }
+        }
 
-        if (num_bytes == -1) {
-            Log_errno(LOG_ERROR, errno, "Can't send");
-            MESSAGE_FAILURE_EXIT;
-        } else if (num_bytes != raw.len) {
-            Log_println(LOG_ERROR, "Length mismatch. Abort!");
-            MESSAGE_FAILURE_EXIT;
+        if (!Message_sendAll(sockfd, iov, iovcnt)) {
+            return false;
         }
 
+        msgs += i;
+        num  -= i;
     }
 
     return true;
 }
 
 /**
- *
- * @param   recvBuffer      receive buffer
+ * sendmsg() until every iovec is sent, partial sends continue
+ * in the middle of an iovec
  */
-bool
-Message_receive(int sockfd, RingBuffer *recvBuffer, Message *msg)
+static bool
+Message_sendAll(int sockfd, struct iovec *iov, int iovcnt)
 {
+    struct msghdr       hdr;
+    ssize_t             num_bytes;
 
-    struct timeval tv;
-    MessageRaw          raw;
-    int                 num_bytes;
-
-    tv.tv_sec  = 1;
-    tv.tv_usec = 0;
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(&hdr, 0, sizeof(hdr));
 
-    /* less than the size of a header */
-    if (RingBuffer_getSize(recvBuffer) < MESSAGE_HEADER_LEN) {
-        /* receive header */
-        do {
-            raw.len = recv(sockfd, raw.data, raw.len, 0);
+    while (iovcnt > 0) {
+        hdr.msg_iov    = iov;
+        hdr.msg_iovlen = iovcnt;
 
-            /* timeout */
-            if (raw.len == -1 && errno == EAGAIN) {
-                Log_errno(LOG_ERROR, errno, "Timeout");
-                return false;
+        if ((num_bytes = sendmsg(sockfd, &hdr, MSG_NOSIGNAL)) == -1) {
+            if (errno == EINTR) {
+                continue;
             }
+            Log_errno(LOG_ERROR, errno, "Can't send");
+            return false;
+        }
 
-            /* write into buffer */
-            if (!RingBuffer_write(recvBuffer, raw.data, raw.len)) {
-                Log_println(LOG_ERROR, "Can't write to ring buffer");
-                return false;
-            }
+        /* skip the completely sent iovecs */
+        while (iovcnt > 0 && (size_t) num_bytes >= iov->iov_len) {
+            num_bytes -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
 
-        } while (RingBuffer_getSize(recvBuffer) < MESSAGE_HEADER_LEN);
+        if (iovcnt > 0) {
+            iov->iov_base  = (char *) iov->iov_base + num_bytes;
+            iov->iov_len  -= num_bytes;
+        }
     }
 
+    return true;
+}
+
+/**
+ * encode the header in network byte order
+ *
+ * @param   header          MESSAGE_HEADER_LEN bytes
+ * @return                  header
+ */
+char *
+Message_encodeHeader(char *header, MessageType type, uint8_t flags, uint16_t len, uint32_t nr)
+{
+    len = htons(len);                       /* host to network order */
+    nr  = htonl(nr);                        /* host to network order */
 
+    header[0] = (char) type;
+    header[1] = (char) flags;
+    memcpy(&(header[2]), &len, sizeof(len));
+    memcpy(&(header[4]), &nr,  sizeof(nr));
 
+    return header;
 }
 
-/*
-bool
+/**
+ * receive until a whole message is in the buffer, recv() writes
+ * straight into the ring and the message is decoded in place
+ * (a timeout is set once with SO_RCVTIMEO by the caller)
+ *
+ * @param   recvBuffer      receive buffer (RINGBUFFER_FLAG_MIRRORED)
+ * @return                  new message (release with Message_unref) or NULL
+ */
+Message *
+Message_receive(int sockfd, RingBuffer *recvBuffer)
 {
+    Message            *msg;
+    char               *span;
+    uint32_t            len;
+    ssize_t             num_bytes;
+
+    if (!(recvBuffer->flags & RINGBUFFER_FLAG_MIRRORED)) {
+        Log_println(LOG_ERROR, "Receive buffer must be mirrored");
+        return NULL;
+    }
+
+    while ((msg = Message_decode(recvBuffer)) == NULL) {
+        len = 1;
+        if ((span = RingBuffer_writableSpan(recvBuffer, &len)) == NULL) {
+            Log_println(LOG_ERROR, "Receive buffer full");
+            return NULL;
+        }
+
+        num_bytes = recv(sockfd, span, len, 0);
+
+        if (num_bytes == -1 && errno == EINTR) {
+            continue;
+        }
+
+        /* timeout */
+        if (num_bytes == -1 && errno == EAGAIN) {
+            Log_errno(LOG_ERROR, errno, "Timeout");
+            return NULL;
+        } else if (num_bytes == -1) {
+            Log_errno(LOG_ERROR, errno, "Can't receive");
+            return NULL;
+        } else if (num_bytes == 0) {
+            Log_println(LOG_ERROR, "Connection closed by peer");
+            return NULL;
+        }
+
+        RingBuffer_commitWrite(recvBuffer, (uint32_t) num_bytes);
+    }
+
+    return msg;
 }
-*/
 
 RingBuffer *
 Message_encode(RingBuffer *buffer, Message *msg)
 {
-    uint16_t len    = htons(msg->header.len);   /* host to network order */
-    uint32_t nr     = htonl(msg->nr);           /* host to network order */
+    char header[MESSAGE_HEADER_LEN];
 
-    RingBuffer_write(buffer, (char *) msg->header.type,  sizeof(msg->header.type));
-    RingBuffer_write(buffer, (char *) msg->header.flags, sizeof(msg->header.flags));
-    RingBuffer_write(buffer, (char *) len,               sizeof(msg->header.len));
-    RingBuffer_write(buffer, (char *) nr,                sizeof(msg->nr));
-    RingBuffer_write(buffer, (char *) msg->data,         msg->header.len);
+    Message_encodeHeader(header, msg->header.type, msg->header.flags, msg->header.len, msg->nr);
 
-    return buffer;
+    if (!RingBuffer_write(buffer, header, MESSAGE_HEADER_LEN) ||
+        !RingBuffer_write(buffer, msg->data, msg->header.len)) {
+        return NULL;
+    }
 
-//    uint16_t len;
-//    uint32_t nr;
-//
-//    raw->len = 0;
-//
-//    /* type */
-//    memcpy(&(raw->data[raw->len]), &(msg->header.type), sizeof(msg->header.type));
-//    raw->len += sizeof(msg->header.type);
-//
-//    /* flags */
-//    memcpy(&(raw->data[raw->len]), &(msg->header.flags), sizeof(msg->header.flags));
-//    raw->len += sizeof(msg->header.flags);
-//
-//    /* len */
-//    len = htons(msg->header.len); /* host to network order */
-//    memcpy(&(raw->data[raw->len]), &len, sizeof(len));
-//    raw->len += sizeof(msg->header.len);
-//
-//    /* nr */
-//    nr = htonl(msg->nr); /* host to network order */
-//    memcpy(&(raw->data[raw->len]), &nr, sizeof(nr));
-//    raw->len += sizeof(msg->nr);
-//
-//    /* data */
-//    memcpy(&(raw->data[raw->len]), msg->data, msg->header.len);
-//    raw->len += msg->header.len;
-//
-//    return raw;
+    return buffer;
 }
 
+/**
+ * decode one message in place from the readable region of the buffer
+ * (RINGBUFFER_FLAG_MIRRORED, otherwise a wrapped message is never contiguous)
+ *
+ * @return                  new message or NULL if the message isn't complete yet
+ */
 Message *
-Message_decode(Message *msg, RingBuffer *buffer)
+Message_decode(RingBuffer *buffer)
 {
+    Message    *msg;
+    const char *span;
+    uint32_t    len = MESSAGE_HEADER_LEN;
+    uint16_t    payload;
+    uint32_t    nr;
+
+    if ((span = RingBuffer_readableSpan(buffer, &len)) == NULL || len < MESSAGE_HEADER_LEN) {
+        return NULL;
+    }
+
+    memcpy(&payload, &(span[2]), sizeof(payload));
+    payload = ntohs(payload);               /* network to host order */
+
+    /* whole message readable? */
+    if (len < MESSAGE_HEADER_LEN + (uint32_t) payload) {
+        len = MESSAGE_HEADER_LEN + payload;
+        if ((span = RingBuffer_readableSpan(buffer, &len)) == NULL || len < MESSAGE_HEADER_LEN + (uint32_t) payload) {
+            return NULL;
+        }
+    }
+
+    if ((msg = Message_new(payload)) == NULL) {
+        return NULL;
+    }
+
+    memcpy(&nr, &(span[4]), sizeof(nr));
+
+    msg->header.type  = (uint8_t) span[0];
+    msg->header.flags = (uint8_t) span[1];
+    msg->nr           = ntohl(nr);          /* network to host order */
+    memcpy(msg->data, &(span[MESSAGE_HEADER_LEN]), payload);
+
+    RingBuffer_consume(buffer, MESSAGE_HEADER_LEN + payload);
+
     return msg;
 }
+
+/**
+ * turn a request into its response in place, invalid UTF-8 bytes are left
+ * as they are and only logged at DEBUG: the client controls them
+ *
+ * @return                  false if the type isn't a request
+ */
+bool
+Message_reply(Message *msg)
+{
+    switch (msg->header.type) {
+        case REQUEST_TO_UPPER:
+            if (!Transform_toUpper(msg->data, msg->header.len)) {
+                Log_println(LOG_DEBUG, "Request %u isn't valid UTF-8", msg->nr);
+            }
+            msg->header.type = RESPONSE_TO_UPPER;
+            return true;
+
+        case REQUEST_TO_LOWER:
+            if (!Transform_toLower(msg->data, msg->header.len)) {
+                Log_println(LOG_DEBUG, "Request %u isn't valid UTF-8", msg->nr);
+            }
+            msg->header.type = RESPONSE_TO_LOWER;
+            return true;
+
+        case REQUEST_FINISH:
+            msg->header.type = RESPONSE_FINISH;
+            msg->header.len  = 0;
+            return true;
+
+        default:
+            Log_println(LOG_ERROR, "Unknown request type %u", msg->header.type);
+            return false;
+    }
+}
@@ -0,0 +1,125 @@
+#include "MessageDecoder.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+MessageDecoder *
+MessageDecoder_new(void)
+{
+    MessageDecoder *this = (MessageDecoder *) malloc(sizeof(MessageDecoder));
+
+    if (this == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate message decoder");
+        return NULL;
+    }
+
+    this->msg = NULL;
+    MessageDecoder_reset(this);
+
+    return this;
+}
+
+void
+MessageDecoder_delete(MessageDecoder *this)
+{
+    if (this != NULL) {
+        Message_unref(this->msg);
+        free(this);
+    }
+}
+
+/**
+ * drop a partially decoded message
+ */
+void
+MessageDecoder_reset(MessageDecoder *this)
+{
+    Message_unref(this->msg);
+
+    this->msg   = NULL;
+    this->state = MESSAGE_DECODER_HEADER;
+    this->have  = 0;
+}
+
+/**
+ * consume bytes until a message is complete or the chunk is used up,
+ * call it again with the remaining chunk until it returns NULL
+ *
+ * @param   data                    input is the chunk, output is the unconsumed rest
+ * @param   len                     input is the chunk length, output is the rest
+ * @return                          the complete message, owned by the caller (Message_unref),
+ *                                  or NULL if more data is needed or the state is
+ *                                  MESSAGE_DECODER_FAILED
+ */
+Message *
+MessageDecoder_feed(MessageDecoder *this, const char **data, uint32_t *len)
+{
+    uint32_t            wanted;
+    uint16_t            payload;
+    uint32_t            nr;
+    Message            *msg;
+
+    while (*len > 0 || (this->state == MESSAGE_DECODER_BODY && this->msg->header.len == 0)) {
+
+        switch (this->state) {
+            case MESSAGE_DECODER_HEADER:
+                wanted = MESSAGE_HEADER_LEN - this->have;
+                if (wanted > *len) wanted = *len;
+
+                memcpy(&(this->header[this->have]), *data, wanted);
+                this->have += wanted;
+                *data      += wanted;
+                *len       -= wanted;
+
+                if (this->have < MESSAGE_HEADER_LEN) {
+                    return NULL;
+                }
+
+                memcpy(&payload, &(this->header[2]), sizeof(payload));
+                memcpy(&nr,      &(this->header[4]), sizeof(nr));
+
+                /* the payload length picks the size class */
+                if ((this->msg = Message_new(ntohs(payload))) == NULL) {   /* network to host order */
+                    this->state = MESSAGE_DECODER_FAILED;
+                    return NULL;
+                }
+
+                this->msg->header.type  = (uint8_t) this->header[0];
+                this->msg->header.flags = (uint8_t) this->header[1];
+                this->msg->nr           = ntohl(nr);      /* network to host order */
+
+                this->state = MESSAGE_DECODER_BODY;
+                this->have  = 0;
+                break;
+
+            case MESSAGE_DECODER_BODY:
+                wanted = this->msg->header.len - this->have;
+                if (wanted > *len) wanted = *len;
+
+                memcpy(&(this->msg->data[this->have]), *data, wanted);
+                this->have += wanted;
+                *data      += wanted;
+                *len       -= wanted;
+
+                if (this->have < this->msg->header.len) {
+                    return NULL;
+                }
+
+                /* complete, the next byte starts a new header */
+                msg         = this->msg;
+                this->msg   = NULL;
+                this->state = MESSAGE_DECODER_HEADER;
+                this->have  = 0;
+                return msg;
+
+            case MESSAGE_DECODER_FAILED:
+                return NULL;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,192 @@
+#include "MessagePool.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+
+static void     MessagePool_init        (void);
+static void     MessagePool_register    (void);
+static void     MessagePool_threadExit  (void *arg);
+static uint8_t  MessagePool_sizeClass   (uint16_t len);
+static bool     MessagePool_refill      (uint8_t sizeClass);
+static void     MessagePool_drain       (uint8_t sizeClass, uint32_t num);
+
+/** payload capacity of every size class */
+static const uint32_t capacity[MESSAGE_POOL_CLASSES] = { 64, 256, 1024, 4096, 16384, UINT16_MAX };
+
+static MessagePoolDepot depot[MESSAGE_POOL_CLASSES] = {
+    { PTHREAD_MUTEX_INITIALIZER, NULL, 0 }, { PTHREAD_MUTEX_INITIALIZER, NULL, 0 },
+    { PTHREAD_MUTEX_INITIALIZER, NULL, 0 }, { PTHREAD_MUTEX_INITIALIZER, NULL, 0 },
+    { PTHREAD_MUTEX_INITIALIZER, NULL, 0 }, { PTHREAD_MUTEX_INITIALIZER, NULL, 0 }
+};
+
+static __thread MessagePoolCache    cache[MESSAGE_POOL_CLASSES];
+static __thread bool                registered;
+
+static pthread_key_t                exitKey;
+static pthread_once_t               exitOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * message with room for at least len bytes of payload,
+ * taken from the calling thread's cache without locking
+ */
+Message *
+MessagePool_get(uint16_t len)
+{
+    uint8_t             sizeClass = MessagePool_sizeClass(len);
+    MessagePoolCache   *local     = &(cache[sizeClass]);
+    Message            *msg;
+
+    if (!registered) {
+        MessagePool_register();
+    }
+
+    if (local->free == NULL && !MessagePool_refill(sizeClass)) {
+        return NULL;
+    }
+
+    msg             = local->free;
+    local->free     = msg->next;
+    local->count--;
+
+    msg->sizeClass  = sizeClass;
+    msg->next       = NULL;
+
+    return msg;
+}
+
+/**
+ * back into the calling thread's cache, a batch goes to the depot
+ * if the cache grows too big (ex. messages freed by another thread)
+ */
+void
+MessagePool_put(Message *msg)
+{
+    MessagePoolCache   *local = &(cache[msg->sizeClass]);
+
+    if (!registered) {
+        MessagePool_register();
+    }
+
+    msg->next   = local->free;
+    local->free = msg;
+    local->count++;
+
+    if (local->count > MESSAGE_POOL_CACHE_MAX) {
+        MessagePool_drain(msg->sizeClass, MESSAGE_POOL_BATCH);
+    }
+}
+
+static void
+MessagePool_init(void)
+{
+    if (pthread_key_create(&exitKey, MessagePool_threadExit)) {
+        Log_println(LOG_WARN, "Can't create message pool key");
+    }
+}
+
+/**
+ * the thread's cache is given back to the depot when it exits, a refill
+ * fills it as well as a put
+ */
+static void
+MessagePool_register(void)
+{
+    pthread_once(&exitOnce, MessagePool_init);
+    pthread_setspecific(exitKey, cache);
+    registered = true;
+}
+
+static void
+MessagePool_threadExit(void *arg)
+{
+    uint8_t             sizeClass;
+
+    for (sizeClass = 0; sizeClass < MESSAGE_POOL_CLASSES; sizeClass++) {
+        MessagePool_drain(sizeClass, cache[sizeClass].count);
+    }
+}
+
+static uint8_t
+MessagePool_sizeClass(uint16_t len)
+{
+    uint8_t             sizeClass = 0;
+
+    while (capacity[sizeClass] < len) {
+        sizeClass++;
+    }
+
+    return sizeClass;
+}
+
+/**
+ * take a batch from the depot, or carve a new slab if the depot is empty.
+ * A slab is a whole number of messages, nothing is left over at its end.
+ * Slabs are never freed, the pool only grows to the peak number of messages.
+ */
+static bool
+MessagePool_refill(uint8_t sizeClass)
+{
+    MessagePoolCache   *local = &(cache[sizeClass]);
+    MessagePoolDepot   *share = &(depot[sizeClass]);
+    Message            *msg;
+    char               *slab;
+    size_t              size;
+    size_t              slabSize;
+    size_t              offset;
+
+    pthread_mutex_lock(&(share->mutex));
+    while (share->free != NULL && local->count < MESSAGE_POOL_BATCH) {
+        msg         = share->free;
+        share->free = msg->next;
+        share->count--;
+
+        msg->next   = local->free;
+        local->free = msg;
+        local->count++;
+    }
+    pthread_mutex_unlock(&(share->mutex));
+
+    if (local->free != NULL) {
+        return true;
+    }
+
+    /* keep the payload of every message aligned */
+    size     = (offsetof(Message, data) + capacity[sizeClass] + 15) & ~((size_t) 15);
+    slabSize = (size > MESSAGE_POOL_SLAB_SIZE) ? size : MESSAGE_POOL_SLAB_SIZE / size * size;
+
+    if ((slab = (char *) malloc(slabSize)) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate message slab");
+        return false;
+    }
+
+    for (offset = 0; offset + size <= slabSize; offset += size) {
+        msg            = (Message *) &(slab[offset]);
+        msg->sizeClass = sizeClass;
+        msg->next      = local->free;
+        local->free    = msg;
+        local->count++;
+    }
+
+    return true;
+}
+
+static void
+MessagePool_drain(uint8_t sizeClass, uint32_t num)
+{
+    MessagePoolCache   *local = &(cache[sizeClass]);
+    MessagePoolDepot   *share = &(depot[sizeClass]);
+    Message            *msg;
+
+    pthread_mutex_lock(&(share->mutex));
+    while (num-- > 0 && (msg = local->free) != NULL) {
+        local->free = msg->next;
+        local->count--;
+
+        msg->next   = share->free;
+        share->free = msg;
+        share->count++;
+    }
+    pthread_mutex_unlock(&(share->mutex));
+}
@@ -0,0 +1,332 @@
+#include "Resolver.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <netinet/in.h>
+
+static void             Resolver_free       (Resolver *this);
+static void            *Resolver_thread     (void *arg);
+static bool             Resolver_equal      (const ResolverKey *key1, const ResolverKey *key2);
+static bool             Resolver_key        (const struct sockaddr *addr, ResolverKey *key);
+static ResolverEntry   *Resolver_set        (Resolver *this, const ResolverKey *key);
+static ResolverEntry   *Resolver_find       (Resolver *this, const ResolverKey *key);
+static ResolverEntry   *Resolver_victim     (Resolver *this, const ResolverKey *key, time_t now);
+static void             Resolver_resolve    (const ResolverKey *key, ResolverEntry *result);
+static uint32_t         Resolver_roundUp    (uint32_t value);
+
+/**
+ * reverse lookups block for seconds if DNS is slow, so they run
+ * on own threads and the results are cached for a while
+ *
+ * @param   numThreads              threads calling getnameinfo()
+ * @param   maxEntries              cached addresses, rounded up to 2^n
+ * @param   maxQueued               pending lookups, more are ignored (and retried later)
+ * @param   ttl                     seconds a name (or its absence) is cached
+ */
+Resolver *
+Resolver_new(uint32_t numThreads, uint32_t maxEntries, uint32_t maxQueued, uint32_t ttl)
+{
+    Resolver           *this;
+    pthread_t           tid;
+    uint32_t            idx;
+    int                 status;
+
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+
+    if ((this = (Resolver *) calloc(1, sizeof(Resolver))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate resolver");
+        return NULL;
+    }
+
+    this->numSets    = Resolver_roundUp((maxEntries + RESOLVER_WAYS - 1) / RESOLVER_WAYS);
+    this->ttl        = ttl;
+    this->max        = Resolver_roundUp(maxQueued + 1);
+    this->numThreads = numThreads;
+    this->running    = true;
+    this->entries    = (ResolverEntry *) calloc(this->numSets * RESOLVER_WAYS, sizeof(ResolverEntry));
+    this->queue      = (ResolverKey *)   malloc(this->max * sizeof(ResolverKey));
+
+    pthread_mutex_init(&(this->mutex), NULL);
+    pthread_cond_init(&(this->notEmpty), NULL);
+
+    if (this->entries == NULL || this->queue == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate resolver cache");
+        Resolver_delete(this);
+        return NULL;
+    }
+
+    for (idx = 0; idx < numThreads; idx++) {
+        if ((status = pthread_create(&tid, NULL, Resolver_thread, this))) {
+            Log_println(LOG_ERROR, "Can't create resolver thread: error = %d", status);
+            Resolver_delete(this);
+            return NULL;
+        }
+        pthread_detach(tid);
+        this->numRunning++;
+    }
+
+    Log_println(LOG_INFO, "Resolver with %u thread(s), %u cached address(es), ttl = %us",
+                numThreads, this->numSets * RESOLVER_WAYS, ttl);
+
+    return this;
+}
+
+/**
+ * pending lookups are dropped, a lookup in progress isn't waited for:
+ * the thread which finishes last frees the resolver
+ */
+void
+Resolver_delete(Resolver *this)
+{
+    bool                last;
+
+    if (this == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(this->mutex));
+    this->running = false;
+    pthread_cond_broadcast(&(this->notEmpty));
+    last = (this->numRunning == 0);
+    pthread_mutex_unlock(&(this->mutex));
+
+    if (last) {
+        Resolver_free(this);
+    }
+}
+
+static void
+Resolver_free(Resolver *this)
+{
+    pthread_cond_destroy(&(this->notEmpty));
+    pthread_mutex_destroy(&(this->mutex));
+
+    free(this->queue);
+    free(this->entries);
+    free(this);
+}
+
+/**
+ * never blocks: a cached name is copied, otherwise a lookup is queued
+ * and the caller goes on with the numeric address
+ *
+ * @return                          true if name holds the host name
+ */
+bool
+Resolver_lookup(Resolver *this, const struct sockaddr *addr, char *name, size_t len)
+{
+    ResolverKey         key;
+    ResolverEntry      *entry;
+    time_t              now;
+    bool                found = false;
+
+    if (this == NULL || len == 0 || !Resolver_key(addr, &key)) {
+        return false;
+    }
+
+    now = time(NULL);
+
+    pthread_mutex_lock(&(this->mutex));
+
+    if ((entry = Resolver_find(this, &key)) != NULL && (entry->state == RESOLVER_PENDING || now < entry->expires)) {
+        if (entry->state == RESOLVER_RESOLVED) {
+            strncpy(name, entry->name, len - 1);
+            name[len - 1] = '\0';
+            found = true;
+        }
+
+    /* queue it, unless the cache set is busy with pending lookups or the queue is full */
+    } else if ((entry = Resolver_victim(this, &key, now)) != NULL && ((this->tail + 1) & (this->max - 1)) != this->head) {
+        entry->key              = key;
+        entry->state            = RESOLVER_PENDING;
+        this->queue[this->tail] = key;
+        this->tail              = (this->tail + 1) & (this->max - 1);
+        pthread_cond_signal(&(this->notEmpty));
+    }
+
+    pthread_mutex_unlock(&(this->mutex));
+
+    return found;
+}
+
+static void *
+Resolver_thread(void *arg)
+{
+    Resolver           *this = (Resolver *) arg;
+    ResolverKey         key;
+    ResolverEntry       result;
+    ResolverEntry      *entry;
+    bool                last;
+
+    pthread_mutex_lock(&(this->mutex));
+
+    for (;;) {
+        while (this->head == this->tail && this->running) {
+            pthread_cond_wait(&(this->notEmpty), &(this->mutex));
+        }
+
+        if (!this->running) {
+            break;
+        }
+
+        key        = this->queue[this->head];
+        this->head = (this->head + 1) & (this->max - 1);
+
+        /* blocking, without holding the cache */
+        pthread_mutex_unlock(&(this->mutex));
+        Resolver_resolve(&key, &result);
+        pthread_mutex_lock(&(this->mutex));
+
+        /* pending entries are never evicted */
+        if ((entry = Resolver_find(this, &key)) != NULL && entry->state == RESOLVER_PENDING) {
+            entry->state   = result.state;
+            entry->expires = time(NULL) + this->ttl;
+            memcpy(entry->name, result.name, sizeof(entry->name));
+        }
+    }
+
+    /* stopped by Resolver_delete() */
+    last = (--this->numRunning == 0);
+    pthread_mutex_unlock(&(this->mutex));
+
+    if (last) {
+        Resolver_free(this);
+    }
+
+    return NULL;
+}
+
+static bool
+Resolver_key(const struct sockaddr *addr, ResolverKey *key)
+{
+    memset(key, 0, sizeof(ResolverKey));
+    key->family = addr->sa_family;
+
+    switch (addr->sa_family) {
+        case AF_INET:
+            memcpy(key->addr, &(((const struct sockaddr_in *)  addr)->sin_addr),  sizeof(struct in_addr));
+            return true;
+        case AF_INET6:
+            memcpy(key->addr, &(((const struct sockaddr_in6 *) addr)->sin6_addr), sizeof(struct in6_addr));
+            key->scopeId = ((const struct sockaddr_in6 *) addr)->sin6_scope_id;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * field by field, the padding of a copied key isn't defined
+ */
+static bool
+Resolver_equal(const ResolverKey *key1, const ResolverKey *key2)
+{
+    return key1->family == key2->family && key1->scopeId == key2->scopeId &&
+           memcmp(key1->addr, key2->addr, sizeof(key1->addr)) == 0;
+}
+
+/**
+ * FNV-1a over the address selects the set
+ */
+static ResolverEntry *
+Resolver_set(Resolver *this, const ResolverKey *key)
+{
+    uint32_t            hash = 2166136261u;
+    uint32_t            idx;
+
+    for (idx = 0; idx < sizeof(key->addr); idx++) {
+        hash = (hash ^ key->addr[idx]) * 16777619u;
+    }
+    hash = (hash ^ key->scopeId) * 16777619u;
+    hash = (hash ^ key->family) * 16777619u;
+
+    return &(this->entries[(hash & (this->numSets - 1)) * RESOLVER_WAYS]);
+}
+
+static ResolverEntry *
+Resolver_find(Resolver *this, const ResolverKey *key)
+{
+    ResolverEntry      *set = Resolver_set(this, key);
+    uint32_t            way;
+
+    for (way = 0; way < RESOLVER_WAYS; way++) {
+        if (set[way].state != RESOLVER_EMPTY && Resolver_equal(&(set[way].key), key)) {
+            return &(set[way]);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * the entry of the same address, an empty one or the one expiring first
+ */
+static ResolverEntry *
+Resolver_victim(Resolver *this, const ResolverKey *key, time_t now)
+{
+    ResolverEntry      *set    = Resolver_set(this, key);
+    ResolverEntry      *victim = NULL;
+    uint32_t            way;
+
+    if ((victim = Resolver_find(this, key)) != NULL) {
+        return victim;
+    }
+
+    for (way = 0; way < RESOLVER_WAYS; way++) {
+        if (set[way].state == RESOLVER_EMPTY) {
+            return &(set[way]);
+        }
+        if (set[way].state != RESOLVER_PENDING && (victim == NULL || set[way].expires < victim->expires)) {
+            victim = &(set[way]);
+        }
+    }
+
+    return victim;
+}
+
+static void
+Resolver_resolve(const ResolverKey *key, ResolverEntry *result)
+{
+    struct sockaddr_storage addr;
+    socklen_t               addrlen;
+    int                     status;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.ss_family = key->family;
+
+    if (key->family == AF_INET) {
+        memcpy(&(((struct sockaddr_in *)  &addr)->sin_addr),  key->addr, sizeof(struct in_addr));
+        addrlen = sizeof(struct sockaddr_in);
+    } else {
+        memcpy(&(((struct sockaddr_in6 *) &addr)->sin6_addr), key->addr, sizeof(struct in6_addr));
+        ((struct sockaddr_in6 *) &addr)->sin6_scope_id = key->scopeId;
+        addrlen = sizeof(struct sockaddr_in6);
+    }
+
+    /* without a name the numeric address is used anyway */
+    status = getnameinfo((struct sockaddr *) &addr, addrlen, result->name, sizeof(result->name), NULL, 0, NI_NAMEREQD);
+    if (status) {
+        Log_gai(LOG_DEBUG, status, "Can't resolve client address");
+        result->state   = RESOLVER_FAILED;
+        result->name[0] = '\0';
+    } else {
+        result->state   = RESOLVER_RESOLVED;
+    }
+}
+
+static uint32_t
+Resolver_roundUp(uint32_t value)
+{
+    uint32_t            power = 1;
+
+    while (power < value) {
+        power <<= 1;
+    }
+
+    return power;
+}
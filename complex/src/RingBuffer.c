@@ -1,13 +1,22 @@
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "RingBuffer.h"
 #include "Log.h"
 
-static inline bool RingBuffer_canRead (RingBuffer *this);
-static inline bool RingBuffer_canWrite(RingBuffer *this);
+static char            *RingBuffer_mapMirrored  (uint32_t size);
+
+static inline void      RingBuffer_lock         (RingBuffer *this);
+static inline void      RingBuffer_unlock       (RingBuffer *this);
+static inline uint32_t  RingBuffer_readable     (RingBuffer *this, uint32_t wanted);
+static inline uint32_t  RingBuffer_writable     (RingBuffer *this, uint32_t wanted);
+static inline void      RingBuffer_publishRead  (RingBuffer *this, uint32_t readPointer);
+static inline void      RingBuffer_publishWrite (RingBuffer *this, uint32_t writePointer);
 
 /**
  *     ring buffer:
@@ -23,7 +32,25 @@ static inline bool RingBuffer_canWrite(RingBuffer *this);
 RingBuffer *
 RingBuffer_new(int num_bytes)
 {
-    RingBuffer *this = (RingBuffer *) malloc(sizeof(RingBuffer));
+    return RingBuffer_newWithFlags(num_bytes, 0);
+}
+
+/**
+ * @param   num_bytes               buffer length is 2^num_bytes
+ * @param   flags                   RINGBUFFER_FLAG_SPSC: no mutex, exactly one thread
+ *                                  reads and exactly one thread writes
+ *                                  RINGBUFFER_FLAG_MIRRORED: the buffer is mapped twice
+ *                                  back to back, the length is at least one page
+ */
+RingBuffer *
+RingBuffer_newWithFlags(int num_bytes, uint8_t flags)
+{
+    RingBuffer *this;
+
+    if (posix_memalign((void **) &this, RINGBUFFER_CACHE_LINE, sizeof(RingBuffer))) {
+        Log_println(LOG_ERROR, "Can't allocate ring buffer");
+        return NULL;
+    }
 
     if (pthread_mutex_init(&(this->mutex), NULL)) {
         Log_errno(LOG_ERROR, errno, "Failed to initialize mutex");
@@ -32,10 +59,27 @@ RingBuffer_new(int num_bytes)
     }
 
     this->max           = (uint32_t) (1 << num_bytes);
-    this->ringBuffer    = (char *) malloc(this->max);
+    if ((flags & RINGBUFFER_FLAG_MIRRORED) && this->max < (uint32_t) sysconf(_SC_PAGESIZE)) {
+        this->max       = (uint32_t) sysconf(_SC_PAGESIZE);
+    }
+    this->flags         = flags;
     this->readPointer   = 0;
     this->writePointer  = 0;
-    this->size          = 0;
+    this->readCache     = 0;
+    this->writeCache    = 0;
+
+    if (flags & RINGBUFFER_FLAG_MIRRORED) {
+        this->ringBuffer = RingBuffer_mapMirrored(this->max);
+    } else {
+        this->ringBuffer = (char *) malloc(this->max);
+    }
+
+    if (this->ringBuffer == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate ring buffer");
+        pthread_mutex_destroy(&(this->mutex));
+        free(this);
+        return NULL;
+    }
 
     return this;
 }
@@ -44,10 +88,133 @@ void
 RingBuffer_delete(RingBuffer *this)
 {
     if (this != NULL) {
-        delete(this);
+        pthread_mutex_destroy(&(this->mutex));
+        if (this->flags & RINGBUFFER_FLAG_MIRRORED) {
+            munmap(this->ringBuffer, 2 * this->max);
+        } else {
+            free(this->ringBuffer);
+        }
+        free(this);
     }
 }
 
+/**
+ * map the same memory twice, back to back:
+ * ringBuffer[i] and ringBuffer[i + size] are the same byte
+ *
+ *      _______________________________ _______________________________
+ *     |   |   |   |   |   |   |   |   |   |   |   |   |   |   |   |   |
+ *     | a | b |   |   |   |   | X | X | a | b |   |   |   |   | X | X |
+ *     |___|___|___|___|___|___|___|___|___|___|___|___|___|___|___|___|
+ *       0   1   2   3   4   5   6   7   0   1   2   3   4   5   6   7
+ */
+static char *
+RingBuffer_mapMirrored(uint32_t size)
+{
+    char   *base;
+    int     fd;
+    int     err;
+
+    if ((fd = memfd_create("RingBuffer", MFD_CLOEXEC)) < 0) {
+        return NULL;
+    }
+
+    if (ftruncate(fd, size) < 0) {
+        goto RingBuffer_mapMirroredClose;
+    }
+
+    /* reserve the address space for both halves */
+    if ((base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        goto RingBuffer_mapMirroredClose;
+    }
+
+    if (mmap(base,        size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        err = errno;
+        munmap(base, 2 * size);
+        errno = err;
+        goto RingBuffer_mapMirroredClose;
+    }
+
+    /* the mappings keep the memory alive */
+    close(fd);
+    return base;
+
+RingBuffer_mapMirroredClose:
+    err = errno;
+    close(fd);
+    errno = err;
+    return NULL;
+}
+
+static inline void
+RingBuffer_lock(RingBuffer *this)
+{
+    if (!(this->flags & RINGBUFFER_FLAG_SPSC)) {
+        pthread_mutex_lock(&(this->mutex));
+    }
+}
+
+static inline void
+RingBuffer_unlock(RingBuffer *this)
+{
+    if (!(this->flags & RINGBUFFER_FLAG_SPSC)) {
+        pthread_mutex_unlock(&(this->mutex));
+    }
+}
+
+/**
+ * consumer: number of readable bytes, the producer's write pointer is
+ * only loaded (acquire) if the cached copy doesn't satisfy the request
+ */
+static inline uint32_t
+RingBuffer_readable(RingBuffer *this, uint32_t wanted)
+{
+    uint32_t readable = (this->writeCache - this->readPointer) & (this->max - 1);
+
+    if (readable < wanted) {
+        this->writeCache = __atomic_load_n(&(this->writePointer), __ATOMIC_ACQUIRE);
+        readable         = (this->writeCache - this->readPointer) & (this->max - 1);
+    }
+
+    return readable;
+}
+
+/**
+ * producer: number of writable bytes (one entry always stays empty),
+ * the consumer's read pointer is only loaded (acquire) if necessary
+ */
+static inline uint32_t
+RingBuffer_writable(RingBuffer *this, uint32_t wanted)
+{
+    uint32_t writable = (this->readCache - this->writePointer - 1) & (this->max - 1);
+
+    if (writable < wanted) {
+        this->readCache = __atomic_load_n(&(this->readPointer), __ATOMIC_ACQUIRE);
+        writable        = (this->readCache - this->writePointer - 1) & (this->max - 1);
+    }
+
+    return writable;
+}
+
+/**
+ * consumer: hand the read entries back to the producer
+ */
+static inline void
+RingBuffer_publishRead(RingBuffer *this, uint32_t readPointer)
+{
+    __atomic_store_n(&(this->readPointer), readPointer & (this->max - 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * producer: publish the written entries to the consumer
+ */
+static inline void
+RingBuffer_publishWrite(RingBuffer *this, uint32_t writePointer)
+{
+    __atomic_store_n(&(this->writePointer), writePointer & (this->max - 1), __ATOMIC_RELEASE);
+}
+
 /**
  * read from ring buffer the whole data
  *
@@ -60,28 +227,23 @@ RingBuffer_delete(RingBuffer *this)
 bool
 RingBuffer_read(RingBuffer *this, char *buffer, uint16_t *size)
 {
-    uint16_t        first_stage_size;
-    uint16_t        second_stage_size;
-    uint16_t        read_size;
+    uint32_t        first_stage_size;
+    uint32_t        second_stage_size;
+    uint32_t        read_size;
+    uint32_t        readable;
     bool            result = true;
 
-    pthread_mutex_lock(&(this->mutex));
-
-//    if (this == &(uart0->tx_ring)) {
-//        uart_put(uart0, '-');
-//    }
+    RingBuffer_lock(this);
 
-    if (!RingBuffer_canRead(this)) {
+    if ((readable = RingBuffer_readable(this, *size)) == 0) {
         result = false;
         goto RingBuffer_readExit;
     }
 
     /* is the buffer not as big as the ring buffer?
      * just read until buffer is full */
-    if (*size < this->size) read_size = *size;
-    else                    read_size = this->size;
-
-    //  || *size < RINGBUFFER_MAX_SIZE
+    if (*size < readable)   read_size = *size;
+    else                    read_size = readable;
 
     /* write pointer has got an overflow ?
      * ring buffer two-stage copy
@@ -95,7 +257,7 @@ RingBuffer_read(RingBuffer *this, char *buffer, uint16_t *size)
      *               ^               ^
      *               W               R
      */
-    if (this->writePointer < this->readPointer) {
+    if (this->readPointer + read_size > this->max && !(this->flags & RINGBUFFER_FLAG_MIRRORED)) {
 
         /* calculate first stage size */
         first_stage_size = this->max - this->readPointer;
@@ -125,7 +287,7 @@ RingBuffer_read(RingBuffer *this, char *buffer, uint16_t *size)
          */
         memcpy(&(buffer[first_stage_size]), &(this->ringBuffer[0]), second_stage_size);
 
-    /* no overflow of write pointer */
+    /* no overflow of write pointer (or the mirror continues the buffer) */
     } else {
         memcpy(buffer, &(this->ringBuffer[this->readPointer]), read_size);
     }
@@ -142,13 +304,10 @@ RingBuffer_read(RingBuffer *this, char *buffer, uint16_t *size)
      *               ^
      *               WR
      */
-    this->readPointer = (this->readPointer + read_size) & (this->max - 1);
-
-    /* decrement size from read size */
-    this->size -= read_size;
+    RingBuffer_publishRead(this, this->readPointer + read_size);
 
 RingBuffer_readExit:
-    pthread_mutex_unlock(&(this->mutex));
+    RingBuffer_unlock(this);
 
     return result;
 }
@@ -164,9 +323,10 @@ bool
 RingBuffer_get(RingBuffer *this, char *character)
 {
     bool result = true;
-    pthread_mutex_lock(&(this->mutex));
 
-    if (!RingBuffer_canRead(this)) {
+    RingBuffer_lock(this);
+
+    if (RingBuffer_readable(this, 1) == 0) {
         result = false;
         goto RingBuffer_getExit;
     }
@@ -174,14 +334,11 @@ RingBuffer_get(RingBuffer *this, char *character)
     /* get charater */
     *character = this->ringBuffer[this->readPointer];
 
-    /* decrement size */
-    this->size -= 1;
-
     /* increment read pointer */
-    this->readPointer = (this->readPointer + 1) & (this->max - 1);
+    RingBuffer_publishRead(this, this->readPointer + 1);
 
 RingBuffer_getExit:
-    pthread_mutex_unlock(&(this->mutex));
+    RingBuffer_unlock(this);
 
     return result;
 }
@@ -192,35 +349,32 @@ RingBuffer_getExit:
 bool
 RingBuffer_write(RingBuffer *this, char *buffer, uint16_t size)
 {
-    uint16_t size_written;
-    uint16_t write_size;
+    uint32_t size_written;
+    uint32_t write_size;
+    uint32_t writePointer;
     bool     result = true;
 
-    pthread_mutex_lock(&(this->mutex));
+    RingBuffer_lock(this);
 
-    if (!RingBuffer_canWrite(this)) {
-        result = false;
-        goto RingBuffer_writeExit;
-    }
+    writePointer = this->writePointer;
 
     /* buffer is not empty */
     if (size > 0) {
         /* cancel if the size doesn't fit in ring buffer */
-        if (size >= (this->max - this->size)) {
+        if (RingBuffer_writable(this, size) < size) {
             result = false;
             goto RingBuffer_writeExit;
         }
         write_size  = size;
-        this->size += write_size;
 
-        /* write pointer doesn't overflow */
-        if (this->writePointer + write_size < this->max) {
+        /* write pointer doesn't overflow (or the mirror continues the buffer) */
+        if (writePointer + write_size < this->max || (this->flags & RINGBUFFER_FLAG_MIRRORED)) {
 
             /* write to ring buffer */
-            memcpy(&(this->ringBuffer[this->writePointer]), buffer, write_size);
+            memcpy(&(this->ringBuffer[writePointer]), buffer, write_size);
 
             /* increment write pointer */
-            this->writePointer += write_size;
+            writePointer += write_size;
 
         /* write pointer would overflow, handle it special */
         } else {
@@ -250,8 +404,8 @@ RingBuffer_write(RingBuffer *this, char *buffer, uint16_t size)
              *     |___|___|___|___|___|___|___|___|
              *       0   1   2   3   4   5   6   7
              */
-            size_written = this->max - this->writePointer;
-            memcpy(&(this->ringBuffer[this->writePointer]), buffer, size_written);
+            size_written = this->max - writePointer;
+            memcpy(&(this->ringBuffer[writePointer]), buffer, size_written);
 
             /* subtract size from already written data
              *
@@ -280,18 +434,21 @@ RingBuffer_write(RingBuffer *this, char *buffer, uint16_t size)
             buffer += size_written;
 
             /* set write pointer to zero to write into the first ringbuffer entry */
-            this->writePointer = 0;
+            writePointer = 0;
 
             /* write to ring buffer */
-            memcpy(&(this->ringBuffer[this->writePointer]), buffer, write_size);
+            memcpy(&(this->ringBuffer[writePointer]), buffer, write_size);
 
             /* increment write pointer */
-            this->writePointer += write_size;
+            writePointer += write_size;
         }
+
+        /* make the data visible to the consumer */
+        RingBuffer_publishWrite(this, writePointer);
     }
 
 RingBuffer_writeExit:
-    pthread_mutex_unlock(&(this->mutex));
+    RingBuffer_unlock(this);
 
     return result;
 }
@@ -304,9 +461,9 @@ RingBuffer_put(RingBuffer *this, char character)
 {
     bool result = true;
 
-    pthread_mutex_lock(&(this->mutex));
+    RingBuffer_lock(this);
 
-    if (!RingBuffer_canWrite(this)) {
+    if (RingBuffer_writable(this, 1) == 0) {
         result = false;
         goto RingBuffer_putExit;
     }
@@ -315,13 +472,135 @@ RingBuffer_put(RingBuffer *this, char character)
     this->ringBuffer[this->writePointer] = character;
 
     /* increment write pointer */
-    this->writePointer = (this->writePointer + 1) & (this->max - 1);
-
-    /* increase size */
-    this->size++;
+    RingBuffer_publishWrite(this, this->writePointer + 1);
 
 RingBuffer_putExit:
-    pthread_mutex_unlock(&(this->mutex));
+    RingBuffer_unlock(this);
+
+    return result;
+}
+
+/**
+ * zero-copy read: contiguous readable region at the read pointer,
+ * only valid until RingBuffer_consume (one consumer thread only)
+ *
+ * @param   this                    a
+ * @param   len                     input is the wanted size (the producer's pointer
+ *                                  is re-loaded if less is known to be readable),
+ *                                  output is the contiguous readable size
+ * @return                          start of the region or NULL if empty
+ */
+char *
+RingBuffer_readableSpan(RingBuffer *this, uint32_t *len)
+{
+    return RingBuffer_readableSpanAt(this, 0, len);
+}
+
+/**
+ * zero-copy read behind the first offset readable bytes, e.g. the wrapped
+ * part after a span of RingBuffer_readableSpan (one consumer thread only)
+ *
+ * @param   offset                  readable bytes to skip, not consumed
+ * @param   len                     see RingBuffer_readableSpan
+ * @return                          start of the region or NULL if nothing is behind offset
+ */
+char *
+RingBuffer_readableSpanAt(RingBuffer *this, uint32_t offset, uint32_t *len)
+{
+    uint32_t readable;
+    uint32_t start;
+    char    *span = NULL;
+
+    RingBuffer_lock(this);
+
+    if ((readable = RingBuffer_readable(this, offset + *len)) > offset) {
+        readable -= offset;
+        start     = (this->readPointer + offset) & (this->max - 1);
+
+        /* without the mirror the region ends at the end of the buffer */
+        if (!(this->flags & RINGBUFFER_FLAG_MIRRORED) && start + readable > this->max) {
+            readable = this->max - start;
+        }
+        span = &(this->ringBuffer[start]);
+    } else {
+        readable = 0;
+    }
+    *len = readable;
+
+    RingBuffer_unlock(this);
+
+    return span;
+}
+
+/**
+ * release len bytes of a span returned by RingBuffer_readableSpan
+ */
+bool
+RingBuffer_consume(RingBuffer *this, uint32_t len)
+{
+    bool result = true;
+
+    RingBuffer_lock(this);
+
+    if (RingBuffer_readable(this, len) < len) {
+        result = false;
+    } else {
+        RingBuffer_publishRead(this, this->readPointer + len);
+    }
+
+    RingBuffer_unlock(this);
+
+    return result;
+}
+
+/**
+ * zero-copy write: contiguous writable region at the write pointer,
+ * fill it (ex. with recv) and publish it with RingBuffer_commitWrite
+ * (one producer thread only)
+ *
+ * @param   this                    a
+ * @param   len                     input is the wanted size, output is the
+ *                                  contiguous writable size
+ * @return                          start of the region or NULL if full
+ */
+char *
+RingBuffer_writableSpan(RingBuffer *this, uint32_t *len)
+{
+    uint32_t writable;
+    char    *span = NULL;
+
+    RingBuffer_lock(this);
+
+    if ((writable = RingBuffer_writable(this, *len)) > 0) {
+        if (!(this->flags & RINGBUFFER_FLAG_MIRRORED) && this->writePointer + writable > this->max) {
+            writable = this->max - this->writePointer;
+        }
+        span = &(this->ringBuffer[this->writePointer]);
+    }
+    *len = writable;
+
+    RingBuffer_unlock(this);
+
+    return span;
+}
+
+/**
+ * publish len bytes written into a span returned by RingBuffer_writableSpan
+ */
+bool
+RingBuffer_commitWrite(RingBuffer *this, uint32_t len)
+{
+    bool result = true;
+
+    RingBuffer_lock(this);
+
+    if (RingBuffer_writable(this, len) < len) {
+        result = false;
+    } else {
+        RingBuffer_publishWrite(this, this->writePointer + len);
+    }
+
+    RingBuffer_unlock(this);
 
     return result;
 }
@@ -0,0 +1,85 @@
+#include "Socket.h"
+#include "Log.h"
+
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define RETURN_ON_ERROR(stat, str)      if (stat < 0) { \
+                                            Log_errno(LOG_ERROR, errno, str); \
+                                            if (listenfd >= 0) close(listenfd); \
+                                            return -1; \
+                                        }
+
+/**
+ * every connection needs a file descriptor, so allow as many as the hard limit
+ */
+bool
+Socket_raiseFileLimit(void)
+{
+    struct rlimit       limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't get file descriptor limit");
+        return false;
+    }
+
+    limit.rlim_cur = limit.rlim_max;
+
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't raise file descriptor limit");
+        return false;
+    }
+
+    Log_println(LOG_DEBUG, "File descriptor limit = %lu", (unsigned long) limit.rlim_cur);
+
+    return true;
+}
+
+/**
+ * non-blocking passive socket, IPv6 sockets don't accept IPv4 mapped addresses
+ */
+int
+Socket_listen(struct addrinfo *addrinfo, int backlog, bool reuseport)
+{
+    int                 listenfd;
+    int                 status;
+    int                 reuseaddr = 1;
+
+    /* create socket */
+    Log_println(LOG_INFO, "Create %s socket", Log_getFamily(addrinfo->ai_family));
+    listenfd = socket(addrinfo->ai_family, addrinfo->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    RETURN_ON_ERROR(listenfd, "Can't create socket");
+
+    /* turn off IPv4 to IPv6 mapping */
+    if (addrinfo->ai_family == AF_INET6) {
+        int v6only = 1;
+        Log_println(LOG_INFO, "Turn off IPv4 to IPv6 mapping");
+        status = setsockopt(listenfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        RETURN_ON_ERROR(status, "Can't set socket option IPV6_V6ONLY = 1");
+    }
+
+    status = setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr));
+    RETURN_ON_ERROR(status, "Can't set socket option SO_REUSEADDR = 1");
+
+    /* several sockets (e.g. one per thread) bind to the same address */
+    if (reuseport) {
+        int enable = 1;
+        status = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable));
+        RETURN_ON_ERROR(status, "Can't set socket option SO_REUSEPORT = 1");
+    }
+
+    /* bind address to socket */
+    Log_println(LOG_INFO, "Bind address to socket");
+    status = bind(listenfd, addrinfo->ai_addr, addrinfo->ai_addrlen);
+    RETURN_ON_ERROR(status, "Can't bind address to socket");
+
+    /* set to passive socket */
+    Log_println(LOG_INFO, "Set to passive socket");
+    status = listen(listenfd, backlog);
+    RETURN_ON_ERROR(status, "Can't set to passive socket");
+
+    return listenfd;
+}
@@ -0,0 +1,257 @@
+#include "ThreadPool.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+static void    *ThreadPool_workerThread (void *arg);
+static bool     ThreadPool_push         (ThreadPool *this, ThreadPoolTask task, void *arg, bool wait);
+static bool     ThreadPool_take         (ThreadPool *this, uint32_t idx, ThreadPoolJob *job);
+static uint32_t ThreadPool_roundUp      (uint32_t value);
+
+/**
+ * spawn all worker threads at once
+ *
+ * @param   numWorkers              number of threads, 0 = number of online cores
+ * @param   maxJobs                 number of queued jobs before ThreadPool_submit() blocks
+ */
+ThreadPool *
+ThreadPool_new(uint32_t numWorkers, uint32_t maxJobs)
+{
+    ThreadPool         *this;
+    uint32_t            idx;
+    int                 status;
+
+    if (numWorkers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numWorkers = (cores > 0) ? (uint32_t) cores : 1;
+    }
+
+    if (maxJobs == 0) {
+        maxJobs = 1;
+    }
+
+    if ((this = (ThreadPool *) calloc(1, sizeof(ThreadPool))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate thread pool");
+        return NULL;
+    }
+
+    this->numWorkers = numWorkers;
+    this->maxJobs    = maxJobs;
+    this->running    = true;
+    this->workers    = (ThreadPoolWorker *) calloc(numWorkers, sizeof(ThreadPoolWorker));
+    this->queues     = (ThreadPoolQueue *)  calloc(numWorkers, sizeof(ThreadPoolQueue));
+
+    pthread_mutex_init(&(this->mutex), NULL);
+    pthread_cond_init(&(this->notEmpty), NULL);
+    pthread_cond_init(&(this->notFull),  NULL);
+
+    if (this->workers == NULL || this->queues == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate workers");
+        ThreadPool_delete(this);
+        return NULL;
+    }
+
+    /* the limit is global, so a single queue must be able to hold every job */
+    for (idx = 0; idx < numWorkers; idx++) {
+        pthread_mutex_init(&(this->queues[idx].mutex), NULL);
+        this->queues[idx].max  = ThreadPool_roundUp(maxJobs + 1);
+        this->queues[idx].jobs = (ThreadPoolJob *) malloc(this->queues[idx].max * sizeof(ThreadPoolJob));
+
+        if (this->queues[idx].jobs == NULL) {
+            Log_errno(LOG_ERROR, errno, "Can't allocate job queue");
+            ThreadPool_delete(this);
+            return NULL;
+        }
+    }
+
+    for (idx = 0; idx < numWorkers; idx++) {
+        this->workers[idx].pool = this;
+        this->workers[idx].idx  = idx;
+
+        if ((status = pthread_create(&(this->workers[idx].tid), NULL, ThreadPool_workerThread, &(this->workers[idx])))) {
+            Log_println(LOG_ERROR, "Can't create worker thread: error = %d", status);
+            this->workers[idx].tid = 0;
+            ThreadPool_delete(this);
+            return NULL;
+        }
+    }
+
+    Log_println(LOG_INFO, "Thread pool with %u worker(s), %u queued job(s) max.", this->numWorkers, this->maxJobs);
+
+    return this;
+}
+
+/**
+ * finish all queued jobs, then join the workers
+ */
+void
+ThreadPool_delete(ThreadPool *this)
+{
+    uint32_t            idx;
+    int                 status;
+
+    if (this == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(this->mutex));
+    this->running = false;
+    pthread_cond_broadcast(&(this->notEmpty));
+    pthread_mutex_unlock(&(this->mutex));
+
+    for (idx = 0; this->workers != NULL && idx < this->numWorkers; idx++) {
+        if (this->workers[idx].tid && (status = pthread_join(this->workers[idx].tid, NULL))) {
+            Log_println(LOG_ERROR, "Can't join worker thread: error = %d", status);
+        }
+    }
+
+    for (idx = 0; this->queues != NULL && idx < this->numWorkers; idx++) {
+        pthread_mutex_destroy(&(this->queues[idx].mutex));
+        free(this->queues[idx].jobs);
+    }
+
+    pthread_cond_destroy(&(this->notFull));
+    pthread_cond_destroy(&(this->notEmpty));
+    pthread_mutex_destroy(&(this->mutex));
+
+    free(this->queues);
+    free(this->workers);
+    free(this);
+}
+
+/**
+ * queue a job, blocks while the pool already holds maxJobs jobs (backpressure)
+ */
+bool
+ThreadPool_submit(ThreadPool *this, ThreadPoolTask task, void *arg)
+{
+    return ThreadPool_push(this, task, arg, true);
+}
+
+/**
+ * queue a job unless the pool is full or shutting down, never blocks
+ * (jobs submitting jobs can't wait for themselves)
+ */
+bool
+ThreadPool_trySubmit(ThreadPool *this, ThreadPoolTask task, void *arg)
+{
+    if (!__atomic_load_n(&(this->running), __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    return ThreadPool_push(this, task, arg, false);
+}
+
+static bool
+ThreadPool_push(ThreadPool *this, ThreadPoolTask task, void *arg, bool wait)
+{
+    ThreadPoolQueue    *queue;
+
+    pthread_mutex_lock(&(this->mutex));
+
+    while (__atomic_load_n(&(this->numJobs), __ATOMIC_RELAXED) >= this->maxJobs) {
+        if (!wait || !this->running) {
+            pthread_mutex_unlock(&(this->mutex));
+            return false;
+        }
+        pthread_cond_wait(&(this->notFull), &(this->mutex));
+    }
+
+    /* distribute round-robin, idle workers steal the rest */
+    queue = &(this->queues[__atomic_fetch_add(&(this->next), 1, __ATOMIC_RELAXED) % this->numWorkers]);
+
+    /* counted once it's queued: a worker which sees it finds it */
+    pthread_mutex_lock(&(queue->mutex));
+    queue->jobs[queue->tail].task = task;
+    queue->jobs[queue->tail].arg  = arg;
+    queue->tail = (queue->tail + 1) & (queue->max - 1);
+    __atomic_add_fetch(&(this->numJobs), 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(queue->mutex));
+
+    pthread_cond_signal(&(this->notEmpty));
+    pthread_mutex_unlock(&(this->mutex));
+
+    return true;
+}
+
+/**
+ * take a job from the own queue, otherwise steal one from another worker
+ */
+static bool
+ThreadPool_take(ThreadPool *this, uint32_t idx, ThreadPoolJob *job)
+{
+    ThreadPoolQueue    *queue;
+    uint32_t            offset;
+    bool                found = false;
+
+    for (offset = 0; !found && offset < this->numWorkers; offset++) {
+        queue = &(this->queues[(idx + offset) % this->numWorkers]);
+
+        pthread_mutex_lock(&(queue->mutex));
+        if (queue->head != queue->tail) {
+            if (offset == 0) {
+                /* own queue: oldest job first */
+                *job        = queue->jobs[queue->head];
+                queue->head = (queue->head + 1) & (queue->max - 1);
+            } else {
+                /* steal: newest job, keeps the victim's cache-warm head */
+                queue->tail = (queue->tail - 1) & (queue->max - 1);
+                *job        = queue->jobs[queue->tail];
+            }
+            found = true;
+        }
+        pthread_mutex_unlock(&(queue->mutex));
+    }
+
+    return found;
+}
+
+static void *
+ThreadPool_workerThread(void *arg)
+{
+    ThreadPoolWorker   *worker = (ThreadPoolWorker *) arg;
+    ThreadPool         *this   = worker->pool;
+    ThreadPoolJob       job;
+
+    for (;;) {
+        if (ThreadPool_take(this, worker->idx, &job)) {
+            /* release the slot before running, a blocked submitter can continue */
+            if (__atomic_fetch_sub(&(this->numJobs), 1, __ATOMIC_ACQ_REL) >= this->maxJobs) {
+                pthread_mutex_lock(&(this->mutex));
+                pthread_cond_broadcast(&(this->notFull));
+                pthread_mutex_unlock(&(this->mutex));
+            }
+
+            job.task(job.arg);
+            continue;
+        }
+
+        pthread_mutex_lock(&(this->mutex));
+        while (__atomic_load_n(&(this->numJobs), __ATOMIC_ACQUIRE) == 0 && this->running) {
+            pthread_cond_wait(&(this->notEmpty), &(this->mutex));
+        }
+
+        /* drain the queues before leaving */
+        if (__atomic_load_n(&(this->numJobs), __ATOMIC_ACQUIRE) == 0 && !this->running) {
+            pthread_mutex_unlock(&(this->mutex));
+            break;
+        }
+        pthread_mutex_unlock(&(this->mutex));
+    }
+
+    return NULL;
+}
+
+static uint32_t
+ThreadPool_roundUp(uint32_t value)
+{
+    uint32_t            power = 1;
+
+    while (power < value) {
+        power <<= 1;
+    }
+
+    return power;
+}
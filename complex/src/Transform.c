@@ -0,0 +1,342 @@
+#include "Transform.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRANSFORM_X86
+#endif
+
+static void     Transform_resolve       (void);
+
+static uint32_t Transform_utf8          (char *data, uint32_t len, uint32_t i, uint32_t end, bool upper, bool *valid);
+static uint32_t Transform_mapUpper      (uint32_t cp);
+static uint32_t Transform_mapLower      (uint32_t cp);
+
+static bool     Transform_scalarUpper   (char *data, uint32_t len);
+static bool     Transform_scalarLower   (char *data, uint32_t len);
+
+#ifdef TRANSFORM_X86
+static bool     Transform_sse2Upper     (char *data, uint32_t len);
+static bool     Transform_sse2Lower     (char *data, uint32_t len);
+static bool     Transform_avx2Upper     (char *data, uint32_t len);
+static bool     Transform_avx2Lower     (char *data, uint32_t len);
+#endif
+
+static TransformFunction    toUpper;
+static TransformFunction    toLower;
+static const char          *name;
+
+/**
+ * UTF-8 payload: ASCII, Latin-1 Supplement, Latin Extended-A, Greek and
+ * Cyrillic letters are converted. Mappings which would change the encoded
+ * length (ex. 'ß' -> "SS") are skipped, the conversion is in place.
+ *
+ * @return                          false if the payload isn't valid UTF-8,
+ *                                  invalid bytes are left as they are
+ */
+bool
+Transform_toUpper(char *data, uint32_t len)
+{
+    if (__atomic_load_n(&toUpper, __ATOMIC_ACQUIRE) == NULL) {
+        Transform_resolve();
+    }
+    return toUpper(data, len);
+}
+
+bool
+Transform_toLower(char *data, uint32_t len)
+{
+    if (__atomic_load_n(&toLower, __ATOMIC_ACQUIRE) == NULL) {
+        Transform_resolve();
+    }
+    return toLower(data, len);
+}
+
+/**
+ * name of the selected implementation
+ */
+const char *
+Transform_getName(void)
+{
+    if (__atomic_load_n(&toUpper, __ATOMIC_ACQUIRE) == NULL) {
+        Transform_resolve();
+    }
+    return name;
+}
+
+/**
+ * one implementation by name, for tests and benchmarks
+ *
+ * @param   name                    "scalar", "sse2" or "avx2"
+ * @return                          false if it's unknown or the CPU doesn't support it
+ */
+bool
+Transform_getFunctions(const char *name, TransformFunction *upper, TransformFunction *lower)
+{
+    if (strcmp(name, "scalar") == 0) {
+        *upper = Transform_scalarUpper;
+        *lower = Transform_scalarLower;
+        return true;
+    }
+
+#ifdef TRANSFORM_X86
+    __builtin_cpu_init();
+
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        *upper = Transform_avx2Upper;
+        *lower = Transform_avx2Lower;
+        return true;
+    }
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        *upper = Transform_sse2Upper;
+        *lower = Transform_sse2Lower;
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+/**
+ * runtime CPU dispatch, racing threads resolve to the same functions
+ */
+static void
+Transform_resolve(void)
+{
+    TransformFunction   upper = Transform_scalarUpper;
+    TransformFunction   lower = Transform_scalarLower;
+
+    name = "scalar";
+
+#ifdef TRANSFORM_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        upper = Transform_avx2Upper;
+        lower = Transform_avx2Lower;
+        name  = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        upper = Transform_sse2Upper;
+        lower = Transform_sse2Lower;
+        name  = "sse2";
+    }
+#endif
+
+    __atomic_store_n(&toLower, lower, __ATOMIC_RELEASE);
+    __atomic_store_n(&toUpper, upper, __ATOMIC_RELEASE);
+}
+
+/**
+ * convert the sequences which start before end, a sequence may
+ * reach beyond end (but not beyond len)
+ *
+ * @return                          index after the last sequence
+ */
+static uint32_t
+Transform_utf8(char *data, uint32_t len, uint32_t i, uint32_t end, bool upper, bool *valid)
+{
+    uint8_t     c;
+    uint32_t    n;
+    uint32_t    k;
+    uint32_t    cp;
+    uint32_t    min;
+    uint32_t    mapped;
+
+    while (i < end) {
+        c = (uint8_t) data[i];
+
+        if (c < 0x80) {
+            if (upper && c >= 'a' && c <= 'z')       data[i] ^= 0x20;
+            else if (!upper && c >= 'A' && c <= 'Z') data[i] ^= 0x20;
+            i++;
+            continue;
+        }
+
+        /* lead byte: sequence length and smallest code point (no overlong forms) */
+        if (c >= 0xC2 && c <= 0xDF)      { n = 2; cp = c & 0x1F; min = 0x80;    }
+        else if (c >= 0xE0 && c <= 0xEF) { n = 3; cp = c & 0x0F; min = 0x800;   }
+        else if (c >= 0xF0 && c <= 0xF4) { n = 4; cp = c & 0x07; min = 0x10000; }
+        else                             { *valid = false; i++; continue; }
+
+        if (i + n > len) {
+            *valid = false;
+            i++;
+            continue;
+        }
+
+        for (k = 1; k < n && ((uint8_t) data[i + k] & 0xC0) == 0x80; k++) {
+            cp = (cp << 6) | ((uint8_t) data[i + k] & 0x3F);
+        }
+
+        if (k < n || cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+            *valid = false;
+            i++;
+            continue;
+        }
+
+        /* every mapped letter is encoded with two bytes */
+        if (n == 2) {
+            mapped = upper ? Transform_mapUpper(cp) : Transform_mapLower(cp);
+            if (mapped != cp) {
+                data[i]     = (char) (0xC0 | (mapped >> 6));
+                data[i + 1] = (char) (0x80 | (mapped & 0x3F));
+            }
+        }
+
+        i += n;
+    }
+
+    return i;
+}
+
+static uint32_t
+Transform_mapUpper(uint32_t cp)
+{
+    if (cp >= 0x00E0 && cp <= 0x00FE && cp != 0x00F7)   return cp - 0x20;   /* Latin-1 */
+    if (cp == 0x00FF)                                   return 0x0178;
+    if (cp >= 0x0100 && cp <= 0x0137 && cp != 0x0131)   return cp & ~1u;    /* Latin Extended-A, pairs */
+    if (cp >= 0x0139 && cp <= 0x0148)                   return (cp & 1) ? cp : cp - 1;
+    if (cp >= 0x014A && cp <= 0x0177)                   return cp & ~1u;
+    if (cp >= 0x0179 && cp <= 0x017E)                   return (cp & 1) ? cp : cp - 1;
+    if (cp == 0x03C2)                                   return 0x03A3;      /* final sigma */
+    if (cp >= 0x03B1 && cp <= 0x03C9)                   return cp - 0x20;   /* Greek */
+    if (cp >= 0x0430 && cp <= 0x044F)                   return cp - 0x20;   /* Cyrillic */
+    if (cp >= 0x0450 && cp <= 0x045F)                   return cp - 0x50;
+    return cp;
+}
+
+static uint32_t
+Transform_mapLower(uint32_t cp)
+{
+    if (cp >= 0x00C0 && cp <= 0x00DE && cp != 0x00D7)   return cp + 0x20;   /* Latin-1 */
+    if (cp == 0x0178)                                   return 0x00FF;
+    if (cp >= 0x0100 && cp <= 0x0137 && cp != 0x0130)   return cp | 1u;     /* Latin Extended-A, pairs */
+    if (cp >= 0x0139 && cp <= 0x0148)                   return (cp & 1) ? cp + 1 : cp;
+    if (cp >= 0x014A && cp <= 0x0177)                   return cp | 1u;
+    if (cp >= 0x0179 && cp <= 0x017E)                   return (cp & 1) ? cp + 1 : cp;
+    if (cp >= 0x0391 && cp <= 0x03A9 && cp != 0x03A2)   return cp + 0x20;   /* Greek */
+    if (cp >= 0x0410 && cp <= 0x042F)                   return cp + 0x20;   /* Cyrillic */
+    if (cp >= 0x0400 && cp <= 0x040F)                   return cp + 0x50;
+    return cp;
+}
+
+static bool
+Transform_scalarUpper(char *data, uint32_t len)
+{
+    bool        valid = true;
+
+    Transform_utf8(data, len, 0, len, true, &valid);
+
+    return valid;
+}
+
+static bool
+Transform_scalarLower(char *data, uint32_t len)
+{
+    bool        valid = true;
+
+    Transform_utf8(data, len, 0, len, false, &valid);
+
+    return valid;
+}
+
+#ifdef TRANSFORM_X86
+
+/*
+ * A vector without a byte >= 0x80 is pure ASCII and converted in one step:
+ * a byte is in [first, last] if it's greater than first - 1 and less than
+ * last + 1 (signed compare), the matching bytes get 0x20 flipped. Vectors
+ * with other bytes take the UTF-8 path until the next sequence boundary.
+ */
+
+__attribute__ ((target ("sse2")))
+static inline bool
+Transform_sse2(char *data, uint32_t len, bool upper)
+{
+    const __m128i   below = _mm_set1_epi8((char) ((upper ? 'a' : 'A') - 1));
+    const __m128i   above = _mm_set1_epi8((char) ((upper ? 'z' : 'Z') + 1));
+    const __m128i   flip  = _mm_set1_epi8(0x20);
+    __m128i         v;
+    __m128i         mask;
+    uint32_t        i     = 0;
+    bool            valid = true;
+
+    while (i + 16 <= len) {
+        v = _mm_loadu_si128((const __m128i *) &(data[i]));
+
+        if (_mm_movemask_epi8(v) != 0) {
+            i = Transform_utf8(data, len, i, i + 16, upper, &valid);
+            continue;
+        }
+
+        mask = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+        v    = _mm_xor_si128(v, _mm_and_si128(mask, flip));
+        _mm_storeu_si128((__m128i *) &(data[i]), v);
+        i   += 16;
+    }
+
+    Transform_utf8(data, len, i, len, upper, &valid);
+
+    return valid;
+}
+
+__attribute__ ((target ("sse2")))
+static bool
+Transform_sse2Upper(char *data, uint32_t len)
+{
+    return Transform_sse2(data, len, true);
+}
+
+__attribute__ ((target ("sse2")))
+static bool
+Transform_sse2Lower(char *data, uint32_t len)
+{
+    return Transform_sse2(data, len, false);
+}
+
+__attribute__ ((target ("avx2")))
+static inline bool
+Transform_avx2(char *data, uint32_t len, bool upper)
+{
+    const __m256i   below = _mm256_set1_epi8((char) ((upper ? 'a' : 'A') - 1));
+    const __m256i   above = _mm256_set1_epi8((char) ((upper ? 'z' : 'Z') + 1));
+    const __m256i   flip  = _mm256_set1_epi8(0x20);
+    __m256i         v;
+    __m256i         mask;
+    uint32_t        i     = 0;
+    bool            valid = true;
+
+    while (i + 32 <= len) {
+        v = _mm256_loadu_si256((const __m256i *) &(data[i]));
+
+        if (_mm256_movemask_epi8(v) != 0) {
+            i = Transform_utf8(data, len, i, i + 32, upper, &valid);
+            continue;
+        }
+
+        mask = _mm256_and_si256(_mm256_cmpgt_epi8(v, below), _mm256_cmpgt_epi8(above, v));
+        v    = _mm256_xor_si256(v, _mm256_and_si256(mask, flip));
+        _mm256_storeu_si256((__m256i *) &(data[i]), v);
+        i   += 32;
+    }
+
+    /* the rest is less than one vector, it starts at a sequence boundary */
+    return Transform_sse2(&(data[i]), len - i, upper) && valid;
+}
+
+__attribute__ ((target ("avx2")))
+static bool
+Transform_avx2Upper(char *data, uint32_t len)
+{
+    return Transform_avx2(data, len, true);
+}
+
+__attribute__ ((target ("avx2")))
+static bool
+Transform_avx2Lower(char *data, uint32_t len)
+{
+    return Transform_avx2(data, len, false);
+}
+
+#endif
@@ -0,0 +1,533 @@
+#include "TransformTest.h"
+#include "Transform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_ALIGN                      32                      /**< payloads start at every offset of a vector */
+#define TEST_PADDING                    48                      /**< ASCII around a mapping case, it crosses vector boundaries */
+
+/**
+ * an implementation of Transform.c, scalar is the reference
+ */
+typedef struct {
+    const char         *name;
+    TransformFunction   toUpper;
+    TransformFunction   toLower;
+} TestImpl;
+
+/**
+ * expected conversions of one payload, the bytes are spelled out
+ */
+typedef struct {
+    const char         *name;
+    bool                valid;
+    const char         *input;
+    const char         *upper;
+    const char         *lower;
+} TestMapping;
+
+static const TestMapping mappings[] = {
+    /* aeoeue sz y-diaeresis: sz has no two-byte upper case, y-diaeresis is U+0178 */
+    { "latin-1 lower", true,
+      "\xC3\xA4\xC3\xB6\xC3\xBC\xC3\x9F\xC3\xBF",
+      "\xC3\x84\xC3\x96\xC3\x9C\xC3\x9F\xC5\xB8",
+      "\xC3\xA4\xC3\xB6\xC3\xBC\xC3\x9F\xC3\xBF" },
+    /* A-grave thorn, multiplication and division sign aren't letters */
+    { "latin-1 upper", true,
+      "\xC3\x80\xC3\x9E\xC3\x97\xC3\xB7",
+      "\xC3\x80\xC3\x9E\xC3\x97\xC3\xB7",
+      "\xC3\xA0\xC3\xBE\xC3\x97\xC3\xB7" },
+    /* pairs: A-macron, L-acute (odd upper case), Eng, Z-acute (odd), Y-diaeresis */
+    { "latin extended-a", true,
+      "\xC4\x80\xC4\x81\xC4\xB9\xC4\xBA\xC5\x8A\xC5\x8B\xC5\xB9\xC5\xBA\xC5\xB8",
+      "\xC4\x80\xC4\x80\xC4\xB9\xC4\xB9\xC5\x8A\xC5\x8A\xC5\xB9\xC5\xB9\xC5\xB8",
+      "\xC4\x81\xC4\x81\xC4\xBA\xC4\xBA\xC5\x8B\xC5\x8B\xC5\xBA\xC5\xBA\xC3\xBF" },
+    /* dotless i, dotted I, n-apostrophe, long s: their case partner is ASCII or longer */
+    { "latin extended-a skipped", true,
+      "\xC4\xB1\xC4\xB0\xC5\x89\xC5\xBF",
+      "\xC4\xB1\xC4\xB0\xC5\x89\xC5\xBF",
+      "\xC4\xB1\xC4\xB0\xC5\x89\xC5\xBF" },
+    /* alpha beta gamma omega final sigma */
+    { "greek lower", true,
+      "\xCE\xB1\xCE\xB2\xCE\xB3\xCF\x89\xCF\x82",
+      "\xCE\x91\xCE\x92\xCE\x93\xCE\xA9\xCE\xA3",
+      "\xCE\xB1\xCE\xB2\xCE\xB3\xCF\x89\xCF\x82" },
+    /* Alpha Sigma Omega, Alpha with tonos isn't mapped */
+    { "greek upper", true,
+      "\xCE\x91\xCE\xA3\xCE\xA9\xCE\x86",
+      "\xCE\x91\xCE\xA3\xCE\xA9\xCE\x86",
+      "\xCE\xB1\xCF\x83\xCF\x89\xCE\x86" },
+    /* privet, io dje */
+    { "cyrillic lower", true,
+      "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 \xD1\x91\xD1\x92",
+      "\xD0\x9F\xD0\xA0\xD0\x98\xD0\x92\xD0\x95\xD0\xA2 \xD0\x81\xD0\x82",
+      "\xD0\xBF\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 \xD1\x91\xD1\x92" },
+    /* Pe Io Ya, omega (U+0460) isn't mapped */
+    { "cyrillic upper", true,
+      "\xD0\x9F\xD0\x81\xD0\xAF\xD1\xA0",
+      "\xD0\x9F\xD0\x81\xD0\xAF\xD1\xA0",
+      "\xD0\xBF\xD1\x91\xD1\x8F\xD1\xA0" },
+    /* euro sign, emoji */
+    { "three and four bytes", true,
+      "\xE2\x82\xAC\xF0\x9F\x98\x80" "a",
+      "\xE2\x82\xAC\xF0\x9F\x98\x80" "A",
+      "\xE2\x82\xAC\xF0\x9F\x98\x80" "a" },
+    { "truncated at the end", false,
+      "ab" "\xC3",
+      "AB" "\xC3",
+      "ab" "\xC3" },
+    { "truncated", false,
+      "a" "\xC3" "z" "\xE2\x82" "z",
+      "A" "\xC3" "Z" "\xE2\x82" "Z",
+      "a" "\xC3" "z" "\xE2\x82" "z" },
+    { "lead byte twice", false,
+      "\xC3\xC3\xA4",
+      "\xC3\xC3\x84",
+      "\xC3\xC3\xA4" },
+    { "stray continuation", false,
+      "\x80" "a" "\xBF",
+      "\x80" "A" "\xBF",
+      "\x80" "a" "\xBF" },
+    { "overlong", false,
+      "\xC0\xAF" "a" "\xE0\x80\xAF",
+      "\xC0\xAF" "A" "\xE0\x80\xAF",
+      "\xC0\xAF" "a" "\xE0\x80\xAF" },
+    { "surrogate", false,
+      "\xED\xA0\x80" "z",
+      "\xED\xA0\x80" "Z",
+      "\xED\xA0\x80" "z" },
+    { "beyond U+10FFFF", false,
+      "\xF4\x90\x80\x80\xF5\x80\x80\x80",
+      "\xF4\x90\x80\x80\xF5\x80\x80\x80",
+      "\xF4\x90\x80\x80\xF5\x80\x80\x80" },
+    /* what follows an invalid byte is converted */
+    { "invalid, then a letter", false,
+      "\xFF\xC3\xA4",
+      "\xFF\xC3\x84",
+      "\xFF\xC3\xA4" }
+};
+
+static uint32_t TransformTest_impls     (TestImpl *impls);
+static bool     TransformTest_mappings  (const TestImpl *impls, uint32_t numImpls);
+static bool     TransformTest_map       (const TestImpl *impl, const TestMapping *mapping, bool upper, uint32_t padding);
+static bool     TransformTest_compare   (const TestImpl *impls, uint32_t numImpls, uint64_t iterations);
+static bool     TransformTest_check     (const TestImpl *impl, const TestImpl *reference, bool upper,
+                                         const char *input, uint32_t len, uint32_t offset);
+static uint32_t TransformTest_generate  (char *data, uint32_t max, uint32_t utf8);
+static uint32_t TransformTest_encode    (char *data, uint32_t cp);
+static void     TransformTest_bench     (const TestImpl *impls, uint32_t numImpls, uint32_t size, uint32_t message);
+static void     TransformTest_dump      (const char *label, const char *data, uint32_t len);
+static void     TransformTest_usage     (const char *program);
+static uint64_t TransformTest_random    (void);
+static uint64_t TransformTest_now       (void);
+
+static uint64_t random_ = 0x9E3779B97F4A7C15ULL;
+
+int
+main(int argc, char *argv[])
+{
+    TestImpl            impls[3];
+    uint32_t            numImpls;
+    uint64_t            iterations = CONFIG_TEST_ITERATIONS;
+    uint32_t            size       = CONFIG_BENCH_SIZE;
+    uint32_t            message    = CONFIG_BENCH_MESSAGE;
+    char               *end;
+    int                 opt;
+
+    while ((opt = getopt(argc, argv, "hn:b:s:")) != -1) {
+        errno = 0;
+        end   = NULL;
+
+        switch (opt) {
+            case 'n':
+                iterations = strtoull(optarg, &end, 10);
+                break;
+            case 'b':
+                size       = (uint32_t) strtoul(optarg, &end, 10);
+                break;
+            case 's':
+                message    = (uint32_t) strtoul(optarg, &end, 10);
+                break;
+            default:
+                TransformTest_usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        if (errno != 0 || end == optarg || *end != '\0' || (opt == 's' && (message == 0 || message > UINT16_MAX))) {
+            fprintf(stderr, "Invalid value of -%c: %s\n", opt, optarg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc) {
+        TransformTest_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    random_ ^= (uint64_t) time(NULL);
+    numImpls = TransformTest_impls(impls);
+
+    printf("Transform: %s selected, %u implementation(s) on this CPU\n", Transform_getName(), numImpls);
+
+    if (!TransformTest_mappings(impls, numImpls) || !TransformTest_compare(impls, numImpls, iterations)) {
+        return EXIT_FAILURE;
+    }
+
+    if (size > 0) {
+        TransformTest_bench(impls, numImpls, size, message);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void
+TransformTest_usage(const char *program)
+{
+    fprintf(stderr, CONFIG_PROGRAM_DESC " " CONFIG_PROGRAM_VERSION "\n");
+    fprintf(stderr, "Usage:\n%s %s\n", program, CONFIG_PROGRAM_USAGE);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Examples:\n");
+    fprintf(stderr, "%s %s\n", program, CONFIG_PROGRAM_HELP1);
+    fprintf(stderr, "%s %s\n", program, CONFIG_PROGRAM_HELP2);
+    fprintf(stderr, "\n");
+}
+
+/**
+ * the implementations the CPU supports, scalar first
+ */
+static uint32_t
+TransformTest_impls(TestImpl *impls)
+{
+    static const char  *names[] = { "scalar", "sse2", "avx2" };
+    uint32_t            num     = 0;
+    uint32_t            idx;
+
+    for (idx = 0; idx < sizeof(names) / sizeof(names[0]); idx++) {
+        if (Transform_getFunctions(names[idx], &(impls[num].toUpper), &(impls[num].toLower))) {
+            impls[num++].name = names[idx];
+        }
+    }
+
+    return num;
+}
+
+/**
+ * every implementation converts the mapped blocks as expected and leaves
+ * invalid bytes alone, with 0 to TEST_PADDING ASCII letters before the case
+ */
+static bool
+TransformTest_mappings(const TestImpl *impls, uint32_t numImpls)
+{
+    uint32_t            numMappings = sizeof(mappings) / sizeof(mappings[0]);
+    uint32_t            idx;
+    uint32_t            mapping;
+    uint32_t            padding;
+
+    for (idx = 0; idx < numImpls; idx++) {
+        for (mapping = 0; mapping < numMappings; mapping++) {
+            for (padding = 0; padding <= TEST_PADDING; padding++) {
+                if (!TransformTest_map(&(impls[idx]), &(mappings[mapping]), true,  padding) ||
+                    !TransformTest_map(&(impls[idx]), &(mappings[mapping]), false, padding)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    printf("Mappings: %u case(s) at %u position(s), all implementations as expected\n", numMappings, TEST_PADDING + 1);
+
+    return true;
+}
+
+/**
+ * "x" * padding + input + "x" * TEST_PADDING
+ */
+static bool
+TransformTest_map(const TestImpl *impl, const TestMapping *mapping, bool upper, uint32_t padding)
+{
+    char                actual[2 * TEST_PADDING + 64];
+    char                expected[2 * TEST_PADDING + 64];
+    const char         *output = upper ? mapping->upper : mapping->lower;
+    uint32_t            len    = (uint32_t) strlen(mapping->input);
+    bool                valid;
+
+    memset(actual,   'x', padding);
+    memset(expected, upper ? 'X' : 'x', padding);
+    memcpy(&(actual[padding]),   mapping->input, len);
+    memcpy(&(expected[padding]), output,         len);
+    memset(&(actual[padding + len]),   'x', TEST_PADDING);
+    memset(&(expected[padding + len]), upper ? 'X' : 'x', TEST_PADDING);
+    len += padding + TEST_PADDING;
+
+    valid = (upper ? impl->toUpper : impl->toLower)(actual, len);
+
+    if (valid == mapping->valid && memcmp(actual, expected, len) == 0) {
+        return true;
+    }
+
+    fprintf(stderr, "%s %s of %s: padding %u, valid %d instead of %d\n", impl->name,
+            upper ? "toUpper" : "toLower", mapping->name, padding, valid, mapping->valid);
+    TransformTest_dump("expected", &(expected[padding]), len - padding - TEST_PADDING);
+    TransformTest_dump("actual",   &(actual[padding]),   len - padding - TEST_PADDING);
+
+    return false;
+}
+
+/**
+ * differential test: random payloads of ASCII, letters of all mapped
+ * blocks, 3- and 4-byte sequences and invalid bytes at every offset,
+ * the vector implementations must produce what the scalar one does
+ */
+static bool
+TransformTest_compare(const TestImpl *impls, uint32_t numImpls, uint64_t iterations)
+{
+    char                input[CONFIG_TEST_LEN_MAX];
+    uint64_t            iteration;
+    uint32_t            len;
+    uint32_t            offset;
+    uint32_t            idx;
+
+    for (iteration = 0; iteration < iterations; iteration++) {
+        len    = TransformTest_generate(input, (uint32_t) (TransformTest_random() % (CONFIG_TEST_LEN_MAX + 1)),
+                                        (uint32_t) (iteration % 4));
+        offset = (uint32_t) (TransformTest_random() % TEST_ALIGN);
+
+        for (idx = 1; idx < numImpls; idx++) {
+            if (!TransformTest_check(&(impls[idx]), &(impls[0]), true,  input, len, offset) ||
+                !TransformTest_check(&(impls[idx]), &(impls[0]), false, input, len, offset)) {
+                return false;
+            }
+        }
+    }
+
+    printf("Compare: %" PRIu64 " random payload(s) of up to %u bytes", iterations, CONFIG_TEST_LEN_MAX);
+    for (idx = 1; idx < numImpls; idx++) {
+        printf("%s%s", idx > 1 ? ", " : ": ", impls[idx].name);
+    }
+    printf("%s\n", numImpls > 1 ? " match scalar" : ", only scalar on this CPU");
+
+    return true;
+}
+
+static bool
+TransformTest_check(const TestImpl *impl, const TestImpl *reference, bool upper,
+                    const char *input, uint32_t len, uint32_t offset)
+{
+    char                expected[CONFIG_TEST_LEN_MAX + TEST_ALIGN];
+    char                actual[CONFIG_TEST_LEN_MAX + TEST_ALIGN];
+    bool                expectedValid;
+    bool                actualValid;
+    uint32_t            idx;
+
+    memcpy(&(expected[offset]), input, len);
+    memcpy(&(actual[offset]),   input, len);
+
+    expectedValid = (upper ? reference->toUpper : reference->toLower)(&(expected[offset]), len);
+    actualValid   = (upper ? impl->toUpper      : impl->toLower)     (&(actual[offset]),   len);
+
+    if (expectedValid == actualValid && memcmp(&(expected[offset]), &(actual[offset]), len) == 0) {
+        return true;
+    }
+
+    for (idx = 0; idx < len && expected[offset + idx] == actual[offset + idx]; idx++) {
+    }
+
+    fprintf(stderr, "%s %s differs from %s: len %u, offset %u, valid %d instead of %d, first difference at %u\n",
+            impl->name, upper ? "toUpper" : "toLower", reference->name, len, offset, actualValid, expectedValid, idx);
+    TransformTest_dump("input",    input, len);
+    TransformTest_dump("expected", &(expected[offset]), len);
+    TransformTest_dump("actual",   &(actual[offset]), len);
+
+    return false;
+}
+
+/**
+ * runs of one kind, so ASCII vectors, mixed vectors and sequences
+ * across vector boundaries all occur
+ *
+ * @param   utf8                    0 = ASCII only, 1 = valid UTF-8, 2 = mostly valid, 3 = anything
+ * @return                          bytes written
+ */
+static uint32_t
+TransformTest_generate(char *data, uint32_t max, uint32_t utf8)
+{
+    /* the mapped blocks and their neighbours */
+    static const uint32_t   blocks[][2] = {
+        { 0x00C0, 0x00FF }, { 0x0100, 0x017F }, { 0x0180, 0x024F }, { 0x0370, 0x03FF },
+        { 0x0400, 0x045F }, { 0x0460, 0x04FF }, { 0x0080, 0x07FF }
+    };
+    char                buffer[4];
+    uint32_t            len = 0;
+    uint32_t            run;
+    uint32_t            kind;
+    uint32_t            num;
+    uint32_t            cp;
+
+    while (len < max) {
+        kind = (utf8 == 0) ? 0 : (uint32_t) (TransformTest_random() % (utf8 == 1 ? 3 : (utf8 == 2 ? 4 : 6)));
+        run  = 1 + (uint32_t) (TransformTest_random() % 48);
+
+        for (; run > 0 && len < max; run--) {
+            switch (kind) {
+                case 0:
+                    /* letters and what's next to them */
+                    buffer[0] = (char) (0x20 + TransformTest_random() % 0x60);
+                    num       = 1;
+                    break;
+                case 1: {
+                    const uint32_t *block = blocks[TransformTest_random() % (sizeof(blocks) / sizeof(blocks[0]))];
+                    cp  = block[0] + (uint32_t) (TransformTest_random() % (block[1] - block[0] + 1));
+                    num = TransformTest_encode(buffer, cp);
+                    break;
+                }
+                case 2:
+                    cp  = (TransformTest_random() & 1) ? 0x0800 + (uint32_t) (TransformTest_random() % 0xF800) :
+                                                         0x10000 + (uint32_t) (TransformTest_random() % 0x100000);
+                    if (utf8 == 1 && cp >= 0xD800 && cp <= 0xDFFF) {
+                        cp += 0x800;
+                    }
+                    num = TransformTest_encode(buffer, cp);
+                    break;
+                case 3:
+                    /* a truncated sequence: the lead byte of a longer one */
+                    cp  = 0x80 + (uint32_t) (TransformTest_random() % 0x10FF80);
+                    num = TransformTest_encode(buffer, cp) - 1;
+                    break;
+                default:
+                    /* any byte, e.g. a stray continuation byte, 0xC0, 0xFF */
+                    buffer[0] = (char) (0x80 + TransformTest_random() % 0x80);
+                    num       = 1;
+                    break;
+            }
+
+            if (len + num > max) {
+                return len;
+            }
+            memcpy(&(data[len]), buffer, num);
+            len += num;
+        }
+    }
+
+    return len;
+}
+
+/**
+ * UTF-8, surrogates are encoded like any other code point
+ *
+ * @return                          bytes written
+ */
+static uint32_t
+TransformTest_encode(char *data, uint32_t cp)
+{
+    if (cp < 0x80) {
+        data[0] = (char) cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        data[0] = (char) (0xC0 | (cp >> 6));
+        data[1] = (char) (0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        data[0] = (char) (0xE0 | (cp >> 12));
+        data[1] = (char) (0x80 | ((cp >> 6) & 0x3F));
+        data[2] = (char) (0x80 | (cp & 0x3F));
+        return 3;
+    }
+    data[0] = (char) (0xF0 | (cp >> 18));
+    data[1] = (char) (0x80 | ((cp >> 12) & 0x3F));
+    data[2] = (char) (0x80 | ((cp >> 6) & 0x3F));
+    data[3] = (char) (0x80 | (cp & 0x3F));
+    return 4;
+}
+
+/**
+ * GB/s of every implementation, one call per message: ASCII letters
+ * and valid UTF-8 with all mapped blocks
+ *
+ * @param   size                    MiB per implementation and payload
+ */
+static void
+TransformTest_bench(const TestImpl *impls, uint32_t numImpls, uint32_t size, uint32_t message)
+{
+    static const char  *payloads[] = { "ascii", "utf-8" };
+    char               *data;
+    uint64_t            bytes = (uint64_t) size * 1024 * 1024;
+    uint64_t            done;
+    uint64_t            start;
+    uint64_t            elapsed;
+    uint32_t            len;
+    uint32_t            payload;
+    uint32_t            idx;
+    bool                upper;
+
+    if ((data = (char *) malloc(message)) == NULL) {
+        fprintf(stderr, "Can't allocate %u bytes\n", message);
+        return;
+    }
+
+    printf("Bench: %u MiB in messages of %u bytes\n", size, message);
+
+    for (payload = 0; payload < sizeof(payloads) / sizeof(payloads[0]); payload++) {
+        if ((len = TransformTest_generate(data, message, payload)) == 0) {
+            continue;
+        }
+
+        for (idx = 0; idx < numImpls; idx++) {
+            start = TransformTest_now();
+
+            /* alternating, so every call has letters to convert */
+            for (done = 0, upper = true; done < bytes; done += len, upper = !upper) {
+                (upper ? impls[idx].toUpper : impls[idx].toLower)(data, len);
+            }
+
+            elapsed = TransformTest_now() - start;
+            printf("  %-6s  %-6s  %6.2f GB/s\n", payloads[payload], impls[idx].name,
+                   elapsed > 0 ? (double) done / elapsed : 0.0);
+        }
+    }
+
+    free(data);
+}
+
+static void
+TransformTest_dump(const char *label, const char *data, uint32_t len)
+{
+    uint32_t            idx;
+
+    fprintf(stderr, "  %-8s", label);
+    for (idx = 0; idx < len; idx++) {
+        fprintf(stderr, "%s%02x", (idx % 32 == 0 && idx > 0) ? "\n          " : " ", (uint8_t) data[idx]);
+    }
+    fprintf(stderr, "\n");
+}
+
+/**
+ * xorshift64*
+ */
+static uint64_t
+TransformTest_random(void)
+{
+    random_ ^= random_ >> 12;
+    random_ ^= random_ << 25;
+    random_ ^= random_ >> 27;
+
+    return random_ * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t
+TransformTest_now(void)
+{
+    struct timespec     now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
@@ -1,7 +1,559 @@
+#define _GNU_SOURCE
+
 #include "WebClient.h"
+#include "Connector.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/socket.h>
+
+#define WEB_CLIENT_RETRIES          2                           /**< connections closed without a response in a row */
+#define WEB_CLIENT_SPLICE_MAX       (1 << 30)                   /**< bytes of one splice() */
+
+static bool     WebClient_valid         (const char *path);
+static bool     WebClient_connect       (WebClient *this);
+static void     WebClient_close         (WebClient *this);
+static bool     WebClient_send          (WebClient *this, const char *path);
+static bool     WebClient_canSplice     (WebClient *this);
+static ssize_t  WebClient_splice        (WebClient *this);
+static bool     WebClient_write         (int fd, const char *data, size_t len);
+static void     WebClient_print         (void *arg, uint32_t idx, WebClientEvent event, const HttpParser *parser,
+                                         const char *data, uint32_t len);
+
+void
+WebConfig_init(WebConfig *this)
+{
+    this->connectDelay   = CONFIG_CONNECT_DELAY;
+    this->bufferSize     = CONFIG_READ_BUFFER_SIZE;
+    this->depth          = CONFIG_PIPELINE_DEPTH;
+    this->output         = NULL;
+    this->numConnections = 1;
+    this->numThreads     = 1;
+    this->duration       = CONFIG_LOAD_DURATION;
+    this->rate           = 0;
+}
 
+/**
+ * nothing is connected before the first fetch
+ *
+ * @param   hostname                as given by the user, for the Host header
+ * @param   port                    numeric
+ */
+WebClient *
+WebClient_new(struct addrinfo *addrinfo, const char *hostname, const char *port, const WebConfig *config)
+{
+    WebClient          *this = (WebClient *) calloc(1, sizeof(WebClient));
+
+    if (this == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate web client");
+        return NULL;
+    }
+
+    this->addrinfo = addrinfo;
+    this->config   = config;
+    this->sockfd   = -1;
+    this->output   = -1;
+    this->pipe[0]  = -1;
+    this->pipe[1]  = -1;
+
+    if ((this->buffer = (char *) malloc(config->bufferSize)) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate read buffer");
+        free(this);
+        return NULL;
+    }
+
+    if (WebClient_host(this->host, sizeof(this->host), hostname, port) < 0) {
+        Log_println(LOG_ERROR, "Can't use host %s", hostname);
+        WebClient_delete(this);
+        return NULL;
+    }
+
+    return this;
+}
+
+void
+WebClient_delete(WebClient *this)
+{
+    if (this != NULL) {
+        WebClient_close(this);
+        if (this->pipe[0] != -1) {
+            close(this->pipe[0]);
+            close(this->pipe[1]);
+        }
+        free(this->buffer);
+        free(this);
+    }
+}
+
+/**
+ * bodies are written to fd instead of being handed to the handler,
+ * Content-Length bodies and those ending with the connection are moved
+ * socket -> pipe -> fd with splice() and never copied to user space,
+ * chunked bodies are written from the read buffer
+ *
+ * @param   fd                      stays owned by the caller
+ */
+bool
+WebClient_setOutput(WebClient *this, int fd)
+{
+    if (pipe2(this->pipe, O_CLOEXEC) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't create pipe");
+        return false;
+    }
+
+    /* fewer round trips through the pipe, the default is 64 KiB */
+    if (fcntl(this->pipe[1], F_SETPIPE_SZ, CONFIG_PIPE_SIZE) == -1) {
+        Log_errno(LOG_DEBUG, errno, "Can't resize pipe");
+    }
+
+    this->output = fd;
+    this->splice = true;
+
+    return true;
+}
+
+/**
+ * GET the paths in order, up to depth requests are sent ahead (pipelining),
+ * the connection is reused and opened again if the server closes it,
+ * requests that weren't answered are sent again on the new connection
+ *
+ * @return                          false if a response couldn't be read,
+ *                                  an HTTP error status isn't a failure
+ */
 bool
-WebClient_get(struct addrinfo *addrinfo)
+WebClient_fetch(WebClient *this, const char **paths, uint32_t numPaths, WebClientHandler handler, void *arg)
 {
+    uint32_t            numDone  = 0;
+    uint32_t            numSent  = 0;
+    uint32_t            numTries = 0;
+    HttpParserEvent     event;
+    const char         *data;
+    uint32_t            len;
+    const char         *body;
+    uint32_t            bodyLen;
+    ssize_t             n;
+    bool                spliced;
+
+    for (numDone = 0; numDone < numPaths; numDone++) {
+        if (!WebClient_valid(paths[numDone])) {
+            Log_println(LOG_ERROR, "Invalid path: %.64s", paths[numDone]);
+            return false;
+        }
+    }
+    numDone = 0;
+
+    while (numDone < numPaths) {
+
+        if (this->sockfd == -1) {
+            if (numTries++ == WEB_CLIENT_RETRIES) {
+                Log_println(LOG_ERROR, "Connection closed %u times without a response", numTries - 1);
+                return false;
+            }
+            if (!WebClient_connect(this)) {
+                return false;
+            }
+            numSent = numDone;
+        }
+
+        /* fill the pipeline */
+        while (numSent < numPaths && numSent - numDone < this->config->depth) {
+            if (!WebClient_send(this, paths[numSent])) {
+                break;
+            }
+            numSent++;
+        }
+        if (this->sockfd == -1) {
+            continue;
+        }
+
+        /* the body is in the socket: straight to the output */
+        spliced = WebClient_canSplice(this);
+        if (spliced) {
+            n = WebClient_splice(this);
+        } else {
+            n = recv(this->sockfd, this->buffer, this->config->bufferSize, 0);
+        }
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (spliced) {
+                WebClient_close(this);
+                return false;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't receive response");
+            WebClient_close(this);
+            return false;
+        }
+
+        if (n == 0) {
+            /* an idle keep-alive connection may be closed at any time, before the response started */
+            if (this->parser.state == HTTP_PARSER_STATUS && this->parser.lineLen == 0) {
+                Log_println(LOG_DEBUG, "Connection closed by server, %u request(s) unanswered", numSent - numDone);
+                WebClient_close(this);
+                continue;
+            }
+
+            if (HttpParser_finish(&(this->parser)) != HTTP_PARSER_COMPLETE) {
+                Log_println(LOG_ERROR, "Connection closed during response to %s", paths[numDone]);
+                WebClient_close(this);
+                return false;
+            }
+
+            handler(arg, numDone, WEB_CLIENT_END, &(this->parser), NULL, 0);
+            this->numResponses++;
+            numDone++;
+            numTries = 0;
+            WebClient_close(this);
+            continue;
+        }
+
+        if (spliced) {
+            HttpParser_skip(&(this->parser), (uint64_t) n);
+            data = NULL;
+            len  = 0;
+        } else {
+            data = this->buffer;
+            len  = (uint32_t) n;
+        }
+
+        do {
+            event = HttpParser_feed(&(this->parser), &data, &len, &body, &bodyLen);
+
+            switch (event) {
+                case HTTP_PARSER_HEAD:
+                    handler(arg, numDone, WEB_CLIENT_HEAD, &(this->parser), NULL, 0);
+                    break;
+
+                case HTTP_PARSER_DATA:
+                    if (this->output == -1) {
+                        handler(arg, numDone, WEB_CLIENT_DATA, &(this->parser), body, bodyLen);
+                    } else if (WebClient_write(this->output, body, bodyLen)) {
+                        this->numWritten += bodyLen;
+                    } else {
+                        WebClient_close(this);
+                        return false;
+                    }
+                    break;
+
+                case HTTP_PARSER_COMPLETE:
+                    handler(arg, numDone, WEB_CLIENT_END, &(this->parser), NULL, 0);
+                    this->numResponses++;
+                    numDone++;
+                    numTries = 0;
+
+                    /* the rest of the pipeline is sent again on a new connection */
+                    if (this->parser.close) {
+                        WebClient_close(this);
+                    } else {
+                        HttpParser_init(&(this->parser), false);
+                    }
+                    break;
+
+                case HTTP_PARSER_ERROR:
+                    Log_println(LOG_ERROR, "Invalid response to %s", paths[numDone]);
+                    WebClient_close(this);
+                    return false;
+
+                case HTTP_PARSER_MORE:
+                    break;
+            }
+        } while (event != HTTP_PARSER_MORE && this->sockfd != -1);
+    }
+
     return true;
 }
+
+/**
+ * Host header value, IPv6 literals in brackets and the port unless it's 80
+ *
+ * @return                          length or -1 if it doesn't fit
+ */
+int
+WebClient_host(char *host, size_t len, const char *hostname, const char *port)
+{
+    bool                literal = (strchr(hostname, ':') != NULL);
+    bool                withPort = (strcmp(port, "80") != 0);
+    int                 n;
+
+    n = snprintf(host, len, "%s%s%s%s%s", literal ? "[" : "", hostname, literal ? "]" : "",
+                 withPort ? ":" : "", withPort ? port : "");
+
+    return (n < 0 || (size_t) n >= len) ? -1 : n;
+}
+
+/**
+ * @return                          length or -1 if the path is invalid or it doesn't fit
+ */
+int
+WebClient_request(char *request, size_t len, const char *host, const char *path)
+{
+    int                 n;
+
+    if (!WebClient_valid(path)) {
+        return -1;
+    }
+
+    n = snprintf(request, len,
+                 "GET %s HTTP/1.1\r\n"
+                 "Host: %s\r\n"
+                 "User-Agent: " CONFIG_PROGRAM_NAME "/" CONFIG_PROGRAM_VERSION "\r\n"
+                 "Accept: */*\r\n"
+                 "\r\n",
+                 path, host);
+
+    return (n < 0 || (size_t) n >= len) ? -1 : n;
+}
+
+/**
+ * GET the paths over one persistent connection, the bodies go to stdout
+ * or one after the other into config->output
+ */
+bool
+WebClient_get(struct addrinfo *addrinfo, const char *hostname, const char *port,
+              const char **paths, uint32_t numPaths, const WebConfig *config)
+{
+    WebClient          *client;
+    int                 fd = -1;
+    bool                success;
+
+    if ((client = WebClient_new(addrinfo, hostname, port, config)) == NULL) {
+        return false;
+    }
+
+    if (config->output != NULL) {
+        if ((fd = open(config->output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+            Log_errno(LOG_ERROR, errno, "Can't open %s", config->output);
+            WebClient_delete(client);
+            return false;
+        }
+
+        if (!WebClient_setOutput(client, fd)) {
+            close(fd);
+            WebClient_delete(client);
+            return false;
+        }
+    }
+
+    success = WebClient_fetch(client, paths, numPaths, WebClient_print, (void *) paths);
+    fflush(stdout);
+
+    Log_println(LOG_INFO, "%llu response(s) over %u connection(s)",
+                (unsigned long long) client->numResponses, client->numConnections);
+
+    if (fd != -1) {
+        Log_println(LOG_INFO, "%s: %llu byte(s) spliced, %llu byte(s) copied", config->output,
+                    (unsigned long long) client->numSpliced, (unsigned long long) client->numWritten);
+        if (close(fd) == -1) {
+            Log_errno(LOG_ERROR, errno, "Can't close %s", config->output);
+            success = false;
+        }
+    }
+
+    WebClient_delete(client);
+
+    return success;
+}
+
+/**
+ * the path goes into the request line as it is
+ */
+static bool
+WebClient_valid(const char *path)
+{
+    size_t              len = strlen(path);
+    size_t              idx;
+
+    if (len == 0 || len > CONFIG_PATH_MAX) {
+        return false;
+    }
+
+    for (idx = 0; idx < len; idx++) {
+        if ((unsigned char) path[idx] <= ' ' || path[idx] == 0x7f) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+WebClient_connect(WebClient *this)
+{
+    if ((this->sockfd = Connector_connect(this->addrinfo, this->config->connectDelay, CONFIG_CONNECT_TIMEOUT)) == -1) {
+        return false;
+    }
+
+    this->numConnections++;
+    HttpParser_init(&(this->parser), false);
+
+    return true;
+}
+
+static void
+WebClient_close(WebClient *this)
+{
+    if (this->sockfd != -1) {
+        close(this->sockfd);
+        this->sockfd = -1;
+    }
+}
+
+/**
+ * a request is small, a blocking send doesn't wait for the responses
+ *
+ * @return                          false if the connection was closed
+ */
+static bool
+WebClient_send(WebClient *this, const char *path)
+{
+    char                request[CONFIG_REQUEST_MAX];
+    int                 len;
+    int                 offset = 0;
+    ssize_t             n;
+
+    if ((len = WebClient_request(request, sizeof(request), this->host, path)) < 0) {
+        Log_println(LOG_ERROR, "Invalid path: %.64s", path);
+        WebClient_close(this);
+        return false;
+    }
+
+    while (offset < len) {
+        n = send(this->sockfd, &(request[offset]), len - offset, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log_errno(LOG_DEBUG, errno, "Can't send request");
+            WebClient_close(this);
+            return false;
+        }
+        offset += (int) n;
+    }
+
+    Log_println(LOG_DEBUG, "GET %s", path);
+
+    return true;
+}
+
+/**
+ * the rest of the body is still in the socket and its end is known
+ */
+static bool
+WebClient_canSplice(WebClient *this)
+{
+    return this->splice &&
+           (this->parser.state == HTTP_PARSER_BODY || this->parser.state == HTTP_PARSER_UNTIL_CLOSE);
+}
+
+/**
+ * move body bytes socket -> pipe -> output, blocks until some arrive,
+ * if the output refuses splice() what is in the pipe is copied and
+ * the read buffer is used from then on
+ *
+ * @return                          bytes moved, 0 at the end of the connection,
+ *                                  -1 with errno set
+ */
+static ssize_t
+WebClient_splice(WebClient *this)
+{
+    size_t              wanted = WEB_CLIENT_SPLICE_MAX;
+    ssize_t             n;
+    ssize_t             moved;
+    ssize_t             m;
+
+    /* never into the next pipelined response */
+    if (this->parser.state == HTTP_PARSER_BODY && this->parser.remaining < wanted) {
+        wanted = (size_t) this->parser.remaining;
+    }
+
+    if ((n = splice(this->sockfd, NULL, this->pipe[1], NULL, wanted, SPLICE_F_MOVE | SPLICE_F_MORE)) <= 0) {
+        if (n == -1 && errno != EINTR) {
+            Log_errno(LOG_ERROR, errno, "Can't splice from socket");
+        }
+        return n;
+    }
+
+    for (moved = 0; moved < n; moved += m) {
+        if (this->splice) {
+            m = splice(this->pipe[0], NULL, this->output, NULL, n - moved, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (m == -1 && errno == EINVAL) {
+                Log_println(LOG_DEBUG, "Output doesn't support splice, copying");
+                this->splice = false;
+                m = 0;
+                continue;
+            }
+            if (m > 0) {
+                this->numSpliced += (uint64_t) m;
+            }
+        } else {
+            m = read(this->pipe[0], this->buffer, ((size_t) (n - moved) < this->config->bufferSize) ? (size_t) (n - moved) : this->config->bufferSize);
+            if (m > 0) {
+                if (!WebClient_write(this->output, this->buffer, m)) {
+                    return -1;
+                }
+                this->numWritten += (uint64_t) m;
+            }
+        }
+
+        if (m == -1) {
+            if (errno == EINTR) {
+                m = 0;
+                continue;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't write output");
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+static bool
+WebClient_write(int fd, const char *data, size_t len)
+{
+    ssize_t             n;
+
+    while (len > 0) {
+        if ((n = write(fd, data, len)) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            Log_errno(LOG_ERROR, errno, "Can't write output");
+            return false;
+        }
+        data += n;
+        len  -= (size_t) n;
+    }
+
+    return true;
+}
+
+static void
+WebClient_print(void *arg, uint32_t idx, WebClientEvent event, const HttpParser *parser,
+                const char *data, uint32_t len)
+{
+    const char        **paths = (const char **) arg;
+
+    switch (event) {
+        case WEB_CLIENT_HEAD:
+            Log_println(LOG_INFO, "GET %s: HTTP/1.%d %d%s", paths[idx], parser->minor, parser->status,
+                        parser->chunked ? ", chunked" : "");
+            break;
+
+        case WEB_CLIENT_DATA:
+            fwrite(data, 1, len, stdout);
+            break;
+
+        case WEB_CLIENT_END:
+            Log_println(LOG_DEBUG, "GET %s: %llu byte(s)", paths[idx], (unsigned long long) parser->bodyLen);
+            break;
+    }
+}
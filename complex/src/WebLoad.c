@@ -0,0 +1,507 @@
+#define _GNU_SOURCE
+
+#include "WebLoad.h"
+#include "LoadRunner.h"
+#include "HttpParser.h"
+#include "RingBuffer.h"
+#include "EventLoop.h"
+#include "Histogram.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+
+/**
+ * an encoded request of one path, shared by all threads
+ */
+typedef struct {
+    char               *data;
+    uint32_t            len;
+} WebLoadRequest;
+
+/**
+ * a request in flight, responses come in the order of the requests
+ */
+typedef struct {
+    uint64_t            intended;               /**< ns (CLOCK_MONOTONIC), latency is measured from here */
+    uint64_t            sent;                   /**< ns, when it was actually encoded */
+    uint32_t            path;                   /**< index of the request */
+} WebLoadSlot;
+
+typedef struct {
+    LoadConnection      connection;             /**< connected socket, output and requests in flight */
+    HttpParser          parser;                 /**< the oldest response, resumed with every chunk */
+    WebLoadSlot        *slots;                  /**< ring of config->depth */
+    uint32_t            first;                  /**< slot of the oldest request in flight */
+    uint32_t            nextPath;               /**< round-robin */
+    bool                eof;                    /**< the server closed the connection */
+} WebLoadConnection;
+
+/**
+ * the HTTP protocol of a load run, the thread's data is a buffer of
+ * config->bufferSize, responses are parsed in place
+ */
+typedef struct {
+    const WebConfig    *config;
+    WebLoadRequest     *requests;
+    uint32_t            numRequests;
+    uint32_t            maxRequest;             /**< longest request */
+} WebLoad;
+
+static bool     WebLoad_encode          (WebLoad *this, const char *hostname, const char *port,
+                                         const char **paths, uint32_t numPaths);
+static bool     WebLoad_init            (LoadThread *thread);
+static bool     WebLoad_open            (LoadConnection *connection);
+static bool     WebLoad_connect         (WebLoadConnection *connection);
+static void     WebLoad_reconnect       (LoadConnection *connection);
+static bool     WebLoad_resend          (WebLoadConnection *connection);
+static void     WebLoad_callback        (EventHandler *handler, uint32_t events);
+static bool     WebLoad_receive         (WebLoadConnection *connection);
+static bool     WebLoad_complete        (WebLoadConnection *connection, uint64_t now);
+static bool     WebLoad_send            (LoadConnection *connection, uint64_t intended);
+static bool     WebLoad_write           (WebLoadConnection *connection, const WebLoadSlot *slot);
+static void     WebLoad_close           (LoadConnection *connection);
+static void     WebLoad_expire          (LoadConnection *connection, uint64_t now);
+static void     WebLoad_report          (LoadRunner *runner, double elapsed);
+
+static const LoadProtocol protocol = {
+    .connectionSize = sizeof(WebLoadConnection),
+    .init           = WebLoad_init,
+    .open           = WebLoad_open,
+    .send           = WebLoad_send,
+    .fail           = WebLoad_reconnect,
+    .close          = WebLoad_close,
+    .expire         = WebLoad_expire,
+    .report         = WebLoad_report
+};
+
+/**
+ * wrk-style benchmark: GET the paths round-robin over all connections
+ * until the duration is over or SIGINT / SIGTERM, keep-alive and
+ * pipelined up to depth, then print the latency percentiles
+ *
+ * @param   hostname                as given by the user, for the Host header
+ * @param   port                    numeric
+ */
+bool
+WebLoad_run(struct addrinfo *addrinfo, const char *hostname, const char *port,
+            const char **paths, uint32_t numPaths, const WebConfig *config)
+{
+    WebLoad             this;
+    LoadRunner          runner;
+    uint32_t            idx;
+    bool                success = false;
+
+    memset(&this, 0, sizeof(this));
+    this.config = config;
+
+    if (WebLoad_encode(&this, hostname, port, paths, numPaths)) {
+        Log_println(LOG_INFO, "%u path(s)", this.numRequests);
+
+        LoadRunner_init(&runner, &protocol, &this, addrinfo);
+
+        runner.numConnections = config->numConnections;
+        runner.numThreads     = config->numThreads;
+        runner.depth          = config->depth;
+        runner.rate           = config->rate;
+        runner.arrival        = LOAD_ARRIVAL_FIXED;
+        runner.duration       = config->duration;
+        runner.connectDelay   = config->connectDelay;
+        runner.connectTimeout = CONFIG_CONNECT_TIMEOUT;
+
+        success = LoadRunner_run(&runner);
+    }
+
+    for (idx = 0; this.requests != NULL && idx < this.numRequests; idx++) {
+        free(this.requests[idx].data);
+    }
+    free(this.requests);
+
+    return success;
+}
+
+/**
+ * the requests are encoded once, every send is a copy
+ */
+static bool
+WebLoad_encode(WebLoad *this, const char *hostname, const char *port, const char **paths, uint32_t numPaths)
+{
+    char                host[NI_MAXHOST + NI_MAXSERV + 3];
+    char                request[CONFIG_REQUEST_MAX];
+    int                 len;
+
+    if (WebClient_host(host, sizeof(host), hostname, port) < 0) {
+        Log_println(LOG_ERROR, "Can't use host %s", hostname);
+        return false;
+    }
+
+    if ((this->requests = (WebLoadRequest *) calloc(numPaths, sizeof(WebLoadRequest))) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate requests");
+        return false;
+    }
+
+    for (this->numRequests = 0; this->numRequests < numPaths; this->numRequests++) {
+        if ((len = WebClient_request(request, sizeof(request), host, paths[this->numRequests])) < 0) {
+            Log_println(LOG_ERROR, "Invalid path: %.64s", paths[this->numRequests]);
+            return false;
+        }
+
+        if ((this->requests[this->numRequests].data = (char *) malloc(len)) == NULL) {
+            Log_errno(LOG_ERROR, errno, "Can't allocate request");
+            return false;
+        }
+
+        memcpy(this->requests[this->numRequests].data, request, len);
+        this->requests[this->numRequests].len = (uint32_t) len;
+
+        if ((uint32_t) len > this->maxRequest) {
+            this->maxRequest = (uint32_t) len;
+        }
+    }
+
+    return true;
+}
+
+static bool
+WebLoad_init(LoadThread *thread)
+{
+    const WebConfig    *config = ((WebLoad *) thread->runner->context)->config;
+
+    if ((thread->data = malloc(config->bufferSize)) == NULL) {
+        Log_errno(LOG_ERROR, errno, "Can't allocate receive buffer");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+WebLoad_open(LoadConnection *base)
+{
+    WebLoadConnection  *connection = (WebLoadConnection *) base;
+    LoadThread         *thread     = base->thread;
+    WebLoad            *load       = (WebLoad *) thread->runner->context;
+    uint32_t            idx        = (uint32_t) (((char *) base - thread->connections) / sizeof(WebLoadConnection));
+
+    connection->nextPath = (thread->idx + idx * thread->runner->numThreads) % load->numRequests;
+    connection->slots    = (WebLoadSlot *) calloc(thread->runner->depth, sizeof(WebLoadSlot));
+
+    if (connection->slots == NULL) {
+        Log_println(LOG_ERROR, "Can't allocate connection");
+        return false;
+    }
+
+    return WebLoad_connect(connection);
+}
+
+/**
+ * room for all requests in flight, a new parser for every connection
+ */
+static bool
+WebLoad_connect(WebLoadConnection *connection)
+{
+    LoadRunner         *runner = connection->connection.thread->runner;
+
+    HttpParser_init(&(connection->parser), false);
+    connection->eof = false;
+
+    if (!LoadRunner_connect(&(connection->connection), ((WebLoad *) runner->context)->maxRequest * runner->depth)) {
+        return false;
+    }
+    connection->connection.handler.callback = WebLoad_callback;
+
+    return true;
+}
+
+/**
+ * the server closed the connection or it failed: connect again without
+ * blocking the thread, the requests in flight are sent once more when
+ * it's done (WebLoad_resend), they keep their intended time
+ */
+static void
+WebLoad_reconnect(LoadConnection *base)
+{
+    WebLoadConnection  *connection = (WebLoadConnection *) base;
+    LoadThread         *thread     = base->thread;
+    uint32_t            len;
+
+    if (!__atomic_load_n(&(thread->runner->running), __ATOMIC_ACQUIRE) ||
+        (thread->exhausted && base->numPending == 0)) {
+        LoadRunner_close(base);
+        return;
+    }
+
+    /* what wasn't sent yet is encoded again by WebLoad_resend() */
+    for (len = 1; RingBuffer_readableSpan(base->output, &len) != NULL; len = 1) {
+        RingBuffer_consume(base->output, len);
+    }
+
+    thread->numReconnects++;
+
+    HttpParser_init(&(connection->parser), false);
+    connection->eof = false;
+
+    if (!LoadRunner_reconnect(base)) {
+        LoadRunner_close(base);
+    }
+}
+
+/**
+ * connected again: the requests in flight first, then new ones
+ */
+static bool
+WebLoad_resend(WebLoadConnection *connection)
+{
+    LoadConnection     *base   = &(connection->connection);
+    LoadThread         *thread = base->thread;
+    uint32_t            idx;
+
+    for (idx = 0; idx < base->numPending; idx++) {
+        WebLoadSlot    *slot = &(connection->slots[(connection->first + idx) % thread->runner->depth]);
+
+        slot->sent = LoadRunner_now();
+        if (!WebLoad_write(connection, slot)) {
+            return false;
+        }
+    }
+
+    return LoadRunner_fill(base);
+}
+
+/**
+ * level-triggered: responses are read until EAGAIN, EPOLLOUT is
+ * registered only while requests are waiting in the output ring,
+ * the errors are counted where they happen
+ */
+static void
+WebLoad_callback(EventHandler *handler, uint32_t events)
+{
+    WebLoadConnection  *connection = (WebLoadConnection *) handler;
+    LoadConnection     *base       = &(connection->connection);
+    bool                ok         = true;
+
+    /* closed by an earlier event of the same batch */
+    if (base->closed) {
+        return;
+    }
+
+    /* the requests in flight are lost if the reconnect failed */
+    if (base->connecting) {
+        if (!LoadRunner_connected(base) || (!base->connecting && !WebLoad_resend(connection))) {
+            LoadRunner_close(base);
+        }
+        LoadRunner_settle(base);
+        return;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        ok = WebLoad_receive(connection) && (connection->eof || LoadRunner_fill(base));
+    } else if (events & EPOLLOUT) {
+        ok = LoadRunner_flush(base);
+    }
+
+    if (!ok || connection->eof) {
+        WebLoad_reconnect(base);
+    }
+
+    LoadRunner_settle(base);
+}
+
+/**
+ * bodies are parsed in the thread's buffer and dropped
+ */
+static bool
+WebLoad_receive(WebLoadConnection *connection)
+{
+    LoadThread         *thread = connection->connection.thread;
+    WebLoad            *load   = (WebLoad *) thread->runner->context;
+    HttpParserEvent     event;
+    const char         *data;
+    uint32_t            len;
+    const char         *body;
+    uint32_t            bodyLen;
+    ssize_t             num_bytes;
+    uint64_t            now;
+
+    for (;;) {
+        num_bytes = recv(connection->connection.handler.fd, (char *) thread->data, load->config->bufferSize, 0);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Log_errno(LOG_WARN, errno, "Can't receive");
+            thread->numReadErrors++;
+            return false;
+        }
+
+        /* one time stamp for all responses of the chunk */
+        now = LoadRunner_now();
+
+        if (num_bytes == 0) {
+            connection->eof = true;
+
+            if (HttpParser_finish(&(connection->parser)) == HTTP_PARSER_COMPLETE) {
+                return WebLoad_complete(connection, now);
+            }
+            if (connection->connection.numPending > 0) {
+                Log_println(LOG_WARN, "Connection closed by server, %u request(s) in flight", connection->connection.numPending);
+                thread->numReadErrors++;
+            }
+            return true;
+        }
+
+        thread->numBytes += (uint64_t) num_bytes;
+        data              = (const char *) thread->data;
+        len               = (uint32_t) num_bytes;
+
+        do {
+            event = HttpParser_feed(&(connection->parser), &data, &len, &body, &bodyLen);
+
+            if (event == HTTP_PARSER_ERROR) {
+                thread->numReadErrors++;
+                return false;
+            }
+
+            if (event == HTTP_PARSER_COMPLETE) {
+                if (!WebLoad_complete(connection, now)) {
+                    return false;
+                }
+
+                /* announced, the requests in flight are sent again on a new connection */
+                if (connection->parser.close) {
+                    connection->eof = true;
+                    return true;
+                }
+                HttpParser_init(&(connection->parser), false);
+            }
+        } while (event != HTTP_PARSER_MORE);
+    }
+}
+
+/**
+ * the response belongs to the oldest request in flight
+ */
+static bool
+WebLoad_complete(WebLoadConnection *connection, uint64_t now)
+{
+    LoadThread         *thread = connection->connection.thread;
+    WebLoadSlot        *slot   = &(connection->slots[connection->first]);
+
+    if (connection->connection.numPending == 0) {
+        Log_println(LOG_ERROR, "Response without a request");
+        thread->numReadErrors++;
+        return false;
+    }
+
+    Histogram_record(thread->histogram, now - slot->intended);
+    Histogram_record(thread->service,   now - slot->sent);
+    __atomic_store_n(&(thread->numReceived), thread->numReceived + 1, __ATOMIC_RELAXED);
+
+    if (connection->parser.status < 200 || connection->parser.status > 299) {
+        thread->numRejected++;
+    }
+
+    connection->first = (connection->first + 1) % thread->runner->depth;
+    connection->connection.numPending--;
+
+    return true;
+}
+
+/**
+ * the next path of the connection, the latency is measured from intended
+ */
+static bool
+WebLoad_send(LoadConnection *base, uint64_t intended)
+{
+    WebLoadConnection  *connection = (WebLoadConnection *) base;
+    LoadThread         *thread     = base->thread;
+    WebLoadSlot        *slot       = &(connection->slots[(connection->first + base->numPending) % thread->runner->depth]);
+
+    slot->intended       = intended;
+    slot->sent           = (thread->runner->rate > 0) ? LoadRunner_now() : intended;
+    slot->path           = connection->nextPath;
+    connection->nextPath = (connection->nextPath + 1) % ((WebLoad *) thread->runner->context)->numRequests;
+
+    if (!WebLoad_write(connection, slot)) {
+        return false;
+    }
+
+    base->numPending++;
+    thread->numSent++;
+
+    return true;
+}
+
+static bool
+WebLoad_write(WebLoadConnection *connection, const WebLoadSlot *slot)
+{
+    LoadThread             *thread  = connection->connection.thread;
+    const WebLoadRequest   *request = &(((WebLoad *) thread->runner->context)->requests[slot->path]);
+
+    if (!RingBuffer_write(connection->connection.output, request->data, (uint16_t) request->len)) {
+        Log_println(LOG_ERROR, "Output buffer full");
+        thread->numWriteErrors++;
+        return false;
+    }
+
+    return true;
+}
+
+static void
+WebLoad_close(LoadConnection *base)
+{
+    WebLoadConnection  *connection = (WebLoadConnection *) base;
+
+    free(connection->slots);
+    connection->slots = NULL;
+}
+
+static void
+WebLoad_expire(LoadConnection *base, uint64_t now)
+{
+    WebLoadConnection  *connection = (WebLoadConnection *) base;
+    WebLoadSlot        *slot;
+    uint32_t            idx;
+
+    for (idx = 0; idx < base->numPending; idx++) {
+        slot = &(connection->slots[(connection->first + idx) % base->thread->runner->depth]);
+        LoadRunner_unanswered(base, slot->intended, slot->sent, now);
+    }
+}
+
+static void
+WebLoad_report(LoadRunner *runner, double elapsed)
+{
+    WebLoad            *this = (WebLoad *) runner->context;
+    LoadTotals          totals;
+
+    if (!LoadRunner_sum(runner, &totals)) {
+        return;
+    }
+
+    if (elapsed <= 0.0) {
+        elapsed = 1e-9;
+    }
+
+    printf("%u connection(s), %u thread(s), %u in flight, %u path(s), %.2f s\n",
+           runner->numConnections, runner->numThreads, runner->depth, this->numRequests, elapsed);
+    printf("  Requests    %" PRIu64 " sent, %" PRIu64 " answered, %" PRIu64 " unanswered, %" PRIu64 " non-2xx, %" PRIu64 " reconnect(s)\n",
+           totals.numSent, totals.numReceived, totals.numUnanswered, totals.numRejected, totals.numReconnects);
+    printf("  Errors      connect %" PRIu64 ", read %" PRIu64 ", write %" PRIu64 "\n",
+           totals.numConnectErrors, totals.numReadErrors, totals.numWriteErrors);
+    printf("  Throughput  %.1f req/s, %.2f MiB/s\n",
+           totals.numReceived / elapsed, totals.numBytes / elapsed / (1024.0 * 1024.0));
+    LoadRunner_printLatency(runner, &totals, "req/s");
+
+    LoadRunner_freeTotals(&totals);
+}
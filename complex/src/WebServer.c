@@ -0,0 +1,1149 @@
+#define _GNU_SOURCE
+
+#include "WebServer.h"
+#include "EventLoop.h"
+#include "Socket.h"
+#include "Log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include <linux/openat2.h>
+
+#define LISTENER_MAX                    2
+
+/* level-triggered, a connection either waits for a request or for room to send the response */
+#define CONNECTION_READ                 (EPOLLIN | EPOLLRDHUP)
+#define CONNECTION_WRITE                (EPOLLOUT)
+
+typedef struct _Shard Shard;
+
+typedef enum {
+    WEB_CONNECTION_READ,                                        /**< collecting a request */
+    WEB_CONNECTION_WRITE,                                       /**< sending its response */
+    WEB_CONNECTION_LINGER                                       /**< last response sent, discarding input until the client closes */
+} WebConnectionState;
+
+typedef struct _Listener {
+    EventHandler        handler;                /**< listening socket */
+    Shard              *shard;                  /**< owning shard */
+    int                 family;                 /**< AF_INET or AF_INET6 */
+} Listener;
+
+/**
+ * requests are parsed in place and responses are built in fixed buffers,
+ * nothing is allocated per request, closed connections are reused
+ */
+typedef struct _Connection {
+    EventHandler        handler;                /**< connected socket */
+    Shard              *shard;                  /**< shard which accepted it */
+    struct _Connection *prev;                   /**< list of open connections, or of idle ones */
+    struct _Connection *next;
+    WebConnectionState  state;
+    uint32_t            events;                 /**< registered events */
+    uint32_t            have;                   /**< bytes in request */
+    uint32_t            consumed;               /**< bytes of the request being answered */
+    uint32_t            headLen;                /**< response head and, for errors, its body */
+    uint32_t            headSent;
+    int                 file;                   /**< body, -1 if none */
+    off_t               offset;                 /**< next byte of the file to send */
+    off_t               end;
+    bool                keepAlive;
+    time_t              active;                 /**< s, monotonic, last time it was served */
+    time_t              started;                /**< s, monotonic, first byte of the pending request */
+    char                request[CONFIG_REQUEST_MAX];
+    char                head[CONFIG_HEAD_MAX];
+} Connection;
+
+/**
+ * event loop with its own listening sockets, the kernel
+ * spreads new connections over all shards (SO_REUSEPORT)
+ */
+struct _Shard {
+    uint32_t            idx;
+    pthread_t           tid;
+    EventLoop          *loop;
+    int                 root;                   /**< document root directory */
+    Listener            listener[LISTENER_MAX];
+    int                 numListeners;
+    Connection         *connections;
+    Connection         *idle;                   /**< closed connections for reuse */
+    EventHandler        timer;                  /**< timerfd, closes the connections which timed out */
+    uint32_t            numConnections;
+    uint64_t            numAccepted;
+    uint64_t            numRequests;
+};
+
+typedef struct {
+    const char         *extension;
+    const char         *type;
+} WebContentType;
+
+static const WebContentType contentTypes[] = {
+    { "html",   "text/html; charset=utf-8"          },
+    { "htm",    "text/html; charset=utf-8"          },
+    { "css",    "text/css"                          },
+    { "js",     "text/javascript"                   },
+    { "json",   "application/json"                  },
+    { "txt",    "text/plain; charset=utf-8"         },
+    { "xml",    "application/xml"                   },
+    { "svg",    "image/svg+xml"                     },
+    { "png",    "image/png"                         },
+    { "jpg",    "image/jpeg"                        },
+    { "jpeg",   "image/jpeg"                        },
+    { "gif",    "image/gif"                         },
+    { "ico",    "image/x-icon"                      },
+    { "pdf",    "application/pdf"                   }
+};
+
+static bool         WebServer_createShard       (Shard *shard, struct addrinfo *addrinfo, bool reuseport);
+static void         WebServer_deleteShard       (Shard *shard);
+static void        *WebServer_shardThread       (void *arg);
+static void         WebServer_acceptCallback    (EventHandler *handler, uint32_t events);
+static void         WebServer_connectionCallback(EventHandler *handler, uint32_t events);
+static void         WebServer_timerCallback     (EventHandler *handler, uint32_t events);
+static bool         WebServer_receive           (Connection *connection);
+static bool         WebServer_discard           (Connection *connection);
+static bool         WebServer_serve             (Connection *connection);
+static bool         WebServer_parse             (Connection *connection);
+static void         WebServer_respond           (Connection *connection, char *method, char *target, bool head);
+static void         WebServer_error             (Connection *connection, int status, const char *reason);
+static bool         WebServer_head              (Connection *connection, int status, const char *reason,
+                                                 const char *type, off_t len, const char *location);
+static bool         WebServer_decode            (char *target);
+static bool         WebServer_encode            (const char *path, char *target, size_t len);
+static int          WebServer_open              (int root, const char *path);
+static const char  *WebServer_type              (const char *path);
+static bool         WebServer_send              (Connection *connection);
+static void         WebServer_finish            (Connection *connection);
+static bool         WebServer_linger            (Connection *connection);
+static void         WebServer_close             (Connection *connection);
+static time_t       WebServer_now               (void);
+
+/**
+ * @param   numShards               number of event loops, 0 = one per online core
+ * @param   root                    directory the files are served from
+ */
+bool
+WebServer_create(struct addrinfo *addrinfo, uint32_t numShards, const char *root)
+{
+    Shard                  *shards;
+    sigset_t                mask;
+    struct signalfd_siginfo siginfo;
+    int                     signalfd_;
+    int                     rootfd;
+    uint32_t                numStarted;
+    uint32_t                idx;
+    uint64_t                numAccepted = 0;
+    uint64_t                numRequests = 0;
+    int                     status;
+
+    if (numShards == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numShards  = (cores > 0) ? (uint32_t) cores : 1;
+    }
+
+    if ((rootfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+        Log_errno(LOG_FATAL, errno, "Can't open document root %s", root);
+        return false;
+    }
+
+    /* SIGINT and SIGTERM are only received through the signalfd */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL)) {
+        Log_println(LOG_FATAL, "Can't block signals");
+        close(rootfd);
+        return false;
+    }
+
+    if ((signalfd_ = signalfd(-1, &mask, SFD_CLOEXEC)) == -1) {
+        Log_errno(LOG_FATAL, errno, "Can't create signalfd");
+        close(rootfd);
+        return false;
+    }
+
+    Socket_raiseFileLimit();
+
+    if ((shards = (Shard *) calloc(numShards, sizeof(Shard))) == NULL) {
+        Log_errno(LOG_FATAL, errno, "Can't allocate shards");
+        close(signalfd_);
+        close(rootfd);
+        return false;
+    }
+
+    for (numStarted = 0; numStarted < numShards; numStarted++) {
+        shards[numStarted].idx  = numStarted;
+        shards[numStarted].root = rootfd;
+
+        if (!WebServer_createShard(&(shards[numStarted]), addrinfo, numShards > 1)) {
+            WebServer_deleteShard(&(shards[numStarted]));
+            break;
+        }
+
+        if ((status = pthread_create(&(shards[numStarted].tid), NULL, WebServer_shardThread, &(shards[numStarted])))) {
+            Log_println(LOG_ERROR, "Can't create shard thread: error = %d", status);
+            WebServer_deleteShard(&(shards[numStarted]));
+            break;
+        }
+    }
+
+    Log_println(LOG_INFO, "%u of %u shard(s) running, document root %s", numStarted, numShards, root);
+
+    /* run until SIGINT or SIGTERM */
+    if (numStarted > 0) {
+        while (read(signalfd_, &siginfo, sizeof(siginfo)) != sizeof(siginfo)) {
+            if (errno != EINTR) {
+                Log_errno(LOG_ERROR, errno, "Can't read signalfd");
+                break;
+            }
+        }
+        Log_println(LOG_DEBUG, "Received signal %s", strsignal(siginfo.ssi_signo));
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        EventLoop_stop(shards[idx].loop);
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        if ((status = pthread_join(shards[idx].tid, NULL))) {
+            Log_println(LOG_ERROR, "Can't join shard thread: error = %d", status);
+        }
+    }
+
+    for (idx = 0; idx < numStarted; idx++) {
+        numAccepted += shards[idx].numAccepted;
+        numRequests += shards[idx].numRequests;
+        WebServer_deleteShard(&(shards[idx]));
+    }
+
+    Log_println(LOG_INFO, "%" PRIu64 " request(s) on %" PRIu64 " connection(s)", numRequests, numAccepted);
+
+    free(shards);
+    close(signalfd_);
+    close(rootfd);
+
+    return numStarted > 0;
+}
+
+static bool
+WebServer_createShard(Shard *shard, struct addrinfo *addrinfo, bool reuseport)
+{
+    Listener           *listener;
+    struct itimerspec   interval = { { 1, 0 }, { 1, 0 } };
+
+    shard->timer.fd = -1;
+
+    if ((shard->loop = EventLoop_new()) == NULL) {
+        return false;
+    }
+
+    /* a sweep every second, a timeout is at most a second late */
+    if ((shard->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
+        Log_errno(LOG_ERROR, errno, "Can't create timerfd");
+        return false;
+    }
+    shard->timer.callback = WebServer_timerCallback;
+
+    if (timerfd_settime(shard->timer.fd, 0, &interval, NULL) == -1 ||
+        !EventLoop_add(shard->loop, &(shard->timer), EPOLLIN)) {
+        Log_errno(LOG_ERROR, errno, "Can't start timer");
+        return false;
+    }
+
+    for (; addrinfo != NULL; addrinfo = addrinfo->ai_next) {
+
+        /* allow only IPv4 and IPv6 */
+        if (addrinfo->ai_family != AF_INET && addrinfo->ai_family != AF_INET6) {
+            Log_println(LOG_WARN, "Ignore family %d", addrinfo->ai_family);
+            continue;
+        }
+
+        if (shard->numListeners >= LISTENER_MAX) {
+            Log_println(LOG_ERROR, "Maximum number of listeners (= %d) exceeds", LISTENER_MAX);
+            break;
+        }
+
+        listener = &(shard->listener[shard->numListeners]);
+
+        if ((listener->handler.fd = Socket_listen(addrinfo, CONFIG_LISTEN_QUEUE, reuseport)) == -1) {
+            continue;
+        }
+
+        listener->handler.callback = WebServer_acceptCallback;
+        listener->shard            = shard;
+        listener->family           = addrinfo->ai_family;
+
+        if (!EventLoop_add(shard->loop, &(listener->handler), EPOLLIN | EPOLLET)) {
+            close(listener->handler.fd);
+            continue;
+        }
+
+        shard->numListeners++;
+    }
+
+    return shard->numListeners > 0;
+}
+
+static void
+WebServer_deleteShard(Shard *shard)
+{
+    Connection         *connection;
+    int                 idx;
+
+    if (shard->numConnections > 0) {
+        Log_println(LOG_INFO, "Shard %u: close %u connection(s)", shard->idx, shard->numConnections);
+    }
+
+    while (shard->connections != NULL) {
+        WebServer_close(shard->connections);
+    }
+
+    while ((connection = shard->idle) != NULL) {
+        shard->idle = connection->next;
+        free(connection);
+    }
+
+    for (idx = 0; idx < shard->numListeners; idx++) {
+        close(shard->listener[idx].handler.fd);
+    }
+
+    if (shard->timer.fd != -1) {
+        close(shard->timer.fd);
+    }
+
+    EventLoop_delete(shard->loop);
+}
+
+static void *
+WebServer_shardThread(void *arg)
+{
+    Shard              *shard = (Shard *) arg;
+
+    Log_println(LOG_DEBUG, "Shard %u: event loop started", shard->idx);
+
+    EventLoop_run(shard->loop);
+
+    return NULL;
+}
+
+/**
+ * edge-triggered: accept until the backlog is empty
+ */
+static void
+WebServer_acceptCallback(EventHandler *handler, uint32_t events)
+{
+    Shard                  *shard = ((Listener *) handler)->shard;
+    Connection             *connection;
+    struct sockaddr_storage client_addr;
+    socklen_t               client_addrlen;
+    char                    address[NI_MAXHOST];
+    char                    port[NI_MAXSERV];
+    int                     connectfd;
+
+    for (;;) {
+        client_addrlen = sizeof(client_addr);
+        connectfd      = accept4(handler->fd, (struct sockaddr *) &client_addr, &client_addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (connectfd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                Log_errno(LOG_ERROR, errno, "Can't accept connection");
+            }
+            return;
+        }
+
+        if ((connection = shard->idle) != NULL) {
+            shard->idle = connection->next;
+        } else if ((connection = (Connection *) malloc(sizeof(Connection))) == NULL) {
+            Log_errno(LOG_ERROR, errno, "Can't allocate connection");
+            close(connectfd);
+            continue;
+        }
+
+        connection->handler.fd       = connectfd;
+        connection->handler.callback = WebServer_connectionCallback;
+        connection->shard            = shard;
+        connection->state            = WEB_CONNECTION_READ;
+        connection->events           = CONNECTION_READ;
+        connection->have             = 0;
+        connection->consumed         = 0;
+        connection->file             = -1;
+        connection->active           = WebServer_now();
+
+        connection->prev = NULL;
+        connection->next = shard->connections;
+        if (shard->connections != NULL) {
+            shard->connections->prev = connection;
+        }
+        shard->connections = connection;
+        shard->numConnections++;
+        shard->numAccepted++;
+
+        if (getnameinfo((struct sockaddr *) &client_addr, client_addrlen, address, sizeof(address),
+                        port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+            Log_println(LOG_DEBUG, "Shard %u: connection from client %s, port %s", shard->idx, address, port);
+        }
+
+        if (!EventLoop_add(shard->loop, &(connection->handler), connection->events)) {
+            WebServer_close(connection);
+        }
+    }
+}
+
+/**
+ * read while a request is incomplete, write while a response is pending,
+ * the registered events follow the state
+ */
+static void
+WebServer_connectionCallback(EventHandler *handler, uint32_t events)
+{
+    Connection         *connection = (Connection *) handler;
+    uint32_t            wanted;
+    bool                ok;
+
+    connection->active = WebServer_now();
+
+    if (connection->state == WEB_CONNECTION_READ) {
+        ok = WebServer_receive(connection) && WebServer_serve(connection);
+    } else if (connection->state == WEB_CONNECTION_LINGER) {
+        ok = WebServer_discard(connection);
+    } else {
+        ok = WebServer_serve(connection);
+    }
+
+    if (!ok) {
+        WebServer_close(connection);
+        return;
+    }
+
+    wanted = (connection->state == WEB_CONNECTION_WRITE) ? CONNECTION_WRITE : CONNECTION_READ;
+    if (wanted != connection->events) {
+        connection->events = wanted;
+        if (!EventLoop_modify(connection->shard->loop, handler, wanted)) {
+            WebServer_close(connection);
+        }
+    }
+}
+
+/**
+ * close the connections which are idle too long, which don't complete a
+ * request in time (the first byte starts the clock, a trickle doesn't
+ * reset it) or whose response doesn't make progress
+ */
+static void
+WebServer_timerCallback(EventHandler *handler, uint32_t events)
+{
+    Shard              *shard = (Shard *) ((char *) handler - offsetof(Shard, timer));
+    Connection         *connection;
+    Connection         *next;
+    uint64_t            expirations;
+    time_t              now = WebServer_now();
+    bool                expired;
+
+    if (read(handler->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        Log_errno(LOG_ERROR, errno, "Can't read timerfd");
+    }
+
+    for (connection = shard->connections; connection != NULL; connection = next) {
+        next = connection->next;
+
+        if (connection->state == WEB_CONNECTION_LINGER) {
+            expired = (now - connection->started >= CONFIG_LINGER_TIMEOUT);
+        } else if (connection->state == WEB_CONNECTION_WRITE) {
+            expired = (now - connection->active >= CONFIG_SEND_TIMEOUT);
+        } else if (connection->have > 0) {
+            expired = (now - connection->started >= CONFIG_REQUEST_TIMEOUT);
+        } else {
+            expired = (now - connection->active >= CONFIG_KEEPALIVE_TIMEOUT);
+        }
+
+        if (expired) {
+            Log_println(LOG_DEBUG, "Shard %u: connection timed out", shard->idx);
+            WebServer_close(connection);
+        }
+    }
+}
+
+/**
+ * @return                          false if the connection is to be closed
+ */
+static bool
+WebServer_receive(Connection *connection)
+{
+    ssize_t             num_bytes;
+
+    for (;;) {
+        num_bytes = recv(connection->handler.fd, &(connection->request[connection->have]),
+                         CONFIG_REQUEST_MAX - connection->have, 0);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Log_errno(LOG_DEBUG, errno, "Can't receive");
+            return false;
+        }
+
+        /* closed by the client, a half received request is dropped */
+        if (num_bytes == 0) {
+            return false;
+        }
+
+        if (connection->have == 0) {
+            connection->started = connection->active;
+        }
+        connection->have += (uint32_t) num_bytes;
+        return true;
+    }
+}
+
+/**
+ * read and drop until the client closes
+ *
+ * @return                          false once the connection is to be closed
+ */
+static bool
+WebServer_discard(Connection *connection)
+{
+    ssize_t             num_bytes;
+
+    for (;;) {
+        num_bytes = recv(connection->handler.fd, connection->request, CONFIG_REQUEST_MAX, 0);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        if (num_bytes == 0) {
+            return false;
+        }
+    }
+}
+
+/**
+ * answer the requests in the buffer one after the other (pipelining),
+ * a response is sent completely before the next request is parsed
+ *
+ * @return                          false if the connection is to be closed
+ */
+static bool
+WebServer_serve(Connection *connection)
+{
+    for (;;) {
+        if (connection->state == WEB_CONNECTION_WRITE) {
+            if (!WebServer_send(connection)) {
+                return false;
+            }
+            if (connection->state == WEB_CONNECTION_WRITE) {
+                return true;
+            }
+            if (!connection->keepAlive) {
+                return WebServer_linger(connection);
+            }
+        }
+
+        if (!WebServer_parse(connection)) {
+            /* no room left for the rest of the request */
+            if (connection->have == CONFIG_REQUEST_MAX) {
+                WebServer_error(connection, 431, "Request Header Fields Too Large");
+                continue;
+            }
+            return true;
+        }
+    }
+}
+
+/**
+ * a complete request line and headers, parsed in place
+ *
+ * @return                          false if more data is needed
+ */
+static bool
+WebServer_parse(Connection *connection)
+{
+    char               *request = connection->request;
+    char               *end;
+    char               *line;
+    char               *next;
+    char               *value;
+    char               *method;
+    char               *target;
+    char               *version;
+    bool                http10;
+    bool                body = false;
+
+    /* the first request of a previous read may have left an empty line */
+    while (connection->have > 0 && (request[0] == '\r' || request[0] == '\n')) {
+        memmove(request, request + 1, --connection->have);
+    }
+
+    if ((end = memmem(request, connection->have, "\r\n\r\n", 4)) != NULL) {
+        connection->consumed = (uint32_t) (end - request) + 4;
+    } else if ((end = memmem(request, connection->have, "\n\n", 2)) != NULL) {
+        connection->consumed = (uint32_t) (end - request) + 2;
+    } else {
+        return false;
+    }
+    *end = '\0';
+
+    /* request line: method target version */
+    line = request;
+    if ((next = strchr(line, '\n')) != NULL) {
+        *next++ = '\0';
+    }
+    if ((value = strchr(line, '\r')) != NULL) {
+        *value = '\0';
+    }
+
+    method = strtok_r(line, " ", &value);
+    target = strtok_r(NULL, " ", &value);
+    version = strtok_r(NULL, " ", &value);
+
+    connection->keepAlive = false;
+
+    if (method == NULL || target == NULL || version == NULL || strncmp(version, "HTTP/1.", 7) != 0 ||
+        strtok_r(NULL, " ", &value) != NULL) {
+        WebServer_error(connection, 400, "Bad Request");
+        return true;
+    }
+
+    /* HTTP/1.1 keeps the connection, HTTP/1.0 only if asked to */
+    http10                = (strcmp(version, "HTTP/1.0") == 0);
+    connection->keepAlive = !http10;
+
+    for (line = next; line != NULL && *line != '\0'; line = next) {
+        if ((next = strchr(line, '\n')) != NULL) {
+            *next++ = '\0';
+        }
+        if ((value = strchr(line, '\r')) != NULL) {
+            *value = '\0';
+        }
+        if ((value = strchr(line, ':')) == NULL) {
+            continue;
+        }
+        *value++ = '\0';
+        while (*value == ' ' || *value == '\t') {
+            value++;
+        }
+
+        if (strcasecmp(line, "Connection") == 0) {
+            if (strcasestr(value, "close") != NULL) {
+                connection->keepAlive = false;
+            } else if (http10 && strcasestr(value, "keep-alive") != NULL) {
+                connection->keepAlive = true;
+            }
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0 ||
+                   (strcasecmp(line, "Content-Length") == 0 && strtoull(value, NULL, 10) > 0)) {
+            body = true;
+        }
+    }
+
+    /* request bodies aren't read, the next request couldn't be found */
+    if (body) {
+        connection->keepAlive = false;
+        WebServer_error(connection, 413, "Content Too Large");
+        return true;
+    }
+
+    WebServer_respond(connection, method, target, strcmp(method, "HEAD") == 0);
+
+    return true;
+}
+
+/**
+ * map the target below the document root and open it
+ */
+static void
+WebServer_respond(Connection *connection, char *method, char *target, bool head)
+{
+    Shard              *shard = connection->shard;
+    char                path[CONFIG_REQUEST_MAX + sizeof(CONFIG_INDEX)];
+    char                location[CONFIG_REQUEST_MAX];
+    struct stat         st;
+    size_t              len;
+    int                 fd;
+
+    shard->numRequests++;
+
+    if (strcmp(method, "GET") != 0 && !head) {
+        WebServer_error(connection, 405, "Method Not Allowed");
+        return;
+    }
+
+    /* the query doesn't select a file */
+    target[strcspn(target, "?#")] = '\0';
+
+    if (target[0] != '/' || !WebServer_decode(target)) {
+        WebServer_error(connection, 400, "Bad Request");
+        return;
+    }
+
+    len = strlen(target);
+    memcpy(path, target, len + 1);
+    if (path[len - 1] == '/') {
+        memcpy(&(path[len]), CONFIG_INDEX, sizeof(CONFIG_INDEX));
+    }
+
+    if ((fd = WebServer_open(shard->root, path)) == -1) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            WebServer_error(connection, 404, "Not Found");
+        } else if (errno == EACCES || errno == EXDEV || errno == ELOOP) {
+            WebServer_error(connection, 403, "Forbidden");
+        } else {
+            Log_errno(LOG_WARN, errno, "Can't open %s", path);
+            WebServer_error(connection, 500, "Internal Server Error");
+        }
+        return;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        Log_errno(LOG_WARN, errno, "Can't stat %s", path);
+        close(fd);
+        WebServer_error(connection, 500, "Internal Server Error");
+        return;
+    }
+
+    /* a directory without the slash: relative links inside would break */
+    if (S_ISDIR(st.st_mode)) {
+        close(fd);
+        if (!WebServer_encode(target, location, sizeof(location) - 1) ||
+            !WebServer_head(connection, 301, "Moved Permanently", "text/plain; charset=utf-8", 0, strcat(location, "/"))) {
+            WebServer_error(connection, 500, "Internal Server Error");
+        }
+        return;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        WebServer_error(connection, 403, "Forbidden");
+        return;
+    }
+
+    if (!WebServer_head(connection, 200, "OK", WebServer_type(path), st.st_size, NULL)) {
+        close(fd);
+        WebServer_error(connection, 500, "Internal Server Error");
+        return;
+    }
+
+    if (head) {
+        close(fd);
+    } else {
+        connection->file   = fd;
+        connection->offset = 0;
+        connection->end    = st.st_size;
+    }
+
+    Log_println(LOG_DEBUG, "Shard %u: %s %s 200 %lld", shard->idx, method, path, (long long) st.st_size);
+}
+
+/**
+ * short plain text response, built into the head buffer
+ */
+static void
+WebServer_error(Connection *connection, int status, const char *reason)
+{
+    size_t              len = strlen(reason) + 1;
+
+    if (connection->consumed == 0) {
+        connection->consumed = connection->have;
+    }
+
+    /* the request can't be framed, nothing behind it is understood */
+    if (status == 400 || status == 431) {
+        connection->keepAlive = false;
+    }
+
+    /* nothing to send, the connection is closed */
+    if (!WebServer_head(connection, status, reason, "text/plain; charset=utf-8", (off_t) len, NULL)) {
+        connection->keepAlive = false;
+        connection->headLen   = 0;
+        connection->headSent  = 0;
+        connection->state     = WEB_CONNECTION_WRITE;
+        return;
+    }
+
+    memcpy(&(connection->head[connection->headLen]), reason, len - 1);
+    connection->head[connection->headLen + len - 1] = '\n';
+    connection->headLen += (uint32_t) len;
+
+    Log_println(LOG_DEBUG, "Shard %u: %d %s", connection->shard->idx, status, reason);
+}
+
+/**
+ * status line and headers, the connection is then sending
+ *
+ * @param   len                     Content-Length
+ * @param   location                redirect, NULL if none
+ * @return                          false if it doesn't fit
+ */
+static bool
+WebServer_head(Connection *connection, int status, const char *reason, const char *type, off_t len,
+               const char *location)
+{
+    int                 n;
+
+    n = snprintf(connection->head, CONFIG_HEAD_MAX,
+                 "HTTP/1.1 %d %s\r\n"
+                 "Server: " CONFIG_PROGRAM_NAME "/" CONFIG_PROGRAM_VERSION "\r\n"
+                 "Content-Type: %s\r\n"
+                 "Content-Length: %lld\r\n"
+                 "%s%s%s%s"
+                 "Connection: %s\r\n"
+                 "\r\n",
+                 status, reason, type, (long long) len,
+                 location != NULL ? "Location: " : "", location != NULL ? location : "", location != NULL ? "\r\n" : "",
+                 status == 405 ? "Allow: GET, HEAD\r\n" : "",
+                 connection->keepAlive ? "keep-alive" : "close");
+
+    /* room for an error body behind the head */
+    if (n < 0 || (size_t) n + 64 > CONFIG_HEAD_MAX) {
+        return false;
+    }
+
+    connection->headLen  = (uint32_t) n;
+    connection->headSent = 0;
+    connection->state    = WEB_CONNECTION_WRITE;
+
+    return true;
+}
+
+/**
+ * %XX in place, a NUL byte, an empty ("//") or a ".." segment is refused,
+ * the path then names nothing above the root
+ */
+static bool
+WebServer_decode(char *target)
+{
+    char               *in  = target;
+    char               *out = target;
+    char                hex[3] = { 0, 0, 0 };
+    char               *segment;
+
+    while (*in != '\0') {
+        if (*in == '%') {
+            if (!isxdigit((unsigned char) in[1]) || !isxdigit((unsigned char) in[2])) {
+                return false;
+            }
+            hex[0] = in[1];
+            hex[1] = in[2];
+            *out   = (char) strtol(hex, NULL, 16);
+            if (*out == '\0') {
+                return false;
+            }
+            in  += 3;
+            out += 1;
+        } else {
+            *out++ = *in++;
+        }
+    }
+    *out = '\0';
+
+    for (segment = target; segment != NULL; segment = strchr(segment + 1, '/')) {
+        if (strncmp(segment, "/..", 3) == 0 && (segment[3] == '/' || segment[3] == '\0')) {
+            return false;
+        }
+        if (segment[1] == '/') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * %XX again for everything but unreserved characters, sub-delimiters, ':', '@'
+ * and '/', a decoded space or CR LF doesn't end up in a header
+ *
+ * @param   len                     room in target, including the NUL byte
+ * @return                          false if it doesn't fit
+ */
+static bool
+WebServer_encode(const char *path, char *target, size_t len)
+{
+    static const char   hex[] = "0123456789ABCDEF";
+    const unsigned char *in;
+    size_t              out = 0;
+
+    for (in = (const unsigned char *) path; *in != '\0'; in++) {
+        if (isalnum(*in) || strchr("-._~!$&'()*+,;=:@/", *in) != NULL) {
+            if (out + 1 >= len) {
+                return false;
+            }
+            target[out++] = (char) *in;
+        } else {
+            if (out + 3 >= len) {
+                return false;
+            }
+            target[out++] = '%';
+            target[out++] = hex[*in >> 4];
+            target[out++] = hex[*in & 0x0f];
+        }
+    }
+    target[out] = '\0';
+
+    return true;
+}
+
+/**
+ * open a decoded path below the root, a symbolic link may not lead out of it.
+ * Non-blocking: opening a FIFO would wait for a writer, it's refused after fstat()
+ *
+ * @param   path                    decoded, starts with '/'
+ * @return                          file descriptor, -1 with errno on error
+ */
+static int
+WebServer_open(int root, const char *path)
+{
+    static bool         noOpenat2 = false;
+    struct open_how     how;
+    char                buffer[CONFIG_REQUEST_MAX + sizeof(CONFIG_INDEX)];
+    char               *segment;
+    char               *next;
+    int                 dir;
+    int                 fd;
+
+    /* relative to the root, "/" is the root itself */
+    while (*path == '/') {
+        path++;
+    }
+    if (*path == '\0') {
+        path = ".";
+    }
+
+    if (!__atomic_load_n(&noOpenat2, __ATOMIC_RELAXED)) {
+        memset(&how, 0, sizeof(how));
+        how.flags   = O_RDONLY | O_CLOEXEC | O_NONBLOCK;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+        if ((fd = (int) syscall(SYS_openat2, root, path, &how, sizeof(how))) != -1 || errno != ENOSYS) {
+            return fd;
+        }
+
+        Log_println(LOG_WARN, "No openat2(), symbolic links below the document root are refused");
+        __atomic_store_n(&noOpenat2, true, __ATOMIC_RELAXED);
+    }
+
+    if (strlen(path) >= sizeof(buffer)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(buffer, path);
+
+    /* one segment at a time, without following any symbolic link */
+    for (dir = root, segment = buffer; ; segment = next) {
+        if ((next = strchr(segment, '/')) != NULL) {
+            *next++ = '\0';
+        }
+
+        if (next == NULL || *next == '\0') {
+            fd = openat(dir, segment, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+        } else {
+            fd = openat(dir, segment, O_RDONLY | O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK | O_DIRECTORY);
+        }
+
+        if (dir != root) {
+            int error = errno;
+            close(dir);
+            errno = error;
+        }
+
+        if (fd == -1 || next == NULL || *next == '\0') {
+            return fd;
+        }
+
+        dir = fd;
+    }
+}
+
+static const char *
+WebServer_type(const char *path)
+{
+    const char         *dot   = strrchr(path, '.');
+    const char         *slash = strrchr(path, '/');
+    uint32_t            idx;
+
+    if (dot != NULL && dot > slash) {
+        for (idx = 0; idx < sizeof(contentTypes) / sizeof(WebContentType); idx++) {
+            if (strcasecmp(dot + 1, contentTypes[idx].extension) == 0) {
+                return contentTypes[idx].type;
+            }
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+/**
+ * head from the buffer, the body with sendfile() in pieces of
+ * CONFIG_SENDFILE_MAX, so a large file doesn't starve the others
+ *
+ * @return                          false if the connection failed,
+ *                                  the state is WEB_CONNECTION_READ once all is sent
+ */
+static bool
+WebServer_send(Connection *connection)
+{
+    ssize_t             num_bytes;
+    size_t              len;
+    bool                more = (connection->file != -1 && connection->offset < connection->end);
+
+    while (connection->headSent < connection->headLen) {
+        num_bytes = send(connection->handler.fd, &(connection->head[connection->headSent]),
+                         connection->headLen - connection->headSent, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+
+        if (num_bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Log_errno(LOG_DEBUG, errno, "Can't send");
+            return false;
+        }
+
+        connection->headSent += (uint32_t) num_bytes;
+    }
+
+    if (more) {
+        len = (size_t) (connection->end - connection->offset);
+        if (len > CONFIG_SENDFILE_MAX) {
+            len = CONFIG_SENDFILE_MAX;
+        }
+
+        num_bytes = sendfile(connection->handler.fd, connection->file, &(connection->offset), len);
+
+        if (num_bytes == -1) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            Log_errno(LOG_DEBUG, errno, "Can't send file");
+            return false;
+        }
+
+        /* truncated while being sent, the length was promised */
+        if (num_bytes == 0) {
+            Log_println(LOG_WARN, "File shrank while being sent");
+            return false;
+        }
+
+        if (connection->offset < connection->end) {
+            return true;
+        }
+    }
+
+    WebServer_finish(connection);
+
+    return true;
+}
+
+/**
+ * the response is out, the request leaves the buffer
+ */
+static void
+WebServer_finish(Connection *connection)
+{
+    if (connection->file != -1) {
+        close(connection->file);
+        connection->file = -1;
+    }
+
+    connection->have -= connection->consumed;
+    memmove(connection->request, &(connection->request[connection->consumed]), connection->have);
+    connection->consumed = 0;
+    connection->state    = WEB_CONNECTION_READ;
+    connection->started  = connection->active;
+}
+
+/**
+ * the last response is out, but input may be unread (a pipelined request,
+ * the body of a 413): close() would answer it with a RST, which may discard
+ * the response before the client has read it. Only the sending side is shut
+ * down, the rest is read and dropped until the client closes or for
+ * CONFIG_LINGER_TIMEOUT.
+ *
+ * @return                          false if the connection is to be closed
+ */
+static bool
+WebServer_linger(Connection *connection)
+{
+    if (shutdown(connection->handler.fd, SHUT_WR) == -1) {
+        return false;
+    }
+
+    connection->state   = WEB_CONNECTION_LINGER;
+    connection->have    = 0;
+    connection->started = connection->active;
+
+    return WebServer_discard(connection);
+}
+
+static void
+WebServer_close(Connection *connection)
+{
+    Shard              *shard = connection->shard;
+
+    /* close() removes the fd from the epoll instance */
+    close(connection->handler.fd);
+
+    if (connection->file != -1) {
+        close(connection->file);
+    }
+
+    if (connection->prev != NULL) {
+        connection->prev->next = connection->next;
+    } else {
+        shard->connections = connection->next;
+    }
+    if (connection->next != NULL) {
+        connection->next->prev = connection->prev;
+    }
+    shard->numConnections--;
+
+    /* kept for the next client */
+    connection->next = shard->idle;
+    shard->idle      = connection;
+}
+
+/**
+ * seconds of a monotonic clock, coarse is precise enough for timeouts
+ */
+static time_t
+WebServer_now(void)
+{
+    struct timespec     now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    return now.tv_sec;
+}